@@ -0,0 +1,176 @@
+/*
+ * arena.c
+ *
+ * A region allocator for per-command data
+ *
+ * Author: Nwankwo Chukwunonso Michael
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+
+#include "arena.h"
+
+// Size of a regular block; larger requests get a block of their own
+#define ARENA_BLOCK_SZ 8192
+
+// Alignment of every allocation
+#define ARENA_ALIGN (sizeof(max_align_t))
+
+/*
+ * A block of memory. Blocks form a list, newest first; the data
+ * follows the header.
+ */
+struct _ar_block
+{
+  struct _ar_block *next;
+  size_t size; // bytes of data in the block
+  size_t used; // bytes handed out so far
+  max_align_t data[];
+};
+
+// definition of struct _arena
+struct _arena
+{
+  struct _ar_block *head;  // the block allocations come from
+  struct _ar_block *first; // the block kept by AR_reset
+  void *last;              // the most recent allocation from head
+};
+
+/*
+ * Create (malloc) a new block with room for size bytes
+ */
+static struct _ar_block *_AR_new_block(size_t size, struct _ar_block *next)
+{
+  struct _ar_block *block = (struct _ar_block *)malloc(sizeof(struct _ar_block) + size);
+  assert(block);
+
+  block->next = next;
+  block->size = size;
+  block->used = 0;
+  return block;
+}
+
+// Documented in .h file
+Arena AR_new()
+{
+  Arena arena = (Arena)malloc(sizeof(struct _arena));
+  assert(arena);
+
+  arena->first = _AR_new_block(ARENA_BLOCK_SZ, NULL);
+  arena->head = arena->first;
+  arena->last = NULL;
+  return arena;
+}
+
+// Documented in .h file
+void AR_free(Arena arena)
+{
+  if (arena == NULL)
+  {
+    return;
+  }
+
+  struct _ar_block *block = arena->head;
+  while (block != NULL)
+  {
+    struct _ar_block *next = block->next;
+    free(block);
+    block = next;
+  }
+
+  free(arena);
+}
+
+// Documented in .h file
+void AR_reset(Arena arena)
+{
+  // free every block but the first one
+  struct _ar_block *block = arena->head;
+  while (block != NULL)
+  {
+    struct _ar_block *next = block->next;
+    if (block != arena->first)
+      free(block);
+    block = next;
+  }
+
+  arena->first->next = NULL;
+  arena->first->used = 0;
+  arena->head = arena->first;
+  arena->last = NULL;
+}
+
+// Documented in .h file
+void *AR_alloc(Arena arena, size_t size)
+{
+  size_t rounded = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+  struct _ar_block *block = arena->head;
+
+  if (block->used + rounded > block->size)
+  {
+    if (rounded > ARENA_BLOCK_SZ / 4)
+    {
+      // a large allocation gets a block of its own, linked in behind
+      // the current block so that one can still be filled
+      struct _ar_block *big = _AR_new_block(rounded, block->next);
+      big->used = rounded;
+      block->next = big;
+      arena->last = NULL;
+      return big->data;
+    }
+
+    block = _AR_new_block(ARENA_BLOCK_SZ, block);
+    arena->head = block;
+  }
+
+  void *ptr = (char *)block->data + block->used;
+  block->used += rounded;
+  arena->last = ptr;
+  return ptr;
+}
+
+// Documented in .h file
+void *AR_realloc(Arena arena, void *ptr, size_t old_size, size_t new_size)
+{
+  if (ptr == NULL)
+  {
+    return AR_alloc(arena, new_size);
+  }
+
+  // grow the most recent allocation in place, if it fits
+  struct _ar_block *block = arena->head;
+  if (ptr == arena->last)
+  {
+    size_t start = (char *)ptr - (char *)block->data;
+    size_t rounded = (new_size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    if (start + rounded <= block->size)
+    {
+      block->used = start + rounded;
+      return ptr;
+    }
+  }
+
+  void *copy = AR_alloc(arena, new_size);
+  memcpy(copy, ptr, old_size < new_size ? old_size : new_size);
+  return copy;
+}
+
+// Documented in .h file
+char *AR_strndup(Arena arena, const char *s, size_t n)
+{
+  char *copy = (char *)AR_alloc(arena, n + 1);
+
+  memcpy(copy, s, n);
+  copy[n] = '\0';
+  return copy;
+}
+
+// Documented in .h file
+char *AR_strdup(Arena arena, const char *s)
+{
+  return AR_strndup(arena, s, strlen(s));
+}
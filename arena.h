@@ -0,0 +1,100 @@
+/*
+ * arena.h
+ *
+ * A region allocator: many small allocations carved out of large
+ * blocks, all released together. Used to hold everything built for
+ * one command line (tokens, words, PipeTree nodes and argument
+ * lists) so it can be released in one step instead of node by node.
+ *
+ * Author: Nwankwo Chukwunonso Michael
+ */
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+
+// struct _arena is defined in the .c file
+typedef struct _arena *Arena;
+
+/*
+ * Create a new, empty arena
+ *
+ * Parameters: None
+ *
+ * Returns: The new arena. It is up to the caller to call AR_free.
+ */
+Arena AR_new();
+
+/*
+ * Destroy an arena, releasing every allocation made from it
+ *
+ * Parameters:
+ *   arena    The arena
+ *
+ * Returns: None
+ */
+void AR_free(Arena arena);
+
+/*
+ * Release every allocation made from an arena, keeping its first
+ * block for reuse. Cheap enough to call once per command line.
+ *
+ * Parameters:
+ *   arena    The arena
+ *
+ * Returns: None
+ */
+void AR_reset(Arena arena);
+
+/*
+ * Allocate memory from an arena. The memory is suitably aligned for
+ * any type, and is not initialized.
+ *
+ * Parameters:
+ *   arena    The arena
+ *   size     Number of bytes
+ *
+ * Returns: The memory; never NULL
+ */
+void *AR_alloc(Arena arena, size_t size);
+
+/*
+ * Resize an allocation made from an arena. If ptr is the most recent
+ * allocation it grows in place when there is room; otherwise the
+ * contents are copied to a new allocation.
+ *
+ * Parameters:
+ *   arena      The arena
+ *   ptr        The allocation, or NULL
+ *   old_size   Its current size
+ *   new_size   The size wanted
+ *
+ * Returns: The resized allocation
+ */
+void *AR_realloc(Arena arena, void *ptr, size_t old_size, size_t new_size);
+
+/*
+ * Copy the first n characters of a string into an arena
+ *
+ * Parameters:
+ *   arena    The arena
+ *   s        The string
+ *   n        Number of characters to copy
+ *
+ * Returns: A NUL-terminated copy
+ */
+char *AR_strndup(Arena arena, const char *s, size_t n);
+
+/*
+ * Copy a string into an arena
+ *
+ * Parameters:
+ *   arena    The arena
+ *   s        The NUL-terminated string
+ *
+ * Returns: The copy
+ */
+char *AR_strdup(Arena arena, const char *s);
+
+#endif /* _ARENA_H_ */
@@ -0,0 +1,553 @@
+/*
+ * brace.c
+ *
+ * Lazy brace expansion
+ *
+ * Author: Nwankwo Chukwunonso Michael
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+
+#include "brace.h"
+
+// No node, e.g. the end of a list
+#define NONE ((size_t)-1)
+
+// The kinds of node a word is compiled to
+typedef enum
+{
+  BR_SEQ,  // items, one after the other
+  BR_ALT,  // {a,b}: one alternative at a time
+  BR_TEXT, // literal characters of the word
+  BR_RANGE // {x..y..step}
+} NodeKind;
+
+// Nodes refer to each other by index, as the array they are kept in
+// grows while the word is compiled
+typedef struct
+{
+  NodeKind kind;
+  size_t next;  // the next item of a sequence, or alternative
+  size_t child; // BR_SEQ: the first item; BR_ALT: the first alternative
+  size_t cur;   // BR_ALT: the alternative being expanded
+  size_t start; // BR_TEXT: the span of the word
+  size_t len;
+  long long first; // BR_RANGE: the ends, the step (negative when
+  long long last;  // counting down) and the value being expanded
+  long long step;
+  long long value;
+  int width;  // BR_RANGE: zero-pad integers to this many characters
+  bool chars; // BR_RANGE: a sequence of characters, not integers
+} Node;
+
+// definition of struct _brace_gen
+struct _brace_gen
+{
+  char *word;
+  Node *nodes; // nodes[0] is the sequence for the whole word
+  size_t num_nodes;
+  size_t cap;
+  char *buf; // the current expansion
+  size_t buf_len;
+  size_t buf_cap;
+  bool started;
+  bool done;
+};
+
+// Documented in .h file
+bool BR_has_braces(const char *word, size_t len)
+{
+  const char *open = memchr(word, '{', len);
+  return open != NULL && memchr(open, '}', len - (open - word)) != NULL;
+}
+
+/*
+ * Add a node to a generator
+ *
+ * Returns: The index of the new node
+ */
+static size_t newNode(BraceGen gen, NodeKind kind)
+{
+  if (gen->num_nodes == gen->cap)
+  {
+    gen->cap = (gen->cap == 0) ? 8 : 2 * gen->cap;
+    gen->nodes = (Node *)realloc(gen->nodes, gen->cap * sizeof(Node));
+    assert(gen->nodes);
+  }
+
+  Node *node = &gen->nodes[gen->num_nodes];
+  memset(node, 0, sizeof(Node));
+  node->kind = kind;
+  node->next = NONE;
+  node->child = NONE;
+  node->cur = NONE;
+  return gen->num_nodes++;
+}
+
+/*
+ * Append an item to a sequence, whose last item is *tail
+ */
+static void appendItem(BraceGen gen, size_t seq, size_t *tail, size_t item)
+{
+  if (*tail == NONE)
+    gen->nodes[seq].child = item;
+  else
+    gen->nodes[*tail].next = item;
+  *tail = item;
+}
+
+/*
+ * Append text to a sequence, merged into the text before it if the
+ * two are adjacent in the word
+ */
+static void appendText(BraceGen gen, size_t seq, size_t *tail, size_t start, size_t len)
+{
+  Node *last = (*tail == NONE) ? NULL : &gen->nodes[*tail];
+  if (last != NULL && last->kind == BR_TEXT && last->start + last->len == start)
+  {
+    last->len += len;
+    return;
+  }
+
+  size_t text = newNode(gen, BR_TEXT);
+  gen->nodes[text].start = start;
+  gen->nodes[text].len = len;
+  appendItem(gen, seq, tail, text);
+}
+
+/*
+ * Parse one end, or the step, of a sequence: an optionally negative
+ * integer, of at most 18 digits so that it cannot overflow
+ *
+ * Returns: true if s[0..len) is such an integer
+ */
+static bool parseInteger(const char *s, size_t len, long long *value)
+{
+  size_t i = (len > 0 && s[0] == '-') ? 1 : 0;
+  if (i == len || len - i > 18)
+    return false;
+
+  long long n = 0;
+  for (size_t k = i; k < len; k++)
+  {
+    if (!isdigit((unsigned char)s[k]))
+      return false;
+    n = 10 * n + (s[k] - '0');
+  }
+
+  *value = (i == 1) ? -n : n;
+  return true;
+}
+
+/*
+ * Returns true if an end of a sequence has a leading zero, as in 01
+ * or -05, which asks for zero-padding
+ */
+static bool hasLeadingZero(const char *s, size_t len)
+{
+  if (len > 0 && s[0] == '-')
+  {
+    s++;
+    len--;
+  }
+  return len > 1 && s[0] == '0';
+}
+
+/*
+ * Parse the inside of braces as a sequence: x..y or x..y..step,
+ * where x and y are both integers or both single characters
+ *
+ * Parameters:
+ *   s, len    The text between the braces
+ *   node      Filled in with the sequence
+ *
+ * Returns: true if the text is a sequence
+ */
+static bool parseRange(const char *s, size_t len, Node *node)
+{
+  const char *dots = NULL;
+  for (size_t i = 0; i + 1 < len && dots == NULL; i++)
+  {
+    if (s[i] == '.' && s[i + 1] == '.' && i > 0)
+      dots = s + i;
+  }
+  if (dots == NULL)
+    return false;
+
+  const char *x = s;
+  size_t x_len = dots - s;
+  const char *y = dots + 2;
+  size_t y_len = len - (y - s);
+
+  // an optional step, after another ..
+  long long step = 1;
+  const char *more = NULL;
+  for (size_t i = 1; i + 1 < y_len && more == NULL; i++)
+  {
+    if (y[i] == '.' && y[i + 1] == '.')
+      more = y + i;
+  }
+  if (more != NULL)
+  {
+    if (!parseInteger(more + 2, len - (more + 2 - s), &step))
+      return false;
+    y_len = more - y;
+  }
+  if (step < 0)
+    step = -step;
+  if (step == 0)
+    step = 1;
+
+  if (parseInteger(x, x_len, &node->first) && parseInteger(y, y_len, &node->last))
+  {
+    node->chars = false;
+    if (hasLeadingZero(x, x_len) || hasLeadingZero(y, y_len))
+      node->width = (x_len > y_len) ? x_len : y_len;
+  }
+  else if (x_len == 1 && y_len == 1)
+  {
+    node->chars = true;
+    node->first = (unsigned char)x[0];
+    node->last = (unsigned char)y[0];
+  }
+  else
+  {
+    return false;
+  }
+
+  node->step = (node->first <= node->last) ? step : -step;
+  node->value = node->first;
+  return true;
+}
+
+/*
+ * Parse the part word[from..to) of a word into items appended to a
+ * sequence
+ *
+ * Parameters:
+ *   gen       The generator
+ *   seq       The sequence
+ *   tail      Its last item, updated as items are appended
+ *   match     For each '{' in the word, the index of its matching
+ *             '}', or NONE if it has none
+ *   from, to  The part of the word
+ *
+ * Returns: None
+ */
+static void parseItems(BraceGen gen, size_t seq, size_t *tail, const size_t *match, size_t from, size_t to)
+{
+  const char *word = gen->word;
+
+  for (size_t i = from; i < to;)
+  {
+    if (word[i] != '{' || match[i] == NONE)
+    {
+      appendText(gen, seq, tail, i, 1);
+      i++;
+      continue;
+    }
+
+    size_t end = match[i];
+
+    // a sequence
+    Node range = {.kind = BR_RANGE, .next = NONE, .child = NONE, .cur = NONE};
+    if (parseRange(word + i + 1, end - i - 1, &range))
+    {
+      size_t node = newNode(gen, BR_RANGE);
+      gen->nodes[node] = range;
+      appendItem(gen, seq, tail, node);
+      i = end + 1;
+      continue;
+    }
+
+    // alternatives, split at the commas outside any inner braces
+    bool has_comma = false;
+    for (size_t j = i + 1; j < end && !has_comma; j = (word[j] == '{' && match[j] != NONE) ? match[j] + 1 : j + 1)
+      has_comma = (word[j] == ',');
+
+    if (!has_comma)
+    {
+      // {x} stays as it is, though braces inside it still expand
+      appendText(gen, seq, tail, i, 1);
+      parseItems(gen, seq, tail, match, i + 1, end);
+      appendText(gen, seq, tail, end, 1);
+      i = end + 1;
+      continue;
+    }
+
+    size_t alt = newNode(gen, BR_ALT);
+    size_t last_alt = NONE;
+    size_t start = i + 1;
+    for (size_t j = i + 1; j <= end;)
+    {
+      if (j < end && word[j] == '{' && match[j] != NONE)
+      {
+        j = match[j] + 1;
+        continue;
+      }
+      if (j < end && word[j] != ',')
+      {
+        j++;
+        continue;
+      }
+
+      size_t sub = newNode(gen, BR_SEQ);
+      size_t sub_tail = NONE;
+      parseItems(gen, sub, &sub_tail, match, start, j);
+      appendItem(gen, alt, &last_alt, sub);
+      start = ++j;
+    }
+    gen->nodes[alt].cur = gen->nodes[alt].child;
+    appendItem(gen, seq, tail, alt);
+    i = end + 1;
+  }
+}
+
+/*
+ * Set a node, and all below it, back to its first expansion
+ */
+static void resetNode(BraceGen gen, size_t n)
+{
+  Node *node = &gen->nodes[n];
+
+  switch (node->kind)
+  {
+  case BR_SEQ:
+    for (size_t item = node->child; item != NONE; item = gen->nodes[item].next)
+      resetNode(gen, item);
+    break;
+  case BR_ALT:
+    node->cur = node->child;
+    resetNode(gen, node->cur);
+    break;
+  case BR_RANGE:
+    node->value = node->first;
+    break;
+  case BR_TEXT:
+    break;
+  }
+}
+
+static bool advanceNode(BraceGen gen, size_t n);
+
+/*
+ * Advance the items of a sequence from item on, the last varying
+ * fastest, as an odometer does
+ *
+ * Returns: false, with the items reset, if they were on their last
+ *   expansion
+ */
+static bool advanceItems(BraceGen gen, size_t item)
+{
+  if (item == NONE)
+    return false;
+  if (advanceItems(gen, gen->nodes[item].next))
+    return true;
+  return advanceNode(gen, item);
+}
+
+/*
+ * Move a node on to its next expansion
+ *
+ * Returns: false, with the node reset, if it was on its last
+ *   expansion
+ */
+static bool advanceNode(BraceGen gen, size_t n)
+{
+  Node *node = &gen->nodes[n];
+
+  switch (node->kind)
+  {
+  case BR_SEQ:
+    return advanceItems(gen, node->child);
+  case BR_ALT:
+    if (advanceNode(gen, node->cur))
+      return true;
+    node->cur = gen->nodes[node->cur].next;
+    if (node->cur != NONE)
+    {
+      resetNode(gen, node->cur);
+      return true;
+    }
+    node->cur = node->child;
+    resetNode(gen, node->cur);
+    return false;
+  case BR_RANGE:
+    if ((node->step > 0 && node->value <= node->last - node->step) ||
+        (node->step < 0 && node->value >= node->last - node->step))
+    {
+      node->value += node->step;
+      return true;
+    }
+    node->value = node->first;
+    return false;
+  case BR_TEXT:
+    break;
+  }
+  return false;
+}
+
+/*
+ * Append characters to the current expansion
+ */
+static void emit(BraceGen gen, const char *s, size_t len)
+{
+  if (gen->buf_len + len + 1 > gen->buf_cap)
+  {
+    gen->buf_cap = (gen->buf_len + len + 1 > 2 * gen->buf_cap) ? gen->buf_len + len + 1 : 2 * gen->buf_cap;
+    gen->buf = (char *)realloc(gen->buf, gen->buf_cap);
+    assert(gen->buf);
+  }
+  memcpy(gen->buf + gen->buf_len, s, len);
+  gen->buf_len += len;
+  gen->buf[gen->buf_len] = '\0';
+}
+
+/*
+ * Append a node's current expansion to the current expansion
+ */
+static void emitNode(BraceGen gen, size_t n)
+{
+  const Node *node = &gen->nodes[n];
+  char number[32];
+
+  switch (node->kind)
+  {
+  case BR_SEQ:
+    for (size_t item = node->child; item != NONE; item = gen->nodes[item].next)
+      emitNode(gen, item);
+    break;
+  case BR_ALT:
+    emitNode(gen, node->cur);
+    break;
+  case BR_TEXT:
+    emit(gen, gen->word + node->start, node->len);
+    break;
+  case BR_RANGE:
+    if (node->chars)
+    {
+      number[0] = (char)node->value;
+      emit(gen, number, 1);
+    }
+    else
+    {
+      emit(gen, number, snprintf(number, sizeof(number), "%0*lld", node->width, node->value));
+    }
+    break;
+  }
+}
+
+/*
+ * Returns the number of expansions of a node, saturating at SIZE_MAX
+ */
+static size_t countNode(BraceGen gen, size_t n)
+{
+  const Node *node = &gen->nodes[n];
+  size_t count = 0;
+
+  switch (node->kind)
+  {
+  case BR_SEQ:
+    count = 1;
+    for (size_t item = node->child; item != NONE; item = gen->nodes[item].next)
+    {
+      size_t c = countNode(gen, item);
+      count = (c != 0 && count > SIZE_MAX / c) ? SIZE_MAX : count * c;
+    }
+    break;
+  case BR_ALT:
+    for (size_t alt = node->child; alt != NONE; alt = gen->nodes[alt].next)
+    {
+      size_t c = countNode(gen, alt);
+      count = (count > SIZE_MAX - c) ? SIZE_MAX : count + c;
+    }
+    break;
+  case BR_TEXT:
+    count = 1;
+    break;
+  case BR_RANGE:
+    count = (size_t)((node->last - node->first) / node->step) + 1;
+    break;
+  }
+  return count;
+}
+
+// Documented in .h file
+BraceGen BR_open(const char *word)
+{
+  BraceGen gen = (BraceGen)calloc(1, sizeof(struct _brace_gen));
+  assert(gen);
+
+  gen->word = strdup(word);
+  assert(gen->word);
+
+  // match the braces first, so that an unmatched one is known to be
+  // plain text without trying to parse what follows it
+  size_t len = strlen(word);
+  size_t *match = (size_t *)malloc((len + 1) * sizeof(size_t));
+  size_t *open = (size_t *)malloc((len + 1) * sizeof(size_t));
+  size_t num_open = 0;
+  assert(match && open);
+
+  for (size_t i = 0; i < len; i++)
+  {
+    match[i] = NONE;
+    if (word[i] == '{')
+      open[num_open++] = i;
+    else if (word[i] == '}' && num_open > 0)
+      match[open[--num_open]] = i;
+  }
+
+  size_t root = newNode(gen, BR_SEQ);
+  size_t tail = NONE;
+  parseItems(gen, root, &tail, match, 0, len);
+
+  free(match);
+  free(open);
+  return gen;
+}
+
+// Documented in .h file
+const char *BR_next(BraceGen gen)
+{
+  if (gen->done)
+    return NULL;
+
+  if (gen->started && !advanceNode(gen, 0))
+  {
+    gen->done = true;
+    return NULL;
+  }
+  gen->started = true;
+
+  gen->buf_len = 0;
+  emit(gen, "", 0);
+  emitNode(gen, 0);
+  return gen->buf;
+}
+
+// Documented in .h file
+size_t BR_count(BraceGen gen)
+{
+  return countNode(gen, 0);
+}
+
+// Documented in .h file
+void BR_close(BraceGen gen)
+{
+  if (gen == NULL)
+  {
+    return;
+  }
+
+  free(gen->word);
+  free(gen->nodes);
+  free(gen->buf);
+  free(gen);
+}
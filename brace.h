@@ -0,0 +1,76 @@
+/*
+ * brace.h
+ *
+ * Lazy brace expansion, as in bash: a{b,c}d is abd and acd, and
+ * {1..3} is 1, 2 and 3. A word is compiled into a small tree that
+ * the expansions are then generated from one at a time, so that
+ * file{1..1000000}.dat never needs a million strings in memory.
+ *
+ * Author: Nwankwo Chukwunonso Michael
+ */
+
+#ifndef _BRACE_H_
+#define _BRACE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// A lazy expansion of one word; struct _brace_gen is defined in the
+// .c file
+typedef struct _brace_gen *BraceGen;
+
+/*
+ * Checks whether a word may hold a brace expression, i.e. has a '{'
+ * with a '}' after it. This is cheap enough to call on every word;
+ * BR_open decides whether the braces really expand.
+ *
+ * Parameters:
+ *   word      The word
+ *   len       Number of characters in word
+ *
+ * Returns: true if the word should be expanded with BR_open
+ */
+bool BR_has_braces(const char *word, size_t len);
+
+/*
+ * Start the expansion of a word. Braces hold either a list of two
+ * or more comma-separated alternatives, each of which may hold
+ * braces of its own, or a sequence {x..y} or {x..y..step} of
+ * integers or of single characters. Integers are zero-padded to the
+ * same width if either end has a leading zero, as in {01..10}, and
+ * count down if x > y. Braces that are neither, such as {a} or an
+ * unmatched {, are left as they are.
+ *
+ * Parameters:
+ *   word      The NUL-terminated word
+ *
+ * Returns: The generator. It is up to the caller to call BR_close
+ *   on it.
+ */
+BraceGen BR_open(const char *word);
+
+/*
+ * Take the next expansion from a generator. Expansions come in the
+ * order bash gives them, the last brace varying fastest; a word with
+ * no braces expands to itself, once.
+ *
+ * Parameters:
+ *   gen       The generator
+ *
+ * Returns: The next expansion, valid until the next call, or NULL if
+ *   there are no more
+ */
+const char *BR_next(BraceGen gen);
+
+/*
+ * Returns the number of expansions of the word a generator was opened
+ * on, without generating them; SIZE_MAX if there are more than that
+ */
+size_t BR_count(BraceGen gen);
+
+/*
+ * Destroy a generator
+ */
+void BR_close(BraceGen gen);
+
+#endif /* _BRACE_H_ */
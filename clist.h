@@ -1,7 +1,9 @@
 /*
  * clist.h
  * 
- * Linked list implementation
+ * List of strings. The elements are kept in one growable array,
+ * followed by a NULL, so appending and indexing are O(1) and the list
+ * can be passed to execvp as an argv without copying.
  * 
  * Author: Nwankwo Chukwunonso Michael
  *
@@ -12,6 +14,7 @@
 
 
 #include <stdbool.h>
+#include "arena.h"
 
 // struct _clist is defined in .c file
 typedef struct _clist *CList;
@@ -36,6 +39,25 @@ typedef const char * CListElementType;
 CList CL_new();
 
 
+/*
+ * Create a new CList whose nodes are allocated from an arena. Freeing
+ * the list, or removing elements from it, then releases nothing: the
+ * memory is reclaimed when the arena is reset or freed.
+ *
+ * Parameters:
+ *   arena    The arena, or NULL to use the heap (same as CL_new)
+ *
+ * Returns: The new list
+ */
+CList CL_new_in(Arena arena);
+
+
+/*
+ * Returns the arena a list was created in, or NULL for a heap list
+ */
+Arena CL_arena(CList list);
+
+
 /*
  * Destroy a list, calling free() on all malloc'd memory.
  *
@@ -70,6 +92,19 @@ int CL_length(CList list);
 void CL_print(CList list);
 
 
+/*
+ * Return the elements of a list as an array, followed by a NULL, such
+ * as the argv execvp takes. The array belongs to the list: it must not
+ * be freed, and is only valid until the list is next changed.
+ *
+ * Parameters:
+ *   list     The list
+ *
+ * Returns: The array
+ */
+CListElementType *CL_array(CList list);
+
+
 /*
  * Insert the specified element onto the head of the list.
  *
@@ -0,0 +1,1410 @@
+/*
+ * globcache.c
+ *
+ * Glob expansion backed by a cache of directory listings
+ *
+ * Author: Nwankwo Chukwunonso Michael
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pwd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "arena.h"
+#include "globmatch.h"
+#include "globcache.h"
+
+// Number of patterns with no matches remembered per directory
+#define GC_MAX_MISSES 32
+
+// Bytes of directory entries fetched by each getdents64 call
+#define GC_READ_SIZE (64 * 1024)
+
+// Most threads used to read the directories matched by one component
+#define GC_MAX_THREADS 8
+
+// Fewest directories in one component worth reading in parallel
+#define GC_MIN_PARALLEL 4
+
+// Result sets smaller than this are sorted with qsort, not radix sort
+#define GC_RADIX_MIN 64
+
+// A directory entry as returned by getdents64
+struct _gc_dirent
+{
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+// The entries of a directory. In data, each name is preceded by its
+// d_type and followed by a NUL.
+typedef struct
+{
+  char *data;
+  size_t cap;
+  char **names; // pointers into data
+  size_t count;
+} Listing;
+
+// A pattern that matched nothing in a directory
+struct _gc_miss
+{
+  struct _gc_miss *next;
+  bool dirs_only; // the pattern was followed by a '/'
+  size_t len;
+  char pattern[];
+};
+
+// The cached listing of one directory
+struct _gc_dir
+{
+  struct _gc_dir *next;   // the cache is kept most recently used first
+  char *path;             // the directory, as written in the pattern
+  dev_t dev;              // identity and mtime of the directory when
+  ino_t ino;              // it was read; the listing is valid while
+  struct timespec mtime;  // these are unchanged
+  time_t read_at;         // when the listing was read
+  Listing listing;
+  bool sorted;            // names are in strcmp order
+  struct _gc_miss *misses;
+  size_t num_misses;
+  size_t bytes;           // memory held by this entry
+};
+
+// A home directory looked up for ~user
+struct _gc_home
+{
+  struct _gc_home *next;
+  char *home; // NULL if there is no such user
+  char user[];
+};
+
+// One path component of a pattern, from the first one with wildcards
+typedef struct
+{
+  const char *text;  // the component, as written in the pattern
+  size_t len;
+  GlobPattern pat;
+  const char *sep;   // the slashes after it, copied to the matches;
+  size_t sep_len;    // if there are any, only directories match
+} Component;
+
+// A pattern split into the path its walk starts from and the
+// components after it
+typedef struct
+{
+  char *full;        // the pattern, with ~ replaced
+  char *start;       // the leading components without wildcards
+  size_t start_len;
+  Component *comps;  // the rest
+  size_t num_comps;
+} Walk;
+
+// definition of struct _glob_gen
+struct _glob_gen
+{
+  Walk walk;
+  bool streaming;        // matching the listing of dir as it goes
+  struct _gc_dir *dir;   // when streaming, the listing
+  bool cached;           // dir is checked out of the cache
+  char *paths;           // otherwise, every match
+  char *path;            // the match returned last
+  size_t next;           // the next name in dir, or match in paths
+  size_t count;          // matches returned so far, or in paths
+};
+
+// Paths stored back to back, each followed by a NUL
+typedef struct
+{
+  char *data;
+  size_t len;
+  size_t cap;
+  size_t count;
+} PathList;
+
+static struct _gc_dir *dirs = NULL;
+static struct _gc_home *homes = NULL;
+static size_t limit = GC_DEFAULT_LIMIT;
+static size_t total = 0; // bytes held by dirs
+static bool unsorted = false;
+
+/*
+ * Returns true if the first len characters of s contain a glob
+ * wildcard
+ */
+static bool hasWildcard(const char *s, size_t len)
+{
+  return memchr(s, '*', len) || memchr(s, '?', len) || memchr(s, '[', len);
+}
+
+/*
+ * Append a path, made of up to three pieces, to a list of paths
+ */
+static void addPath(PathList *list, const char *a, size_t a_len, const char *b, size_t b_len,
+                    const char *c, size_t c_len)
+{
+  size_t n = a_len + b_len + c_len + 1;
+  if (list->len + n > list->cap)
+  {
+    list->cap = (list->cap == 0) ? 4096 : list->cap;
+    while (list->len + n > list->cap)
+      list->cap *= 2;
+    list->data = (char *)realloc(list->data, list->cap);
+    assert(list->data);
+  }
+
+  char *p = list->data + list->len;
+  memcpy(p, a, a_len);
+  memcpy(p + a_len, b, b_len);
+  memcpy(p + a_len + b_len, c, c_len);
+  p[n - 1] = '\0';
+
+  list->len += n;
+  list->count++;
+}
+
+/*
+ * Read the entries of a directory with getdents64, which returns many
+ * of them per system call
+ *
+ * Parameters:
+ *   path    The directory
+ *   ls      Filled in with the entries
+ *
+ * Returns: true on success, false if the directory could not be
+ *   opened, in which case ls is untouched
+ */
+static bool readListing(const char *path, Listing *ls)
+{
+  int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    return false;
+  }
+
+  char *buf = (char *)malloc(GC_READ_SIZE);
+  assert(buf);
+
+  size_t used = 0;
+  ls->cap = GC_READ_SIZE;
+  ls->data = (char *)malloc(ls->cap);
+  ls->count = 0;
+  assert(ls->data);
+
+  long n;
+  while ((n = syscall(SYS_getdents64, fd, buf, GC_READ_SIZE)) > 0)
+  {
+    for (long off = 0; off < n;)
+    {
+      struct _gc_dirent *ent = (struct _gc_dirent *)(buf + off);
+      off += ent->d_reclen;
+
+      size_t len = strlen(ent->d_name) + 1;
+      while (used + len + 1 > ls->cap)
+      {
+        ls->cap *= 2;
+        ls->data = (char *)realloc(ls->data, ls->cap);
+        assert(ls->data);
+      }
+      ls->data[used] = ent->d_type;
+      memcpy(ls->data + used + 1, ent->d_name, len);
+      used += len + 1;
+      ls->count++;
+    }
+  }
+  close(fd);
+  free(buf);
+
+  ls->names = (char **)malloc((ls->count + 1) * sizeof(char *));
+  assert(ls->names);
+
+  char *name = ls->data + 1;
+  for (size_t i = 0; i < ls->count; i++)
+  {
+    ls->names[i] = name;
+    name += strlen(name) + 2;
+  }
+  return true;
+}
+
+/*
+ * Free the memory held by a listing
+ */
+static void freeListing(Listing *ls)
+{
+  free(ls->names);
+  free(ls->data);
+}
+
+/*
+ * Look up the home directory for ~user, as glob(GLOB_TILDE) does:
+ * $HOME for plain ~, the password database otherwise. Lookups in the
+ * password database are cached, including failed ones.
+ *
+ * Parameters:
+ *   user    The user name; not NUL-terminated
+ *   len     Length of the name, 0 for the current user
+ *
+ * Returns: The home directory, or NULL if it cannot be found
+ */
+static const char *homeDir(const char *user, size_t len)
+{
+  if (len == 0)
+  {
+    const char *home = getenv("HOME");
+    if (home != NULL && *home != '\0')
+      return home;
+  }
+
+  for (struct _gc_home *h = homes; h != NULL; h = h->next)
+  {
+    if (strlen(h->user) == len && strncmp(h->user, user, len) == 0)
+      return h->home;
+  }
+
+  struct _gc_home *h = (struct _gc_home *)malloc(sizeof(struct _gc_home) + len + 1);
+  assert(h);
+  memcpy(h->user, user, len);
+  h->user[len] = '\0';
+
+  struct passwd *pw = (len == 0) ? getpwuid(getuid()) : getpwnam(h->user);
+  h->home = (pw != NULL) ? strdup(pw->pw_dir) : NULL;
+
+  h->next = homes;
+  homes = h;
+  return h->home;
+}
+
+/*
+ * qsort comparison for directory entry names
+ */
+static int compareNames(const void *a, const void *b)
+{
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+ * Read the listing of a directory into a new cache entry
+ *
+ * Parameters:
+ *   path    The directory
+ *   st      The result of stat() on the directory, taken before
+ *           reading it
+ *
+ * Returns: The new entry, not linked into the cache, or NULL if the
+ *   directory could not be opened
+ */
+static struct _gc_dir *readDir(const char *path, const struct stat *st)
+{
+  Listing listing;
+  if (!readListing(path, &listing))
+  {
+    return NULL;
+  }
+
+  struct _gc_dir *d = (struct _gc_dir *)calloc(1, sizeof(struct _gc_dir));
+  assert(d);
+  d->path = strdup(path);
+  assert(d->path);
+  d->dev = st->st_dev;
+  d->ino = st->st_ino;
+  d->mtime = st->st_mtim;
+  d->read_at = time(NULL);
+  d->listing = listing;
+  d->bytes = sizeof(struct _gc_dir) + strlen(path) + 1 + listing.cap + (listing.count + 1) * sizeof(char *);
+  return d;
+}
+
+/*
+ * Free a cache entry, which must not be linked into the cache
+ */
+static void freeDir(struct _gc_dir *d)
+{
+  while (d->misses != NULL)
+  {
+    struct _gc_miss *next = d->misses->next;
+    free(d->misses);
+    d->misses = next;
+  }
+
+  freeListing(&d->listing);
+  free(d->path);
+  free(d);
+}
+
+/*
+ * Drop the least recently used entries until the cache holds at most
+ * max bytes
+ *
+ * Parameters:
+ *   max        The number of bytes to keep
+ *   keep_head  If true, the most recently used entry is never dropped
+ */
+static void evict(size_t max, bool keep_head)
+{
+  while (total > max && dirs != NULL && !(keep_head && dirs->next == NULL))
+  {
+    struct _gc_dir **link = &dirs;
+    while ((*link)->next != NULL)
+      link = &(*link)->next;
+
+    total -= (*link)->bytes;
+    freeDir(*link);
+    *link = NULL;
+  }
+}
+
+/*
+ * Returns true if a cached listing still describes the directory. A
+ * directory changed in the same second it was read may not show a
+ * new mtime, so such a listing is never trusted.
+ */
+static bool isFresh(const struct _gc_dir *d, const struct stat *st)
+{
+  return d->dev == st->st_dev && d->ino == st->st_ino &&
+         d->mtime.tv_sec == st->st_mtim.tv_sec && d->mtime.tv_nsec == st->st_mtim.tv_nsec &&
+         d->mtime.tv_sec < d->read_at;
+}
+
+/*
+ * Find the listing of a directory, reading it if it is not cached or
+ * has changed
+ *
+ * Parameters:
+ *   path      The directory
+ *   cached    Set to false if the listing is too big to cache, in
+ *             which case the caller must freeDir it
+ *
+ * Returns: The listing, moved to the front of the cache, or NULL if
+ *   path is not a readable directory
+ */
+static struct _gc_dir *lookup(const char *path, bool *cached)
+{
+  struct stat st;
+  if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode))
+  {
+    return NULL;
+  }
+
+  struct _gc_dir **link = &dirs;
+  while (*link != NULL && strcmp((*link)->path, path) != 0)
+    link = &(*link)->next;
+
+  struct _gc_dir *d = *link;
+  if (d != NULL)
+  {
+    *link = d->next;
+    total -= d->bytes;
+
+    if (!isFresh(d, &st))
+    {
+      freeDir(d);
+      d = NULL;
+    }
+  }
+
+  if (d == NULL)
+  {
+    d = readDir(path, &st);
+    if (d == NULL)
+      return NULL;
+  }
+
+  *cached = (d->bytes <= limit);
+  if (*cached)
+  {
+    d->next = dirs;
+    dirs = d;
+    total += d->bytes;
+    evict(limit, true);
+  }
+
+  return d;
+}
+
+/*
+ * Returns true if a component is known to match nothing in a listing
+ */
+static bool isMiss(const struct _gc_dir *d, const Component *comp)
+{
+  for (struct _gc_miss *m = d->misses; m != NULL; m = m->next)
+  {
+    if (m->len == comp->len && m->dirs_only == (comp->sep_len > 0) &&
+        memcmp(m->pattern, comp->text, comp->len) == 0)
+      return true;
+  }
+  return false;
+}
+
+/*
+ * Remember that a component matched nothing in a cached listing
+ */
+static void addMiss(struct _gc_dir *d, const Component *comp)
+{
+  if (d->num_misses == GC_MAX_MISSES)
+  {
+    return;
+  }
+
+  size_t bytes = sizeof(struct _gc_miss) + comp->len;
+  struct _gc_miss *m = (struct _gc_miss *)malloc(bytes);
+  assert(m);
+  m->dirs_only = (comp->sep_len > 0);
+  m->len = comp->len;
+  memcpy(m->pattern, comp->text, comp->len);
+
+  m->next = d->misses;
+  d->misses = m;
+  d->num_misses++;
+
+  d->bytes += bytes;
+  total += bytes;
+  evict(limit, true);
+}
+
+/*
+ * Returns true if a directory entry is a directory, or a symbolic
+ * link to one
+ *
+ * Parameters:
+ *   prefix, prefix_len   The directory holding the entry, as a prefix
+ *                        for its name
+ *   name, name_len       The entry
+ *   type                 The entry's d_type
+ */
+static bool isDirectory(const char *prefix, size_t prefix_len, const char *name, size_t name_len,
+                        unsigned char type)
+{
+  if (type == DT_DIR)
+    return true;
+  if (type != DT_UNKNOWN && type != DT_LNK)
+    return false;
+
+  char path[PATH_MAX];
+  if (prefix_len + name_len >= sizeof(path))
+    return false;
+  memcpy(path, prefix, prefix_len);
+  memcpy(path + prefix_len, name, name_len + 1);
+
+  struct stat st;
+  return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/*
+ * Append the entries of a listing that match a component to a list
+ * of paths
+ *
+ * Parameters:
+ *   ls                   The listing
+ *   comp                 The component
+ *   prefix, prefix_len   The listing's directory, as a prefix for the
+ *                        matched names
+ *   out                  The list of paths
+ *
+ * Returns: The number of matches
+ */
+static size_t matchListing(const Listing *ls, const Component *comp, const char *prefix, size_t prefix_len,
+                           PathList *out)
+{
+  size_t count = 0;
+  for (size_t i = 0; i < ls->count; i++)
+  {
+    const char *name = ls->names[i];
+    size_t name_len = strlen(name);
+
+    if (!GM_match(comp->pat, name, name_len))
+      continue;
+    if (comp->sep_len > 0 && !isDirectory(prefix, prefix_len, name, name_len, name[-1]))
+      continue;
+
+    addPath(out, prefix, prefix_len, name, name_len, comp->sep, comp->sep_len);
+    count++;
+  }
+  return count;
+}
+
+/*
+ * Match a component against the entries of one directory, reading it
+ * without the cache
+ *
+ * Parameters:
+ *   prefix   The directory, as a prefix for the matched names; "" for
+ *            the current directory
+ *   comp     The component
+ *   out      The list the matches are appended to
+ */
+static void matchDir(const char *prefix, const Component *comp, PathList *out)
+{
+  Listing ls;
+  if (readListing(*prefix != '\0' ? prefix : ".", &ls))
+  {
+    matchListing(&ls, comp, prefix, strlen(prefix), out);
+    freeListing(&ls);
+  }
+}
+
+/*
+ * Match a component against the entries of one directory, using the
+ * cached listing
+ */
+static void matchCachedDir(const char *prefix, const Component *comp, PathList *out)
+{
+  if (limit == 0)
+  {
+    matchDir(prefix, comp, out);
+    return;
+  }
+
+  bool cached = true;
+  struct _gc_dir *d = lookup(*prefix != '\0' ? prefix : ".", &cached);
+  if (d == NULL)
+  {
+    return;
+  }
+
+  if (!isMiss(d, comp) && matchListing(&d->listing, comp, prefix, strlen(prefix), out) == 0 && cached)
+    addMiss(d, comp);
+
+  if (!cached)
+    freeDir(d);
+}
+
+// The directories matched against one component by a pool of threads
+typedef struct
+{
+  const char **prefixes;
+  size_t count;
+  const Component *comp;
+  PathList *outs;   // the matches in each directory
+  size_t next;      // the next directory to take, updated atomically
+} DirJobs;
+
+/*
+ * Thread body: match directories until there are none left
+ */
+static void *dirWorker(void *arg)
+{
+  DirJobs *jobs = (DirJobs *)arg;
+
+  for (;;)
+  {
+    size_t i = __atomic_fetch_add(&jobs->next, 1, __ATOMIC_RELAXED);
+    if (i >= jobs->count)
+      break;
+    matchDir(jobs->prefixes[i], jobs->comp, &jobs->outs[i]);
+  }
+  return NULL;
+}
+
+/*
+ * Match a component against the entries of many directories, reading
+ * them in parallel. The matches are appended in the order of the
+ * directories.
+ */
+static void matchDirs(const PathList *dirs_in, const Component *comp, PathList *out)
+{
+  DirJobs jobs = {0};
+  jobs.count = dirs_in->count;
+  jobs.comp = comp;
+  jobs.prefixes = (const char **)malloc(jobs.count * sizeof(char *));
+  jobs.outs = (PathList *)calloc(jobs.count, sizeof(PathList));
+  assert(jobs.prefixes && jobs.outs);
+
+  const char *prefix = dirs_in->data;
+  for (size_t i = 0; i < jobs.count; i++)
+  {
+    jobs.prefixes[i] = prefix;
+    prefix += strlen(prefix) + 1;
+  }
+
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t num_threads = (cpus > 1) ? cpus - 1 : 0;
+  if (num_threads > GC_MAX_THREADS - 1)
+    num_threads = GC_MAX_THREADS - 1;
+  if (jobs.count < GC_MIN_PARALLEL)
+    num_threads = 0;
+
+  // this thread works too, and finishes the jobs if none can start
+  pthread_t threads[GC_MAX_THREADS];
+  size_t started = 0;
+  while (started < num_threads && pthread_create(&threads[started], NULL, dirWorker, &jobs) == 0)
+    started++;
+  dirWorker(&jobs);
+  for (size_t i = 0; i < started; i++)
+    pthread_join(threads[i], NULL);
+
+  for (size_t i = 0; i < jobs.count; i++)
+  {
+    if (jobs.outs[i].count > 0)
+    {
+      addPath(out, jobs.outs[i].data, jobs.outs[i].len - 1, "", 0, "", 0);
+      out->count += jobs.outs[i].count - 1;
+    }
+    free(jobs.outs[i].data);
+  }
+  free(jobs.outs);
+  free(jobs.prefixes);
+}
+
+/*
+ * Extend each path in a list by one component of a pattern
+ *
+ * Parameters:
+ *   in     The paths matched by the components before this one
+ *   comp   The component
+ *   last   true if this is the last component of the pattern
+ *   serial true to read one directory at a time, without the cache,
+ *          as the threads of a tree walk must
+ *   out    The list the extended paths are appended to
+ */
+static void matchComponent(const PathList *in, const Component *comp, bool last, bool serial, PathList *out)
+{
+  if (!GM_is_literal(comp->pat) && serial)
+  {
+    const char *path = in->data;
+    for (size_t i = 0; i < in->count; i++, path += strlen(path) + 1)
+      matchDir(path, comp, out);
+    return;
+  }
+  if (!GM_is_literal(comp->pat))
+  {
+    if (in->count == 1)
+      matchCachedDir(in->data, comp, out);
+    else
+      matchDirs(in, comp, out);
+    return;
+  }
+
+  // a literal is appended without reading the directory; only at the
+  // end of the pattern must it be checked to exist
+  const char *literal = GM_literal(comp->pat);
+  size_t literal_len = strlen(literal);
+  const char *path = in->data;
+  for (size_t i = 0; i < in->count; i++)
+  {
+    size_t path_len = strlen(path);
+    size_t before = out->len;
+    addPath(out, path, path_len, literal, literal_len, comp->sep, comp->sep_len);
+
+    struct stat st;
+    const char *added = out->data + before;
+    if (last && ((comp->sep_len > 0) ? stat(added, &st) != 0 || !S_ISDIR(st.st_mode) : lstat(added, &st) != 0))
+    {
+      out->len = before;
+      out->count--;
+    }
+    path += path_len + 1;
+  }
+}
+
+/*
+ * Returns true if a component is **, which matches any number of
+ * directories
+ */
+static bool isGlobstar(const Component *comp)
+{
+  return comp->len == 2 && comp->text[0] == '*' && comp->text[1] == '*';
+}
+
+static void matchComponents(PathList *matched, const Component *comps, size_t num_comps, bool serial);
+
+// The directories a thread of a tree walk has yet to read. The thread
+// takes the newest from its own end; idle threads steal the oldest.
+typedef struct
+{
+  pthread_mutex_t lock;
+  char **dirs;
+  size_t head;
+  size_t tail;
+  size_t cap;
+} WorkQueue;
+
+// A walk of the directory trees below a **
+typedef struct
+{
+  const Component *rest;  // the components after the **
+  size_t num_rest;
+  const char *sep;        // the separator after the **
+  size_t sep_len;
+  WorkQueue *queues;      // one per thread
+  PathList *outs;         // the matches found by each thread
+  size_t num_threads;
+  size_t pending;         // directories queued or being read
+} TreeWalk;
+
+// What a thread of a tree walk is given
+typedef struct
+{
+  TreeWalk *walk;
+  size_t id;
+} TreeWorker;
+
+/*
+ * Add a directory to the end of a queue
+ */
+static void pushDir(WorkQueue *q, char *dir)
+{
+  pthread_mutex_lock(&q->lock);
+  if (q->tail == q->cap)
+  {
+    // slide the entries down, growing the array if over half is used
+    size_t used = q->tail - q->head;
+    if (used * 2 >= q->cap)
+    {
+      q->cap = (q->cap == 0) ? 64 : 2 * q->cap;
+      q->dirs = (char **)realloc(q->dirs, q->cap * sizeof(char *));
+      assert(q->dirs);
+    }
+    memmove(q->dirs, q->dirs + q->head, used * sizeof(char *));
+    q->head = 0;
+    q->tail = used;
+  }
+  q->dirs[q->tail++] = dir;
+  pthread_mutex_unlock(&q->lock);
+}
+
+/*
+ * Take a directory from a queue: the newest for its own thread, the
+ * oldest for a thief, which is likely the root of a larger subtree
+ *
+ * Returns: The directory, or NULL if the queue is empty
+ */
+static char *takeDir(WorkQueue *q, bool steal)
+{
+  char *dir = NULL;
+  pthread_mutex_lock(&q->lock);
+  if (q->head < q->tail)
+    dir = steal ? q->dirs[q->head++] : q->dirs[--q->tail];
+  pthread_mutex_unlock(&q->lock);
+  return dir;
+}
+
+/*
+ * Read one directory of a tree walk: queue its subdirectories, and
+ * match the components after the ** against its entries. The first
+ * of them is matched against the listing already read, so that only
+ * the entries it matches are looked at further.
+ */
+static void walkDir(TreeWalk *walk, size_t id, const char *dir)
+{
+  Listing ls;
+  if (!readListing(*dir != '\0' ? dir : ".", &ls))
+  {
+    return;
+  }
+
+  size_t dir_len = strlen(dir);
+  for (size_t i = 0; i < ls.count; i++)
+  {
+    // like *, ** does not match hidden directories; nor does it
+    // follow symbolic links
+    const char *name = ls.names[i];
+    unsigned char type = name[-1];
+    if (name[0] == '.')
+      continue;
+
+    size_t name_len = strlen(name);
+    if (type == DT_UNKNOWN)
+    {
+      char path[PATH_MAX];
+      struct stat st;
+      if (dir_len + name_len >= sizeof(path))
+        continue;
+      memcpy(path, dir, dir_len);
+      memcpy(path + dir_len, name, name_len + 1);
+      if (lstat(path, &st) == 0 && S_ISDIR(st.st_mode))
+        type = DT_DIR;
+    }
+    if (type != DT_DIR)
+      continue;
+
+    char *sub = (char *)malloc(dir_len + name_len + walk->sep_len + 1);
+    assert(sub);
+    memcpy(sub, dir, dir_len);
+    memcpy(sub + dir_len, name, name_len);
+    memcpy(sub + dir_len + name_len, walk->sep, walk->sep_len);
+    sub[dir_len + name_len + walk->sep_len] = '\0';
+
+    __atomic_add_fetch(&walk->pending, 1, __ATOMIC_SEQ_CST);
+    pushDir(&walk->queues[id], sub);
+  }
+
+  PathList matched = {0};
+  matchListing(&ls, &walk->rest[0], dir, dir_len, &matched);
+  freeListing(&ls);
+
+  matchComponents(&matched, walk->rest + 1, walk->num_rest - 1, true);
+  if (matched.count > 0)
+  {
+    PathList *out = &walk->outs[id];
+    addPath(out, matched.data, matched.len - 1, "", 0, "", 0);
+    out->count += matched.count - 1;
+  }
+  free(matched.data);
+}
+
+/*
+ * Thread body for a tree walk: read directories from its own queue,
+ * or stolen from another, until none are left anywhere
+ */
+static void *treeWorker(void *arg)
+{
+  TreeWorker *worker = (TreeWorker *)arg;
+  TreeWalk *walk = worker->walk;
+
+  while (__atomic_load_n(&walk->pending, __ATOMIC_SEQ_CST) > 0)
+  {
+    char *dir = takeDir(&walk->queues[worker->id], false);
+    for (size_t i = 1; dir == NULL && i < walk->num_threads; i++)
+      dir = takeDir(&walk->queues[(worker->id + i) % walk->num_threads], true);
+
+    if (dir == NULL)
+    {
+      // the other threads are still reading; their subdirectories
+      // may yet come
+      sched_yield();
+      continue;
+    }
+
+    walkDir(walk, worker->id, dir);
+    free(dir);
+    __atomic_sub_fetch(&walk->pending, 1, __ATOMIC_SEQ_CST);
+  }
+  return NULL;
+}
+
+/*
+ * Match a ** and the components after it: every directory below the
+ * paths matched so far, and those paths themselves, are read by a
+ * pool of threads, and the rest of the pattern is matched in each.
+ * A ** at the end of a pattern matches every path below, as * would
+ * in each directory.
+ *
+ * Parameters:
+ *   in          The paths matched by the components before the **
+ *   comps       The ** and the components after it
+ *   num_comps   Number of components in comps
+ *   serial      true to walk in the calling thread only
+ *   out         The list the matches are appended to
+ */
+static void walkTree(const PathList *in, const Component *comps, size_t num_comps, bool serial, PathList *out)
+{
+  TreeWalk walk = {0};
+  walk.sep = comps[0].sep;
+  walk.sep_len = comps[0].sep_len;
+  walk.rest = comps + 1;
+  walk.num_rest = num_comps - 1;
+
+  Component star = {"*", 1, NULL, comps[0].sep, comps[0].sep_len};
+  if (walk.num_rest == 0)
+  {
+    // at the end, ** matches whatever * would below it; it stays
+    // limited to directories if a '/' follows it
+    star.pat = GM_compile("*", 1);
+    walk.rest = &star;
+    walk.num_rest = 1;
+    walk.sep = "/";
+    walk.sep_len = 1;
+  }
+
+  long cpus = serial ? 1 : sysconf(_SC_NPROCESSORS_ONLN);
+  walk.num_threads = (cpus < 1) ? 1 : (cpus > GC_MAX_THREADS) ? GC_MAX_THREADS : cpus;
+  walk.queues = (WorkQueue *)calloc(walk.num_threads, sizeof(WorkQueue));
+  walk.outs = (PathList *)calloc(walk.num_threads, sizeof(PathList));
+  TreeWorker *workers = (TreeWorker *)malloc(walk.num_threads * sizeof(TreeWorker));
+  assert(walk.queues && walk.outs && workers);
+
+  for (size_t i = 0; i < walk.num_threads; i++)
+  {
+    pthread_mutex_init(&walk.queues[i].lock, NULL);
+    workers[i].walk = &walk;
+    workers[i].id = i;
+  }
+
+  const char *path = in->data;
+  for (size_t i = 0; i < in->count; i++, path += strlen(path) + 1)
+  {
+    char *dir = strdup(path);
+    assert(dir);
+    walk.pending++;
+    pushDir(&walk.queues[0], dir);
+
+    // as in bash, a/** matches a/ itself
+    if (star.pat != NULL && *path != '\0')
+      addPath(out, path, strlen(path), "", 0, "", 0);
+  }
+
+  // this thread is worker 0, and carries on alone if no other starts
+  pthread_t threads[GC_MAX_THREADS];
+  size_t started = 1;
+  while (started < walk.num_threads && pthread_create(&threads[started], NULL, treeWorker, &workers[started]) == 0)
+    started++;
+  treeWorker(&workers[0]);
+  for (size_t i = 1; i < started; i++)
+    pthread_join(threads[i], NULL);
+
+  for (size_t i = 0; i < walk.num_threads; i++)
+  {
+    if (walk.outs[i].count > 0)
+    {
+      addPath(out, walk.outs[i].data, walk.outs[i].len - 1, "", 0, "", 0);
+      out->count += walk.outs[i].count - 1;
+    }
+    free(walk.outs[i].data);
+    free(walk.queues[i].dirs);
+    pthread_mutex_destroy(&walk.queues[i].lock);
+  }
+  free(walk.outs);
+  free(walk.queues);
+  free(workers);
+  GM_free(star.pat);
+}
+
+/*
+ * Match the components of a pattern one at a time
+ *
+ * Parameters:
+ *   matched     The paths the components start from; replaced by
+ *               the paths they match
+ *   comps       The components
+ *   num_comps   Number of components
+ *   serial      As for matchComponent
+ */
+static void matchComponents(PathList *matched, const Component *comps, size_t num_comps, bool serial)
+{
+  for (size_t i = 0; i < num_comps && matched->count > 0; i++)
+  {
+    PathList next = {0};
+    bool globstar = isGlobstar(&comps[i]);
+    if (globstar)
+      walkTree(matched, comps + i, num_comps - i, serial, &next);
+    else
+      matchComponent(matched, &comps[i], i == num_comps - 1, serial, &next);
+
+    free(matched->data);
+    *matched = next;
+
+    // the walk has matched the rest of the pattern
+    if (globstar)
+      break;
+  }
+}
+
+/*
+ * Sort paths by strcmp order: by their first byte, then within each
+ * bucket by the next one, and so on
+ *
+ * Parameters:
+ *   paths    The paths, all equal in their first depth bytes
+ *   tmp      Scratch space for count pointers
+ *   count    Number of paths
+ *   depth    Number of bytes already sorted on
+ */
+static void radixSort(char **paths, char **tmp, size_t count, size_t depth)
+{
+  while (count >= GC_RADIX_MIN)
+  {
+    size_t sizes[256] = {0};
+    for (size_t i = 0; i < count; i++)
+      sizes[(unsigned char)paths[i][depth]]++;
+
+    size_t starts[256];
+    size_t largest = 0;
+    for (size_t c = 0, start = 0; c < 256; c++)
+    {
+      starts[c] = start;
+      start += sizes[c];
+      if (sizes[c] > sizes[largest])
+        largest = c;
+    }
+
+    size_t ends[256];
+    memcpy(ends, starts, sizeof(ends));
+    for (size_t i = 0; i < count; i++)
+      tmp[ends[(unsigned char)paths[i][depth]]++] = paths[i];
+    memcpy(paths, tmp, count * sizeof(char *));
+
+    // the paths that have ended (bucket 0) are equal and in place;
+    // recurse into the smaller buckets and loop on the largest, which
+    // keeps the recursion shallow
+    for (size_t c = 1; c < 256; c++)
+    {
+      if (c != largest && sizes[c] > 1)
+        radixSort(paths + starts[c], tmp, sizes[c], depth + 1);
+    }
+    if (largest == 0)
+      return;
+
+    paths += starts[largest];
+    count = sizes[largest];
+    depth++;
+  }
+
+  qsort(paths, count, sizeof(char *), compareNames);
+}
+
+/*
+ * Copy a list of matches into a single buffer, sorted unless
+ * GC_set_unsorted is in effect
+ *
+ * Returns: The buffer, allocated from arena or with malloc if arena is
+ *   NULL; list is left empty, but for its count, which no longer
+ *   counts duplicates
+ */
+static char *finishPaths(PathList *list, Arena arena)
+{
+  char *result;
+  if (unsorted)
+  {
+    if (arena == NULL)
+    {
+      result = list->data;
+      list->data = NULL;
+      return result;
+    }
+    result = (char *)AR_alloc(arena, list->len);
+    memcpy(result, list->data, list->len);
+    return result;
+  }
+
+  char **paths = (char **)malloc(2 * list->count * sizeof(char *));
+  assert(paths);
+
+  char *path = list->data;
+  for (size_t i = 0; i < list->count; i++)
+  {
+    paths[i] = path;
+    path += strlen(path) + 1;
+  }
+  radixSort(paths, paths + list->count, list->count, 0);
+
+  result = (arena != NULL) ? (char *)AR_alloc(arena, list->len) : (char *)malloc(list->len);
+  assert(result);
+
+  // a pattern with two ** can match a path in more than one way
+  char *p = result;
+  size_t count = 0;
+  for (size_t i = 0; i < list->count; i++)
+  {
+    if (i > 0 && strcmp(paths[i], paths[i - 1]) == 0)
+      continue;
+
+    size_t n = strlen(paths[i]) + 1;
+    memcpy(p, paths[i], n);
+    p += n;
+    count++;
+  }
+  list->count = count;
+  free(paths);
+  return result;
+}
+
+/*
+ * Split a pattern into the path its walk starts from, made of the
+ * leading components without wildcards, and the components after it.
+ * The last component is always kept, so that it is checked to exist.
+ *
+ * Parameters:
+ *   pattern   The pattern
+ *   walk      Filled in with the parts; release with freeWalk
+ */
+static void splitPattern(const char *pattern, Walk *walk)
+{
+  // replace a leading ~ or ~user by the home directory; as with
+  // glob(), it is left alone if there is no such user
+  const char *home = "";
+  const char *rest = pattern;
+  if (pattern[0] == '~')
+  {
+    size_t user_len = strcspn(pattern + 1, "/");
+    const char *dir = hasWildcard(pattern + 1, user_len) ? NULL : homeDir(pattern + 1, user_len);
+    if (dir != NULL)
+    {
+      home = dir;
+      rest = pattern + 1 + user_len;
+    }
+  }
+
+  size_t home_len = strlen(home);
+  size_t len = home_len + strlen(rest);
+  walk->full = (char *)malloc(len + 1);
+  walk->start = (char *)malloc(len + 1);
+  walk->comps = (Component *)malloc((len + 1) * sizeof(Component));
+  assert(walk->full && walk->start && walk->comps);
+  memcpy(walk->full, home, home_len);
+  memcpy(walk->full + home_len, rest, len - home_len + 1);
+  walk->start_len = 0;
+  walk->num_comps = 0;
+
+  for (const char *p = walk->full; *p != '\0';)
+  {
+    Component *comp = &walk->comps[walk->num_comps];
+    comp->text = p;
+    comp->len = strcspn(p, "/");
+    p += comp->len;
+
+    // a \ before a '/' quotes the separator, which needs no quoting
+    size_t backslashes = 0;
+    while (backslashes < comp->len && p[-1 - backslashes] == '\\')
+      backslashes++;
+    comp->pat = GM_compile(comp->text, comp->len - ((*p == '/') ? backslashes % 2 : 0));
+    comp->sep = p;
+    comp->sep_len = strspn(p, "/");
+    p += comp->sep_len;
+
+    // **/** matches no more than ** does
+    if (walk->num_comps > 0 && isGlobstar(comp) && isGlobstar(comp - 1))
+    {
+      GM_free(comp->pat);
+      (comp - 1)->sep = comp->sep;
+      (comp - 1)->sep_len = comp->sep_len;
+      continue;
+    }
+
+    if (walk->num_comps == 0 && *p != '\0' && GM_is_literal(comp->pat))
+    {
+      size_t n = strlen(GM_literal(comp->pat));
+      memcpy(walk->start + walk->start_len, GM_literal(comp->pat), n);
+      memcpy(walk->start + walk->start_len + n, comp->sep, comp->sep_len);
+      walk->start_len += n + comp->sep_len;
+      GM_free(comp->pat);
+      continue;
+    }
+    walk->num_comps++;
+  }
+  walk->start[walk->start_len] = '\0';
+}
+
+/*
+ * Free the memory held by a split pattern
+ */
+static void freeWalk(Walk *walk)
+{
+  for (size_t i = 0; i < walk->num_comps; i++)
+    GM_free(walk->comps[i].pat);
+  free(walk->comps);
+  free(walk->start);
+  free(walk->full);
+}
+
+// Documented in .h file
+size_t GC_expand(const char *pattern, Arena arena, char **paths)
+{
+  *paths = NULL;
+
+  Walk walk;
+  splitPattern(pattern, &walk);
+
+  // match one component at a time, from the paths matched so far
+  PathList matched = {0};
+  addPath(&matched, walk.start, walk.start_len, "", 0, "", 0);
+  matchComponents(&matched, walk.comps, walk.num_comps, false);
+  if (walk.num_comps == 0)
+    matched.count = 0;
+
+  if (matched.count > 0)
+    *paths = finishPaths(&matched, arena);
+  size_t count = matched.count;
+
+  free(matched.data);
+  freeWalk(&walk);
+  return count;
+}
+
+/*
+ * Take a cached listing out of the cache while a GlobGen reads it, so
+ * that it cannot be evicted from under the generator
+ */
+static void checkOut(struct _gc_dir *d)
+{
+  struct _gc_dir **link = &dirs;
+  while (*link != d)
+    link = &(*link)->next;
+
+  *link = d->next;
+  total -= d->bytes;
+}
+
+/*
+ * Return a listing taken out by checkOut to the cache, unless a newer
+ * listing of the same directory has been cached meanwhile
+ *
+ * Returns: true if d is back in the cache, false if it was freed
+ */
+static bool checkIn(struct _gc_dir *d)
+{
+  for (struct _gc_dir *other = dirs; other != NULL; other = other->next)
+  {
+    if (strcmp(other->path, d->path) == 0)
+    {
+      freeDir(d);
+      return false;
+    }
+  }
+
+  d->next = dirs;
+  dirs = d;
+  total += d->bytes;
+  evict(limit, true);
+  return true;
+}
+
+// Documented in .h file
+GlobGen GC_open(const char *pattern)
+{
+  GlobGen gen = (GlobGen)calloc(1, sizeof(struct _glob_gen));
+  assert(gen);
+  splitPattern(pattern, &gen->walk);
+
+  // a pattern whose only wildcards are in its last component, and
+  // which is not limited to directories, is streamed straight from
+  // the directory's listing; any other is expanded in full
+  Walk *walk = &gen->walk;
+  if (walk->num_comps == 1 && !GM_is_literal(walk->comps[0].pat) && walk->comps[0].sep_len == 0 &&
+      !isGlobstar(&walk->comps[0]))
+  {
+    bool cached = true;
+    gen->dir = lookup(walk->start_len > 0 ? walk->start : ".", &cached);
+    gen->cached = cached;
+    if (gen->dir != NULL && isMiss(gen->dir, &walk->comps[0]))
+    {
+      gen->next = gen->dir->listing.count;
+    }
+    else if (gen->dir != NULL && !unsorted && !gen->dir->sorted)
+    {
+      Listing *ls = &gen->dir->listing;
+      char **tmp = (char **)malloc((ls->count + 1) * sizeof(char *));
+      assert(tmp);
+      radixSort(ls->names, tmp, ls->count, 0);
+      free(tmp);
+      gen->dir->sorted = true;
+    }
+
+    if (gen->dir != NULL && gen->cached)
+      checkOut(gen->dir);
+
+    gen->path = (char *)malloc(walk->start_len + NAME_MAX + 1);
+    assert(gen->path);
+    memcpy(gen->path, walk->start, walk->start_len);
+    gen->streaming = true;
+  }
+  else
+  {
+    gen->count = GC_expand(pattern, NULL, &gen->paths);
+    gen->path = gen->paths;
+  }
+
+  return gen;
+}
+
+// Documented in .h file
+const char *GC_next(GlobGen gen)
+{
+  if (!gen->streaming)
+  {
+    if (gen->next == gen->count)
+      return NULL;
+
+    const char *path = (gen->next++ == 0) ? gen->path : gen->path + strlen(gen->path) + 1;
+    gen->path = (char *)path;
+    return path;
+  }
+
+  if (gen->dir == NULL)
+  {
+    return NULL;
+  }
+
+  const Listing *ls = &gen->dir->listing;
+  const Component *comp = &gen->walk.comps[0];
+  while (gen->next < ls->count)
+  {
+    const char *name = ls->names[gen->next++];
+    size_t name_len = strlen(name);
+    if (GM_match(comp->pat, name, name_len))
+    {
+      memcpy(gen->path + gen->walk.start_len, name, name_len + 1);
+      gen->count++;
+      return gen->path;
+    }
+  }
+  return NULL;
+}
+
+// Documented in .h file
+void GC_close(GlobGen gen)
+{
+  if (gen == NULL)
+  {
+    return;
+  }
+
+  if (gen->streaming && gen->dir != NULL)
+  {
+    // a pattern read in full that matched nothing is remembered
+    bool miss = (gen->count == 0 && gen->next == gen->dir->listing.count);
+
+    if (!gen->cached)
+    {
+      freeDir(gen->dir);
+    }
+    else if (checkIn(gen->dir) && miss && !isMiss(gen->dir, &gen->walk.comps[0]))
+    {
+      addMiss(gen->dir, &gen->walk.comps[0]);
+    }
+  }
+
+  if (gen->streaming)
+    free(gen->path);
+  free(gen->paths);
+  freeWalk(&gen->walk);
+  free(gen);
+}
+
+// Documented in .h file
+bool GC_set_unsorted(bool value)
+{
+  bool old = unsorted;
+  unsorted = value;
+  return old;
+}
+
+// Documented in .h file
+size_t GC_set_limit(size_t bytes)
+{
+  size_t old = limit;
+  limit = bytes;
+  evict(limit, false);
+  return old;
+}
+
+// Documented in .h file
+void GC_clear()
+{
+  evict(0, false);
+
+  while (homes != NULL)
+  {
+    struct _gc_home *next = homes->next;
+    free(homes->home);
+    free(homes);
+    homes = next;
+  }
+}
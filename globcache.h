@@ -0,0 +1,117 @@
+/*
+ * globcache.h
+ *
+ * Glob expansion backed by a cache of directory listings. A listing
+ * is reused for as long as the directory's inode and mtime are
+ * unchanged, so repeated expansions in the same directory cost a
+ * stat() instead of a full directory read.
+ *
+ * Author: Nwankwo Chukwunonso Michael
+ */
+
+#ifndef _GLOBCACHE_H_
+#define _GLOBCACHE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "arena.h"
+
+// Memory the cache may hold by default, in bytes
+#define GC_DEFAULT_LIMIT (16 * 1024 * 1024)
+
+/*
+ * Expand a glob pattern, with the same results as
+ * glob(pattern, GLOB_TILDE, ...): matches are in sorted order, and a
+ * leading ~ or ~user is replaced by the home directory.
+ *
+ * Each path component is compiled once and matched against the
+ * directories matched by the components before it. When there are
+ * many of those, as for lib? in src?/lib?, they are read in
+ * parallel. The listing of a directory reached by a single path, as
+ * for ~/notes/x* or *.log, is cached, as are the patterns that matched
+ * nothing in it, for as long as the directory is unchanged.
+ *
+ * A component that is exactly ** matches any number of directories,
+ * including none, as with bash's globstar: hidden directories are
+ * skipped and symbolic links are not followed. The tree below is
+ * walked by a pool of threads that steal directories from each other,
+ * and the components after the ** are matched against each listing as
+ * it is read, so no subtree is read twice.
+ *
+ * Parameters:
+ *   pattern   The pattern
+ *   arena     Arena the result is allocated from, or NULL for malloc
+ *   paths     Set to the matching paths, stored back to back in one
+ *             buffer, each followed by a NUL; NULL if nothing matched.
+ *             Without an arena, it is up to the caller to free it.
+ *
+ * Returns: The number of matches; 0 if nothing matched
+ */
+size_t GC_expand(const char *pattern, Arena arena, char **paths);
+
+// A lazy expansion of one pattern; struct _glob_gen is defined in the
+// .c file
+typedef struct _glob_gen *GlobGen;
+
+/*
+ * Start a lazy expansion of a glob pattern, whose matches are then
+ * taken one at a time with GC_next, in the same order as from
+ * GC_expand. A pattern whose wildcards are all in its last component
+ * (*.log, ~/notes/x*) is matched against the directory's listing as
+ * the matches are taken, so that no list of them is ever built; any
+ * other is expanded in full by GC_expand first.
+ *
+ * Parameters:
+ *   pattern   The pattern
+ *
+ * Returns: The generator. It is up to the caller to call GC_close
+ *   on it.
+ */
+GlobGen GC_open(const char *pattern);
+
+/*
+ * Take the next match from a generator
+ *
+ * Parameters:
+ *   gen       The generator
+ *
+ * Returns: The next matching path, valid until the next call, or NULL
+ *   if there are no more
+ */
+const char *GC_next(GlobGen gen);
+
+/*
+ * Destroy a generator
+ */
+void GC_close(GlobGen gen);
+
+/*
+ * Choose whether GC_expand and GC_next sort their matches. Unsorted, they come in
+ * directory order, which saves the sort on very large expansions.
+ *
+ * Parameters:
+ *   value     true to leave the matches unsorted
+ *
+ * Returns: The previous setting
+ */
+bool GC_set_unsorted(bool value);
+
+/*
+ * Set the amount of memory the cache may hold. The least recently
+ * used listings are dropped to stay under it; a limit of 0 disables
+ * the cache, so that every expansion reads its directories.
+ *
+ * Parameters:
+ *   bytes     The new limit
+ *
+ * Returns: The previous limit
+ */
+size_t GC_set_limit(size_t bytes);
+
+/*
+ * Drop every cached listing, home directory and negative result
+ */
+void GC_clear();
+
+#endif /* _GLOBCACHE_H_ */
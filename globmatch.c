@@ -0,0 +1,337 @@
+/*
+ * globmatch.c
+ *
+ * Compiled glob patterns for one path component
+ *
+ * Author: Nwankwo Chukwunonso Michael
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+
+#include "globmatch.h"
+
+// The kinds of item a pattern is compiled to
+typedef enum
+{
+  GM_CHAR, // one literal character
+  GM_ANY,  // ?
+  GM_STAR, // *
+  GM_SET   // [...]
+} ItemKind;
+
+typedef struct
+{
+  ItemKind kind;
+  unsigned char c;       // for GM_CHAR
+  unsigned char set[32]; // for GM_SET, a bitmap of the bytes it matches
+} Item;
+
+// Patterns of these shapes are matched with a single memcmp
+typedef enum
+{
+  SHAPE_GENERAL,
+  SHAPE_LITERAL, // abc
+  SHAPE_PREFIX,  // abc*
+  SHAPE_SUFFIX,  // *abc
+  SHAPE_NONE     // ends in a lone \, which fnmatch never matches
+} Shape;
+
+// definition of struct _glob_pattern
+struct _glob_pattern
+{
+  Item *items;
+  size_t num_items;
+  Shape shape;
+  char *literal; // the literal characters, for every shape but general
+  size_t literal_len;
+};
+
+// The character classes allowed in a set, as in [[:digit:]]
+static const struct
+{
+  const char *name;
+  int (*is)(int);
+} char_classes[] = {
+    {"alnum", isalnum}, {"alpha", isalpha}, {"blank", isblank}, {"cntrl", iscntrl},
+    {"digit", isdigit}, {"graph", isgraph}, {"lower", islower}, {"print", isprint},
+    {"punct", ispunct}, {"space", isspace}, {"upper", isupper}, {"xdigit", isxdigit}};
+
+static inline void setAdd(unsigned char *set, unsigned char c)
+{
+  set[c >> 3] |= 1 << (c & 7);
+}
+
+static inline bool setHas(const unsigned char *set, unsigned char c)
+{
+  return set[c >> 3] & (1 << (c & 7));
+}
+
+/*
+ * Parse a set starting at pattern[i] == '['
+ *
+ * Parameters:
+ *   pattern, len   The pattern
+ *   i              Index of the '['
+ *   item           Filled in with the set
+ *
+ * Returns: The index just past the closing ']', or 0 if there is no
+ *   valid set here, in which case the '[' is an ordinary character
+ */
+static size_t parseSet(const char *pattern, size_t len, size_t i, Item *item)
+{
+  size_t j = i + 1;
+  bool negate = false;
+
+  memset(item, 0, sizeof(Item));
+  item->kind = GM_SET;
+
+  if (j < len && (pattern[j] == '!' || pattern[j] == '^'))
+  {
+    negate = true;
+    j++;
+  }
+
+  for (bool first = true; j < len; first = false)
+  {
+    unsigned char c = pattern[j];
+
+    if (c == ']' && !first)
+    {
+      if (negate)
+      {
+        for (size_t k = 0; k < sizeof(item->set); k++)
+          item->set[k] = ~item->set[k];
+      }
+      return j + 1;
+    }
+
+    // a character class, such as [:alpha:]
+    if (c == '[' && j + 1 < len && pattern[j + 1] == ':')
+    {
+      const char *end = memchr(pattern + j + 2, ':', len - j - 2);
+      if (end != NULL && end + 1 < pattern + len && end[1] == ']')
+      {
+        size_t name_len = end - (pattern + j + 2);
+        size_t k = 0;
+        for (; k < sizeof(char_classes) / sizeof(char_classes[0]); k++)
+        {
+          if (strlen(char_classes[k].name) == name_len && strncmp(char_classes[k].name, pattern + j + 2, name_len) == 0)
+            break;
+        }
+        if (k == sizeof(char_classes) / sizeof(char_classes[0]))
+          return 0;
+
+        for (int b = 1; b < 256; b++)
+        {
+          if (char_classes[k].is(b))
+            setAdd(item->set, b);
+        }
+        j = (end - pattern) + 2;
+        continue;
+      }
+    }
+
+    if (c == '\\' && j + 1 < len)
+      c = pattern[++j];
+
+    // a range, such as a-z; a '-' before the closing ']' is literal
+    unsigned char hi = c;
+    if (j + 2 < len && pattern[j + 1] == '-' && pattern[j + 2] != ']')
+    {
+      j += 2;
+      hi = pattern[j];
+      if (hi == '\\' && j + 1 < len)
+        hi = pattern[++j];
+    }
+
+    for (unsigned b = c; b <= hi; b++)
+      setAdd(item->set, b);
+    j++;
+  }
+
+  return 0;
+}
+
+// Documented in .h file
+GlobPattern GM_compile(const char *pattern, size_t len)
+{
+  GlobPattern pat = (GlobPattern)calloc(1, sizeof(struct _glob_pattern));
+  assert(pat);
+
+  pat->items = (Item *)malloc((len + 1) * sizeof(Item));
+  pat->literal = (char *)malloc(len + 1);
+  assert(pat->items && pat->literal);
+
+  size_t i = 0;
+  size_t end;
+  while (i < len)
+  {
+    Item *item = &pat->items[pat->num_items];
+    item->kind = GM_CHAR;
+    item->c = pattern[i];
+
+    if (pattern[i] == '\\' && i + 1 < len)
+    {
+      item->c = pattern[i + 1];
+      i += 2;
+    }
+    else if (pattern[i] == '*')
+    {
+      item->kind = GM_STAR;
+      i++;
+
+      // ** is the same as *
+      if (pat->num_items > 0 && pat->items[pat->num_items - 1].kind == GM_STAR)
+        continue;
+    }
+    else if (pattern[i] == '?')
+    {
+      item->kind = GM_ANY;
+      i++;
+    }
+    else if (pattern[i] == '[' && (end = parseSet(pattern, len, i, item)) != 0)
+    {
+      i = end;
+    }
+    else
+    {
+      item->kind = GM_CHAR;
+      item->c = pattern[i];
+      i++;
+    }
+
+    pat->num_items++;
+  }
+
+  // recognise the shapes that need no general matching
+  size_t first = 0;
+  size_t last = pat->num_items;
+  if (last > 0 && pat->items[0].kind == GM_STAR)
+    first = 1;
+  else if (last > 0 && pat->items[last - 1].kind == GM_STAR)
+    last--;
+
+  pat->shape = (first == 1) ? SHAPE_SUFFIX : (last < pat->num_items) ? SHAPE_PREFIX : SHAPE_LITERAL;
+  for (size_t k = first; k < last; k++)
+  {
+    if (pat->items[k].kind != GM_CHAR)
+    {
+      pat->shape = SHAPE_GENERAL;
+      break;
+    }
+    pat->literal[pat->literal_len++] = pat->items[k].c;
+  }
+  pat->literal[pat->literal_len] = '\0';
+
+  size_t backslashes = 0;
+  while (backslashes < len && pattern[len - 1 - backslashes] == '\\')
+    backslashes++;
+  if (backslashes % 2 == 1)
+    pat->shape = SHAPE_NONE;
+
+  return pat;
+}
+
+/*
+ * Returns true if a single character matches an item other than *
+ */
+static inline bool itemMatches(const Item *item, unsigned char c)
+{
+  switch (item->kind)
+  {
+  case GM_CHAR:
+    return item->c == c;
+  case GM_SET:
+    return setHas(item->set, c);
+  default:
+    return true;
+  }
+}
+
+// Documented in .h file
+bool GM_match(GlobPattern pat, const char *name, size_t len)
+{
+  // a leading '.' is only matched by a literal '.'
+  if (name[0] == '.' && !(pat->num_items > 0 && pat->items[0].kind == GM_CHAR && pat->items[0].c == '.'))
+  {
+    return false;
+  }
+
+  switch (pat->shape)
+  {
+  case SHAPE_LITERAL:
+    return len == pat->literal_len && memcmp(name, pat->literal, len) == 0;
+  case SHAPE_PREFIX:
+    return len >= pat->literal_len && memcmp(name, pat->literal, pat->literal_len) == 0;
+  case SHAPE_SUFFIX:
+    return len >= pat->literal_len && memcmp(name + len - pat->literal_len, pat->literal, pat->literal_len) == 0;
+  case SHAPE_NONE:
+    return false;
+  case SHAPE_GENERAL:
+    break;
+  }
+
+  // on a mismatch, let the most recent * absorb one more character
+  const Item *items = pat->items;
+  size_t p = 0;
+  size_t n = 0;
+  size_t star_p = (size_t)-1;
+  size_t star_n = 0;
+
+  while (n < len)
+  {
+    if (p < pat->num_items && items[p].kind == GM_STAR)
+    {
+      star_p = p++;
+      star_n = n;
+    }
+    else if (p < pat->num_items && itemMatches(&items[p], name[n]))
+    {
+      p++;
+      n++;
+    }
+    else if (star_p != (size_t)-1)
+    {
+      p = star_p + 1;
+      n = ++star_n;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+  while (p < pat->num_items && items[p].kind == GM_STAR)
+    p++;
+
+  return p == pat->num_items;
+}
+
+// Documented in .h file
+bool GM_is_literal(GlobPattern pat)
+{
+  return pat->shape == SHAPE_LITERAL;
+}
+
+// Documented in .h file
+const char *GM_literal(GlobPattern pat)
+{
+  return pat->literal;
+}
+
+// Documented in .h file
+void GM_free(GlobPattern pat)
+{
+  if (pat == NULL)
+  {
+    return;
+  }
+
+  free(pat->items);
+  free(pat->literal);
+  free(pat);
+}
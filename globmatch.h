@@ -0,0 +1,64 @@
+/*
+ * globmatch.h
+ *
+ * Compiled glob patterns for one path component. A pattern is
+ * compiled once and then matched against every name in a directory,
+ * with the same results as fnmatch(pattern, name, FNM_PERIOD).
+ *
+ * Author: Nwankwo Chukwunonso Michael
+ */
+
+#ifndef _GLOBMATCH_H_
+#define _GLOBMATCH_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// struct _glob_pattern is defined in the .c file
+typedef struct _glob_pattern *GlobPattern;
+
+/*
+ * Compile a pattern for a single path component: * ? [...] with
+ * ranges, negation ([!...] or [^...]) and character classes such as
+ * [:digit:], and \ to quote the next character.
+ *
+ * Parameters:
+ *   pattern   The pattern
+ *   len       Number of characters in pattern
+ *
+ * Returns: The compiled pattern. It is up to the caller to call
+ *   GM_free on it.
+ */
+GlobPattern GM_compile(const char *pattern, size_t len);
+
+/*
+ * Match a name against a compiled pattern. As with FNM_PERIOD, a
+ * leading '.' in name only matches a literal '.' in the pattern.
+ *
+ * Parameters:
+ *   pat       The compiled pattern
+ *   name      The NUL-terminated name
+ *   len       Length of name
+ *
+ * Returns: true if name matches
+ */
+bool GM_match(GlobPattern pat, const char *name, size_t len);
+
+/*
+ * Returns true if a compiled pattern has no wildcards, i.e. matches
+ * exactly one name, which GM_literal returns
+ */
+bool GM_is_literal(GlobPattern pat);
+
+/*
+ * For a literal pattern, the one name it matches, with quoting
+ * removed
+ */
+const char *GM_literal(GlobPattern pat);
+
+/*
+ * Destroy a compiled pattern
+ */
+void GM_free(GlobPattern pat);
+
+#endif /* _GLOBMATCH_H_ */
@@ -0,0 +1,149 @@
+/*
+ * intern.c
+ *
+ * A session-wide table of interned strings
+ *
+ * Author: Nwankwo Chukwunonso Michael
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "intern.h"
+#include "arena.h"
+
+// Number of slots in the table when the first string is interned
+#define IN_INITIAL_CAP 256
+
+// A slot of the table; str is NULL if the slot is empty
+typedef struct
+{
+  const char *str;
+  uint32_t hash;
+  uint32_t len;
+} Entry;
+
+// The table: open addressing with linear probing, kept at most half
+// full. The strings themselves live in storage.
+static Entry *table = NULL;
+static size_t cap = 0;
+static size_t count = 0;
+static Arena storage = NULL;
+static size_t bytes = 0;
+static size_t limit = IN_DEFAULT_LIMIT;
+
+/*
+ * FNV-1a hash of the first len characters of str
+ */
+static uint32_t hashString(const char *str, size_t len)
+{
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < len; i++)
+  {
+    hash ^= (unsigned char)str[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+/*
+ * Find the slot for a string: the one holding it, or the empty slot
+ * where it would go
+ */
+static Entry *findSlot(const char *str, size_t len, uint32_t hash)
+{
+  for (size_t i = hash & (cap - 1);; i = (i + 1) & (cap - 1))
+  {
+    Entry *entry = &table[i];
+    if (entry->str == NULL)
+      return entry;
+    if (entry->hash == hash && entry->len == len && memcmp(entry->str, str, len) == 0)
+      return entry;
+  }
+}
+
+/*
+ * Double the number of slots in the table, or create it
+ */
+static void grow()
+{
+  Entry *old = table;
+  size_t old_cap = cap;
+
+  cap = (cap == 0) ? IN_INITIAL_CAP : 2 * cap;
+  table = (Entry *)calloc(cap, sizeof(Entry));
+  assert(table);
+
+  for (size_t i = 0; i < old_cap; i++)
+  {
+    if (old[i].str != NULL)
+      *findSlot(old[i].str, old[i].len, old[i].hash) = old[i];
+  }
+  free(old);
+}
+
+// Documented in .h file
+const char *IN_lookup(const char *str, size_t len)
+{
+  if (table == NULL)
+  {
+    return NULL;
+  }
+
+  return findSlot(str, len, hashString(str, len))->str;
+}
+
+// Documented in .h file
+const char *IN_intern(const char *str, size_t len)
+{
+  if (table == NULL)
+  {
+    grow();
+    storage = AR_new();
+  }
+
+  uint32_t hash = hashString(str, len);
+  Entry *entry = findSlot(str, len, hash);
+  if (entry->str != NULL)
+    return entry->str;
+
+  // a string is charged for its copy and its share of the slots
+  size_t size = len + 1 + 2 * sizeof(Entry);
+  if (len > UINT32_MAX || bytes + size > limit)
+    return NULL;
+
+  if (2 * (count + 1) > cap)
+  {
+    grow();
+    entry = findSlot(str, len, hash);
+  }
+
+  entry->str = AR_strndup(storage, str, len);
+  entry->hash = hash;
+  entry->len = len;
+  count++;
+  bytes += size;
+  return entry->str;
+}
+
+// Documented in .h file
+size_t IN_set_limit(size_t new_limit)
+{
+  size_t old = limit;
+  limit = new_limit;
+  return old;
+}
+
+// Documented in .h file
+size_t IN_count()
+{
+  return count;
+}
+
+// Documented in .h file
+size_t IN_bytes()
+{
+  return bytes;
+}
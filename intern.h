@@ -0,0 +1,68 @@
+/*
+ * intern.h
+ *
+ * A session-wide table of interned strings. Each distinct string is
+ * stored once, in an arena that lives as long as the shell, so equal
+ * strings share one copy and can be compared by pointer. Command
+ * names, and the words of trees built on the heap, are interned.
+ *
+ * Author: Nwankwo Chukwunonso Michael
+ */
+
+#ifndef _INTERN_H_
+#define _INTERN_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Memory the table may hold by default, in bytes
+#define IN_DEFAULT_LIMIT (1024 * 1024)
+
+/*
+ * Intern a string: return the table's copy of it, adding one if there
+ * is none yet. Interned strings are never freed, so a new string is
+ * only added while the table is under its memory limit.
+ *
+ * Parameters:
+ *   str       The string; need not be NUL-terminated
+ *   len       Number of characters in str
+ *
+ * Returns: The interned, NUL-terminated copy, which must not be
+ *   modified or freed; or NULL if str is new and the table is full
+ */
+const char *IN_intern(const char *str, size_t len);
+
+/*
+ * Find a string in the table, without adding it
+ *
+ * Parameters:
+ *   str       The string; need not be NUL-terminated
+ *   len       Number of characters in str
+ *
+ * Returns: The interned copy, or NULL if str has not been interned
+ */
+const char *IN_lookup(const char *str, size_t len);
+
+/*
+ * Set the most memory the table may hold. Strings already interned
+ * stay; a limit of 0 stops any more from being added.
+ *
+ * Parameters:
+ *   bytes     The limit, in bytes
+ *
+ * Returns: The previous limit
+ */
+size_t IN_set_limit(size_t bytes);
+
+/*
+ * Returns the number of strings interned
+ */
+size_t IN_count();
+
+/*
+ * Returns the memory the table holds, in bytes, counted against its
+ * limit
+ */
+size_t IN_bytes();
+
+#endif /* _INTERN_H_ */
@@ -1,8 +1,8 @@
 /*
  * parse.c
  *
- * Code that implements a recursive descent parser for arithmetic
- * expressions
+ * A single-pass, table-driven parser for command lines: lists of
+ * pipelines, of commands with their redirections
  *
  * Author: Nwankwo Chukwunonso Michael
  */
@@ -14,245 +14,310 @@
 #include "tokenize.h"
 #include "clist.h"
 
-// static function declaration
-static PipeTree pipe(TList tokens, char *errmsg, size_t errmsg_sz);
-static PipeTree redirect(TList tokens, char *errmsg, size_t errmsg_sz);
-static PipeTree primary(TList tokens, char *errmsg, size_t errmsg_sz);
+// What a token does in the grammar
+typedef enum
+{
+  G_WORD,     // a word of the command being parsed
+  G_REDIRECT, // a redirection of the command being parsed
+  G_PIPE,     // ends a stage of a pipeline
+  G_LIST,     // ends a pipeline of a list
+  G_END       // ends the whole command
+} Role;
+
+// The streams a redirection sets, which may each be set once
+enum
+{
+  STREAM_IN = 1 << 0,
+  STREAM_OUT = 1 << 1,
+  STREAM_ERR = 1 << 2
+};
 
+/*
+ * The grammar, one entry for every token:
+ *
+ *   line      := list END
+ *   list      := pipeline (listop pipeline)* [; | &]
+ *   listop    := ; | & | && | ||
+ *   pipeline  := command ((| | |&) command)*
+ *   command   := WORD (WORD | redirect)*
+ *   redirect  := (< | > | >> | 2> | 2>>) WORD | 2>&1
+ *
+ * kind is the PipeNodeType a redirection, pipe or list operator adds
+ * to the tree; streams, the streams it sets.
+ */
+static const struct
+{
+  Role role;
+  PipeNodeType kind;
+  unsigned char streams;
+} grammar[] = {
+    [TOK_WORD] = {G_WORD, WORD, 0},
+    [TOK_QUOTED_WORD] = {G_WORD, WORD, 0},
+    [TOK_LESSTHAN] = {G_REDIRECT, CMD_LESS, STREAM_IN},
+    [TOK_GREATERTHAN] = {G_REDIRECT, CMD_GREAT, STREAM_OUT},
+    [TOK_APPEND] = {G_REDIRECT, CMD_APPEND, STREAM_OUT},
+    [TOK_ERR_GREATERTHAN] = {G_REDIRECT, CMD_ERR_GREAT, STREAM_ERR},
+    [TOK_ERR_APPEND] = {G_REDIRECT, CMD_ERR_APPEND, STREAM_ERR},
+    [TOK_ERR_TO_OUT] = {G_REDIRECT, CMD_ERR_TO_OUT, STREAM_ERR},
+    [TOK_PIPE] = {G_PIPE, CMD_PIPE, 0},
+    [TOK_PIPE_ERR] = {G_PIPE, CMD_PIPE_ERR, STREAM_ERR},
+    [TOK_SEMI] = {G_LIST, CMD_SEQ, 0},
+    [TOK_AMP] = {G_LIST, CMD_BACKGROUND, 0},
+    [TOK_AND] = {G_LIST, CMD_AND, 0},
+    [TOK_OR] = {G_LIST, CMD_OR, 0},
+    [TOK_END] = {G_END, WORD, 0},
+};
+
+// The trees of a command being parsed
+typedef struct
+{
+  PipeTree list;     // the pipelines before the current one, or NULL
+  PipeNodeType op;   // the operator after them, once it is read
+  PipeTree pipeline; // the stages of the current pipeline, or NULL
+  PipeTree stage;    // the command being parsed, or NULL
+  size_t num_words;  // the words of the command so far
+  unsigned char streams; // the streams its redirections set
+} Parser;
 
+/*
+ * Free whatever a parser has built
+ */
+static void discard(Parser *p)
+{
+  PT_free(p->list);
+  PT_free(p->pipeline);
+  PT_free(p->stage);
+}
 
 /**
- * Parse a pipe command
- * 
- * Parses a pipe command from the list of tokens. A pipe command has the
- * format 'A | B' to pipe the output of A into the input of B.
- * 
- * Parameters
- *  tokens - List of tokens to parse
- *  errmsg - Error message buffer 
- *  errmsg_sz - Size of error message buffer
- * Return Parse tree for the full pipe command, or NULL on error
-*/
-
-static PipeTree pipe(TList tokens, char *errmsg, size_t errmsg_sz)
+ * Parse a redirection of the command being parsed
+ *
+ * Parses a redirection operator and, unless it is 2>&1, the file
+ * that follows it. Redirections may come anywhere after the command
+ * word, in any order, but each stream is redirected once only.
+ *
+ * Parameter
+ *    p - The parser
+ *    src - Source of the tokens to parse, at the operator
+ *    errmsg - Error message buffer
+ *    errmsg_sz - Size of error message buffer
+ * Return 0 on success, or -1 on error
+ */
+static int redirect(Parser *p, TokSource src, char *errmsg, size_t errmsg_sz)
 {
-  PipeTree ret = redirect(tokens, errmsg, errmsg_sz);
+  TokenType tt = TOK_source_next_type(src);
+  PipeNodeType kind = grammar[tt].kind;
 
-  if (ret == NULL)
+  // error handling, for multiple redirection
+  if (p->streams & grammar[tt].streams)
   {
-    return NULL;
+    snprintf(errmsg, errmsg_sz, "Multiple redirection");
+    return -1;
   }
+  p->streams |= grammar[tt].streams;
+  TOK_source_consume(src);
 
-  // check for zero or more occurence of a pipe
-  if (TOK_next_type(tokens) == TOK_PIPE)
+  if (kind == CMD_ERR_TO_OUT)
   {
+    PT_set_redirect_span(p->stage, kind, NULL, 0, false);
+    return 0;
+  }
 
-    TOK_consume(tokens);
-
-    PipeTree right = pipe(tokens, errmsg, errmsg_sz);
-
-    if (right == NULL)
-    {
-      PT_free(ret); // free the malloc'd memory
-      return NULL;
-    }
+  // error handling, no file name
+  if (grammar[TOK_source_next_type(src)].role != G_WORD)
+  {
+    snprintf(errmsg, errmsg_sz, "Expect filename after redirection");
+    return -1;
+  }
 
-    ret = PT_pipe(ret, right);
+  // update the node, taking the word from the token list
+  Token file = TOK_source_take(src);
+  PT_set_redirect_span(p->stage, kind, file.word, file.len, !file.borrowed);
+  if (file.glob || file.brace)
+  {
+    size_t index = (kind == CMD_LESS)                           ? PT_INPUT_FILE
+                   : (kind == CMD_GREAT || kind == CMD_APPEND) ? PT_OUTPUT_FILE
+                                                                : PT_ERROR_FILE;
+    PT_set_pattern(p->stage, index);
   }
 
-  return ret;
+  return 0;
 }
 
 /**
- * Parse a redirection expression
- * 
- * Parses a redirection expression from the token list, including the 
- * redirection operators >, >>, < and |.
- * 
- * Parameter
- *    tokens - Token list to parse 
- *    errmsg - Error message buffer
- *    errmsg_sz - Size of error message buffer
- * Return A parse tree for the redirection, or NULL on error
+ * Parse a word of the command being parsed: the command itself, which
+ * starts a new command node, or one of its arguments
+ *
+ * Parameters
+ *    p - The parser
+ *    src - Source of the tokens to parse, at the word
+ * Return None
  */
-
-static PipeTree redirect(TList tokens, char *errmsg, size_t errmsg_sz)
+static void word(Parser *p, TokSource src)
 {
+  // words are taken from the token list rather than copied; a
+  // borrowed span stays in the input line, and the tree is built
+  // in the same arena as the tokens
+  Token word = TOK_source_take(src);
 
-  PipeTree ret = primary(tokens, errmsg, errmsg_sz);
-
-  if (ret == NULL)
+  if (p->stage == NULL)
   {
-    return NULL;
+    p->stage = PT_word_span(TOK_source_arena(src), word.word, word.len, !word.borrowed);
+    p->num_words = 0;
+    p->streams = 0;
   }
-
-  // check for occurence of < or >
-  if (TOK_next_type(tokens) == TOK_LESSTHAN || TOK_next_type(tokens) == TOK_GREATERTHAN)
+  else
   {
+    PT_set_args_span(p->stage, word.word, word.len, !word.borrowed);
+  }
 
-    // if it is an input, update the input file
-    if (TOK_next_type(tokens) == TOK_LESSTHAN)
-    {
-      TOK_consume(tokens);
-
-      // error handling, no file name
-      if (TOK_next_type(tokens) != TOK_QUOTED_WORD && TOK_next_type(tokens) != TOK_WORD)
-      {
-        snprintf(errmsg, errmsg_sz, "Expect filename after redirection");
-        PT_free(ret);
-        return NULL;
-      }
-
-      // update the node
-      setInputFiles(ret, TOK_next_word(tokens));
-
-      // advance the token
-      TOK_consume(tokens);
+  // glob patterns and braces are only marked, and expanded when
+  // the tree is evaluated
+  if (word.glob || word.brace)
+    PT_set_pattern(p->stage, p->num_words);
+  p->num_words++;
+}
 
-      // error handling, for multiple redirection
-      if (TOK_next_type(tokens) == TOK_LESSTHAN)
-      {
-        snprintf(errmsg, errmsg_sz, "Multiple redirection");
-        PT_free(ret);
-        return NULL;
-      }
+/**
+ * Parse a whole command, through the TOK_END that ends it
+ *
+ * The tokens are read in a single pass. Each one is looked up in the
+ * grammar table, and its role decides what it adds to the tree: a
+ * word or a redirection goes on the command being parsed; a pipe ends
+ * that command, which becomes a stage of the current pipeline; and a
+ * list operator ends that pipeline, which becomes an item of the list.
+ *
+ * Parameters
+ *    src - Source of the tokens to parse
+ *    errmsg - Error message output buffer
+ *    errmsg_sz - Size of the error message buffer
+ * Returns The parse tree, or NULL on error
+ */
+static PipeTree command(TokSource src, char *errmsg, size_t errmsg_sz)
+{
 
-      // check if output file needs to be set
-      if (TOK_next_type(tokens) == TOK_GREATERTHAN)
-      {
-        TOK_consume(tokens);
+  // if there are no tokens, or only tok_end
+  if (TOK_source_next_type(src) == TOK_END)
+  {
+    return NULL; // no further processing
+  }
 
-        // error handling, no file name
-        if (TOK_next_type(tokens) != TOK_QUOTED_WORD && TOK_next_type(tokens) != TOK_WORD)
-        {
-          snprintf(errmsg, errmsg_sz, "Expect filename after redirection");
-          PT_free(ret);
-          return NULL;
-        }
+  Parser p = {.list = NULL, .op = CMD_SEQ, .pipeline = NULL, .stage = NULL};
 
-        // update the node
-        setOutputFiles(ret, TOK_next_word(tokens));
+  for (;;)
+  {
+    TokenType tt = TOK_source_next_type(src);
+    Role role = grammar[tt].role;
 
-        TOK_consume(tokens);
-      }
+    if (role == G_WORD)
+    {
+      word(&p, src);
+      continue;
     }
-    else
+
+    // only a list may end where no command has started: after ; or &
+    if (p.stage == NULL && !(role == G_END && p.list != NULL && p.pipeline == NULL &&
+                             (p.op == CMD_SEQ || p.op == CMD_BACKGROUND)))
     {
-      TOK_consume(tokens);
+      snprintf(errmsg, errmsg_sz, "No command specified");
+      discard(&p);
+      return NULL;
+    }
 
-      // error handling, no file name
-      if (TOK_next_type(tokens) != TOK_QUOTED_WORD && TOK_next_type(tokens) != TOK_WORD)
+    if (role == G_REDIRECT)
+    {
+      if (redirect(&p, src, errmsg, errmsg_sz) != 0)
       {
-        snprintf(errmsg, errmsg_sz, "Expect filename after redirection");
-        PT_free(ret);
+        discard(&p);
         return NULL;
       }
+      continue;
+    }
 
-      // update the node
-      setOutputFiles(ret, TOK_next_word(tokens));
-
-      // advance the token
-      TOK_consume(tokens);
-
-      // error handling, for multiple redirection
-      if (TOK_next_type(tokens) == TOK_GREATERTHAN)
+    // the command is complete; |& sends its errors down the pipe too
+    if (role == G_PIPE && grammar[tt].streams != 0)
+    {
+      if (p.streams & grammar[tt].streams)
       {
         snprintf(errmsg, errmsg_sz, "Multiple redirection");
-        PT_free(ret);
+        discard(&p);
         return NULL;
       }
-
-      // check if input file needs to be set
-      if (TOK_next_type(tokens) == TOK_LESSTHAN)
-      {
-        TOK_consume(tokens);
-
-        // error handling, no file name
-        if (TOK_next_type(tokens) != TOK_QUOTED_WORD && TOK_next_type(tokens) != TOK_WORD)
-        {
-          snprintf(errmsg, errmsg_sz, "Expect filename after redirection");
-          PT_free(ret);
-          return NULL;
-        }
-
-        // update the node
-        setInputFiles(ret, TOK_next_word(tokens));
-
-        TOK_consume(tokens);
-      }
+      PT_set_redirect_span(p.stage, CMD_ERR_TO_OUT, NULL, 0, false);
     }
-  }
-
-  return ret;
-}
-
 
-/**
- * Parse the primary part of an expression 
- *
- * This function parses the primary part of an expression from the given
- * token list. This includes literal values, identifiers, and parenthesized 
- * expressions.
- *
- * Parameters
- *    tokens - The token list to parse
- *    errmsg - Error message output buffer
- *    errmsg_sz - Size of the error message buffer
- * Returns A parse tree representing the primary expression.
-*/
-static PipeTree primary(TList tokens, char *errmsg, size_t errmsg_sz)
-{
+    if (p.stage != NULL)
+    {
+      p.pipeline = (p.pipeline == NULL) ? p.stage : PT_pipe(p.pipeline, p.stage);
+      p.stage = NULL;
+    }
 
-  if (TOK_next_type(tokens) == TOK_WORD || TOK_next_type(tokens) == TOK_QUOTED_WORD)
-  {
-    PipeTree ret = PT_word(TOK_next_word(tokens), NULL);
-    TOK_consume(tokens);
+    if (role == G_PIPE)
+    {
+      TOK_source_consume(src);
+      continue;
+    }
 
-    while (TOK_next_type(tokens) == TOK_WORD || TOK_next_type(tokens) == TOK_QUOTED_WORD)
+    // so is the pipeline
+    if (p.pipeline != NULL)
     {
-      PT_set_args(ret, TOK_next_word(tokens));
+      p.list = (p.list == NULL) ? p.pipeline : PT_list(p.list, p.op, p.pipeline);
+      p.pipeline = NULL;
+      p.op = CMD_SEQ;
+    }
 
-      TOK_consume(tokens);
+    if (role == G_LIST)
+    {
+      p.op = grammar[tt].kind;
+      TOK_source_consume(src);
+      continue;
     }
 
-    return ret;
+    // a list ending in &, which runs its last chain in the background;
+    // one ending in ; is as if it did not
+    if (p.op == CMD_BACKGROUND)
+      p.list = PT_list(p.list, p.op, NULL);
+
+    TOK_source_consume(src);
+    return p.list;
   }
-  else
+}
+
+// Documented in the .h file
+PipeTree Parse(TList tokens, char *errmsg, size_t errmsg_sz)
+{
+  if (tokens == NULL)
   {
-    // error handling
-    snprintf(errmsg, errmsg_sz, "No command specified");
     return NULL;
   }
+
+  TokSource src = TOK_source_list(tokens);
+  PipeTree ret = command(src, errmsg, errmsg_sz);
+  TOK_source_free(src);
+
+  return ret;
 }
 
 // Documented in the .h file
-PipeTree Parse(TList tokens, char *errmsg, size_t errmsg_sz)
+PipeTree ParseLine(char *line, Arena arena, char *errmsg, size_t errmsg_sz)
 {
+  errmsg[0] = '\0';
+
+  TokSource src = TOK_source_line(line, arena);
+  PipeTree ret = command(src, errmsg, errmsg_sz);
 
-  // if tokens is null or has only tok_end
-  if (TOK_next_type(tokens) == TOK_END || tokens == NULL)
+  // the parser sees a tokenizer error as the end of the line, so a
+  // tree built from the tokens before it must be discarded
+  if (TOK_source_failed(src, errmsg, errmsg_sz))
   {
-    return NULL; // no further processing
+    PT_free(ret);
+    ret = NULL;
   }
 
-  PipeTree ret = pipe(tokens, errmsg, errmsg_sz);
-
+  // a failed line is left as it was, e.g. to be continued
   if (ret == NULL)
-  {
-    return NULL;
-  }
+    TOK_source_restore(src);
 
-  // check if the token list is at the end
-  if (TOK_next_type(tokens) == TOK_END)
-  {
-    TOK_consume(tokens);
-    return ret;
-  }
-  else
-  {
-    // handle error, unexpected token
-    snprintf(errmsg, errmsg_sz, "Syntax error on token %s", TT_to_str(TOK_next_type(tokens)));
-    PT_free(ret); // free malloc'd memory
-    return NULL;
-  }
+  TOK_source_free(src);
+  return ret;
 }
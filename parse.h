@@ -41,4 +41,27 @@
  */
 PipeTree Parse(TList tokens, char *errmsg, size_t errmsg_sz);
 
+/**
+ * Tokenizes and parses a command line in a single pass.
+ *
+ * Like Parse(TOK_tokenize_spans(line, arena, ...)), but the parser
+ * pulls each token from the tokenizer as it needs it, so the list of
+ * tokens is never built: only the word being parsed is held at a
+ * time. Escape-free words are borrowed from line, which must outlive
+ * the returned tree.
+ *
+ * Parameters
+ *    line - The command line
+ *    arena - Where to build the tree, or NULL for the heap
+ *    errmsg - Return space for an error message from the tokenizer or
+ *        the parser. It is set to the empty string if the line holds
+ *        no command.
+ *    errmsg_sz - The size of errmsg
+ *
+ * Return The PipeTree, or NULL on error or if the line is blank. It is
+ *        up to the caller to call PT_free on the tree.
+ *        On error, line is left unchanged.
+ */
+PipeTree ParseLine(char *line, Arena arena, char *errmsg, size_t errmsg_sz);
+
 #endif /* _PARSE_H_ */
@@ -0,0 +1,282 @@
+/*
+ * parsecache.c
+ *
+ * A cache of parsed command lines, kept in least recently used order
+ *
+ * Author: Nwankwo Chukwunonso Michael
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "parsecache.h"
+#include "parse.h"
+
+// A cached line. The entry, its key, the copy of the line the tree was
+// parsed from, whose words the tree borrows, and the tree itself all
+// live in the entry's arena, released in one step on eviction.
+typedef struct _entry
+{
+  Arena arena;
+  const char *key; // the line as given
+  size_t len;
+  uint32_t hash;
+  PipeTree tree;
+  struct _entry *prev;  // the entries in use order, most recent first
+  struct _entry *next;
+  struct _entry *chain; // next entry in the same bucket
+} Entry;
+
+// A hash table of the entries, chained through each bucket, and the
+// list of them in use order
+static Entry **buckets = NULL;
+static size_t num_buckets = 0;
+static Entry *head = NULL;
+static Entry *tail = NULL;
+static size_t count = 0;
+static size_t capacity = PC_DEFAULT_CAPACITY;
+static size_t hits = 0;
+static size_t misses = 0;
+
+// With the cache disabled, the last line parsed, dropped on the next
+// call; it is built in one arena, reset for each line
+static Entry *uncached = NULL;
+static Arena line_arena = NULL;
+
+/*
+ * FNV-1a hash of the first len characters of str
+ */
+static uint32_t hashLine(const char *str, size_t len)
+{
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < len; i++)
+  {
+    hash ^= (unsigned char)str[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+/*
+ * Returns the bucket an entry with the given hash is chained in
+ */
+static Entry **bucketOf(uint32_t hash)
+{
+  return &buckets[hash & (num_buckets - 1)];
+}
+
+/*
+ * Allocate the buckets for the current capacity, and chain every
+ * entry into them again
+ */
+static void rehash()
+{
+  size_t want = 16;
+  while (want < capacity)
+    want *= 2;
+
+  free(buckets);
+  buckets = (Entry **)calloc(want, sizeof(Entry *));
+  assert(buckets);
+  num_buckets = want;
+
+  for (Entry *entry = head; entry != NULL; entry = entry->next)
+  {
+    Entry **bucket = bucketOf(entry->hash);
+    entry->chain = *bucket;
+    *bucket = entry;
+  }
+}
+
+/*
+ * Take an entry out of the use order list
+ */
+static void unlinkEntry(Entry *entry)
+{
+  if (entry->prev != NULL)
+    entry->prev->next = entry->next;
+  else
+    head = entry->next;
+
+  if (entry->next != NULL)
+    entry->next->prev = entry->prev;
+  else
+    tail = entry->prev;
+}
+
+/*
+ * Put an entry at the front of the use order list
+ */
+static void pushFront(Entry *entry)
+{
+  entry->prev = NULL;
+  entry->next = head;
+  if (head != NULL)
+    head->prev = entry;
+  head = entry;
+  if (tail == NULL)
+    tail = entry;
+}
+
+/*
+ * Free an entry and its tree, which live in its arena
+ */
+static void freeEntry(Entry *entry)
+{
+  if (entry == NULL || entry->arena == line_arena)
+    return;
+
+  AR_free(entry->arena);
+}
+
+/*
+ * Evict the least recently used entry
+ */
+static void evict()
+{
+  Entry *victim = tail;
+  unlinkEntry(victim);
+
+  Entry **link = bucketOf(victim->hash);
+  while (*link != victim)
+    link = &(*link)->chain;
+  *link = victim->chain;
+
+  freeEntry(victim);
+  count--;
+}
+
+/*
+ * Parse a line into a new entry, and optimize its tree, once, before
+ * it is shared
+ *
+ * Parameters:
+ *   arena   The arena to build the entry in; it is freed if the line
+ *           does not parse, unless it is line_arena
+ *
+ * Returns: The entry, or NULL if the line is blank or does not parse
+ */
+static Entry *newEntry(Arena arena, const char *line, size_t len, uint32_t hash, char *errmsg, size_t errmsg_sz)
+{
+  Entry *entry = (Entry *)AR_alloc(arena, sizeof(Entry) + 2 * (len + 1));
+
+  char *key = (char *)(entry + 1);
+  char *copy = key + len + 1;
+  memcpy(key, line, len + 1);
+  memcpy(copy, line, len + 1);
+
+  entry->arena = arena;
+  entry->key = key;
+  entry->len = len;
+  entry->hash = hash;
+  entry->tree = ParseLine(copy, arena, errmsg, errmsg_sz);
+  if (entry->tree == NULL)
+  {
+    freeEntry(entry);
+    return NULL;
+  }
+
+  PT_optimize(entry->tree);
+  return entry;
+}
+
+// Documented in .h file
+PipeTree PC_parse(const char *line, char *errmsg, size_t errmsg_sz)
+{
+  size_t len = strlen(line);
+  uint32_t hash = hashLine(line, len);
+  errmsg[0] = '\0';
+
+  uncached = NULL;
+
+  if (capacity == 0)
+  {
+    if (line_arena == NULL)
+      line_arena = AR_new();
+    AR_reset(line_arena);
+
+    misses++;
+    uncached = newEntry(line_arena, line, len, hash, errmsg, errmsg_sz);
+    return (uncached != NULL) ? uncached->tree : NULL;
+  }
+
+  if (buckets == NULL)
+    rehash();
+
+  for (Entry *entry = *bucketOf(hash); entry != NULL; entry = entry->chain)
+  {
+    if (entry->hash == hash && entry->len == len && memcmp(entry->key, line, len) == 0)
+    {
+      hits++;
+      unlinkEntry(entry);
+      pushFront(entry);
+      return entry->tree;
+    }
+  }
+
+  misses++;
+  Entry *entry = newEntry(AR_new(), line, len, hash, errmsg, errmsg_sz);
+  if (entry == NULL)
+    return NULL;
+
+  if (count == capacity)
+    evict();
+
+  Entry **bucket = bucketOf(hash);
+  entry->chain = *bucket;
+  *bucket = entry;
+  pushFront(entry);
+  count++;
+
+  return entry->tree;
+}
+
+// Documented in .h file
+size_t PC_set_capacity(size_t new_capacity)
+{
+  size_t old = capacity;
+  capacity = new_capacity;
+
+  while (count > capacity)
+    evict();
+  if (capacity > 0 && buckets != NULL)
+    rehash();
+
+  return old;
+}
+
+// Documented in .h file
+void PC_clear()
+{
+  while (count > 0)
+    evict();
+
+  uncached = NULL;
+  AR_free(line_arena);
+  line_arena = NULL;
+  free(buckets);
+  buckets = NULL;
+  num_buckets = 0;
+  hits = 0;
+  misses = 0;
+}
+
+// Documented in .h file
+size_t PC_hits()
+{
+  return hits;
+}
+
+// Documented in .h file
+size_t PC_misses()
+{
+  return misses;
+}
+
+// Documented in .h file
+size_t PC_count()
+{
+  return count;
+}
@@ -0,0 +1,80 @@
+/*
+ * parsecache.h
+ *
+ * A cache of parsed command lines. A line seen before is looked up by
+ * its text and its tree reused, so it is not tokenized and parsed
+ * again. The least recently used line is evicted when the cache is
+ * full.
+ *
+ * A cached tree does not depend on the filesystem: glob patterns and
+ * braces are only marked by the parser, and expanded each time the
+ * tree is evaluated, so a cached tree never goes stale. Evaluating a
+ * tree does not change it.
+ *
+ * Each line and its tree are built in an arena of their own, released
+ * when the line is evicted, and the tree is rewritten by PT_optimize
+ * once, before it is cached, under the rules set at that time.
+ *
+ * Author: Nwankwo Chukwunonso Michael
+ */
+
+#ifndef _PARSECACHE_H_
+#define _PARSECACHE_H_
+
+#include <stddef.h>
+
+#include "pipeline.h"
+
+// Number of lines the cache holds by default
+#define PC_DEFAULT_CAPACITY 512
+
+/*
+ * Parse a command line, or find the tree it was parsed into before
+ *
+ * Parameters:
+ *   line       The command line; it is not modified
+ *   errmsg     Return space for an error message, filled in in case
+ *              of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The tree, which belongs to the cache: the caller must not
+ *   modify or free it, and it stays valid until the next call to
+ *   PC_parse or PC_clear. NULL if the line is blank, in which case
+ *   errmsg is empty, or does not parse, in which case the line is not
+ *   cached.
+ */
+PipeTree PC_parse(const char *line, char *errmsg, size_t errmsg_sz);
+
+/*
+ * Set the number of lines the cache holds, evicting the least
+ * recently used lines beyond it. A capacity of 0 disables the cache:
+ * PC_parse then parses every line, and keeps only the last.
+ *
+ * Parameters:
+ *   capacity   The number of lines
+ *
+ * Returns: The previous capacity
+ */
+size_t PC_set_capacity(size_t capacity);
+
+/*
+ * Free every cached line and tree, and reset the counters
+ */
+void PC_clear();
+
+/*
+ * Returns the number of calls to PC_parse that found the line cached
+ */
+size_t PC_hits();
+
+/*
+ * Returns the number of calls to PC_parse that had to parse the line
+ */
+size_t PC_misses();
+
+/*
+ * Returns the number of lines cached
+ */
+size_t PC_count();
+
+#endif /* _PARSECACHE_H_ */
@@ -8,7 +8,11 @@
  *
  */
 
+// for pipe2()
+#define _GNU_SOURCE
+
 #include <unistd.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -20,277 +24,1002 @@
 #include <fcntl.h>
 #include <pwd.h>
 #include <errno.h>
+#include <signal.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stddef.h>
 
 #include "pipeline.h"
 #include "clist.h"
+#include "globcache.h"
+#include "brace.h"
+#include "intern.h"
 
+// Bytes kept free below ARG_MAX when sizing a batch, as xargs does
+#define ARG_HEADROOM 4096
 
-// Function prototype declaration
-static int handlePipe(PipeTree tree);
-static int executeCommand(char *command, char *const *args, const char *in, const char *out);
+extern char **environ;
+
+// The most bytes of argv per command; 0 to take it from ARG_MAX
+static size_t arg_limit = 0;
+
+// Number of batches of one command that may run at once
+static int batch_jobs = 1;
+
+// The exit status of each stage of the last command evaluated, kept
+// here rather than in the tree, which evaluation never changes
+static int *last_status = NULL;
+static size_t last_num_stages = 0;
+static size_t last_status_cap = 0;
+
+// Number of lists run in the background that may not have been reaped
+static size_t background_jobs = 0;
+
+// The environment commands are exec'd with, or NULL for environ
+static char *const *exec_envp = NULL;
+
+// How processes for commands are made: PT_SPAWN_POSIX or PT_SPAWN_FORK
+static int spawn_backend = PT_SPAWN_POSIX;
 
-// definition of struct _pipe_tree_node
+// The rewrites PT_optimize makes, and how often each has been made
+static unsigned opt_rules = PT_OPT_ALL;
+static size_t opt_fired[PT_NUM_OPTS];
+
+// The commands run by the shell itself; exit and quit are the same
+typedef enum
+{
+  BI_NONE,
+  BI_EXIT,
+  BI_AUTHOR,
+  BI_CD,
+  BI_PWD
+} Builtin;
+
+// The redirections of a command, with any patterns in them expanded
+typedef struct
+{
+  const char *in;
+  const char *out;
+  const char *err;
+  bool out_append; // >> rather than >
+  bool err_append;
+  bool err_to_out; // 2>&1, applied after out
+} Redirects;
+
+// Function prototype declaration
+static int runPipeline(PipeTree tree);
+static int runList(PipeTree tree);
+static int executeCommand(Builtin builtin, char *const *args, const Redirects *rd);
+static int evaluatePatterns(PipeTree tree);
+static int copyFile(PipeTree tree);
+static void applyRedirects(const int fds[3], bool err_to_out);
+
+// The interned names of the builtins; a command is a builtin if its
+// interned copy is one of these
+static struct
+{
+  const char *exit, *quit, *author, *cd, *pwd;
+} builtins;
+
+// Number of argv slots kept in a command node itself: the command, six
+// arguments and the NULL, what is left of two cache lines once the
+// redirections are in. A longer argv spills to an array of its own,
+// whose size doubles from this one.
+#define PT_INLINE_ARGV 8
+
+// definition of struct _pipe_tree_node, a tag and a union. A WORD node
+// is one command, or stage; a CMD_PIPE node is a whole pipeline,
+// holding its stages by value, in order, in one array; a CMD_LIST node
+// is a list of commands and pipelines, each joined to the next by the
+// operator in connectors.
 struct _pipe_tree_node
 {
-  PipeNodeType type;
-  char *command;
-  char *input;
-  char *output;
-  CList args;
-  PipeTree left;
-  PipeTree right;
+  unsigned char type;      // a PipeNodeType
+  unsigned char builtin;   // a Builtin
+  bool input_pattern : 1;  // whether a redirection is a glob pattern
+  bool output_pattern : 1;
+  bool error_pattern : 1;
+  bool output_append : 1;  // >> rather than >
+  bool error_append : 1;   // 2>> rather than 2>
+  bool error_to_output : 1; // 2>&1
+  bool copy_file : 1;  // cat file >out, copied by the shell itself
+  bool run_inline : 1; // a builtin stage, run by the shell itself
+  uint32_t argc;       // WORD: words in argv, the command first
+  Arena arena; // if not NULL, the node and its strings live here
+  union
+  {
+    struct // WORD
+    {
+      char *input;
+      char *output;
+      char *error;
+      CList owned;    // strings this node must free; the rest are borrowed
+      bool *patterns; // for each word of argv, whether it is a glob
+                      // pattern; as long as argv's slots, or NULL
+      char **spill;   // argv, once it outgrows inline_argv
+      // argv, NULL-terminated; found through argvOf, as a pointer to
+      // it would not survive the node being moved into a pipeline
+      char *inline_argv[PT_INLINE_ARGV];
+    };
+    struct // CMD_PIPE
+    {
+      struct _pipe_tree_node *stages;
+      size_t num_stages;
+      size_t stages_cap;
+    };
+    struct // CMD_LIST
+    {
+      struct _pipe_tree_node **items; // commands and pipelines
+      unsigned char *connectors;      // the PipeNodeType after each item:
+                                      // CMD_AND or CMD_OR, and at the
+                                      // end of a chain CMD_SEQ or
+                                      // CMD_BACKGROUND
+      size_t num_items;
+      size_t items_cap;
+    };
+  };
 };
 
+// a command node, and so every stage of a pipeline, is two cache lines
+_Static_assert(sizeof(struct _pipe_tree_node) <= 128, "PipeTree node outgrew two cache lines");
+
+/*
+ * Returns the argv of a command node: the command, then its arguments,
+ * then NULL
+ */
+static char **argvOf(PipeTree tree)
+{
+  return (tree->spill != NULL) ? tree->spill : tree->inline_argv;
+}
+
+/*
+ * Returns the number of slots in the argv of a command node, and so in
+ * its patterns: PT_INLINE_ARGV, doubled as often as argv has spilled,
+ * which is the least such size that holds the words and the NULL
+ */
+static size_t argvCap(PipeTree tree)
+{
+  size_t cap = PT_INLINE_ARGV;
+  if (tree->spill == NULL)
+    return cap;
+
+  while (cap < tree->argc + 1)
+    cap *= 2;
+  return cap;
+}
+
+/*
+ * Returns the environment a command is exec'd with
+ */
+static char *const *environment()
+{
+  return (exec_envp != NULL) ? exec_envp : environ;
+}
+
+/*
+ * In a child, replace the process with a command, searching PATH as
+ * execvp does, with the environment set by PT_set_environment
+ *
+ * Returns: Only if the command cannot be exec'd
+ */
+static void execCommand(char *const *argv)
+{
+  execvpe(argv[0], argv, environment());
+}
+
+/*
+ * Start a command in a process of its own, with its standard streams
+ * set up: first joined to the pipes given, then redirected to the
+ * files opened by openRedirects. posix_spawn makes the process without
+ * copying the shell's page tables, which fork does however large the
+ * shell has grown; fork is kept, selected by PT_set_spawn.
+ *
+ * Parameters:
+ *   argv        The command, then its arguments, then NULL
+ *   in          Descriptor to read standard input from, or -1
+ *   out         Descriptor to write standard output to, or -1
+ *   fds         The redirections, from openRedirects
+ *   err_to_out  Whether standard error goes where standard output does
+ *
+ * Returns: The pid of the process, 0 if the command could not be run,
+ *   which has been reported, or -1 if no process could be made
+ */
+static pid_t spawnCommand(char *const *argv, int in, int out, const int fds[3], bool err_to_out)
+{
+  if (spawn_backend == PT_SPAWN_FORK)
+  {
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      if (in >= 0)
+        dup2(in, STDIN_FILENO);
+      if (out >= 0)
+        dup2(out, STDOUT_FILENO);
+      applyRedirects(fds, err_to_out);
+
+      execCommand(argv);
+      // If execCommand returns, it must have failed
+      exit(EXIT_FAILURE);
+    }
+    return pid;
+  }
+
+  // the same steps as above, taken by the child posix_spawn makes; the
+  // pipes are close-on-exec, but the redirections must be closed
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  if (in >= 0)
+    posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO);
+  if (out >= 0)
+    posix_spawn_file_actions_adddup2(&actions, out, STDOUT_FILENO);
+  for (int i = 0; i < 3; i++)
+  {
+    if (fds[i] >= 0 && fds[i] != i)
+    {
+      posix_spawn_file_actions_adddup2(&actions, fds[i], i);
+      posix_spawn_file_actions_addclose(&actions, fds[i]);
+    }
+  }
+  if (err_to_out)
+    posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+
+  pid_t pid;
+  int rc = posix_spawnp(&pid, argv[0], &actions, NULL, argv, environment());
+  posix_spawn_file_actions_destroy(&actions);
+
+  if (rc == EAGAIN || rc == ENOMEM)
+  {
+    errno = rc;
+    return -1;
+  }
+  if (rc != 0)
+  {
+    fprintf(stderr, "%s: Command not found\n", argv[0]);
+    return 0;
+  }
+  return pid;
+}
+
+/*
+ * Append a word to the argv of a command node, spilling argv to an
+ * array of its own when the slots in the node are full
+ *
+ * Parameters:
+ *   tree    The command node
+ *   word    The word, already kept on the node
+ *
+ * Returns: None
+ */
+static void appendArg(PipeTree tree, char *word)
+{
+  // one slot is kept for the NULL
+  size_t old_cap = argvCap(tree);
+  if (tree->argc + 1 == old_cap)
+  {
+    size_t cap = 2 * old_cap;
+    size_t old_size = old_cap * sizeof(char *);
+    char **spill;
+    if (tree->arena != NULL)
+      spill = (char **)AR_realloc(tree->arena, tree->spill, (tree->spill != NULL) ? old_size : 0, cap * sizeof(char *));
+    else
+      spill = (char **)realloc(tree->spill, cap * sizeof(char *));
+    assert(spill);
+    if (tree->spill == NULL)
+      memcpy(spill, tree->inline_argv, old_size);
+    tree->spill = spill;
+
+    if (tree->patterns != NULL)
+    {
+      bool *patterns;
+      if (tree->arena != NULL)
+        patterns = (bool *)AR_realloc(tree->arena, tree->patterns, old_cap, cap);
+      else
+        patterns = (bool *)realloc(tree->patterns, cap);
+      assert(patterns);
+      memset(patterns + old_cap, 0, cap - old_cap);
+      tree->patterns = patterns;
+    }
+  }
+
+  char **argv = argvOf(tree);
+  argv[tree->argc++] = word;
+  argv[tree->argc] = NULL;
+}
+
 /*
- * Convert an PipeNodeType into a printable character
+ * Convert an PipeNodeType into the operator it is written as
  *
  * Parameters:
  *   ent    The PipeNodeType to convert
  *
- * Returns: A single character representing the ent
+ * Returns: A string representing the ent
  */
-static char PipeNodeType_to_char(PipeNodeType ent)
+static const char *PipeNodeType_to_str(PipeNodeType ent)
 {
 
   switch (ent)
   {
   case CMD_PIPE:
-    return '|';
+    return "|";
   case CMD_LESS:
-    return '<';
+    return "<";
   case CMD_GREAT:
-    return '>';
+    return ">";
+  case CMD_SEQ:
+    return ";";
+  case CMD_BACKGROUND:
+    return "&";
+  case CMD_AND:
+    return "&&";
+  case CMD_OR:
+    return "||";
+  case CMD_APPEND:
+    return ">>";
+  case CMD_ERR_GREAT:
+    return "2>";
+  case CMD_ERR_APPEND:
+    return "2>>";
+  case CMD_ERR_TO_OUT:
+    return "2>&1";
+  case CMD_PIPE_ERR:
+    return "|&";
   default:
-    return '?';
+    return "?";
   }
 }
 
-// Documented in .h file
-int setInputFiles(PipeTree tree, const char *in)
+/*
+ * Record a string on a node. A borrowed span is NUL-terminated in
+ * place; an owned string is added to the node's owned list so that
+ * PT_free can release it, unless the node lives in an arena, in which
+ * case the string was allocated from the same arena. An owned heap
+ * string is swapped for its interned copy when the table has room, so
+ * trees built on the heap share one copy of each word.
+ *
+ * Parameters:
+ *   tree    The node the string belongs to
+ *   str     The string, or the start of a span
+ *   len     Length of the span (ignored when owned)
+ *   owned   True if the node is responsible for freeing str
+ *
+ * Returns: str, or the interned copy that replaced it
+ */
+static char *keepString(PipeTree tree, char *str, size_t len, bool owned)
 {
-  // handle NULL tree situation
-  if (tree == NULL)
+  if (owned && tree->arena != NULL)
   {
-    return -1;
+    // released along with the arena
   }
+  else if (owned)
+  {
+    const char *shared = IN_intern(str, strlen(str));
+    if (shared != NULL)
+    {
+      free(str);
+      return (char *)shared;
+    }
 
-  // Copy input filename string
-  tree->input = strdup(in);
-  assert(tree->input); // assert not null
+    if (tree->owned == NULL)
+    {
+      tree->owned = CL_new();
+    }
+    CL_append(tree->owned, str);
+  }
+  else
+  {
+    str[len] = '\0';
+  }
 
-  return 0; // return 0 on SUCCESS
+  return str;
 }
 
-// Documented in .h file
-int setOutputFiles(PipeTree tree, const char *out)
+/*
+ * Intern the names of the builtins, the first time they are needed
+ */
+static void internBuiltins()
 {
-  // handle NULL tree situation
-  if (tree == NULL)
+  if (builtins.exit != NULL)
   {
-    return -1;
+    return;
   }
 
-  // Copy input filename string
-  tree->output = strdup(out);
-  assert(tree->output); // assert not null
+  // the few bytes they take are allowed past the table's limit
+  size_t limit = IN_set_limit(SIZE_MAX);
+  builtins.exit = IN_intern("exit", 4);
+  builtins.quit = IN_intern("quit", 4);
+  builtins.author = IN_intern("author", 6);
+  builtins.cd = IN_intern("cd", 2);
+  builtins.pwd = IN_intern("pwd", 3);
+  IN_set_limit(limit);
+  assert(builtins.exit && builtins.quit && builtins.author && builtins.cd && builtins.pwd);
+}
 
-  return 0; // return 0 on SUCCESS
+/*
+ * Find which builtin a command is, by the pointer to its interned name
+ *
+ * Returns: The builtin, or BI_NONE if the command is run from a file
+ */
+static Builtin builtinId(const char *command)
+{
+  internBuiltins();
+  const char *name = IN_lookup(command, strlen(command));
+
+  if (name == NULL)
+    return BI_NONE;
+  if (name == builtins.exit || name == builtins.quit)
+    return BI_EXIT;
+  if (name == builtins.author)
+    return BI_AUTHOR;
+  if (name == builtins.cd)
+    return BI_CD;
+  if (name == builtins.pwd)
+    return BI_PWD;
+  return BI_NONE;
 }
 
-// Documented in .h file
-PipeTree PT_word(const char *command, const char *args[])
+/*
+ * Copy a string onto a node: into its arena, or else the interned copy,
+ * falling back to a heap copy the node owns when the table is full
+ *
+ * Parameters:
+ *   tree    The node the string belongs to
+ *   str     The string to copy
+ *
+ * Returns: The copy
+ */
+static char *copyString(PipeTree tree, const char *str)
 {
+  if (tree->arena != NULL)
+  {
+    return AR_strdup(tree->arena, str);
+  }
 
-  // Use malloc to request for a valid block of memory
-  PipeTree node = (PipeTree)malloc(sizeof(struct _pipe_tree_node));
-  assert(node); // assert a valid block of memory was returned
+  const char *shared = IN_intern(str, strlen(str));
+  if (shared != NULL)
+  {
+    return (char *)shared;
+  }
 
-  // set the type
-  node->type = WORD;
+  char *copy = strdup(str);
+  assert(copy); // assert a valid block of memory was returned
+  return keepString(tree, copy, 0, true);
+}
 
-  // set the input/output file to NULL
+/*
+ * Clear every field of a command node, which may be a stage in the
+ * array of a pipeline
+ *
+ * Parameters:
+ *   node    The node
+ *   arena   Where its strings and arrays are allocated, or NULL
+ *
+ * Returns: None
+ */
+static void initCommand(PipeTree node, Arena arena)
+{
+  node->type = WORD;
+  node->builtin = BI_NONE;
+  node->input_pattern = false;
+  node->output_pattern = false;
+  node->error_pattern = false;
+  node->output_append = false;
+  node->error_append = false;
+  node->error_to_output = false;
+  node->copy_file = false;
+  node->run_inline = false;
+  node->arena = arena;
   node->input = NULL;
   node->output = NULL;
+  node->error = NULL;
+  node->owned = NULL;
+  node->patterns = NULL;
+  node->spill = NULL;
+  node->argc = 0;
+  node->inline_argv[0] = NULL;
+}
 
-  // set the command
-  node->command = strdup(command);
-  assert(node->command); // assert a valid block of memory was returned
+/*
+ * Allocate a node with every field cleared
+ *
+ * Parameters:
+ *   arena   Where to allocate the node, or NULL for the heap
+ *   type    The type of the node
+ *
+ * Returns: The new node
+ */
+static PipeTree newNode(Arena arena, PipeNodeType type)
+{
+  // a pipeline or a list is allocated without the room a command needs
+  size_t size = (type == WORD)       ? sizeof(struct _pipe_tree_node)
+                : (type == CMD_LIST) ? offsetof(struct _pipe_tree_node, items_cap) + sizeof(size_t)
+                                     : offsetof(struct _pipe_tree_node, stages_cap) + sizeof(size_t);
+  PipeTree node;
+  if (arena != NULL)
+    node = (PipeTree)AR_alloc(arena, size);
+  else
+    node = (PipeTree)malloc(size);
+  assert(node); // assert a valid block of memory was returned
 
-  // first set the args to NULL
-  if (args == NULL || args[0] == NULL)
+  if (type == WORD)
   {
-    node->args = NULL;
+    initCommand(node, arena);
   }
   else
   {
-    // we need to add a linkedlist to the node;
-    node->args = CL_new();
+    // no builtin, no patterns, and no stages or items yet
+    memset(node, 0, size);
+    node->type = type;
+    node->arena = arena;
+  }
 
-    size_t idx = 0;
+  return node;
+}
 
-    // loop through the strings and append to CList
-    while (args[idx] != NULL)
-    {
-      CListElementType element = strdup(args[idx]);
-      CL_append(node->args, element);
-      idx++;
-    }
+// Documented in .h file
+int setInputFiles(PipeTree tree, const char *in)
+{
+  // handle NULL tree situation
+  if (tree == NULL || tree->type != WORD)
+  {
+    return -1;
   }
 
-  // set the left and right to NULL
-  node->left = NULL;
-  node->right = NULL;
+  // Copy input filename string
+  tree->input = copyString(tree, in);
 
-  // return the node
-  return node;
+  return 0; // return 0 on SUCCESS
 }
 
 // Documented in .h file
-PipeTree PT_pipe(PipeTree left, PipeTree right)
+int setOutputFiles(PipeTree tree, const char *out)
 {
-  // Use malloc to request for a valid block of memory
-  PipeTree new = (PipeTree)malloc(sizeof(struct _pipe_tree_node));
-  assert(new); // assert a valid block of memory was returned
+  // handle NULL tree situation
+  if (tree == NULL || tree->type != WORD)
+  {
+    return -1;
+  }
 
-  // set the type, left and right child of the new node
-  new->type = CMD_PIPE;
+  // Copy output filename string
+  tree->output = copyString(tree, out);
 
-  // left and right child
-  new->left = left;
-  new->right = right;
+  return 0; // return 0 on SUCCESS
+}
 
-  // NULL these attributes
-  new->command = NULL;
-  new->args = NULL;
-  new->input = NULL;
-  new->output = NULL;
+// Documented in .h file
+int setInputSpan(PipeTree tree, char *in, size_t len, bool owned)
+{
+  if (tree == NULL || tree->type != WORD)
+  {
+    return -1;
+  }
 
-  // return the node
-  return new;
+  tree->input = keepString(tree, in, len, owned);
+  return 0;
 }
 
-/**
- * Callback to free a command argument.
- *
- * Called by foreach used in PT_free to
- * free each argument string.
- * Parameters
- *    pos - Position in argument list
- *    arg - Argument string to free
- *    cb_data - Optional callback data (unused)
- */
-
-void PT_free_args_callback(int pos, CListElementType arg, void *cb_data)
+// Documented in .h file
+int setOutputSpan(PipeTree tree, char *out, size_t len, bool owned)
 {
-  free((void *)arg);
-  arg = NULL;
+  if (tree == NULL || tree->type != WORD)
+  {
+    return -1;
+  }
+
+  tree->output = keepString(tree, out, len, owned);
+  return 0;
 }
 
 // Documented in .h file
-void PT_free(PipeTree tree)
+int PT_set_redirect_span(PipeTree tree, PipeNodeType kind, char *file, size_t len, bool owned)
 {
-  // Base Case: do nothing, just return
-  if (tree == NULL)
+  if (tree == NULL || tree->type != WORD || (kind != CMD_ERR_TO_OUT && file == NULL))
   {
-    return;
+    return -1;
   }
 
-  // if type is of type CMD_PIPE, make a recursive call
-  // to free the LEFT child, then the RIGHT child
-  if (tree->type == CMD_PIPE)
+  switch (kind)
   {
-    PT_free(tree->left);
-    PT_free(tree->right);
+  case CMD_LESS:
+    tree->input = keepString(tree, file, len, owned);
+    return 0;
+  case CMD_GREAT:
+  case CMD_APPEND:
+    tree->output = keepString(tree, file, len, owned);
+    tree->output_append = (kind == CMD_APPEND);
+    return 0;
+  case CMD_ERR_GREAT:
+  case CMD_ERR_APPEND:
+    tree->error = keepString(tree, file, len, owned);
+    tree->error_append = (kind == CMD_ERR_APPEND);
+    tree->error_to_output = false;
+    return 0;
+  case CMD_ERR_TO_OUT:
+    tree->error = NULL;
+    tree->error_pattern = false;
+    tree->error_to_output = true;
+    return 0;
+  default:
+    return -1;
   }
-  else if (tree->type == WORD)
-  {
-    // free the files
-    free((void *)tree->input);
-    tree->input = NULL;
-
-    free((void *)tree->output);
-    tree->output = NULL;
+}
 
-    // free the memory for command
-    free((void *)tree->command);
-    tree->command = NULL;
+// Documented in .h file
+PipeTree PT_word(const char *command, const char *args[])
+{
+  PipeTree node = newNode(NULL, WORD);
 
-    // free the linkedlist, if args is not NULL
-    if (tree->args != NULL)
-    {
-      // free the memory allocated for the element in the AST
-      CL_foreach(tree->args, PT_free_args_callback, NULL);
+  // set the command, which is argv[0]
+  appendArg(node, copyString(node, command));
+  node->builtin = builtinId(command);
 
-      CL_free(tree->args);
-      tree->args = NULL;
-    }
+  // loop through the strings and append to the args
+  for (size_t idx = 0; args != NULL && args[idx] != NULL; idx++)
+  {
+    PT_set_args(node, args[idx]);
   }
 
-  // Free the node itself, after the children have been freed.
-  free(tree);
-  tree = NULL;
-  return;
+  // return the node
+  return node;
 }
 
 // Documented in .h file
-int PT_count(PipeTree tree)
+PipeTree PT_word_span(Arena arena, char *command, size_t len, bool owned)
 {
-  if (tree == NULL)
-    return 0;
+  PipeTree node = newNode(arena, WORD);
 
-  if (tree->type == WORD)
-    return 1;
+  // set the command, which is argv[0]
+  command = keepString(node, command, len, owned);
+
+  // the command name is interned whatever the span came from, so that
+  // builtins can be recognized by pointer
+  const char *shared = IN_intern(command, strlen(command));
+  if (shared != NULL)
+  {
+    command = (char *)shared;
+  }
+  node->builtin = builtinId(command);
+  appendArg(node, command);
 
-  return 1 + PT_count(tree->left) + PT_count(tree->right);
+  return node;
 }
 
-// Documented in .h file
-int PT_depth(PipeTree tree)
+/*
+ * Append the stages of a tree to a pipeline: the tree itself if it
+ * is a command, or each of its stages if it is a pipeline. The stages
+ * are moved, and the tree's own node released.
+ *
+ * Parameters:
+ *   pipeline  The CMD_PIPE node
+ *   tree      The command or pipeline to append
+ *
+ * Returns: None
+ */
+static void appendStages(PipeTree pipeline, PipeTree tree)
 {
-  // Base case 1: If NULL, return 0 as a NULL node contributes nothing to the depth
-  if (tree == NULL)
-    return 0;
+  PipeTree stages = (tree->type == CMD_PIPE) ? tree->stages : tree;
+  size_t count = (tree->type == CMD_PIPE) ? tree->num_stages : 1;
+  size_t size = sizeof(struct _pipe_tree_node);
 
-  // Base case 2: If of type VALUE or SYMBOL, return 1
-  if (tree->type == WORD)
-    return 1;
+  if (pipeline->num_stages + count > pipeline->stages_cap)
+  {
+    size_t cap = (pipeline->stages_cap == 0) ? 4 : 2 * pipeline->stages_cap;
+    while (cap < pipeline->num_stages + count)
+      cap *= 2;
 
-  //
-  // Recursive Operation
-  //
+    if (pipeline->arena != NULL)
+      pipeline->stages = (PipeTree)AR_realloc(pipeline->arena, pipeline->stages, pipeline->stages_cap * size, cap * size);
+    else
+      pipeline->stages = (PipeTree)realloc(pipeline->stages, cap * size);
+    assert(pipeline->stages);
+    pipeline->stages_cap = cap;
+  }
 
-  int left = PT_depth(tree->left);   // get the depth of the left child
-  int right = PT_depth(tree->right); // get the depth of the right child
+  memcpy(pipeline->stages + pipeline->num_stages, stages, count * size);
+  pipeline->num_stages += count;
 
-  // return 1 plus the greater of left and right, or any if left is equal to right
-  return 1 + (left > right ? left : right);
+  // the stages now belong to the pipeline; only the shell is left
+  if (tree->arena == NULL)
+  {
+    if (tree->type == CMD_PIPE)
+      free(tree->stages);
+    free(tree);
+  }
 }
 
 // Documented in .h file
-int PT_evaluate(PipeTree tree)
+PipeTree PT_pipe(PipeTree left, PipeTree right)
 {
-
-  // check if the node to be evaluated is a command
-  if (tree->type == WORD)
+  // a pipeline on the left is extended, rather than nested
+  PipeTree pipeline = left;
+  if (left->type != CMD_PIPE)
   {
+    pipeline = newNode(left->arena, CMD_PIPE);
+    appendStages(pipeline, left);
+  }
+
+  appendStages(pipeline, right);
+  return pipeline;
+}
+
+/*
+ * Append an item to a list, followed by the operator that joins it to
+ * the next
+ */
+static void appendItem(PipeTree list, PipeTree item, PipeNodeType op)
+{
+  if (list->num_items == list->items_cap)
+  {
+    size_t cap = (list->items_cap == 0) ? 4 : 2 * list->items_cap;
+    size_t old_cap = list->items_cap;
+
+    if (list->arena != NULL)
+    {
+      list->items = (PipeTree *)AR_realloc(list->arena, list->items, old_cap * sizeof(PipeTree), cap * sizeof(PipeTree));
+      list->connectors = (unsigned char *)AR_realloc(list->arena, list->connectors, old_cap, cap);
+    }
+    else
+    {
+      list->items = (PipeTree *)realloc(list->items, cap * sizeof(PipeTree));
+      list->connectors = (unsigned char *)realloc(list->connectors, cap);
+    }
+    assert(list->items && list->connectors);
+    list->items_cap = cap;
+  }
+
+  list->items[list->num_items] = item;
+  list->connectors[list->num_items] = op;
+  list->num_items++;
+}
+
+// Documented in .h file
+PipeTree PT_list(PipeTree left, PipeNodeType op, PipeTree right)
+{
+  assert(op == CMD_SEQ || op == CMD_BACKGROUND || op == CMD_AND || op == CMD_OR);
+  assert(right != NULL || op == CMD_SEQ || op == CMD_BACKGROUND);
+
+  // a list on the left is extended, rather than nested
+  PipeTree list = left;
+  if (left->type != CMD_LIST)
+  {
+    list = newNode(left->arena, CMD_LIST);
+    appendItem(list, left, CMD_SEQ);
+  }
+
+  // op joins the last item on the left to the first on the right
+  list->connectors[list->num_items - 1] = op;
+  if (right == NULL)
+    return list;
+
+  if (right->type != CMD_LIST)
+  {
+    appendItem(list, right, CMD_SEQ);
+    return list;
+  }
+
+  // the items of a list on the right are moved, and its node released
+  for (size_t i = 0; i < right->num_items; i++)
+    appendItem(list, right->items[i], right->connectors[i]);
+  if (right->arena == NULL)
+  {
+    free(right->items);
+    free(right->connectors);
+    free(right);
+  }
+  return list;
+}
+
+/**
+ * Callback to free a string owned by a node.
+ *
+ * Called by foreach used in PT_free to
+ * free each owned string.
+ * Parameters
+ *    pos - Position in argument list
+ *    arg - Argument string to free
+ *    cb_data - Optional callback data (unused)
+ */
+
+void PT_free_args_callback(int pos, CListElementType arg, void *cb_data)
+{
+  free((void *)arg);
+  arg = NULL;
+}
+
+/*
+ * Start recording the statuses of a command of num_stages stages,
+ * each -1 until the stage has run
+ */
+static void resetStatus(size_t num_stages)
+{
+  if (num_stages > last_status_cap)
+  {
+    last_status = (int *)realloc(last_status, num_stages * sizeof(int));
+    assert(last_status);
+    last_status_cap = num_stages;
+  }
+
+  for (size_t i = 0; i < num_stages; i++)
+    last_status[i] = -1;
+  last_num_stages = num_stages;
+}
+
+/*
+ * Free what a command node holds, but not the node itself, which may
+ * be a stage in the array of a pipeline
+ */
+static void freeStage(PipeTree stage)
+{
+  // free the strings owned by this node; command, args and the
+  // files may also point into them
+  if (stage->owned != NULL)
+  {
+    CL_foreach(stage->owned, PT_free_args_callback, NULL);
+
+    CL_free(stage->owned);
+    stage->owned = NULL;
+  }
+
+  free(stage->spill);
+  stage->spill = NULL;
+
+  free(stage->patterns);
+}
 
-    // data preprocessing, get the arguments and command ready for execution
-    size_t size = CL_length(tree->args);
-    const char *args[size + 2];
+// Documented in .h file
+void PT_free(PipeTree tree)
+{
+  // Base Case: do nothing, just return. A tree built in an arena is
+  // released with the arena.
+  if (tree == NULL || tree->arena != NULL)
+  {
+    return;
+  }
+
+  // a list frees each of its items, then their arrays; a pipeline
+  // each of its stages, then their array
+  if (tree->type == CMD_LIST)
+  {
+    for (size_t i = 0; i < tree->num_items; i++)
+      PT_free(tree->items[i]);
+    free(tree->items);
+    free(tree->connectors);
+  }
+  else if (tree->type == CMD_PIPE)
+  {
+    for (size_t i = 0; i < tree->num_stages; i++)
+      freeStage(&tree->stages[i]);
+    free(tree->stages);
+  }
+  else if (tree->type == WORD)
+  {
+    freeStage(tree);
+  }
+
+  // Free the node itself, after the stages have been freed.
+  free(tree);
+  tree = NULL;
+  return;
+}
+
+// Documented in .h file
+int PT_count(PipeTree tree)
+{
+  if (tree == NULL)
+    return 0;
+
+  if (tree->type == WORD)
+    return 1;
+
+  // each item, and each operator between two of them
+  if (tree->type == CMD_LIST)
+  {
+    int count = (int)tree->num_items - 1;
+    for (size_t i = 0; i < tree->num_items; i++)
+      count += PT_count(tree->items[i]);
+    return count;
+  }
+
+  // each stage, and each pipe between two of them
+  return 2 * (int)tree->num_stages - 1;
+}
+
+// Documented in .h file
+int PT_depth(PipeTree tree)
+{
+  // Base case 1: If NULL, return 0 as a NULL node contributes nothing to the depth
+  if (tree == NULL)
+    return 0;
 
-    args[0] = tree->command;
+  // Base case 2: a single command
+  if (tree->type == WORD)
+    return 1;
 
-    for (size_t i = 0; i < size; i++)
+  // item i sits under i + 1 operators, as the stages of a pipeline
+  // do under its pipes, except the last, which shares the last one
+  if (tree->type == CMD_LIST)
+  {
+    int depth = 0;
+    for (size_t i = 0; i < tree->num_items; i++)
     {
-      args[i + 1] = CL_nth(tree->args, i);
+      size_t above = (i + 1 < tree->num_items) ? i + 1 : i;
+      int item_depth = (int)above + PT_depth(tree->items[i]);
+      if (item_depth > depth)
+        depth = item_depth;
     }
+    return depth;
+  }
+
+  // as deep as the chain of pipes would be: one level for each
+  // stage, the last pipe holding the last two
+  return (int)tree->num_stages;
+}
+
+/*
+ * Returns the redirections of a command node, as they are written
+ */
+static Redirects redirectsOf(PipeTree tree)
+{
+  Redirects rd = {tree->input, tree->output, tree->error, tree->output_append, tree->error_append, tree->error_to_output};
+  return rd;
+}
+
+/*
+ * Returns true if a command node has glob patterns or braces to
+ * expand before it runs
+ */
+static bool hasPatterns(PipeTree tree)
+{
+  return tree->patterns != NULL || tree->input_pattern || tree->output_pattern || tree->error_pattern;
+}
+
+// Documented in .h file
+int PT_evaluate(PipeTree tree)
+{
+  // lists run in the background are reaped once they are done
+  while (background_jobs > 0)
+  {
+    pid_t pid = waitpid(-1, NULL, WNOHANG);
+    if (pid > 0)
+      background_jobs--;
+    else if (pid == 0)
+      break;
+    else if (errno != EINTR)
+      background_jobs = 0;
+  }
+
+  // a pipeline PT_optimize left one stage is run as that command
+  if (tree->type == CMD_PIPE && tree->num_stages == 1)
+    tree = tree->stages;
 
-    args[size + 1] = NULL;
-    return executeCommand(tree->command, (char *const *)args, tree->input, tree->output);
+  // a command with glob patterns is expanded now, possibly into
+  // several batches
+  if (tree->type == WORD && hasPatterns(tree))
+  {
+    resetStatus(1);
+    last_status[0] = evaluatePatterns(tree);
+    return last_status[0];
+  }
+
+  // check if the node to be evaluated is a command
+  if (tree->type == WORD)
+  {
+
+    // argv was built NULL-terminated as the command was parsed, and
+    // is handed to exec as it is, however often the tree runs
+    Redirects rd = redirectsOf(tree);
+    resetStatus(1);
+    if (tree->copy_file)
+      last_status[0] = copyFile(tree);
+    else
+      last_status[0] = executeCommand(tree->builtin, argvOf(tree), &rd);
+    return last_status[0];
   }
 
-  // handle the pipe
-  return handlePipe(tree);
+  if (tree->type == CMD_LIST)
+    return runList(tree);
+
+  // handle the pipeline
+  return runPipeline(tree);
 }
 
 /**
@@ -306,10 +1035,10 @@ int PT_evaluate(PipeTree tree)
  * 
  * Return 0 on success, non-zero on failure
 */
-static int redirectSTDOUT(int *ofd, int *original_stdout, const char *filePath)
+static int redirectSTDOUT(int *ofd, int *original_stdout, const char *filePath, bool append)
 {
   const int mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
-  *ofd = open(filePath, O_WRONLY | O_CREAT | O_TRUNC, mode);
+  *ofd = open(filePath, O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), mode);
   if (*ofd < 0)
   {
     if (errno == EACCES)
@@ -330,32 +1059,110 @@ static int redirectSTDOUT(int *ofd, int *original_stdout, const char *filePath)
   // Redirect stdout
   *original_stdout = dup(STDOUT_FILENO);
   dup2(*ofd, STDOUT_FILENO);
+  close(*ofd);
+
+  return 0;
+}
+
+/*
+ * Open the files a command's streams are redirected to, as a shell
+ * does before running it
+ *
+ * Parameters
+ *    rd - The redirections
+ *    fds - Set to the descriptors for standard input, output and
+ *        error, in that order; -1 for a stream not redirected
+ *
+ * Return 0 on success, or -1 if a file cannot be opened, in which case
+ *    those already open are closed
+ */
+static int openRedirects(const Redirects *rd, int fds[3])
+{
+  const int mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+  const char *files[3] = {rd->in, rd->out, rd->err};
+  const bool append[3] = {false, rd->out_append, rd->err_append};
+
+  fds[0] = fds[1] = fds[2] = -1;
+  for (int i = 0; i < 3; i++)
+  {
+    if (files[i] == NULL)
+      continue;
+
+    fds[i] = (i == 0) ? open(files[i], O_RDONLY)
+                      : open(files[i], O_WRONLY | O_CREAT | (append[i] ? O_APPEND : O_TRUNC), mode);
+    if (fds[i] < 0)
+    {
+      fprintf(stderr, "%s: Error opening file: %s\n", files[i], strerror(errno));
+      for (int j = 0; j < i; j++)
+      {
+        if (fds[j] >= 0)
+          close(fds[j]);
+      }
+      return -1;
+    }
+  }
 
   return 0;
 }
 
+/*
+ * In a child about to exec, move the descriptors opened by
+ * openRedirects onto its standard streams, then send standard error
+ * where standard output now goes if the command has 2>&1
+ */
+static void applyRedirects(const int fds[3], bool err_to_out)
+{
+  for (int i = 0; i < 3; i++)
+  {
+    if (fds[i] >= 0 && fds[i] != i)
+    {
+      dup2(fds[i], i);
+      close(fds[i]);
+    }
+  }
+
+  if (err_to_out)
+    dup2(STDOUT_FILENO, STDERR_FILENO);
+}
+
+/*
+ * Close the descriptors opened by openRedirects
+ */
+static void closeRedirects(int fds[3])
+{
+  for (int i = 0; i < 3; i++)
+  {
+    if (fds[i] >= 0)
+      close(fds[i]);
+    fds[i] = -1;
+  }
+}
+
 /**
  * Execute a command with arguments.
  * Handles built-in commands and external programs.
  *
  * Parameters
- *    command - a char * that represents the command
- *    args - an array of char * that represents the arguments for the command
- *    in - a char * representing the input filename, if any
- *    out - a char * representing the output filename, if any
+ *    builtin - which builtin the command is, or BI_NONE
+ *    args - an array of char * that represents the command, then its
+ *        arguments, NULL-terminated
+ *    rd - the redirections of the command; a builtin only has its
+ *        standard output redirected
  * Returns 0 on success and -1 otherwise
  *
  */
-static int executeCommand(char *command, char *const *args, const char *in, const char *out)
+static int executeCommand(Builtin builtin, char *const *args, const Redirects *rd)
 {
+  const char *out = rd->out;
+  const char *command = args[0];
 
   // Built-in commands exit, quit
-  if (strcmp(command, "exit") == 0 || strcmp(command, "quit") == 0)
+  if (builtin == BI_EXIT)
   {
     // Terminate the shell
     exit(0);
   }
-  else if (strcmp(command, "author") == 0)
+  else if (builtin == BI_AUTHOR)
   {
     int ofd;
     int original_stdout;
@@ -363,7 +1170,7 @@ static int executeCommand(char *command, char *const *args, const char *in, cons
     // check if we have to redirect the stdout
     if (out != NULL)
     {
-      int status = redirectSTDOUT(&ofd, &original_stdout, out);
+      int status = redirectSTDOUT(&ofd, &original_stdout, out, rd->out_append);
       if (status == -1)
         return -1;
     }
@@ -380,373 +1187,1587 @@ static int executeCommand(char *command, char *const *args, const char *in, cons
     }
     return 0;
   }
-  else if (strcmp(command, "cd") == 0)
+  else if (builtin == BI_CD)
+  {
+    // Change directory
+    if (args[1] == NULL || strcmp(args[1], "~") == 0)
+    {
+      chdir(getenv("HOME"));
+    }
+    else
+    {
+      if (chdir(args[1]) != 0)
+      {
+        perror("cd failed");
+        return -1;
+      }
+    }
+    return 0;
+  }
+  else if (builtin == BI_PWD)
+  {
+
+    int ofd;
+    int original_stdout;
+    // check if we have to redirect the stdout
+    if (out != NULL)
+    {
+      // check if we have to redirect the stdout
+      int status = redirectSTDOUT(&ofd, &original_stdout, out, rd->out_append);
+      if (status == -1)
+        return -1;
+    }
+
+    // Print working directory
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)) != NULL)
+    {
+      printf("%s\n", cwd);
+    }
+    else
+    {
+      perror("pwd failed");
+      return -1;
+    }
+
+    if (out != NULL)
+    {
+      // Revert stdout back
+      fflush(stdout); // flush buffered content
+      dup2(original_stdout, STDOUT_FILENO);
+      close(original_stdout);
+    }
+
+    return 0;
+  }
+  else
+  {
+    // Open the files the streams are redirected to
+    int fds[3];
+    if (openRedirects(rd, fds) != 0)
+    {
+      return -1;
+    }
+
+    // Handle external commands
+    pid_t pid = spawnCommand(args, -1, -1, fds, rd->err_to_out);
+    if (pid == -1)
+    {
+      // Fork failed
+      perror("fork failed");
+      closeRedirects(fds);
+      return -1;
+    }
+    else if (pid == 0)
+    {
+      // the command could not be run, as if its child had failed
+      closeRedirects(fds);
+      return EXIT_FAILURE;
+    }
+    else
+    {
+      // Parent process
+      int status;
+      waitpid(pid, &status, 0);
+
+      // error handling
+      if (status != 0)
+      {
+        fprintf(stderr, "%s: Command not found\n", command);
+        fprintf(stderr, "Child %u exited with status 2\n", pid);
+      }
+
+      // handle file descriptors in the parent
+      closeRedirects(fds);
+
+      return WEXITSTATUS(status);
+    }
+  }
+}
+
+/*
+ * Run a stage of a pipeline that is a builtin, or a command with glob
+ * patterns to expand, in the child forked for it, with stdin and
+ * stdout already set up: it is evaluated as it would be in the shell
+ *
+ * Parameters:
+ *   stage   The command to run
+ *
+ * Returns: Never; the child exits with the status of the stage
+ */
+static void execStage(PipeTree stage)
+{
+  int rc = PT_evaluate(stage);
+  fflush(stdout);
+  exit(rc < 0 ? EXIT_FAILURE : rc);
+}
+
+/*
+ * Start a stage of a pipeline that is a plain command with
+ * spawnCommand, its redirections opened by the shell
+ *
+ * Parameters:
+ *   stage   The command
+ *   in      The read end of the pipe from the stage before, or -1
+ *   out     The write end of the pipe to the stage after, or -1
+ *
+ * Returns: As spawnCommand; 0 too if a file cannot be opened
+ */
+static pid_t spawnStage(PipeTree stage, int in, int out)
+{
+  Redirects rd = redirectsOf(stage);
+  int fds[3];
+  if (openRedirects(&rd, fds) != 0)
+    return 0;
+
+  // argv was built when the command was parsed, ready for exec
+  pid_t pid = spawnCommand(argvOf(stage), in, out, fds, rd.err_to_out);
+  closeRedirects(fds);
+  return pid;
+}
+
+/*
+ * Run a builtin stage of a pipeline in the shell, rather than in a
+ * child forked for it. A builtin reads nothing, and what author or pwd
+ * writes fits in a pipe's buffer, so the stage runs to completion
+ * before the stage reading from it has even started.
+ *
+ * Parameters:
+ *   stage   The builtin
+ *   out     The write end of the pipe to the next stage, or -1 for
+ *           the last stage
+ *
+ * Returns: The status of the stage
+ */
+static int runInline(PipeTree stage, int out)
+{
+  int saved_stdout = -1;
+  if (out >= 0)
+  {
+    saved_stdout = dup(STDOUT_FILENO);
+    dup2(out, STDOUT_FILENO);
+  }
+
+  Redirects rd = redirectsOf(stage);
+  int rc = executeCommand(stage->builtin, argvOf(stage), &rd);
+  fflush(stdout);
+
+  if (saved_stdout >= 0)
+  {
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+  }
+  return (rc < 0) ? EXIT_FAILURE : rc;
+}
+
+/**
+  * Execute a pipeline
+  *
+  * Creates the N - 1 pipes of an N-stage pipeline, then starts one
+  * child per stage straight from the shell, each with its stdin and
+  * stdout joined to the pipes on either side. The pipes are created
+  * close-on-exec, so no command inherits the ends meant for another;
+  * a child that does not exec closes them itself. Each child is
+  * reaped by its pid, so that a list running in the background is
+  * left to PT_evaluate, and each stage's status is recorded, for
+  * PT_status. A stage PT_optimize marked to run inline runs in the
+  * shell, while the children are started. The tree itself is only
+  * read.
+  *
+  * Paramters
+  *    tree - CMD_PIPE node holding the stages
+  *
+  * Return 0 if every stage succeeded, -1 otherwise
+*/
+static int runPipeline(PipeTree tree)
+{
+  size_t n = tree->num_stages;
+  int *fds = (int *)malloc(2 * (n - 1) * sizeof(int));
+  pid_t *pids = (pid_t *)malloc(n * sizeof(pid_t));
+  assert(fds && pids);
+
+  size_t num_pipes = 0;
+  size_t started = 0;
+  int ret = 0;
+
+  // pipe i joins stage i to stage i + 1: fds[2i] is its read end
+  for (; num_pipes < n - 1; num_pipes++)
+  {
+    if (pipe2(&fds[2 * num_pipes], O_CLOEXEC) == -1)
+    {
+      perror("plaidsh: Error creating pipe");
+      ret = -1;
+      break;
+    }
+  }
+
+  // a child that exits without exec must not flush the shell's output
+  fflush(stdout);
+
+  resetStatus(n);
+
+  for (size_t i = 0; ret == 0 && i < n; i++)
+  {
+    if (tree->stages[i].run_inline)
+    {
+      pids[i] = 0;
+      last_status[i] = runInline(&tree->stages[i], (i < n - 1) ? fds[2 * i + 1] : -1);
+      started++;
+      continue;
+    }
+
+    // a plain command is exec'd straight away, so the stage is that
+    // one process; anything else is run by a copy of the shell
+    PipeTree stage = &tree->stages[i];
+    bool spawned = (stage->builtin == BI_NONE && !hasPatterns(stage));
+    if (spawned)
+      pids[i] = spawnStage(stage, (i > 0) ? fds[2 * (i - 1)] : -1, (i < n - 1) ? fds[2 * i + 1] : -1);
+    else
+      pids[i] = fork();
+
+    if (pids[i] == -1)
+    {
+      perror("plaidsh: Error forking the child");
+      ret = -1;
+      break;
+    }
+    else if (pids[i] == 0 && !spawned)
+    {
+      // read from the previous stage, and write to the next
+      if (i > 0 && dup2(fds[2 * (i - 1)], STDIN_FILENO) == -1)
+      {
+        perror("plaidsh: Error redirecting pipe read end to standard in");
+        exit(EXIT_FAILURE);
+      }
+      if (i < n - 1 && dup2(fds[2 * i + 1], STDOUT_FILENO) == -1)
+      {
+        perror("plaidsh: Error redirecting pipe write end to standard out");
+        exit(EXIT_FAILURE);
+      }
+      for (size_t p = 0; p < 2 * num_pipes; p++)
+        close(fds[p]);
+
+      execStage(stage);
+    }
+
+    // a stage that could not be run has said so
+    if (pids[i] == 0)
+      last_status[i] = EXIT_FAILURE;
+    started++;
+  }
+
+  // Parent process: only the children use the pipes
+  for (size_t p = 0; p < 2 * num_pipes; p++)
+    close(fds[p]);
+
+  // reap the stages in order; one that exits early waits as a zombie
+  // until its turn, with its status kept
+  for (size_t i = 0; i < started; i++)
+  {
+    if (pids[i] == 0)
+      continue;
+
+    int status;
+    pid_t pid;
+    do
+      pid = waitpid(pids[i], &status, 0);
+    while (pid == -1 && errno == EINTR);
+
+    if (pid == pids[i])
+      last_status[i] = WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+  }
+
+  // report each stage that failed; one closed by its reader going
+  // away, as in yes | head, is not an error
+  for (size_t i = 0; i < started; i++)
+  {
+    if (last_status[i] != 0)
+    {
+      ret = -1;
+      // a stage run inline, or that could not be run, reported its own
+      // error
+      if (last_status[i] == 128 + SIGPIPE || pids[i] == 0)
+        continue;
+
+      fprintf(stderr, "%s: Command not found\n", argvOf(&tree->stages[i])[0]);
+      fprintf(stderr, "Child %u exited with status 2\n", pids[i]);
+    }
+  }
+
+  free(pids);
+  free(fds);
+  return ret; // return 0 on success
+}
+
+/*
+ * Evaluate the items first..last of a list, an and-or chain: each
+ * item after && runs only if the status so far is 0, and each after
+ * || only if it is not, as in sh
+ *
+ * Returns: The status of the last item that ran
+ */
+static int runAndOr(PipeTree list, size_t first, size_t last)
+{
+  int rc = 0;
+
+  for (size_t i = first; i <= last; i++)
+  {
+    PipeNodeType op = (i > first) ? list->connectors[i - 1] : CMD_SEQ;
+    if ((op == CMD_AND && rc != 0) || (op == CMD_OR && rc == 0))
+      continue;
+
+    rc = PT_evaluate(list->items[i]);
+  }
+
+  return rc;
+}
+
+/**
+  * Execute a list
+  *
+  * Runs each and-or chain of the list in turn, in the shell itself, so
+  * that none of ; && || or & needs a second shell. A chain followed by
+  * & runs in a child of its own, which is not waited for; it is
+  * reaped by a later evaluation once it is done.
+  *
+  * Paramters
+  *    tree - CMD_LIST node holding the items
+  *
+  * Return The status of the last chain run in the foreground, or 0 if
+  *    it ran in the background
+*/
+static int runList(PipeTree tree)
+{
+  int rc = 0;
+
+  for (size_t first = 0; first < tree->num_items;)
+  {
+    // the chain runs to the first item followed by ; or &
+    size_t last = first;
+    while (tree->connectors[last] == CMD_AND || tree->connectors[last] == CMD_OR)
+      last++;
+
+    if (tree->connectors[last] == CMD_BACKGROUND)
+    {
+      // a child that exits must not flush the shell's output again
+      fflush(stdout);
+
+      pid_t pid = fork();
+      if (pid == -1)
+      {
+        perror("plaidsh: Error forking the child");
+        rc = -1;
+      }
+      else if (pid == 0)
+      {
+        int status = runAndOr(tree, first, last);
+        fflush(stdout);
+        exit(status < 0 ? EXIT_FAILURE : status);
+      }
+      else
+      {
+        background_jobs++;
+        rc = 0;
+      }
+    }
+    else
+    {
+      rc = runAndOr(tree, first, last);
+    }
+
+    first = last + 1;
+  }
+
+  return rc;
+}
+
+/*
+ * Returns true if command is run by the shell itself
+ */
+static bool isBuiltin(const char *command)
+{
+  return builtinId(command) != BI_NONE;
+}
+
+/*
+ * Returns the number of bytes the argv of a command may take: ARG_MAX,
+ * less the environment, which shares its space, and some headroom
+ */
+static size_t argBudget()
+{
+  if (arg_limit != 0)
+  {
+    return arg_limit;
+  }
+
+  long arg_max = sysconf(_SC_ARG_MAX);
+  size_t env_bytes = ARG_HEADROOM;
+  for (char *const *env = environment(); env != NULL && *env != NULL; env++)
+    env_bytes += strlen(*env) + 1 + sizeof(char *);
+
+  if (arg_max <= 0)
+    arg_max = _POSIX_ARG_MAX;
+  return ((size_t)arg_max > env_bytes) ? arg_max - env_bytes : 0;
+}
+
+// The argv of a command being expanded, and the batches it is run in
+typedef struct
+{
+  const char *command;
+  char *words;      // the words of argv, back to back
+  size_t len;
+  size_t cap;
+  size_t *offsets;  // where each word starts in words
+  size_t count;
+  size_t offsets_cap;
+  size_t bytes;     // size of argv as counted against ARG_MAX
+  size_t budget;
+  bool batchable;   // argv may be split into batches
+  bool in_tail;     // past the words repeated in every batch
+  size_t prefix_count;
+  size_t prefix_len;
+  size_t prefix_bytes;
+  size_t num_batches;
+  Redirects rd;
+  int fds[3];       // the redirections, opened for the first batch
+  pid_t *running;   // batches still running
+  int num_running;
+  int status;       // the exit status of the last batch that failed
+} Batches;
+
+/*
+ * Wait for one running batch to finish: any that already has, or else
+ * the oldest. Only the batches' own pids are waited for, so that a
+ * list running in the background is left to PT_evaluate.
+ */
+static void waitBatch(Batches *b)
+{
+  int status = 0;
+  pid_t pid = 0;
+  int found = -1;
+
+  for (int i = 0; i < b->num_running && found < 0; i++)
+  {
+    pid = waitpid(b->running[i], &status, WNOHANG);
+    if (pid == b->running[i])
+      found = i;
+  }
+
+  if (found < 0)
+  {
+    do
+      pid = waitpid(b->running[0], &status, 0);
+    while (pid == -1 && errno == EINTR);
+    found = 0;
+  }
+
+  b->running[found] = b->running[--b->num_running];
+
+  if (pid > 0 && status != 0)
+  {
+    fprintf(stderr, "%s: Command not found\n", b->command);
+    fprintf(stderr, "Child %u exited with status 2\n", pid);
+    b->status = WEXITSTATUS(status);
+  }
+}
+
+/*
+ * Start a batch with the words collected so far, first waiting for a
+ * running one if batch_jobs are already running
+ *
+ * Returns: 0 on success, -1 if the redirections cannot be opened or
+ *   the batch cannot be started
+ */
+static int startBatch(Batches *b)
+{
+  // every batch shares the redirections, opened once
+  if (b->num_batches == 0)
+  {
+    if (openRedirects(&b->rd, b->fds) != 0)
+      return -1;
+    b->running = (pid_t *)malloc(batch_jobs * sizeof(pid_t));
+    assert(b->running);
+  }
+
+  while (b->num_running >= batch_jobs)
+    waitBatch(b);
+
+  char **argv = (char **)malloc((b->count + 1) * sizeof(char *));
+  assert(argv);
+  for (size_t i = 0; i < b->count; i++)
+    argv[i] = b->words + b->offsets[i];
+  argv[b->count] = NULL;
+
+  pid_t pid = spawnCommand(argv, -1, -1, b->fds, b->rd.err_to_out);
+  free(argv);
+  if (pid == -1)
+  {
+    perror("fork failed");
+    return -1;
+  }
+
+  if (pid > 0)
+    b->running[b->num_running++] = pid;
+  else
+    b->status = EXIT_FAILURE;
+  b->num_batches++;
+  return 0;
+}
+
+/*
+ * Add a word to the argv being built. If it does not fit, the words
+ * so far are run as a batch, and the word starts the next one after
+ * the words repeated in every batch.
+ *
+ * Returns: 0 on success, -1 if argv is too long and cannot be split,
+ *   or a batch could not be started
+ */
+static int addWord(Batches *b, const char *word)
+{
+  size_t len = strlen(word) + 1;
+  size_t bytes = len + sizeof(char *);
+
+  // argv is NULL-terminated, hence the extra pointer
+  if (b->bytes + bytes + sizeof(char *) > b->budget)
+  {
+    if (!b->batchable || !b->in_tail || b->count == b->prefix_count)
+    {
+      fprintf(stderr, "%s: Argument list too long\n", b->command);
+      return -1;
+    }
+
+    if (startBatch(b) != 0)
+      return -1;
+
+    b->count = b->prefix_count;
+    b->len = b->prefix_len;
+    b->bytes = b->prefix_bytes;
+  }
+
+  if (b->len + len > b->cap)
+  {
+    b->cap = (b->len + len > 2 * b->cap) ? b->len + len : 2 * b->cap;
+    b->words = (char *)realloc(b->words, b->cap);
+    assert(b->words);
+  }
+  if (b->count == b->offsets_cap)
+  {
+    b->offsets_cap = (b->offsets_cap == 0) ? 64 : 2 * b->offsets_cap;
+    b->offsets = (size_t *)realloc(b->offsets, b->offsets_cap * sizeof(size_t));
+    assert(b->offsets);
+  }
+
+  memcpy(b->words + b->len, word, len);
+  b->offsets[b->count++] = b->len;
+  b->len += len;
+  b->bytes += bytes;
+  return 0;
+}
+
+/*
+ * Returns true if a word has wildcards, and so is matched as a glob
+ * pattern
+ */
+static bool hasWildcard(const char *word)
+{
+  return strpbrk(word, "*?[") != NULL;
+}
+
+/*
+ * Add the matches of a glob pattern to the argv being built, or the
+ * pattern itself if it matches nothing
+ *
+ * Returns: 0 on success, -1 on failure, as for addWord
+ */
+static int addMatches(Batches *b, const char *pattern)
+{
+  GlobGen gen = GC_open(pattern);
+  const char *path;
+  bool matched = false;
+  int rc = 0;
+
+  while (rc == 0 && (path = GC_next(gen)) != NULL)
+  {
+    matched = true;
+    rc = addWord(b, path);
+  }
+  GC_close(gen);
+
+  if (rc == 0 && !matched)
+    rc = addWord(b, pattern);
+  return rc;
+}
+
+/*
+ * Add the expansions of a word with braces or wildcards to the argv
+ * being built. Braces are expanded first, one expansion at a time,
+ * and each expansion with wildcards is then matched as a pattern.
+ *
+ * Returns: 0 on success, -1 on failure, as for addWord
+ */
+static int addExpansions(Batches *b, const char *word)
+{
+  BraceGen braces = BR_open(word);
+  const char *expansion;
+  int rc = 0;
+
+  while (rc == 0 && (expansion = BR_next(braces)) != NULL)
+  {
+    // as in bash, an empty expansion, as from {,x}, is dropped
+    if (*expansion == '\0')
+      continue;
+
+    if (hasWildcard(expansion))
+      rc = addMatches(b, expansion);
+    else
+      rc = addWord(b, expansion);
+  }
+  BR_close(braces);
+
+  return rc;
+}
+
+/*
+ * Expand a redirection with braces or wildcards, which must expand to
+ * exactly one file
+ *
+ * Parameters:
+ *   word      The word
+ *   file      Set to the file, to be freed by the caller
+ *
+ * Returns: 0 on success, -1 if the word expands to several files
+ */
+static int expandRedirect(const char *word, char **file)
+{
+  BraceGen braces = BR_open(word);
+  char *paths = NULL;
+  size_t count = 0;
+
+  *file = NULL;
+  if (BR_count(braces) == 1)
+  {
+    const char *expansion = BR_next(braces);
+    if (hasWildcard(expansion))
+      count = GC_expand(expansion, NULL, &paths);
+    *file = (count == 0) ? strdup(expansion) : paths;
+  }
+  BR_close(braces);
+
+  if (*file == NULL || count > 1)
+  {
+    fprintf(stderr, "%s: Ambiguous redirect\n", word);
+    free(*file);
+    *file = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Evaluate a command that holds glob patterns or braces. These are
+ * expanded one word at a time, into an argv whose size is checked
+ * against ARG_MAX as it grows. If it would not fit, the command is
+ * run in batches, as xargs does, each repeating the words before the
+ * first pattern. That requires every word after the first pattern to
+ * be one too, so that no word ends up in the wrong place; otherwise
+ * the command fails, as execvp would have.
+ *
+ * Parameters:
+ *   tree    The command node
+ *
+ * Returns: The exit status of the command, or -1 on error
+ */
+static int evaluatePatterns(PipeTree tree)
+{
+  size_t num_words = tree->argc;
+  char **argv = argvOf(tree);
+  Batches b = {0};
+  b.fds[0] = b.fds[1] = b.fds[2] = -1;
+  b.rd = redirectsOf(tree);
+
+  char *in_file = NULL;
+  char *out_file = NULL;
+  char *err_file = NULL;
+  int rc = 0;
+
+  if (tree->input_pattern && (rc = expandRedirect(tree->input, &in_file)) == 0)
+    b.rd.in = in_file;
+  if (rc == 0 && tree->output_pattern && (rc = expandRedirect(tree->output, &out_file)) == 0)
+    b.rd.out = out_file;
+  if (rc == 0 && tree->error_pattern && (rc = expandRedirect(tree->error, &err_file)) == 0)
+    b.rd.err = err_file;
+
+  // batches can only repeat a plain command and the words before the
+  // first pattern, and only if a pattern ends the command
+  size_t first_pattern = num_words;
+  bool pattern_last = false;
+  for (size_t i = 0; i < num_words; i++)
+  {
+    bool is_pattern = (tree->patterns != NULL && tree->patterns[i]);
+    if (is_pattern && first_pattern == num_words)
+      first_pattern = i;
+    pattern_last = is_pattern;
+  }
+
+  bool builtin = (first_pattern > 0 && isBuiltin(argv[0]));
+  b.command = argv[0];
+  b.batchable = (first_pattern > 0 && pattern_last && !builtin);
+  b.budget = builtin ? (size_t)-1 : argBudget();
+
+  for (size_t i = 0; rc == 0 && i < num_words; i++)
+  {
+    if (i == first_pattern)
+    {
+      b.in_tail = true;
+      b.prefix_count = b.count;
+      b.prefix_len = b.len;
+      b.prefix_bytes = b.bytes;
+    }
+
+    const char *word = argv[i];
+    if (tree->patterns != NULL && tree->patterns[i])
+      rc = addExpansions(&b, word);
+    else
+      rc = addWord(&b, word);
+  }
+
+  if (rc == 0 && b.num_batches == 0 && b.count > 0)
+  {
+    // it all fits: run the command as any other, unless the words
+    // expanded to nothing at all, as {,} does
+    char **argv = (char **)malloc((b.count + 1) * sizeof(char *));
+    assert(argv);
+    for (size_t i = 0; i < b.count; i++)
+      argv[i] = b.words + b.offsets[i];
+    argv[b.count] = NULL;
+
+    rc = executeCommand(builtinId(argv[0]), argv, &b.rd);
+    free(argv);
+  }
+  else if (rc == 0 && b.num_batches > 0)
+  {
+    // the last batch is started, however few words it has
+    rc = startBatch(&b);
+  }
+
+  while (b.num_running > 0)
+    waitBatch(&b);
+  if (rc == 0 && b.num_batches > 0)
+    rc = b.status;
+
+  closeRedirects(b.fds);
+  free(b.running);
+  free(b.offsets);
+  free(b.words);
+  free(in_file);
+  free(out_file);
+  free(err_file);
+  return rc;
+}
+
+/*
+ * Append a command, or stage, to a string: a space, the command and
+ * its arguments, then its redirections
+ */
+static void appendCommand(StrBuilder *sb, PipeTree tree)
+{
+  char **argv = argvOf(tree);
+
+  for (size_t i = 0; i < tree->argc; i++)
+  {
+    SB_append_char(sb, ' ');
+    SB_append(sb, argv[i]);
+  }
+
+  if (tree->input != NULL)
+  {
+    SB_append_n(sb, " <", 2);
+    SB_append(sb, tree->input);
+  }
+
+  if (tree->output != NULL)
+  {
+    SB_append_char(sb, ' ');
+    SB_append(sb, PipeNodeType_to_str(tree->output_append ? CMD_APPEND : CMD_GREAT));
+    SB_append(sb, tree->output);
+  }
+
+  if (tree->error != NULL)
+  {
+    SB_append_char(sb, ' ');
+    SB_append(sb, PipeNodeType_to_str(tree->error_append ? CMD_ERR_APPEND : CMD_ERR_GREAT));
+    SB_append(sb, tree->error);
+  }
+
+  if (tree->error_to_output)
+  {
+    SB_append_char(sb, ' ');
+    SB_append(sb, PipeNodeType_to_str(CMD_ERR_TO_OUT));
+  }
+}
+
+// Documented in .h file
+void PT_append_string(PipeTree tree, StrBuilder *sb)
+{
+  if (tree == NULL)
+  {
+    return;
+  }
+
+  if (tree->type == WORD)
+  {
+    appendCommand(sb, tree);
+    return;
+  }
+
+  // a list: each item in turn, followed by its operator, but for a ;
+  // at the end
+  if (tree->type == CMD_LIST)
+  {
+    for (size_t i = 0; i < tree->num_items; i++)
+    {
+      PT_append_string(tree->items[i], sb);
+      if (i + 1 < tree->num_items || tree->connectors[i] != CMD_SEQ)
+      {
+        SB_append_char(sb, ' ');
+        SB_append(sb, PipeNodeType_to_str(tree->connectors[i]));
+      }
+    }
+    return;
+  }
+
+  // a pipeline: each stage in turn, separated by the pipe
+  char pipe_str[2] = {' ', PipeNodeType_to_str(tree->type)[0]};
+  for (size_t i = 0; i < tree->num_stages; i++)
+  {
+    if (i > 0)
+      SB_append_n(sb, pipe_str, 2);
+    appendCommand(sb, &tree->stages[i]);
+  }
+}
+
+// Documented in .h file
+size_t PT_tree2string(PipeTree tree, char *buf, size_t buf_sz)
+{
+  StrBuilder sb;
+  SB_init(&sb, buf, buf_sz);
+  PT_append_string(tree, &sb);
+
+  return SB_length(&sb);
+}
+
+// Documented in the .h file
+int PT_set_args(PipeTree tree, const char *arg)
+{
+  if (tree == NULL || tree->type != WORD)
+  {
+    return -1;
+  }
+
+  appendArg(tree, copyString(tree, arg));
+  return 0;
+}
+
+// Documented in the .h file
+int PT_set_args_span(PipeTree tree, char *arg, size_t len, bool owned)
+{
+  if (tree == NULL || tree->type != WORD)
+  {
+    return -1;
+  }
+
+  appendArg(tree, keepString(tree, arg, len, owned));
+  return 0;
+}
+
+// Documented in the .h file
+int PT_set_pattern(PipeTree tree, size_t index)
+{
+  if (tree == NULL || tree->type != WORD)
+  {
+    return -1;
+  }
+
+  if (index == PT_INPUT_FILE)
+  {
+    tree->input_pattern = true;
+    return 0;
+  }
+  if (index == PT_OUTPUT_FILE)
+  {
+    tree->output_pattern = true;
+    return 0;
+  }
+  if (index == PT_ERROR_FILE)
+  {
+    tree->error_pattern = (tree->error != NULL);
+    return (tree->error != NULL) ? 0 : -1;
+  }
+
+  if (index >= tree->argc)
+  {
+    return -1;
+  }
+
+  // as long as argv's slots, and grown along with them
+  if (tree->patterns == NULL)
+  {
+    if (tree->arena != NULL)
+      tree->patterns = (bool *)AR_alloc(tree->arena, argvCap(tree));
+    else
+      tree->patterns = (bool *)malloc(argvCap(tree));
+    assert(tree->patterns);
+    memset(tree->patterns, 0, argvCap(tree));
+  }
+
+  tree->patterns[index] = true;
+  return 0;
+}
+
+// Documented in the .h file
+char *const *PT_argv(PipeTree tree)
+{
+  if (tree == NULL || tree->type != WORD)
+  {
+    return NULL;
+  }
+
+  return argvOf(tree);
+}
+
+// Documented in the .h file
+char *const *PT_set_environment(char *const envp[])
+{
+  char *const *old = exec_envp;
+  exec_envp = envp;
+  return old;
+}
+
+// Documented in the .h file
+int PT_status(size_t stage)
+{
+  return (stage < last_num_stages) ? last_status[stage] : -1;
+}
+
+// Documented in the .h file
+size_t PT_set_arg_limit(size_t bytes)
+{
+  size_t old = arg_limit;
+  arg_limit = bytes;
+  return old;
+}
+
+// Documented in the .h file
+int PT_set_batch_jobs(int jobs)
+{
+  int old = batch_jobs;
+  batch_jobs = (jobs > 0) ? jobs : 1;
+  return old;
+}
+
+/*
+ * Find whether a command is a cat that only copies one source to its
+ * standard output: a file named by its one argument, or else its
+ * standard input, redirected or not. The caller checks where the
+ * output goes.
+ *
+ * Parameters:
+ *   stage    The command
+ *   source   Set to the file copied, or NULL for standard input
+ *
+ * Returns: true if the command is such a cat
+ */
+static bool isPlainCat(PipeTree stage, const char **source)
+{
+  char **argv = argvOf(stage);
+  if (stage->builtin != BI_NONE || hasPatterns(stage) || stage->argc == 0 || strcmp(argv[0], "cat") != 0 ||
+      stage->error != NULL || stage->error_to_output)
+  {
+    return false;
+  }
+
+  if (stage->argc == 1)
   {
-    // Change directory
-    if (args[1] == NULL || strcmp(args[1], "~") == 0)
-    {
-      chdir(getenv("HOME"));
-    }
-    else
-    {
-      if (chdir(args[1]) != 0)
-      {
-        perror("cd failed");
-        return -1;
-      }
-    }
-    return 0;
+    *source = stage->input;
+    return true;
   }
-  else if (strcmp(command, "pwd") == 0)
+
+  // an option, or "-" for standard input, is left to cat
+  if (stage->argc == 2 && stage->input == NULL && argv[1][0] != '-')
   {
+    *source = argv[1];
+    return true;
+  }
 
-    int ofd;
-    int original_stdout;
-    // check if we have to redirect the stdout
-    if (out != NULL)
-    {
-      // check if we have to redirect the stdout
-      int status = redirectSTDOUT(&ofd, &original_stdout, out);
-      if (status == -1)
-        return -1;
-    }
+  return false;
+}
 
-    // Print working directory
-    char cwd[4096];
-    if (getcwd(cwd, sizeof(cwd)) != NULL)
-    {
-      printf("%s\n", cwd);
-    }
-    else
-    {
-      perror("pwd failed");
-      return -1;
-    }
+/*
+ * Remove a stage from a pipeline, moving those after it down
+ */
+static void removeStage(PipeTree pipeline, size_t index)
+{
+  if (pipeline->arena == NULL)
+    freeStage(&pipeline->stages[index]);
 
-    if (out != NULL)
-    {
-      // Revert stdout back
-      fflush(stdout); // flush buffered content
-      dup2(original_stdout, STDOUT_FILENO);
-      close(original_stdout);
-    }
+  memmove(&pipeline->stages[index], &pipeline->stages[index + 1],
+          (pipeline->num_stages - index - 1) * sizeof(struct _pipe_tree_node));
+  pipeline->num_stages--;
+}
 
-    return 0;
-  }
-  else
+/*
+ * Remove the cat stages of a pipeline that only pass data along: a
+ * first stage cat file, or cat <file, becomes the input of the stage
+ * after it, and a plain cat between two stages is dropped. A cat at
+ * either end of the pipeline reading or writing the terminal is kept,
+ * as it decides what a command sees, as in ls | cat.
+ *
+ * Returns: The number of stages removed
+ */
+static size_t dropCats(PipeTree pipeline)
+{
+  size_t removed = 0;
+
+  for (size_t i = 0; i + 1 < pipeline->num_stages && pipeline->num_stages > 1;)
   {
-    int ifd;
-    int ofd;
+    PipeTree stage = &pipeline->stages[i];
+    PipeTree next = &pipeline->stages[i + 1];
+    const char *source = NULL;
 
-    if (in != NULL)
+    bool passes = isPlainCat(stage, &source) && stage->output == NULL && next->input == NULL;
+    if (!passes || (source != NULL && i > 0) || (source == NULL && i == 0))
     {
-
-      // Open the input filePath
-      const int mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
-      ifd = open(in, O_RDONLY, mode);
-      if (ifd == -1)
-      {
-        perror("plaidsh: Error opening file");
-        return -1;
-      }
+      i++;
+      continue;
     }
 
-    if (out != NULL)
-    {
-      const int mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
-      ofd = open(out, O_WRONLY | O_CREAT | O_TRUNC, mode);
-      if (ofd < 0)
-      {
-        if (errno == EACCES)
-        {
-          // Permission denied
-          fprintf(stderr, "%s: Permission denied", out);
-        }
-        else
-        {
-          // Other errors
-          fprintf(stderr, "%s: Error opening file: %s\n", out, strerror(errno));
-        }
-        return -1;
-      }
-    }
+    // copied before the cat, which may own the string, is freed
+    if (source != NULL)
+      next->input = copyString(next, source);
+    removeStage(pipeline, i);
+    removed++;
+  }
 
-    // Handle external commands
-    pid_t pid = fork();
-    if (pid == -1)
-    {
-      // Fork failed
-      perror("fork failed");
-      return -1;
-    }
-    else if (pid == 0)
-    {
+  return removed;
+}
 
-      if (in != NULL)
-      {
-        dup2(ifd, STDIN_FILENO);
-        close(ifd);
-      }
+// Documented in the .h file
+void PT_optimize(PipeTree tree)
+{
+  if (tree == NULL)
+    return;
 
-      if (out != NULL)
-      {
-        dup2(ofd, STDOUT_FILENO);
-        close(ofd);
-      }
-      // Child process
-      execvp(command, args);
-      // If execvp returns, it must have failed
+  if (tree->type == CMD_LIST)
+  {
+    for (size_t i = 0; i < tree->num_items; i++)
+      PT_optimize(tree->items[i]);
+    return;
+  }
 
-      exit(EXIT_FAILURE);
-    }
-    else
-    {
-      // Parent process
-      int status;
-      waitpid(pid, &status, 0);
+  if (tree->type == CMD_PIPE)
+  {
+    if (opt_rules & PT_OPT_CAT_INPUT)
+      opt_fired[0] += dropCats(tree);
 
-      // error handling
-      if (status != 0)
+    // a builtin on its own already runs in the shell
+    for (size_t i = 0; (opt_rules & PT_OPT_INLINE_BUILTIN) && tree->num_stages > 1 && i < tree->num_stages; i++)
+    {
+      PipeTree stage = &tree->stages[i];
+      if ((stage->builtin == BI_AUTHOR || stage->builtin == BI_PWD) && !stage->run_inline)
       {
-        fprintf(stderr, "%s: Command not found\n", command);
-        fprintf(stderr, "Child %u exited with status 2\n", pid);
+        stage->run_inline = true;
+        opt_fired[1]++;
       }
+    }
 
-      // handle file descriptors in the parent
-      if (in != NULL)
-        close(ifd);
-      if (out != NULL)
-        close(ofd);
+    if (tree->num_stages > 1)
+      return;
+    tree = tree->stages;
+  }
 
-      return WEXITSTATUS(status);
-    }
+  const char *source = NULL;
+  if ((opt_rules & PT_OPT_COPY_FILE) && !tree->copy_file && isPlainCat(tree, &source) && source != NULL &&
+      tree->output != NULL)
+  {
+    tree->copy_file = true;
+    opt_fired[2]++;
   }
 }
 
-/**
-  * Execute a pipe command
-  *
-  * Executes the command pipeline specified by the parse tree
-  * tree. This handles all pipe and redirection syntax associated
-  * with the pipeline.
-  * 
-  * Paramters
-  *    tree - Parse tree with pipe/redirection commands
-  * 
-  * Return 0 on success, non-zero on failure
-*/
+// Documented in the .h file
+int PT_set_spawn(int backend)
+{
+  int old = spawn_backend;
+  spawn_backend = (backend == PT_SPAWN_FORK) ? PT_SPAWN_FORK : PT_SPAWN_POSIX;
+  return old;
+}
 
-static int handlePipe(PipeTree tree)
+// Documented in the .h file
+unsigned PT_set_optimizations(unsigned rules)
 {
-  int pipefd[2];
-  pid_t leftPid, rightPid;
+  unsigned old = opt_rules;
+  opt_rules = rules & PT_OPT_ALL;
+  return old;
+}
 
-  if (pipe(pipefd) == -1)
+// Documented in the .h file
+size_t PT_optimized(unsigned rule)
+{
+  for (int i = 0; i < PT_NUM_OPTS; i++)
   {
-    perror("plaidsh: Error creating pipe");
-    return -1;
+    if (rule == (1u << i))
+      return opt_fired[i];
   }
+  return 0;
+}
+
+/*
+ * Run a command PT_optimize marked as a copy, cat file >out, without a
+ * process: the kernel copies the file with copy_file_range, falling
+ * back to read and write where it cannot, e.g. between file systems
+ *
+ * Returns: The status cat would have, or -1 if the output cannot be
+ *   opened
+ */
+static int copyFile(PipeTree tree)
+{
+  const char *source = (tree->argc == 2) ? argvOf(tree)[1] : tree->input;
+  const int mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
 
-  leftPid = fork();
-  if (leftPid == -1)
+  // the output is opened first, as the shell would before running cat;
+  // copy_file_range refuses O_APPEND, so >> seeks to the end instead
+  int out = open(tree->output, O_WRONLY | O_CREAT | (tree->output_append ? 0 : O_TRUNC), mode);
+  if (out < 0)
   {
-    perror("plaidsh: Error forking the child");
+    fprintf(stderr, "%s: Error opening file: %s\n", tree->output, strerror(errno));
     return -1;
   }
-  else if (leftPid == 0)
-  {
-    // Left child writes to pipe
+  if (tree->output_append)
+    lseek(out, 0, SEEK_END);
 
-    close(pipefd[0]); // close the unused read end
-
-    // Redirect the standardout to the write end of the pipe
-    if (dup2(pipefd[1], STDOUT_FILENO) == -1)
-    {
-      perror("plaidsh: Error redirecting pipe write end to standard out");
-      return -1;
-    }
-
-    // Close the write end
-    close(pipefd[1]);
-
-    PT_evaluate(tree->left);
-    exit(EXIT_SUCCESS);
+  int in = open(source, O_RDONLY);
+  if (in < 0)
+  {
+    fprintf(stderr, "cat: %s: %s\n", source, strerror(errno));
+    close(out);
+    return EXIT_FAILURE;
   }
 
-  rightPid = fork();
-  if (rightPid == -1)
+  // like cat, refuse to append a file to itself, which would never end
+  struct stat in_st, out_st;
+  if (fstat(in, &in_st) == 0 && fstat(out, &out_st) == 0 && S_ISREG(in_st.st_mode) &&
+      in_st.st_dev == out_st.st_dev && in_st.st_ino == out_st.st_ino && in_st.st_size > 0)
   {
-    perror("plaidsh: Error forking the child");
-    return -1;
+    fprintf(stderr, "cat: %s: input file is output file\n", source);
+    close(in);
+    close(out);
+    return EXIT_FAILURE;
   }
-  else if (rightPid == 0)
+
+  bool in_kernel = true;
+  char buf[65536];
+  int rc = 0;
+  for (;;)
   {
-    // Right child reads from the pipe
-    close(pipefd[1]);
-    if (dup2(pipefd[0], STDIN_FILENO) == -1)
+    ssize_t n;
+    if (in_kernel)
     {
-      perror("plaidsh: Error forking the child");
-      return -1;
+      n = copy_file_range(in, NULL, out, NULL, 1 << 30, 0);
+      if (n < 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP || errno == EBADF))
+      {
+        // both offsets have moved past what was copied
+        in_kernel = false;
+        continue;
+      }
+    }
+    else
+    {
+      n = read(in, buf, sizeof(buf));
+      for (ssize_t done = 0; n > 0 && done < n;)
+      {
+        ssize_t w = write(out, buf + done, n - done);
+        if (w < 0 && errno != EINTR)
+        {
+          n = -1;
+          break;
+        }
+        done += (w > 0) ? w : 0;
+      }
     }
 
-    close(pipefd[0]); // close the read end of the pipe
-
-    PT_evaluate(tree->right);
-    exit(EXIT_SUCCESS);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+    {
+      fprintf(stderr, "cat: %s: %s\n", source, strerror(errno));
+      rc = EXIT_FAILURE;
+    }
+    if (n <= 0)
+      break;
   }
 
-  // Parent process
-  close(pipefd[0]);
-  close(pipefd[1]);
+  close(in);
+  close(out);
+  return rc;
+}
+
+/*
+ * The serialized form of a tree. Every integer is little-endian, and
+ * nothing refers to an address, so the bytes can be written to a file,
+ * mapped at any address, or passed to another process as they are.
+ *
+ *   header  "PSPT", u8 version, u8 node type, u16 reserved (0),
+ *           u32 total length, u32 number of stages or items
+ *   stage   u16 flags, u32 argc, then argc pattern bytes if
+ *           SF_PATTERNS, then the argc words, then the input file if
+ *           SF_INPUT, the output file if SF_OUTPUT and the error file
+ *           if SF_ERROR
+ *   item    u8 operator that follows the item, then the item, a
+ *           command or a pipeline, as a tree of its own
+ *   string  u32 length, the characters, a '\0'
+ *
+ * A single command is a tree of one stage.
+ */
+#define SERIAL_MAGIC "PSPT"
+#define SERIAL_HEADER_SZ 16
+
+// Flags of a serialized stage
+#define SF_INPUT 0x01
+#define SF_OUTPUT 0x02
+#define SF_INPUT_PATTERN 0x04
+#define SF_OUTPUT_PATTERN 0x08
+#define SF_PATTERNS 0x10
+#define SF_ERROR 0x20
+#define SF_ERROR_PATTERN 0x40
+#define SF_OUTPUT_APPEND 0x80
+#define SF_ERROR_APPEND 0x100
+#define SF_ERROR_TO_OUTPUT 0x200
+
+// Where PT_serialize writes: bytes past sz are counted, not written
+typedef struct
+{
+  unsigned char *buf;
+  size_t pos;
+  size_t sz;
+} Writer;
 
-  int status1;
-  int status2;
+// Where PT_deserialize reads; ok is cleared by a read past the end
+typedef struct
+{
+  const unsigned char *buf;
+  size_t pos;
+  size_t len;
+  bool ok;
+} Reader;
 
-  // wait for the child processes
-  waitpid(leftPid, &status1, 0);
-  waitpid(rightPid, &status2, 0);
+/*
+ * Write n bytes, if they fit
+ */
+static void putBytes(Writer *w, const void *bytes, size_t n)
+{
+  if (w->pos + n <= w->sz)
+    memcpy(w->buf + w->pos, bytes, n);
+  w->pos += n;
+}
 
-  // check for exit status and handle error
-  if (status1 != 0)
-  {
-    fprintf(stderr, "%s: Command not found\n", tree->left->command);
-    fprintf(stderr, "Child %u exited with status 2", leftPid);
-    return -1;
-  }
+/*
+ * Write a little-endian integer of n bytes
+ */
+static void putInt(Writer *w, uint32_t value, size_t n)
+{
+  unsigned char bytes[4];
+  for (size_t i = 0; i < n; i++)
+    bytes[i] = (value >> (8 * i)) & 0xff;
+  putBytes(w, bytes, n);
+}
+
+/*
+ * Write a string: its length, its characters and a '\0'
+ */
+static void putString(Writer *w, const char *str)
+{
+  size_t len = strlen(str);
+  putInt(w, len, 4);
+  putBytes(w, str, len + 1);
+}
 
-  // check for exit status and handle error
-  if (status2 != 0)
+/*
+ * Returns n bytes read from r, or NULL, clearing r->ok, if there are
+ * not that many left
+ */
+static const unsigned char *getBytes(Reader *r, size_t n)
+{
+  if (!r->ok || n > r->len - r->pos)
   {
-    fprintf(stderr, "%s: Command not found\n", tree->right->command);
-    fprintf(stderr, "Child %u exited with status 2", rightPid);
-    return -1;
+    r->ok = false;
+    return NULL;
   }
 
-  return 0; // return 0 on success
+  const unsigned char *bytes = r->buf + r->pos;
+  r->pos += n;
+  return bytes;
+}
+
+/*
+ * Returns a little-endian integer of n bytes read from r, or 0
+ */
+static uint32_t getInt(Reader *r, size_t n)
+{
+  const unsigned char *bytes = getBytes(r, n);
+  uint32_t value = 0;
+  for (size_t i = 0; bytes != NULL && i < n; i++)
+    value |= (uint32_t)bytes[i] << (8 * i);
+  return value;
 }
 
 /*
- * Helper function to append a string to the buffer
- * It ensures that the buffer size is not exceeded.
+ * Returns a string read from r, pointing into its buffer, or NULL if
+ * it runs past the end or is not terminated
  */
-static void safe_strcat(char *dest, const char *src, size_t dest_sz)
+static char *getString(Reader *r)
 {
-  size_t len = strlen(dest);
-  if (len < dest_sz - 1)
+  uint32_t len = getInt(r, 4);
+  const unsigned char *str = getBytes(r, (size_t)len + 1);
+  if (str == NULL || str[len] != '\0')
   {
-    strncat(dest, src, dest_sz - len - 1);
+    r->ok = false;
+    return NULL;
   }
+  return (char *)str;
 }
 
 /*
- * Helper function to append a node's details to the buffer.
+ * Write a command node, or stage, in serialized form
  */
-static void append_node_to_buf(PipeTree tree, char *buf, size_t buf_sz)
+static void serializeStage(Writer *w, PipeTree stage)
 {
+  char **argv = argvOf(stage);
+  uint32_t flags = 0;
+  if (stage->input != NULL)
+    flags |= SF_INPUT;
+  if (stage->output != NULL)
+    flags |= SF_OUTPUT;
+  if (stage->error != NULL)
+    flags |= SF_ERROR;
+  if (stage->input_pattern)
+    flags |= SF_INPUT_PATTERN;
+  if (stage->output_pattern)
+    flags |= SF_OUTPUT_PATTERN;
+  if (stage->error_pattern)
+    flags |= SF_ERROR_PATTERN;
+  if (stage->patterns != NULL)
+    flags |= SF_PATTERNS;
+  if (stage->output_append)
+    flags |= SF_OUTPUT_APPEND;
+  if (stage->error_append)
+    flags |= SF_ERROR_APPEND;
+  if (stage->error_to_output)
+    flags |= SF_ERROR_TO_OUTPUT;
+
+  putInt(w, flags, 2);
+  putInt(w, stage->argc, 4);
+  if (stage->patterns != NULL)
+    putBytes(w, stage->patterns, stage->argc);
+  for (uint32_t i = 0; i < stage->argc; i++)
+    putString(w, argv[i]);
+  if (stage->input != NULL)
+    putString(w, stage->input);
+  if (stage->output != NULL)
+    putString(w, stage->output);
+  if (stage->error != NULL)
+    putString(w, stage->error);
+}
 
-  if (tree->type != WORD)
+/*
+ * Read a stage into a cleared command node. Its strings are borrowed
+ * from the reader's buffer.
+ *
+ * Returns: 0 on success, -1 if the stage is malformed
+ */
+static int deserializeStage(Reader *r, PipeTree stage)
+{
+  uint32_t flags = getInt(r, 2);
+  uint32_t argc = getInt(r, 4);
+  const unsigned char *patterns = (flags & SF_PATTERNS) ? getBytes(r, argc) : NULL;
+
+  // a command has at least its name
+  if (!r->ok || argc == 0)
+    return -1;
+
+  for (uint32_t i = 0; i < argc && r->ok; i++)
   {
-    char temp[2] = {PipeNodeType_to_char(tree->type), '\0'};
-    safe_strcat(buf, temp, buf_sz);
+    char *word = getString(r);
+    if (word != NULL)
+      appendArg(stage, word);
   }
-  else
-  {
-    // add space
-    safe_strcat(buf, " ", buf_sz);
-
-    // add the command
-    safe_strcat(buf, tree->command, buf_sz);
+  if (flags & SF_INPUT)
+    stage->input = getString(r);
+  if (flags & SF_OUTPUT)
+    stage->output = getString(r);
+  if (flags & SF_ERROR)
+    stage->error = getString(r);
+  if (!r->ok)
+    return -1;
 
-    // add the command's argument
-    size_t size = CL_length(tree->args);
+  stage->builtin = builtinId(argvOf(stage)[0]);
+  stage->input_pattern = (flags & SF_INPUT_PATTERN) && stage->input != NULL;
+  stage->output_pattern = (flags & SF_OUTPUT_PATTERN) && stage->output != NULL;
+  stage->error_pattern = (flags & SF_ERROR_PATTERN) && stage->error != NULL;
+  stage->output_append = (flags & SF_OUTPUT_APPEND) && stage->output != NULL;
+  stage->error_append = (flags & SF_ERROR_APPEND) && stage->error != NULL;
+  stage->error_to_output = (flags & SF_ERROR_TO_OUTPUT) && stage->error == NULL;
+  for (uint32_t i = 0; patterns != NULL && i < argc; i++)
+  {
+    if (patterns[i])
+      PT_set_pattern(stage, i);
+  }
 
-    for (size_t i = 0; i < size; i++)
-    {
-      safe_strcat(buf, " ", buf_sz);
-      safe_strcat(buf, (char *)CL_nth(tree->args, i), buf_sz);
-    }
+  return 0;
+}
 
-    // add the redirections
-    if (tree->input != NULL)
+/*
+ * Write a tree in serialized form: a header, then its stages, or for a
+ * list its items, each a tree of its own
+ */
+static void serializeTree(Writer *w, PipeTree tree)
+{
+  size_t start = w->pos;
+  PipeTree stages = (tree->type == CMD_PIPE) ? tree->stages : tree;
+  size_t count = (tree->type == CMD_PIPE)   ? tree->num_stages
+                 : (tree->type == CMD_LIST) ? tree->num_items
+                                            : 1;
+
+  putBytes(w, SERIAL_MAGIC, 4);
+  putInt(w, PT_SERIAL_VERSION, 1);
+  putInt(w, tree->type, 1);
+  putInt(w, 0, 2);
+  putInt(w, 0, 4); // the total length, filled in below
+  putInt(w, count, 4);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    if (tree->type == CMD_LIST)
     {
-      safe_strcat(buf, " ", buf_sz);
-      safe_strcat(buf, "<", buf_sz);
-      safe_strcat(buf, tree->input, buf_sz);
+      putInt(w, tree->connectors[i], 1);
+      serializeTree(w, tree->items[i]);
     }
-
-    // add the redirections
-    if (tree->output != NULL)
+    else
     {
-      safe_strcat(buf, " ", buf_sz);
-      safe_strcat(buf, ">", buf_sz);
-      safe_strcat(buf, tree->input, buf_sz);
+      serializeStage(w, &stages[i]);
     }
   }
+
+  // now that the length is known
+  size_t end = w->pos;
+  w->pos = start + 8;
+  putInt(w, end - start, 4);
+  w->pos = end;
+}
+
+// Documented in the .h file
+size_t PT_serialize(PipeTree tree, void *buf, size_t buf_sz)
+{
+  Writer w = {.buf = (unsigned char *)buf, .pos = 0, .sz = buf_sz};
+  serializeTree(&w, tree);
+  return w.pos;
 }
 
 /*
- * Function to convert the tree to a string.
+ * Read a tree written by serializeTree
+ *
  * Parameters:
- *   tree    The tree to convert
- *   buf     The buffer to write the string to
- *   buf_sz  The size of the buffer
+ *   buf      The serialized tree
+ *   len      Number of bytes in buf
+ *   arena    Where to allocate the tree, or NULL for the heap
+ *   nested   True for an item of a list, which cannot be a list
+ *   size     Set to the number of bytes the tree takes
+ *
+ * Returns: The tree, or NULL if buf does not hold a valid one
  */
-size_t PT_tree2stringHelper(PipeTree tree, char *buf, size_t buf_sz)
+static PipeTree deserializeTree(const unsigned char *buf, size_t len, Arena arena, bool nested, size_t *size)
 {
-
-  // Base case
-  if (tree == NULL)
+  Reader r = {.buf = buf, .pos = 0, .len = len, .ok = true};
+
+  const unsigned char *magic = getBytes(&r, 4);
+  uint32_t version = getInt(&r, 1);
+  uint32_t type = getInt(&r, 1);
+  getInt(&r, 2);
+  uint32_t total = getInt(&r, 4);
+  uint32_t count = getInt(&r, 4);
+
+  if (!r.ok || memcmp(magic, SERIAL_MAGIC, 4) != 0 || version != PT_SERIAL_VERSION || total > len ||
+      (type != WORD && type != CMD_PIPE && type != CMD_LIST) || (nested && type == CMD_LIST) ||
+      count == 0 || (type == WORD && count != 1))
   {
-    return 0;
+    return NULL;
   }
+  r.len = total;
+  *size = total;
 
-  // Append left child
-  if (tree->left != NULL)
-  {
-    PT_tree2stringHelper(tree->left, buf, buf_sz);
-    safe_strcat(buf, " ", buf_sz);
-  }
+  // every stage or item takes a few bytes, so a bad count cannot ask
+  // for much
+  if (count > total / 6)
+    return NULL;
 
-  // Append current node
-  append_node_to_buf(tree, buf, buf_sz);
+  PipeTree tree = newNode(arena, type);
 
-  // Append right child
-  if (tree->right != NULL)
+  if (type == CMD_LIST)
   {
-    safe_strcat(buf, " ", buf_sz);
-    PT_tree2stringHelper(tree->right, buf, buf_sz);
-    safe_strcat(buf, " ", buf_sz);
-  }
+    for (uint32_t i = 0; i < count; i++)
+    {
+      uint32_t op = getInt(&r, 1);
+      size_t item_size = 0;
+      PipeTree item = r.ok ? deserializeTree(r.buf + r.pos, r.len - r.pos, arena, true, &item_size) : NULL;
+      bool valid_op = (op == CMD_SEQ || op == CMD_BACKGROUND || (i + 1 < count && (op == CMD_AND || op == CMD_OR)));
+      if (item == NULL || !valid_op)
+      {
+        PT_free(item);
+        PT_free(tree);
+        return NULL;
+      }
 
-  return strlen(buf);
-}
+      appendItem(tree, item, op);
+      r.pos += item_size;
+    }
+    return tree;
+  }
 
-// Documented in .h file
-size_t PT_tree2string(PipeTree tree, char *buf, size_t buf_sz)
-{
+  PipeTree stages = tree;
+  if (type == CMD_PIPE)
+  {
+    size_t size = count * sizeof(struct _pipe_tree_node);
+    if (arena != NULL)
+      tree->stages = (PipeTree)AR_alloc(arena, size);
+    else
+      tree->stages = (PipeTree)malloc(size);
+    assert(tree->stages);
+    tree->stages_cap = count;
+    stages = tree->stages;
+  }
 
-  // Clear the buffer
-  memset(buf, 0, buf_sz);
+  for (uint32_t i = 0; i < count; i++)
+  {
+    if (type == CMD_PIPE)
+    {
+      initCommand(&stages[i], arena);
+      tree->num_stages++;
+    }
 
-  // invoke the helper function to convert the ExprTree into a printable ASCII string
-  size_t num_of_char_added = PT_tree2stringHelper(tree, buf, buf_sz);
+    if (deserializeStage(&r, &stages[i]) != 0)
+    {
+      PT_free(tree);
+      return NULL;
+    }
+  }
 
-  return num_of_char_added; // return the num of char added
+  return tree;
 }
 
 // Documented in the .h file
-int PT_set_args(PipeTree tree, const char *arg)
+PipeTree PT_deserialize(const void *buf, size_t len, Arena arena)
 {
-  if (tree->args == NULL)
-  {
-    tree->args = CL_new();
-  }
-
-  char *element = strdup(arg);
-  assert(element);
-
-  CL_append(tree->args, element);
-  return 0;
+  size_t size;
+  return deserializeTree((const unsigned char *)buf, len, arena, false, &size);
 }
 
 // Safe string comparison
@@ -764,21 +2785,25 @@ bool test_pipeline(PipeTree tree, const char *expected_command, const char **exp
 {
 
   // Check the command, input/output files
-  if (!safe_strcmp(tree->command, expected_command))
+  if (tree->type != WORD)
+    return expected_command == NULL && expected_input_file == NULL && expected_output_file == NULL && args_sz == 0;
+
+  char **argv = argvOf(tree);
+  if (!safe_strcmp(argv[0], expected_command))
     return false;
   if (!safe_strcmp(tree->input, expected_input_file))
     return false;
   if (!safe_strcmp(tree->output, expected_output_file))
     return false;
 
-  // Check the args
-  size_t size = CL_length(tree->args);
+  // Check the args, which follow the command in argv
+  size_t size = tree->argc - 1;
   if (size != args_sz)
     return false;
 
   for (size_t i = 0; i < size; i++)
   {
-    if (!safe_strcmp(CL_nth(tree->args, i), expected_args[i]))
+    if (!safe_strcmp(argv[i + 1], expected_args[i]))
       return false;
   }
 
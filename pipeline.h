@@ -13,6 +13,7 @@
 #include <stdbool.h>
 
 #include "clist.h"
+#include "strbuild.h"
 
 typedef struct _pipe_tree_node *PipeTree;
 
@@ -22,7 +23,17 @@ typedef enum
   WORD,
   CMD_LESS,
   CMD_GREAT,
-  CMD_PIPE
+  CMD_PIPE,
+  CMD_LIST,       // a list of pipelines, joined by the operators below
+  CMD_SEQ,        // ;
+  CMD_BACKGROUND, // &
+  CMD_AND,        // &&
+  CMD_OR,         // ||
+  CMD_APPEND,     // >>
+  CMD_ERR_GREAT,  // 2>
+  CMD_ERR_APPEND, // 2>>
+  CMD_ERR_TO_OUT, // 2>&1
+  CMD_PIPE_ERR    // |&
 } PipeNodeType;
 
 /**
@@ -43,22 +54,67 @@ typedef enum
  */
 PipeTree PT_word(const char *command, const char *args[]);
 
+/**
+ * Create a new Pipetree node for a shell command, without copying
+ * the command.
+ *
+ * If owned is true, command is a malloc'd string whose ownership
+ * passes to the node. Otherwise command is a borrowed span of len
+ * characters (for instance a word in the input line produced by
+ * TOK_tokenize_spans); it is NUL-terminated in place and must
+ * outlive the node.
+ *
+ * If arena is not NULL the node is allocated from it, owned strings
+ * must come from the same arena, and every node and argument later
+ * added to the tree is allocated there too. PT_free on such a tree
+ * does nothing; the tree is released with the arena.
+ *
+ * Parameters
+ *    arena - Where to allocate the tree, or NULL for the heap
+ *    command - Command string, or start of the command span
+ *    len - Length of the span (ignored when owned)
+ *    owned - True if the node takes ownership of command
+ * Returns
+ *    New PipeTree node
+ */
+PipeTree PT_word_span(Arena arena, char *command, size_t len, bool owned);
+
 /*
- * Create an interior node on tree of CMD_PIPE type. An interior node always represents
- * a pipeline.
+ * Join two trees into a pipeline of CMD_PIPE type. A pipeline is flat:
+ * it holds the stages of left, then those of right, in one array, so
+ * a pipeline on the left is extended rather than nested.
  *
  * Parameters:
- *   left     Left side of the pipeline
- *   right    Right side of the pipeline
+ *   left     Left side of the pipeline: a command or a pipeline
+ *   right    Right side of the pipeline: a command or a pipeline
  *
- * Returns: The new tree, which will consist of an interior node with
- *   two children.
+ * Returns: The pipeline, which may be left itself. Both trees become
+ *   part of it, and must not be used or freed on their own.
  *
  * It is the responsibility of the caller to call PT_free on a tree
  * that contains this leaf
  */
 PipeTree PT_pipe(PipeTree left, PipeTree right);
 
+/*
+ * Join two trees into a list of CMD_LIST type. Like a pipeline, a list
+ * is flat: it holds the pipelines of left, then those of right, each
+ * followed by the operator that joins it to the next. When the list
+ * is evaluated, a pipeline after && runs only if the one before it
+ * succeeded, and one after || only if it failed; an and-or chain
+ * followed by & runs in the background, without being waited for.
+ *
+ * Parameters:
+ *   left     Left side of the list: a command, a pipeline or a list
+ *   op       CMD_SEQ, CMD_BACKGROUND, CMD_AND or CMD_OR
+ *   right    Right side of the list, or NULL to end the list with op,
+ *            which must then be CMD_SEQ or CMD_BACKGROUND
+ *
+ * Returns: The list, which may be left itself. Both trees become part
+ *   of it, and must not be used or freed on their own.
+ */
+PipeTree PT_list(PipeTree left, PipeNodeType op, PipeTree right);
+
 /*
  * Destroy a PipeTree, calling free() on all malloc'd memory
  *
@@ -71,7 +127,9 @@ void PT_free(PipeTree tree);
 
 /*
  * Return the number of nodes in the tree, including both leaf and
- * interior nodes in the count.
+ * interior nodes in the count. Each pipe of a pipeline counts as an
+ * interior node, so N stages count as 2N - 1; so does each operator
+ * between two pipelines of a list.
  *
  * Parameters:
  *   tree     The tree
@@ -82,7 +140,9 @@ int PT_count(PipeTree tree);
 
 /*
  * Return the maximum depth for the tree. A tree that contains just a
- * single leaf node has a depth of 1.
+ * single leaf node has a depth of 1, and a pipeline of N stages a
+ * depth of N, as if each pipe nested the rest of the pipeline. The
+ * operators of a list nest the rest of the list in the same way.
  *
  * Parameters:
  *   tree     The tree
@@ -104,7 +164,23 @@ int PT_depth(PipeTree tree);
 int PT_evaluate(PipeTree tree);
 
 /*
- * Convert an ExprTree into a printable ASCII string stored in buf
+ * Return the exit status of a stage of the command last evaluated, as
+ * bash's PIPESTATUS does. A single command is stage 0. The statuses
+ * are kept by the shell, not the tree, so that evaluating a tree never
+ * changes it.
+ *
+ * Parameters:
+ *   stage    Index of the stage, from 0
+ *
+ * Returns: The exit status, or 128 plus the signal that killed the
+ *   stage; -1 if the stage did not run or does not exist
+ */
+int PT_status(size_t stage);
+
+/*
+ * Convert an ExprTree into a printable ASCII string stored in buf. A
+ * string too long for buf is truncated; PT_append_string on a
+ * dynamic StrBuilder gets the whole of it.
  *
  * Parameters:
  *   tree     The tree
@@ -116,6 +192,56 @@ int PT_evaluate(PipeTree tree);
  */
 size_t PT_tree2string(PipeTree tree, char *buf, size_t buf_sz);
 
+/*
+ * Append the printable string of a tree, as PT_tree2string makes it,
+ * to a string builder. It takes one pass over the tree, and time
+ * linear in the length of the string.
+ *
+ * Parameters:
+ *   tree     The tree
+ *   sb       The builder; see SB_truncated if it has a fixed buffer
+ *
+ * Returns: None
+ */
+void PT_append_string(PipeTree tree, StrBuilder *sb);
+
+// Version of the format written by PT_serialize; a tree serialized
+// by another version is not read
+#define PT_SERIAL_VERSION 2
+
+/*
+ * Write a tree in a compact binary form, which PT_deserialize turns
+ * back into the same tree. The form holds no addresses and its
+ * integers are little-endian, so it may be stored in a file, mapped
+ * at any address, or handed to another process as it is.
+ *
+ * Parameters:
+ *   tree     The tree
+ *   buf      The buffer
+ *   buf_sz   Size of buffer, in bytes
+ *
+ * Returns: The number of bytes the tree takes. As with snprintf, they
+ *   are only written if that is no more than buf_sz, so a first call
+ *   with a buf_sz of 0 finds the size of buffer needed.
+ */
+size_t PT_serialize(PipeTree tree, void *buf, size_t buf_sz);
+
+/*
+ * Rebuild a tree written by PT_serialize. The words and filenames are
+ * not copied: the tree points into buf, which must stay unchanged for
+ * as long as the tree is used. Nothing is written to buf, so it may
+ * be mapped read-only.
+ *
+ * Parameters:
+ *   buf      The serialized tree
+ *   len      Number of bytes in buf; more than the tree takes is fine
+ *   arena    Where to allocate the tree, or NULL for the heap
+ *
+ * Returns: The tree, or NULL if buf does not hold a valid tree of
+ *   this version. The caller must call PT_free on it.
+ */
+PipeTree PT_deserialize(const void *buf, size_t len, Arena arena);
+
 /**
  * Add new argument to a pipeline tree node's arguments.
  *
@@ -130,6 +256,151 @@ size_t PT_tree2string(PipeTree tree, char *buf, size_t buf_sz);
 
 int PT_set_args(PipeTree tree, const char *arg);
 
+/**
+ * Add new argument to a pipeline tree node's arguments, without
+ * copying it. Ownership follows the same rules as PT_word_span.
+ *
+ * Parameters
+ *    tree - Pipeline node to add arg to
+ *    arg - Argument string, or start of the argument span
+ *    len - Length of the span (ignored when owned)
+ *    owned - True if the node takes ownership of arg
+ * Return 0 on success, non-zero on failure
+ */
+int PT_set_args_span(PipeTree tree, char *arg, size_t len, bool owned);
+
+// For PT_set_pattern, the redirection files of a command node
+#define PT_INPUT_FILE ((size_t)-1)
+#define PT_OUTPUT_FILE ((size_t)-2)
+#define PT_ERROR_FILE ((size_t)-3)
+
+/**
+ * Mark a word of a command node as a glob pattern, or as having
+ * braces. It is expanded when the tree is evaluated: braces first,
+ * one expansion at a time, then each expansion with wildcards is
+ * replaced by the paths it matches, or kept as it is if there are
+ * none. A redirection file must expand to exactly one word and match
+ * at most one path.
+ *
+ * If the expanded arguments would exceed ARG_MAX, the command is run
+ * in several batches, as xargs would; see PT_set_arg_limit.
+ *
+ * Parameters
+ *    tree - Pipeline tree node
+ *    index - 0 for the command, i + 1 for the i-th argument, or
+ *            PT_INPUT_FILE, PT_OUTPUT_FILE or PT_ERROR_FILE
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int PT_set_pattern(PipeTree tree, size_t index);
+
+/**
+ * Return the argv of a command node, as it is handed to exec: the
+ * command, then its arguments, then NULL. It is built as the command
+ * is parsed, and used as it is each time the tree is evaluated. Words
+ * marked with PT_set_pattern appear unexpanded.
+ *
+ * Parameters
+ *    tree - Pipeline tree node
+ *
+ * Returns the argv, which must not be changed, or NULL if tree is not
+ *    a command
+ */
+char *const *PT_argv(PipeTree tree);
+
+/**
+ * Set the environment commands run with, in place of the shell's own.
+ * Builtins are not affected.
+ *
+ * Parameters
+ *    envp - NULL-terminated array of "NAME=value" strings, kept
+ *           until it is replaced, or NULL for the shell's environment
+ *
+ * Returns the previous environment, or NULL if it was the shell's
+ */
+char *const *PT_set_environment(char *const envp[]);
+
+/**
+ * Set the most bytes the argv of a command may take before it is
+ * split into batches, e.g. to test batching.
+ *
+ * Parameters
+ *    bytes - The limit, or 0 to use ARG_MAX less the environment
+ *
+ * Returns the previous limit
+ */
+size_t PT_set_arg_limit(size_t bytes);
+
+/**
+ * Set how many batches of one command may run at the same time. Only
+ * a command whose expanded arguments exceed the argv limit is split
+ * into batches, so that every other command runs as it always has.
+ *
+ * Parameters
+ *    jobs - Number of batches run in parallel; 1 runs them in turn
+ *
+ * Returns the previous number
+ */
+int PT_set_batch_jobs(int jobs);
+
+// How a command is started in a process of its own: by posix_spawn,
+// which does not copy the shell's page tables, or by fork and exec
+#define PT_SPAWN_POSIX 0
+#define PT_SPAWN_FORK 1
+
+/**
+ * Set how commands are started. A builtin, a stage that expands
+ * patterns, and a list run in the background are always forked, as
+ * they run the shell's own code.
+ *
+ * Parameters
+ *    backend - PT_SPAWN_POSIX, the default, or PT_SPAWN_FORK
+ *
+ * Returns the previous backend
+ */
+int PT_set_spawn(int backend);
+
+// The rewrites of PT_optimize, each of which can be switched off:
+// cat stages that only pass data along are removed, a cat at the
+// start becoming the input of the stage after it; author and pwd
+// stages run in the shell rather than in a child; and cat file >out
+// is copied by the shell, rather than by a cat process
+#define PT_OPT_CAT_INPUT 0x1
+#define PT_OPT_INLINE_BUILTIN 0x2
+#define PT_OPT_COPY_FILE 0x4
+#define PT_OPT_ALL 0x7
+#define PT_NUM_OPTS 3
+
+/**
+ * Rewrite a tree, between parsing and evaluation, so that it runs with
+ * fewer processes, under the rules set by PT_set_optimizations. The
+ * tree is changed in place, and keeps its address; a pipeline may be
+ * left with one stage. What it prints is the same, but for errors
+ * about a missing file, which come from the shell rather than cat,
+ * and PT_status numbers the stages that are left. Optimizing a tree
+ * again changes nothing.
+ *
+ * Parameters
+ *    tree - Pipeline tree to optimize
+ */
+void PT_optimize(PipeTree tree);
+
+/**
+ * Set the rules PT_optimize applies; all of them at first.
+ *
+ * Parameters
+ *    rules - The PT_OPT_ values of the rules, or-ed together
+ *
+ * Returns the previous rules
+ */
+unsigned PT_set_optimizations(unsigned rules);
+
+/**
+ * Returns the number of times PT_optimize has applied a rule, one of
+ * the PT_OPT_ values: stages removed, stages inlined or copies made
+ */
+size_t PT_optimized(unsigned rule);
+
 /**
  * Set output file for a pipeline tree node.
  *
@@ -159,6 +430,41 @@ int setOutputFiles(PipeTree tree, const char *out);
  */
 int setInputFiles(PipeTree tree, const char *in);
 
+/**
+ * Set the input or output file for a pipeline tree node, without
+ * copying it. Ownership follows the same rules as PT_word_span.
+ *
+ * Parameters
+ *    tree - Pipeline tree node
+ *    in/out - Filename, or start of the filename span
+ *    len - Length of the span (ignored when owned)
+ *    owned - True if the node takes ownership of the filename
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int setInputSpan(PipeTree tree, char *in, size_t len, bool owned);
+int setOutputSpan(PipeTree tree, char *out, size_t len, bool owned);
+
+/**
+ * Redirect a stream of a pipeline tree node, without copying the
+ * file. Ownership follows the same rules as PT_word_span. A stream
+ * redirected before is redirected again, replacing the earlier file.
+ *
+ * Parameters
+ *    tree - Pipeline tree node
+ *    kind - CMD_LESS, CMD_GREAT or CMD_APPEND for standard input or
+ *           output, CMD_ERR_GREAT or CMD_ERR_APPEND for standard
+ *           error, or CMD_ERR_TO_OUT to send standard error wherever
+ *           standard output goes, after its own redirection
+ *    file - Filename, or start of the filename span; NULL for
+ *           CMD_ERR_TO_OUT
+ *    len - Length of the span (ignored when owned)
+ *    owned - True if the node takes ownership of the filename
+ *
+ * Returns 0 on success, -1 on failure
+ */
+int PT_set_redirect_span(PipeTree tree, PipeNodeType kind, char *file, size_t len, bool owned);
+
 /**
  * Tests a pipeline represented by a PipeTree against expected values.
  *
@@ -7,6 +7,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <assert.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 #include <stdbool.h>
@@ -16,10 +19,306 @@
 #include "token.h"
 #include "parse.h"
 #include "pipeline.h"
+#include "globcache.h"
+#include "parsecache.h"
+#include "scriptcache.h"
 
 // colors
 #define BOLD_RED
 
+// Size of the chunks a script is read in
+#define SCRIPT_CHUNK_SZ 65536
+
+// Whether a script is run from its compiled form, cached next to it
+static bool script_cache = true;
+
+// The commands of a compiled script are built in one arena, reset
+// after each command. It is a global so that it stays reachable in
+// the children forked to run a pipeline.
+static Arena arena = NULL;
+
+/*
+ * Callback to count the TOK_END tokens in a list, i.e. the number
+ * of complete commands in a list produced by a line-mode TokStream
+ */
+static void count_commands_callback(int pos, TListElementType token, void *cb_data)
+{
+    if (token.type == TOK_END)
+        (*(int *)cb_data)++;
+}
+
+/*
+ * Parse and evaluate the first command in a list of tokens from a
+ * line-mode TokStream, consuming its tokens through the TOK_END that
+ * terminates it.
+ *
+ * Parameters:
+ *   tokens    The list of tokens; must contain a TOK_END
+ *
+ * Returns: None
+ */
+static void run_command(TList tokens)
+{
+    char errmsg[128] = {'\0'};
+
+    // an empty command, e.g. a blank line
+    if (TOK_next_type(tokens) == TOK_END)
+    {
+        TOK_consume(tokens);
+        return;
+    }
+
+    PipeTree tree = Parse(tokens, errmsg, sizeof(errmsg));
+    if (tree == NULL)
+    {
+        fprintf(stderr, "%s\n", errmsg);
+
+        // discard the rest of the failed command
+        while (TOK_next_type(tokens) != TOK_END)
+            TOK_consume(tokens);
+        TOK_consume(tokens);
+        return;
+    }
+
+    // Parse consumed the TOK_END
+    PT_optimize(tree);
+    PT_evaluate(tree);
+    PT_free(tree);
+}
+
+/*
+ * Run the commands in a script from its compiled form, which is
+ * loaded from the script's cache file when that is current, so that
+ * the script is not tokenized or parsed again
+ *
+ * Parameters:
+ *   path      The path of the script
+ *
+ * Returns: true if the script was run, false if it has no compiled
+ *   form, e.g. because it does not parse
+ */
+static bool run_compiled_script(const char *path)
+{
+    char errmsg[128] = {'\0'};
+    Script script = SC_open(path, errmsg, sizeof(errmsg));
+    if (script == NULL)
+        return false;
+
+    for (size_t i = 0; i < SC_num_commands(script); i++)
+    {
+        PipeTree tree = SC_command(script, i, arena);
+        assert(tree != NULL);
+        PT_optimize(tree);
+        PT_evaluate(tree);
+        AR_reset(arena);
+    }
+
+    SC_close(script);
+    return true;
+}
+
+/*
+ * Append the tokens from a line-mode TokStream to the tokens pending
+ * from earlier input, and run each command they complete
+ *
+ * Parameters:
+ *   pending   The tokens of the command still being read
+ *   tokens    The newly-completed tokens; freed by this function
+ *
+ * Returns: None
+ */
+static void run_completed(TList pending, TList tokens)
+{
+    int commands = 0;
+    TL_foreach(tokens, count_commands_callback, &commands);
+    TL_join(pending, tokens);
+    TL_free(tokens);
+
+    for (; commands > 0; commands--)
+        run_command(pending);
+}
+
+/*
+ * Run the commands in a script file, one per line. With the script
+ * cache on, as it is by default, a regular file is read and compiled
+ * in full (or loaded from its cache file) before its first command
+ * runs. Otherwise, and for a FIFO or a script that does not compile,
+ * the file is read in chunks and each command runs as soon as its
+ * line is complete, so the script starts executing before it has been
+ * read in full. A line that does not tokenize or parse is reported
+ * without stopping the rest.
+ *
+ * Parameters:
+ *   path      The path of the script
+ *
+ * Returns: 0 on success, 1 if the script could not be read
+ */
+static int run_script(const char *path)
+{
+    char errmsg[128] = {'\0'};
+    char *chunk = malloc(SCRIPT_CHUNK_SZ);
+    TokStream ts = TOK_stream_new(true);
+    TList pending = TL_new();
+    int status = 0;
+    int fd = -1;
+    int lineno = 1;
+    int start = 1;    // the line the current command began on
+
+    // after a tokenizer error, the rest of the line is skipped
+    bool skipping = false;
+
+    if (script_cache && run_compiled_script(path))
+        goto done;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || chunk == NULL)
+    {
+        perror(path);
+        status = 1;
+        goto done;
+    }
+
+    for (;;)
+    {
+        ssize_t n = read(fd, chunk, SCRIPT_CHUNK_SZ);
+        if (n < 0)
+        {
+            perror(path);
+            status = 1;
+            break;
+        }
+
+        if (n == 0)
+        {
+            // the last line need not end with a newline
+            TList tokens = TOK_stream_finish(ts, errmsg, sizeof(errmsg));
+            if (tokens == NULL)
+            {
+                fprintf(stderr, "%s:%d: %s\n", path, start, errmsg);
+                break;
+            }
+
+            Token end = {.type = TOK_END};
+            TL_append(tokens, end);
+            run_completed(pending, tokens);
+            break;
+        }
+
+        // feed the chunk a line at a time, so that an error costs only
+        // the line it is on
+        for (const char *line = chunk; line < chunk + n; )
+        {
+            const char *nl = memchr(line, '\n', chunk + n - line);
+            const char *next = (nl != NULL) ? nl + 1 : chunk + n;
+
+            if (!skipping)
+            {
+                TList tokens = TOK_stream_feed(ts, line, next - line, errmsg, sizeof(errmsg));
+                if (tokens != NULL)
+                {
+                    run_completed(pending, tokens);
+                }
+                else
+                {
+                    fprintf(stderr, "%s:%d: %s\n", path, lineno, errmsg);
+
+                    // drop the failed command and resync at the next newline
+                    TOK_free(pending);
+                    pending = TL_new();
+                    TOK_stream_free(ts);
+                    ts = TOK_stream_new(true);
+                    skipping = true;
+                }
+            }
+
+            if (nl != NULL)
+            {
+                lineno++;
+                skipping = false;
+                if (!TOK_stream_in_quote(ts))
+                    start = lineno;
+            }
+            line = next;
+        }
+    }
+
+done:
+    if (fd >= 0)
+        close(fd);
+    free(chunk);
+    TOK_free(pending);
+    TOK_stream_free(ts);
+    return status;
+}
+
+/*
+ * Parse a line whose quotes are not closed, with the continuation
+ * lines that close them, as one command. The lines go through a
+ * stream tokenizer as they are read, so a tokenizer error is reported
+ * as soon as the line with it is read, and the tokens it completes
+ * are kept and parsed once the quotes are closed: the lines are not
+ * tokenized again.
+ *
+ * Parameters:
+ *   input      The first line
+ *   errmsg     Return space for an error message
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The tree of the whole command, or NULL on error (or if the
+ *   first line did not end inside quotes, in which case errmsg is left
+ *   untouched). It is up to the caller to call PT_free on the tree.
+ */
+static PipeTree parse_continued(const char *input, char *errmsg, size_t errmsg_sz)
+{
+    TokStream ts = TOK_stream_new(false);
+    char stream_errmsg[128];
+    TList tokens = TOK_stream_feed(ts, input, strlen(input), stream_errmsg, sizeof(stream_errmsg));
+
+    if (tokens == NULL || !TOK_stream_in_quote(ts))
+    {
+        TOK_free(tokens);
+        TOK_stream_free(ts);
+        return NULL;
+    }
+
+    PipeTree tree = NULL;
+    bool ok = true;
+    while (ok && TOK_stream_in_quote(ts))
+    {
+        char *more = readline("> ");
+        if (more == NULL)
+            break;
+
+        TList line_tokens = TOK_stream_feed(ts, "\n", 1, errmsg, errmsg_sz);
+        if (line_tokens != NULL)
+        {
+            TL_join(tokens, line_tokens);
+            TL_free(line_tokens);
+            line_tokens = TOK_stream_feed(ts, more, strlen(more), errmsg, errmsg_sz);
+        }
+        free(more);
+
+        ok = (line_tokens != NULL);
+        TL_join(tokens, line_tokens);
+        TL_free(line_tokens);
+    }
+
+    if (ok)
+    {
+        TList line_tokens = TOK_stream_finish(ts, errmsg, errmsg_sz);
+        ok = (line_tokens != NULL);
+        TL_join(tokens, line_tokens);
+        TL_free(line_tokens);
+    }
+
+    if (ok)
+        tree = Parse(tokens, errmsg, errmsg_sz);
+
+    TOK_free(tokens);
+    TOK_stream_free(ts);
+    return tree;
+}
+
 int main(int argc, char *argv[])
 {
     char *input = NULL;
@@ -27,7 +326,51 @@ int main(int argc, char *argv[])
     char errmsg[128] = {'\0'};
     // char errmsg2[128] = {'\0'};
     PipeTree tree = NULL;
-    TList tokens = NULL;
+    PipeTree continued = NULL;
+
+    arena = AR_new();
+
+    // the glob cache's memory cap, in KB; 0 disables it
+    const char *glob_cache_kb = getenv("PLAIDSH_GLOB_CACHE_KB");
+    if (glob_cache_kb != NULL)
+        GC_set_limit(strtoul(glob_cache_kb, NULL, 10) * 1024);
+
+    // leave glob matches in directory order, skipping the sort
+    const char *glob_unsorted = getenv("PLAIDSH_GLOB_UNSORTED");
+    if (glob_unsorted != NULL && strcmp(glob_unsorted, "1") == 0)
+        GC_set_unsorted(true);
+
+    // how many batches of a command too long for one argv run at once
+    const char *batch_jobs = getenv("PLAIDSH_BATCH_JOBS");
+    if (batch_jobs != NULL)
+        PT_set_batch_jobs(atoi(batch_jobs));
+
+    // start commands by fork and exec rather than posix_spawn
+    const char *spawn = getenv("PLAIDSH_SPAWN");
+    if (spawn != NULL && strcmp(spawn, "fork") == 0)
+        PT_set_spawn(PT_SPAWN_FORK);
+
+    // which rewrites of PT_optimize to make, as a mask of PT_OPT_
+    // values; 0 runs every command as it was written
+    const char *optimize = getenv("PLAIDSH_OPTIMIZE");
+    if (optimize != NULL)
+        PT_set_optimizations(strtoul(optimize, NULL, 0));
+
+    // how many command lines to keep parsed; 0 disables the cache
+    const char *parse_cache = getenv("PLAIDSH_PARSE_CACHE");
+    if (parse_cache != NULL)
+        PC_set_capacity(strtoul(parse_cache, NULL, 10));
+
+    // whether scripts are run from, and compiled to, a cache file
+    const char *script_cache_env = getenv("PLAIDSH_SCRIPT_CACHE");
+    if (script_cache_env != NULL && strcmp(script_cache_env, "0") == 0)
+        script_cache = false;
+
+    // plaidsh script: run the script instead of reading commands
+    if (argc > 1)
+    {
+        return run_script(argv[1]);
+    }
 
     printf("\n\e[01;34mWelcome to \e[01;32mPlaid Shell!\e[01;39m\n");
 
@@ -46,40 +389,41 @@ int main(int argc, char *argv[])
 
         add_history(input);
 
-        // Step 2: Tokenize the user input
-        tokens = TOK_tokenize_input(input, errmsg, sizeof(errmsg));
+        // Steps 2 and 3: tokenize and parse the user input in one
+        // pass, or reuse the tree of the same line entered before;
+        // that tree belongs to the cache
+        tree = PC_parse(input, errmsg, sizeof(errmsg));
 
-        if (tokens == NULL)
+        // an open quote continues onto the next lines; that command is
+        // not cached, and is freed once it has run
+        if (tree == NULL)
         {
-            fprintf(stderr, "%s\n", errmsg);
-            goto loop_end;
+            continued = parse_continued(input, errmsg, sizeof(errmsg));
+            if (continued != NULL)
+                PT_optimize(continued);
+            tree = continued;
         }
 
-        if (TL_length(tokens) == 0)
-            goto loop_end;
-
-        // Step 3: parse the input
-        tree = Parse(tokens, errmsg, sizeof(errmsg));
-
-
         if (tree == NULL)
         {
-            fprintf(stderr, "%s\n", errmsg);
+            if (errmsg[0] != '\0')
+                fprintf(stderr, "%s\n", errmsg);
             goto loop_end;
         }
 
-        // Step 4: evaluate the tree
+        // Step 4: evaluate the tree, already rewritten to fork less
         PT_evaluate(tree);
         goto loop_end;
 
     loop_end:
+        tree = NULL;
+        PT_free(continued);
+        continued = NULL;
         free(input);
         input = NULL;
-        TOK_free(tokens);
-        tokens = NULL;
-        PT_free(tree);
-        tree = NULL;
     }
 
+    PC_clear();
+    AR_free(arena);
     return 0;
 }
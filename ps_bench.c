@@ -0,0 +1,1378 @@
+/*
+ * ps_bench.c
+ *
+ * Micro-benchmarks for the Plaid Shell tokenizer, parser and
+ * evaluator. Run with no arguments to run every benchmark, or name
+ * the benchmarks to run, e.g. "./ps_bench scan".
+ *
+ * The default build uses -O0 and AddressSanitizer, which distorts
+ * the numbers; for meaningful results build with
+ *
+ *   make clean && make CFLAGS=-O2 ps_bench
+ *
+ * Author: Nwankwo Chukwunonso Michael
+ */
+
+// for nftw()
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <stdbool.h>
+#include <malloc.h>
+#include <glob.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <ftw.h>
+#include <fnmatch.h>
+#include <pthread.h>
+
+#include "token.h"
+#include "tokenize.h"
+#include "scan.h"
+#include "parse.h"
+#include "pipeline.h"
+#include "globcache.h"
+#include "brace.h"
+#include "intern.h"
+#include "parsecache.h"
+#include "scriptcache.h"
+
+/*
+ * Allocation counting. ps_bench is linked with --wrap for each of
+ * these, so every call made from the shell's own code lands here
+ * first. Live and peak heap bytes are tracked as well.
+ */
+static size_t num_allocs = 0;
+static size_t live_bytes = 0;
+static size_t peak_bytes = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+char *__real_strdup(const char *s);
+void __real_free(void *ptr);
+
+static void *counted(void *ptr)
+{
+    num_allocs++;
+    if (ptr != NULL)
+    {
+        live_bytes += malloc_usable_size(ptr);
+        if (live_bytes > peak_bytes)
+            peak_bytes = live_bytes;
+    }
+    return ptr;
+}
+
+void *__wrap_malloc(size_t size)
+{
+    return counted(__real_malloc(size));
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    return counted(__real_calloc(n, size));
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    if (ptr != NULL)
+        live_bytes -= malloc_usable_size(ptr);
+    return counted(__real_realloc(ptr, size));
+}
+
+char *__wrap_strdup(const char *s)
+{
+    return counted(__real_strdup(s));
+}
+
+void __wrap_free(void *ptr)
+{
+    if (ptr != NULL)
+        live_bytes -= malloc_usable_size(ptr);
+    __real_free(ptr);
+}
+
+/*
+ * Returns the current time, in seconds, from a monotonic clock
+ */
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Build a generated command line of roughly len bytes: a command
+ * followed by words of 1..max_word characters, with every tenth word
+ * quoted.
+ *
+ * Returns: A malloc'd line; the caller must free it
+ */
+static char *generate_line(size_t len, size_t max_word)
+{
+    char *line = malloc(len + max_word + 8);
+    assert(line);
+
+    size_t pos = (size_t)sprintf(line, "echo");
+    for (int w = 0; pos < len; w++)
+    {
+        size_t wlen = 1 + (w * 7) % max_word;
+        bool quoted = (w % 10 == 9);
+
+        line[pos++] = ' ';
+        if (quoted)
+            line[pos++] = '"';
+        for (size_t i = 0; i < wlen; i++)
+            line[pos++] = (quoted && i % 8 == 4) ? ' ' : 'a' + (w + i) % 26;
+        if (quoted)
+            line[pos++] = '"';
+    }
+    line[pos] = '\0';
+    return line;
+}
+
+/*
+ * The tokenizer's original word loop: one byte at a time, with a
+ * chain of comparisons per byte
+ */
+static size_t scan_word_bytewise(const char *s)
+{
+    const char *p = s;
+    while (*p != '<' && *p != '>' && *p != '|' && *p != '"' && !isspace(*p) && *p != '\0')
+        p++;
+    return p - s;
+}
+
+/*
+ * Compares the byte-at-a-time word scan against each SCAN_word
+ * implementation on one line, and times the whole tokenizer with
+ * each.
+ */
+static void bench_scan_line(size_t max_word)
+{
+    const size_t line_len = 512 * 1024;
+    const int reps = 20;
+    char *line = generate_line(line_len, max_word);
+    size_t len = strlen(line);
+    char errmsg[128];
+
+    printf("scan: %zu byte line, words up to %zu bytes, %d reps\n", len, max_word, reps);
+
+    // reference: the original byte-at-a-time loop
+    size_t ref_stops = 0;
+    double t0 = now();
+    for (int r = 0; r < reps; r++)
+    {
+        ref_stops = 0;
+        for (size_t pos = 0; pos < len; pos++, ref_stops++)
+            pos += scan_word_bytewise(line + pos);
+    }
+    double ref = now() - t0;
+    printf("  %-8s %8.1f MB/s\n", "bytewise", reps * len / ref / 1e6);
+
+    ScanImpl impls[] = {SCAN_SCALAR, SCAN_SSE2, SCAN_AVX2};
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++)
+    {
+        ScanImpl impl = SCAN_set_impl(impls[i]);
+        if (impl != impls[i])
+            continue; // not supported on this CPU
+
+        size_t stops = 0;
+        t0 = now();
+        for (int r = 0; r < reps; r++)
+        {
+            stops = 0;
+            for (size_t pos = 0; pos < len; pos++, stops++)
+                pos += SCAN_word(line + pos, len - pos);
+        }
+        double t = now() - t0;
+        assert(stops == ref_stops);
+
+        t0 = now();
+        TList tokens = TOK_tokenize_input(line, errmsg, sizeof(errmsg));
+        double tok = now() - t0;
+        assert(tokens != NULL);
+        TOK_free(tokens);
+
+        printf("  %-8s %8.1f MB/s  (%.2fx)  tokenize %.2f ms\n",
+               SCAN_impl_name(impl), reps * len / t / 1e6, ref / t, tok * 1e3);
+    }
+
+    SCAN_set_impl(SCAN_AUTO);
+    free(line);
+}
+
+static void bench_scan()
+{
+    bench_scan_line(40);
+    bench_scan_line(1000);
+}
+
+/*
+ * Tokenizes single words of growing size, with and without escapes.
+ * The time per megabyte should stay flat.
+ */
+static void bench_longword()
+{
+    char errmsg[128];
+
+    printf("longword: time to tokenize one word\n");
+    for (size_t mb = 1; mb <= 16; mb *= 2)
+    {
+        size_t len = mb * 1024 * 1024;
+        char *word = malloc(len + 1);
+        assert(word);
+
+        for (int escaped = 0; escaped <= 1; escaped++)
+        {
+            memset(word, 'w', len);
+            word[len] = '\0';
+            if (escaped)
+                memcpy(word + 1, "\\ ", 2);
+
+            double t0 = now();
+            TList tokens = TOK_tokenize_input(word, errmsg, sizeof(errmsg));
+            double t = now() - t0;
+            assert(tokens != NULL);
+            TOK_free(tokens);
+
+            printf("  %3zu MB %-9s %8.2f ms  %6.2f ms/MB\n", mb, escaped ? "escaped" : "plain", t * 1e3, t * 1e3 / mb);
+        }
+        free(word);
+    }
+}
+
+// A batch of typical interactive command lines
+static const char *recorded_lines[] = {
+    "ls -l",
+    "cd /tmp",
+    "grep -n \"static int\" pipeline.c parse.c tokenize.c",
+    "cat plaidsh.c | grep readline | wc -l",
+    "sort <names.txt >sorted.txt",
+    "echo \"hello, world\" >greeting.txt",
+    "find . -name Makefile -type f",
+    "git log --oneline -n 20 | head -5",
+    "tr a-z A-Z <in.txt | sort -u | uniq -c >out.txt",
+    "echo a\\ b c\\\"d \"e\\tf\"",
+    "make clean",
+    "gcc -Wall -Werror -g -c tokenize.c -o tokenize.o",
+};
+
+/*
+ * Tokenizes and parses a batch of recorded command lines, counting
+ * the allocations per line: with owned words and a heap tree, with
+ * borrowed spans, and with spans and everything else in an arena
+ * that is reset after each line.
+ */
+static void bench_alloc()
+{
+    const int num_lines = sizeof(recorded_lines) / sizeof(recorded_lines[0]);
+    const int reps = 20000;
+    char errmsg[128];
+    char line[256];
+
+    printf("alloc: %d recorded lines, %d reps\n", num_lines, reps);
+
+    for (int mode = 0; mode < 3; mode++)
+    {
+        Arena arena = (mode == 2) ? AR_new() : NULL;
+        num_allocs = 0;
+
+        double t0 = now();
+        for (int r = 0; r < reps; r++)
+        {
+            for (int i = 0; i < num_lines; i++)
+            {
+                strcpy(line, recorded_lines[i]);
+                TList tokens = (mode == 0) ? TOK_tokenize_input(line, errmsg, sizeof(errmsg))
+                                           : TOK_tokenize_spans(line, arena, errmsg, sizeof(errmsg));
+                assert(tokens != NULL);
+
+                PipeTree tree = Parse(tokens, errmsg, sizeof(errmsg));
+                assert(tree != NULL);
+
+                TOK_free(tokens);
+                PT_free(tree);
+                if (arena != NULL)
+                    AR_reset(arena);
+            }
+        }
+        double t = now() - t0;
+
+        const char *names[] = {"heap", "spans", "arena"};
+        printf("  %-6s %6.2f allocs/line  %7.2f us/line\n", names[mode],
+               (double)num_allocs / reps / num_lines, t * 1e6 / reps / num_lines);
+
+        if (arena != NULL)
+            AR_free(arena);
+    }
+}
+
+/*
+ * Compares tokenizing a whole line and then parsing it against
+ * ParseLine, which pulls tokens as it parses, on generated lines of
+ * growing length. Reports the time, and the peak heap used beyond
+ * what the finished tree itself holds: the token list, or the
+ * tokenizer's pending word.
+ */
+static void bench_fused()
+{
+    char errmsg[128];
+
+    printf("fused: two-pass vs single-pass parse\n");
+    for (size_t kb = 4; kb <= 64; kb *= 2)
+    {
+        char *line = generate_line(kb * 1024, 12);
+        size_t len = strlen(line);
+        char *copy = malloc(len + 1);
+
+        for (int fused = 0; fused <= 1; fused++)
+        {
+            memcpy(copy, line, len + 1);
+            live_bytes = peak_bytes = 0;
+
+            double t0 = now();
+            PipeTree tree;
+            if (fused)
+            {
+                tree = ParseLine(copy, NULL, errmsg, sizeof(errmsg));
+            }
+            else
+            {
+                TList tokens = TOK_tokenize_spans(copy, NULL, errmsg, sizeof(errmsg));
+                tree = Parse(tokens, errmsg, sizeof(errmsg));
+                TOK_free(tokens);
+            }
+            double t = now() - t0;
+            assert(tree != NULL);
+            size_t tree_bytes = live_bytes;
+            PT_free(tree);
+
+            printf("  %3zu KB %-9s %8.2f ms  tree %6zu KB  overhead %6zu KB\n", kb, fused ? "ParseLine" : "two-pass",
+                   t * 1e3, tree_bytes / 1024, (peak_bytes - tree_bytes) / 1024);
+        }
+
+        free(copy);
+        free(line);
+    }
+}
+
+/*
+ * Tokenizes lines of up to 100k tokens, then peeks at and consumes
+ * every token, as the parser does. With a list that appends and
+ * peeks in O(1), the time per token should stay flat.
+ */
+static void bench_tlist()
+{
+    char errmsg[128];
+
+    printf("tlist: time per token to append, and to peek and consume\n");
+    for (int num_tokens = 12500; num_tokens <= 100000; num_tokens *= 2)
+    {
+        char *line = malloc(2 * num_tokens + 1);
+        assert(line);
+        for (int i = 0; i < num_tokens; i++)
+            memcpy(line + 2 * i, "w ", 2);
+        line[2 * num_tokens] = '\0';
+
+        double t0 = now();
+        TList tokens = TOK_tokenize_input(line, errmsg, sizeof(errmsg));
+        double tokenize = now() - t0;
+        assert(tokens != NULL && TL_length(tokens) == num_tokens);
+
+        t0 = now();
+        size_t words = 0;
+        while (TOK_next_type(tokens) != TOK_END)
+        {
+            words += (TOK_next_word(tokens) != NULL);
+            TOK_consume(tokens);
+        }
+        double consume = now() - t0;
+        assert(words == (size_t)num_tokens);
+
+        TOK_free(tokens);
+        free(line);
+        printf("  %6d tokens  tokenize %8.2f ms  %6.1f ns/token  consume %8.2f ms  %6.1f ns/token\n", num_tokens,
+               tokenize * 1e3, tokenize * 1e9 / num_tokens, consume * 1e3, consume * 1e9 / num_tokens);
+    }
+}
+
+/*
+ * Parses and runs "true" with up to 100k arguments. Building the
+ * argv walks every argument, so with O(1) append and indexing the
+ * time per argument should stay flat.
+ */
+static void bench_args()
+{
+    char errmsg[128];
+
+    printf("args: time per argument to parse, and to build argv and run\n");
+    for (int num_args = 12500; num_args <= 100000; num_args *= 2)
+    {
+        size_t len = 5 + 2 * num_args;
+        char *line = malloc(len + 1);
+        assert(line);
+        memcpy(line, "true ", 5);
+        for (int i = 0; i < num_args; i++)
+            memcpy(line + 5 + 2 * i, "a ", 2);
+        line[len] = '\0';
+
+        double t0 = now();
+        PipeTree tree = ParseLine(line, NULL, errmsg, sizeof(errmsg));
+        double parse = now() - t0;
+        assert(tree != NULL);
+
+        t0 = now();
+        int rc = PT_evaluate(tree);
+        double run = now() - t0;
+        assert(rc == 0);
+
+        PT_free(tree);
+        free(line);
+        printf("  %6d args  parse %8.2f ms  %6.1f ns/arg  run %8.2f ms\n", num_args, parse * 1e3,
+               parse * 1e9 / num_args, run * 1e3);
+    }
+}
+
+/*
+ * Returns the average time, in seconds, of expanding a pattern with
+ * GC_expand, and sets count to its number of matches
+ */
+static double time_expand(const char *pattern, int reps, size_t *count)
+{
+    double t0 = now();
+    for (int r = 0; r < reps; r++)
+    {
+        char *paths;
+        *count = GC_expand(pattern, NULL, &paths);
+        free(paths);
+    }
+    return (now() - t0) / reps;
+}
+
+/*
+ * Expands patterns in a directory of 100k files, and across 64
+ * subdirectories of 1000 files, with glob() and with GC_expand, cold
+ * and cached, sorted and unsorted
+ */
+static void bench_glob()
+{
+    const int num_files = 100000;
+    const int num_dirs = 64;
+    const int files_per_dir = 1000;
+    const int reps = 20;
+    char dir[] = "/tmp/ps_bench.XXXXXX";
+    char path[256];
+    char *old_cwd = getcwd(NULL, 0);
+
+    assert(mkdtemp(dir) != NULL);
+    for (int i = 0; i < num_files; i++)
+    {
+        snprintf(path, sizeof(path), "%s/f%06d.%s", dir, i, (i % 10 == 0) ? "log" : "dat");
+        close(open(path, O_WRONLY | O_CREAT, 0600));
+    }
+    for (int d = 0; d < num_dirs; d++)
+    {
+        snprintf(path, sizeof(path), "%s/d%02d", dir, d);
+        mkdir(path, 0700);
+        for (int i = 0; i < files_per_dir; i++)
+        {
+            snprintf(path, sizeof(path), "%s/d%02d/f%04d.%s", dir, d, i, (i % 10 == 0) ? "log" : "dat");
+            close(open(path, O_WRONLY | O_CREAT, 0600));
+        }
+    }
+
+    // a listing is only trusted once the directory is older than it
+    struct timespec times[2] = {{0, UTIME_OMIT}, {time(NULL) - 10, 0}};
+    utimensat(AT_FDCWD, dir, times, 0);
+    assert(chdir(dir) == 0);
+
+    printf("glob: %d files, and %d dirs of %d, %d reps\n", num_files, num_dirs, files_per_dir, reps);
+
+    const char *patterns[] = {"*.log", "*.none", "f*", "d*/*.log"};
+    for (int p = 0; p < 4; p++)
+    {
+        size_t ref_count = 0;
+        double t0 = now();
+        for (int r = 0; r < reps; r++)
+        {
+            glob_t glob_result = {0};
+            glob(patterns[p], GLOB_TILDE, NULL, &glob_result);
+            ref_count = glob_result.gl_pathc;
+            globfree(&glob_result);
+        }
+        double ref = (now() - t0) / reps;
+
+        size_t count = 0;
+        GC_clear();
+        double cold = time_expand(patterns[p], 1, &count);
+        assert(count == ref_count);
+
+        double warm = time_expand(patterns[p], reps, &count);
+        assert(count == ref_count);
+
+        GC_set_unsorted(true);
+        double unsorted = time_expand(patterns[p], reps, &count);
+        GC_set_unsorted(false);
+        assert(count == ref_count);
+
+        printf("  %-9s %6zu matches  glob %8.2f ms  cold %8.2f ms  warm %8.3f ms  (%.0fx)  unsorted %8.3f ms\n",
+               patterns[p], count, ref * 1e3, cold * 1e3, warm * 1e3, ref / warm, unsorted * 1e3);
+    }
+
+    GC_clear();
+    for (int i = 0; i < num_files; i++)
+    {
+        snprintf(path, sizeof(path), "%s/f%06d.%s", dir, i, (i % 10 == 0) ? "log" : "dat");
+        unlink(path);
+    }
+    for (int d = 0; d < num_dirs; d++)
+    {
+        for (int i = 0; i < files_per_dir; i++)
+        {
+            snprintf(path, sizeof(path), "%s/d%02d/f%04d.%s", dir, d, i, (i % 10 == 0) ? "log" : "dat");
+            unlink(path);
+        }
+        snprintf(path, sizeof(path), "%s/d%02d", dir, d);
+        rmdir(path);
+    }
+    rmdir(dir);
+    assert(chdir(old_cwd) == 0);
+    free(old_cwd);
+}
+
+// Number of paths matched by the nftw() walk in bench_tree
+static size_t tree_matches = 0;
+
+/*
+ * nftw() callback for the reference walk in bench_tree: counts the
+ * files named *.json under the current directory
+ */
+static int count_json(const char *path, const struct stat *sb, int type, struct FTW *ftw)
+{
+    if (type == FTW_F && fnmatch("*.json", path + ftw->base, FNM_PERIOD) == 0)
+        tree_matches++;
+    return 0;
+}
+
+/*
+ * nftw() callback to remove the tree built by bench_tree
+ */
+static int remove_path(const char *path, const struct stat *sb, int type, struct FTW *ftw)
+{
+    return remove(path);
+}
+
+/*
+ * Expands a globstar pattern for every *.json file in a tree of 4680
+ * directories, 8 wide and 4 deep, against a single-threaded nftw()
+ * and fnmatch() walk
+ */
+static void bench_tree()
+{
+    const int fanout = 8;
+    const int depth = 4;
+    const int files_per_dir = 16;
+    const int reps = 5;
+    char dir[] = "/tmp/ps_bench.XXXXXX";
+    char path[256];
+    char *old_cwd = getcwd(NULL, 0);
+    int num_dirs = 0;
+
+    // build the tree a level at a time; node n of a level is n's
+    // digits in base fanout
+    assert(mkdtemp(dir) != NULL);
+    for (int level = 1, width = fanout; level <= depth; level++, width *= fanout)
+    {
+        for (int n = 0; n < width; n++, num_dirs++)
+        {
+            int len = snprintf(path, sizeof(path), "%s", dir);
+            for (int l = level - 1, div = width / fanout; l >= 0; l--, div /= fanout)
+                len += snprintf(path + len, sizeof(path) - len, "/d%d", (n / div) % fanout);
+            mkdir(path, 0700);
+
+            for (int i = 0; i < files_per_dir; i++)
+            {
+                snprintf(path + len, sizeof(path) - len, "/f%02d.%s", i, (i % 4 == 0) ? "json" : "txt");
+                close(open(path, O_WRONLY | O_CREAT, 0600));
+            }
+        }
+    }
+    assert(chdir(dir) == 0);
+
+    printf("tree: %d dirs of %d files, %d reps\n", num_dirs, files_per_dir, reps);
+
+    double t0 = now();
+    for (int r = 0; r < reps; r++)
+    {
+        tree_matches = 0;
+        nftw(".", count_json, 64, FTW_PHYS);
+    }
+    double ref = (now() - t0) / reps;
+
+    size_t count = 0;
+    double sorted = time_expand("**/*.json", reps, &count);
+    assert(count == tree_matches);
+
+    GC_set_unsorted(true);
+    double unsorted = time_expand("**/*.json", reps, &count);
+    GC_set_unsorted(false);
+    assert(count == tree_matches);
+
+    printf("  %-9s %6zu matches  nftw %8.2f ms  ** %8.2f ms  (%.1fx)  unsorted %8.2f ms  (%ld cpus)\n",
+           "**/*.json", count, ref * 1e3, sorted * 1e3, ref / sorted, unsorted * 1e3, sysconf(_SC_NPROCESSORS_ONLN));
+
+    GC_clear();
+    assert(chdir(old_cwd) == 0);
+    nftw(dir, remove_path, 64, FTW_DEPTH | FTW_PHYS);
+    free(old_cwd);
+}
+
+/*
+ * Runs a command over 300k files, more than fit in one argv: peak
+ * heap and time of expanding the pattern lazily into batches, against
+ * expanding it in full first
+ */
+static void bench_batch()
+{
+    const int num_files = 300000;
+    char dir[] = "/tmp/ps_bench.XXXXXX";
+    char path[256];
+    char errmsg[128];
+    char *old_cwd = getcwd(NULL, 0);
+
+    assert(mkdtemp(dir) != NULL);
+    for (int i = 0; i < num_files; i++)
+    {
+        snprintf(path, sizeof(path), "%s/f%06d", dir, i);
+        close(open(path, O_WRONLY | O_CREAT, 0600));
+    }
+    struct timespec times[2] = {{0, UTIME_OMIT}, {time(NULL) - 10, 0}};
+    utimensat(AT_FDCWD, dir, times, 0);
+    assert(chdir(dir) == 0);
+
+    printf("batch: true f* over %d files, ARG_MAX %ld\n", num_files, sysconf(_SC_ARG_MAX));
+
+    // every match held at once, with an argv pointing into them
+    GC_clear();
+    live_bytes = peak_bytes = 0;
+    double t0 = now();
+    char *paths;
+    size_t count = GC_expand("f*", NULL, &paths);
+    char **argv = (char **)malloc((count + 2) * sizeof(char *));
+    char *p = paths;
+    for (size_t i = 0; i < count; i++, p += strlen(p) + 1)
+        argv[i + 1] = p;
+    free(argv);
+    free(paths);
+    printf("  %-16s %8.2f ms  peak heap %6zu KB  (expansion only; execvp would fail)\n", "full expansion",
+           (now() - t0) * 1e3, peak_bytes / 1024);
+
+    for (int jobs = 1; jobs <= 4; jobs *= 4)
+    {
+        char line[] = "true f*";
+        PT_set_batch_jobs(jobs);
+        GC_clear();
+        live_bytes = peak_bytes = 0;
+        t0 = now();
+        PipeTree tree = ParseLine(line, NULL, errmsg, sizeof(errmsg));
+        int rc = PT_evaluate(tree);
+        PT_free(tree);
+        printf("  batches, %d job%s %8.2f ms  peak heap %6zu KB  status %d\n", jobs, jobs > 1 ? "s" : " ",
+               (now() - t0) * 1e3, peak_bytes / 1024, rc);
+    }
+    PT_set_batch_jobs(1);
+
+    GC_clear();
+    for (int i = 0; i < num_files; i++)
+    {
+        snprintf(path, sizeof(path), "%s/f%06d", dir, i);
+        unlink(path);
+    }
+    rmdir(dir);
+    assert(chdir(old_cwd) == 0);
+    free(old_cwd);
+}
+
+/*
+ * Expands file{1..1000000}.dat: peak heap and time of a Token per
+ * expansion, as an eager expansion in the tokenizer would build,
+ * against generating them lazily, alone and as the arguments of a
+ * command run in batches
+ */
+static void bench_brace()
+{
+    const char *word = "file{1..1000000}.dat";
+    char errmsg[128];
+
+    printf("brace: %s\n", word);
+
+    // a Token for every expansion
+    live_bytes = peak_bytes = 0;
+    double t0 = now();
+    BraceGen gen = BR_open(word);
+    size_t count = BR_count(gen);
+    Token *tokens = (Token *)malloc(count * sizeof(Token));
+    const char *expansion;
+    for (size_t i = 0; (expansion = BR_next(gen)) != NULL; i++)
+    {
+        tokens[i].type = TOK_WORD;
+        tokens[i].word = strdup(expansion);
+    }
+    BR_close(gen);
+    double elapsed = now() - t0;
+    for (size_t i = 0; i < count; i++)
+        free(tokens[i].word);
+    free(tokens);
+    printf("  %-16s %8.2f ms  peak heap %6zu KB\n", "eager tokens", elapsed * 1e3, peak_bytes / 1024);
+
+    live_bytes = peak_bytes = 0;
+    t0 = now();
+    gen = BR_open(word);
+    size_t lazy_count = 0;
+    while (BR_next(gen) != NULL)
+        lazy_count++;
+    BR_close(gen);
+    assert(lazy_count == count);
+    printf("  %-16s %8.2f ms  peak heap %6zu KB\n", "generator", (now() - t0) * 1e3, peak_bytes / 1024);
+
+    char line[64];
+    snprintf(line, sizeof(line), "true %s", word);
+    live_bytes = peak_bytes = 0;
+    t0 = now();
+    PipeTree tree = ParseLine(line, NULL, errmsg, sizeof(errmsg));
+    int rc = PT_evaluate(tree);
+    PT_free(tree);
+    printf("  %-16s %8.2f ms  peak heap %6zu KB  status %d\n", "true, batches", (now() - t0) * 1e3, peak_bytes / 1024,
+           rc);
+}
+
+/*
+ * Parses the recorded command lines into heap trees, as the history
+ * of a session would hold them, and keeps every tree: allocations per
+ * line, and the heap the trees hold, with each word copied and with
+ * the words interned. Interned strings are never freed, so the copied
+ * numbers are only meaningful when no benchmark has filled the table
+ * before this one, i.e. run as "./ps_bench intern".
+ */
+static void bench_intern()
+{
+    const int num_lines = sizeof(recorded_lines) / sizeof(recorded_lines[0]);
+    const int reps = 2000;
+    PipeTree *trees = (PipeTree *)malloc(reps * num_lines * sizeof(PipeTree));
+    char errmsg[128];
+    char line[256];
+
+    printf("intern: %d recorded lines, %d reps, every tree kept\n", num_lines, reps);
+
+    // copies first, so the table is still empty
+    size_t old_limit = IN_set_limit(0);
+    for (int mode = 0; mode < 2; mode++)
+    {
+        if (mode == 1)
+            IN_set_limit(old_limit);
+
+        num_allocs = 0;
+        size_t live_before = live_bytes;
+        double t0 = now();
+        for (int r = 0; r < reps; r++)
+        {
+            for (int i = 0; i < num_lines; i++)
+            {
+                strcpy(line, recorded_lines[i]);
+                TList tokens = TOK_tokenize_input(line, errmsg, sizeof(errmsg));
+                assert(tokens != NULL);
+                trees[r * num_lines + i] = Parse(tokens, errmsg, sizeof(errmsg));
+                assert(trees[r * num_lines + i] != NULL);
+                TOK_free(tokens);
+            }
+        }
+        double t = now() - t0;
+        size_t held = live_bytes - live_before;
+
+        const char *names[] = {"copied", "interned"};
+        printf("  %-9s %6.2f allocs/line  %7.2f us/line  trees hold %6zu KB  (%zu strings interned)\n", names[mode],
+               (double)num_allocs / reps / num_lines, t * 1e6 / reps / num_lines, held / 1024, IN_count());
+
+        for (int i = 0; i < reps * num_lines; i++)
+            PT_free(trees[i]);
+    }
+
+    free(trees);
+}
+
+/*
+ * Runs one stage of a pipeline the way the shell used to, for
+ * bench_spawn: a child for this stage and a child for the rest, each
+ * evaluating its part, which forks again to run the command
+ */
+static void run_nested(PipeTree *stages, int i, int n)
+{
+    if (i == n - 1)
+    {
+        PT_evaluate(stages[i]);
+        return;
+    }
+
+    int pipefd[2];
+    assert(pipe(pipefd) == 0);
+
+    pid_t left = fork();
+    if (left == 0)
+    {
+        close(pipefd[0]);
+        dup2(pipefd[1], STDOUT_FILENO);
+        close(pipefd[1]);
+        PT_evaluate(stages[i]);
+        exit(EXIT_SUCCESS);
+    }
+
+    pid_t right = fork();
+    if (right == 0)
+    {
+        close(pipefd[1]);
+        dup2(pipefd[0], STDIN_FILENO);
+        close(pipefd[0]);
+        run_nested(stages, i + 1, n);
+        exit(EXIT_SUCCESS);
+    }
+
+    close(pipefd[0]);
+    close(pipefd[1]);
+    waitpid(left, NULL, 0);
+    waitpid(right, NULL, 0);
+}
+
+/*
+ * Spawn latency of a 50-stage pipeline of true: forking a child for
+ * each side of each pipe, each of which forks the command, against
+ * forking every stage straight from the shell
+ */
+static void bench_spawn()
+{
+    const int num_stages = 50;
+    const int reps = 20;
+    PipeTree stages[num_stages];
+    char errmsg[128];
+    char line[num_stages * 8];
+
+    printf("spawn: %d-stage pipeline of true, %d reps\n", num_stages, reps);
+    fflush(stdout);
+
+    size_t pos = 0;
+    for (int i = 0; i < num_stages; i++)
+    {
+        stages[i] = PT_word("true", NULL);
+        pos += sprintf(line + pos, (i == 0) ? "true" : " | true");
+    }
+
+    double t0 = now();
+    for (int r = 0; r < reps; r++)
+        run_nested(stages, 0, num_stages);
+    printf("  %-8s %8.2f ms/pipeline\n", "nested", (now() - t0) * 1e3 / reps);
+    fflush(stdout);
+
+    PipeTree tree = ParseLine(line, NULL, errmsg, sizeof(errmsg));
+    assert(tree != NULL);
+    t0 = now();
+    for (int r = 0; r < reps; r++)
+        assert(PT_evaluate(tree) == 0);
+    printf("  %-8s %8.2f ms/pipeline\n", "flat", (now() - t0) * 1e3 / reps);
+
+    PT_free(tree);
+    for (int i = 0; i < num_stages; i++)
+        PT_free(stages[i]);
+}
+
+// A machine-generated pipeline, and what bench_stages measures on it
+typedef struct
+{
+    char *line;
+    size_t len;
+    int num_stages;
+    double parse, parse_line, stringify, free;
+    size_t string_len;
+    int count;
+    int depth;
+} StageRun;
+
+/*
+ * Parse, stringify and free a pipeline with every stage, as run on a
+ * thread for bench_stages
+ */
+static void *run_stages(void *arg)
+{
+    StageRun *run = (StageRun *)arg;
+    char errmsg[128];
+
+    char *copy = strdup(run->line);
+    double t0 = now();
+    TList tokens = TOK_tokenize_input(copy, errmsg, sizeof(errmsg));
+    PipeTree tree = Parse(tokens, errmsg, sizeof(errmsg));
+    run->parse = now() - t0;
+    assert(tree != NULL);
+    TOK_free(tokens);
+    run->count = PT_count(tree);
+    run->depth = PT_depth(tree);
+
+    size_t buf_sz = 2 * run->len;
+    char *buf = malloc(buf_sz);
+    t0 = now();
+    run->string_len = PT_tree2string(tree, buf, buf_sz);
+    run->stringify = now() - t0;
+    free(buf);
+
+    t0 = now();
+    PT_free(tree);
+    run->free = now() - t0;
+
+    strcpy(copy, run->line);
+    t0 = now();
+    tree = ParseLine(copy, NULL, errmsg, sizeof(errmsg));
+    run->parse_line = now() - t0;
+    assert(tree != NULL);
+    PT_free(tree);
+    free(copy);
+    return NULL;
+}
+
+/*
+ * Parses, stringifies and frees a generated pipeline of 100k stages.
+ * The work runs on a thread with a 64 KB stack, far too small for
+ * anything that recursed once per stage.
+ */
+static void bench_stages()
+{
+    const int num_stages = 100000;
+    StageRun run = {0};
+    run.num_stages = num_stages;
+    run.line = malloc(num_stages * 32);
+    assert(run.line);
+
+    for (int i = 0; i < num_stages; i++)
+        run.len += sprintf(run.line + run.len, "%scmd%d -x <in%d", (i == 0) ? "" : " | ", i % 100, i);
+
+    printf("stages: %d stages, %zu KB line, 64 KB stack\n", num_stages, run.len / 1024);
+
+    pthread_attr_t attr;
+    pthread_t thread;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, 64 * 1024);
+    assert(pthread_create(&thread, &attr, run_stages, &run) == 0);
+    pthread_join(thread, NULL);
+    pthread_attr_destroy(&attr);
+
+    assert(run.count == 2 * num_stages - 1 && run.depth == num_stages);
+    printf("  %-10s %8.2f ms\n", "parse", run.parse * 1e3);
+    printf("  %-10s %8.2f ms\n", "ParseLine", run.parse_line * 1e3);
+    printf("  %-10s %8.2f ms  (%zu KB)\n", "stringify", run.stringify * 1e3, run.string_len / 1024);
+    printf("  %-10s %8.2f ms\n", "free", run.free * 1e3);
+
+    free(run.line);
+}
+
+/*
+ * Parses a few hundred distinct command lines, made from the recorded
+ * ones, again and again, as automation sending the same commands
+ * would: from scratch each time, and through the parse cache
+ */
+static void bench_parsecache()
+{
+    const int num_recorded = sizeof(recorded_lines) / sizeof(recorded_lines[0]);
+    const int num_lines = 300;
+    const int rounds = 200;
+    char errmsg[128];
+    char *lines[num_lines];
+
+    for (int i = 0; i < num_lines; i++)
+    {
+        // the command name is numbered, e.g. ls17 -l
+        const char *recorded = recorded_lines[i % num_recorded];
+        int name_len = strcspn(recorded, " ");
+        lines[i] = malloc(300);
+        sprintf(lines[i], "%.*s%d%s", name_len, recorded, i, recorded + name_len);
+    }
+
+    printf("parsecache: %d distinct lines, %d rounds\n", num_lines, rounds);
+
+    char line[300];
+    num_allocs = 0;
+    double t0 = now();
+    for (int r = 0; r < rounds; r++)
+    {
+        for (int i = 0; i < num_lines; i++)
+        {
+            strcpy(line, lines[i]);
+            PipeTree tree = ParseLine(line, NULL, errmsg, sizeof(errmsg));
+            assert(tree != NULL);
+            PT_free(tree);
+        }
+    }
+    double t = now() - t0;
+    printf("  %-8s %7.3f us/line  %6.2f allocs/line\n", "parse", t * 1e6 / rounds / num_lines,
+           (double)num_allocs / rounds / num_lines);
+
+    PC_clear();
+    num_allocs = 0;
+    t0 = now();
+    for (int r = 0; r < rounds; r++)
+    {
+        for (int i = 0; i < num_lines; i++)
+            assert(PC_parse(lines[i], errmsg, sizeof(errmsg)) != NULL);
+    }
+    t = now() - t0;
+    printf("  %-8s %7.3f us/line  %6.2f allocs/line  %zu hits, %zu misses\n", "cached", t * 1e6 / rounds / num_lines,
+           (double)num_allocs / rounds / num_lines, PC_hits(), PC_misses());
+
+    PC_clear();
+    for (int i = 0; i < num_lines; i++)
+        free(lines[i]);
+}
+
+/*
+ * Loads a generated script of recorded lines into trees: compiling it,
+ * which tokenizes and parses it and writes its cache file, and then
+ * from the cache file, which is mapped and deserialized
+ */
+static void bench_script()
+{
+    const int num_recorded = sizeof(recorded_lines) / sizeof(recorded_lines[0]);
+    const int num_lines = 50000;
+    const int rounds = 5;
+    char errmsg[128];
+    char path[] = "/tmp/ps_bench.XXXXXX";
+    char cache_path[64];
+
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    FILE *f = fdopen(fd, "w");
+    assert(f);
+    for (int i = 0; i < num_lines; i++)
+        fprintf(f, "%s\n", recorded_lines[i % num_recorded]);
+    long size = ftell(f);
+    fclose(f);
+    snprintf(cache_path, sizeof(cache_path), "%s%s", path, SC_SUFFIX);
+
+    printf("script: %d lines, %ld KB\n", num_lines, size / 1024);
+
+    for (int mode = 0; mode < 2; mode++)
+    {
+        double open_time = 0;
+        double load_time = 0;
+        for (int r = 0; r < rounds; r++)
+        {
+            if (mode == 0)
+                unlink(cache_path);
+
+            double t0 = now();
+            Script script = SC_open(path, errmsg, sizeof(errmsg));
+            assert(script != NULL && SC_from_cache(script) == (mode == 1));
+            double t1 = now();
+            for (size_t i = 0; i < SC_num_commands(script); i++)
+            {
+                PipeTree tree = SC_command(script, i, NULL);
+                assert(tree != NULL);
+                PT_free(tree);
+            }
+            double t2 = now();
+            SC_close(script);
+
+            open_time += t1 - t0;
+            load_time += t2 - t1;
+        }
+
+        struct stat st;
+        assert(stat(cache_path, &st) == 0);
+        printf("  %-8s open %8.2f ms  trees %7.2f ms  %6.3f us/line  (cache file %ld KB)\n",
+               (mode == 0) ? "compile" : "cached", open_time * 1e3 / rounds, load_time * 1e3 / rounds,
+               (open_time + load_time) * 1e6 / rounds / num_lines, (long)st.st_size / 1024);
+    }
+
+    unlink(cache_path);
+    unlink(path);
+}
+
+/*
+ * TL_foreach callback for bench_tostring: appends a token to the
+ * string with strcat, which finds the end of the string each time, as
+ * PT_tree2string did before it tracked the length
+ */
+static void strcat_callback(int pos, TListElementType token, void *cb_data)
+{
+    char *buf = (char *)cb_data;
+    strcat(buf, " ");
+    strcat(buf, (token.type == TOK_WORD) ? token.word : TT_to_str(token.type));
+}
+
+/*
+ * Stringifies pipelines of a few KB to a few hundred: into a fixed
+ * buffer with PT_tree2string, into a growing StrBuilder, and, for
+ * reference, by clearing the buffer and strcat'ing each word. The
+ * time per KB should stay flat for the first two.
+ */
+static void bench_tostring()
+{
+    char errmsg[128];
+    const int reps = 20;
+
+    printf("tostring: time to stringify a pipeline, per KB of output\n");
+    for (int num_stages = 64; num_stages <= 16384; num_stages *= 4)
+    {
+        char *line = malloc(num_stages * 40);
+        assert(line);
+        size_t len = 0;
+        for (int i = 0; i < num_stages; i++)
+            len += sprintf(line + len, "%sgrep -v pattern%d <in%d.txt", (i == 0) ? "" : " | ", i, i);
+
+        char *copy = strdup(line);
+        PipeTree tree = ParseLine(copy, NULL, errmsg, sizeof(errmsg));
+        assert(tree != NULL);
+        TList tokens = TOK_tokenize_input(line, errmsg, sizeof(errmsg));
+        assert(tokens != NULL);
+
+        size_t buf_sz = 2 * len;
+        char *buf = malloc(buf_sz);
+        assert(buf);
+
+        double t0 = now();
+        size_t out_len = 0;
+        for (int r = 0; r < reps; r++)
+            out_len = PT_tree2string(tree, buf, buf_sz);
+        double fixed = (now() - t0) / reps;
+
+        t0 = now();
+        for (int r = 0; r < reps; r++)
+        {
+            StrBuilder sb;
+            SB_init_dynamic(&sb);
+            PT_append_string(tree, &sb);
+            assert(SB_length(&sb) == out_len);
+            SB_free(&sb);
+        }
+        double dynamic = (now() - t0) / reps;
+
+        // strcat is quadratic; a single run of it is plenty
+        t0 = now();
+        memset(buf, 0, buf_sz);
+        TL_foreach(tokens, strcat_callback, buf);
+        double reference = now() - t0;
+
+        double kb = out_len / 1024.0;
+        printf("  %6.1f KB  fixed %8.2f us/KB  builder %8.2f us/KB  strcat %10.2f us/KB\n", kb,
+               fixed * 1e6 / kb, dynamic * 1e6 / kb, reference * 1e6 / kb);
+
+        TOK_free(tokens);
+        PT_free(tree);
+        free(copy);
+        free(buf);
+        free(line);
+    }
+}
+
+/*
+ * Latency of a list of commands with && || ; and 2>&1, run by the
+ * shell itself against handing the whole line to sh -c, which costs
+ * a fork and exec of a second shell on top of the commands. They are
+ * named by path, so that sh does not run them as builtins.
+ */
+static void bench_lists()
+{
+    const int reps = 200;
+    char errmsg[128];
+    char native[] = "/bin/true && /bin/false || /bin/true ; /bin/true 2>&1";
+    char wrapped[] = "sh -c \"/bin/true && /bin/false || /bin/true ; /bin/true 2>&1\"";
+
+    printf("lists: %s, %d reps\n", native, reps);
+
+    // the commands' own failures would flood the output
+    int saved_stderr = dup(STDERR_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    assert(saved_stderr >= 0 && null_fd >= 0);
+
+    const char *names[] = {"native", "sh -c"};
+    char *lines[] = {native, wrapped};
+    double ms[2];
+    for (int i = 0; i < 2; i++)
+    {
+        PipeTree tree = ParseLine(lines[i], NULL, errmsg, sizeof(errmsg));
+        assert(tree != NULL);
+
+        dup2(null_fd, STDERR_FILENO);
+        double t0 = now();
+        for (int r = 0; r < reps; r++)
+            assert(PT_evaluate(tree) == 0);
+        ms[i] = (now() - t0) * 1e3 / reps;
+        dup2(saved_stderr, STDERR_FILENO);
+
+        PT_free(tree);
+    }
+
+    for (int i = 0; i < 2; i++)
+        printf("  %-8s %8.3f ms/line\n", names[i], ms[i]);
+
+    close(null_fd);
+    close(saved_stderr);
+}
+
+/*
+ * Latency of lines full of cat stages, run as parsed and once
+ * PT_optimize has removed the cats and made the copy in the shell
+ */
+static void bench_optimize()
+{
+    const int reps = 200;
+    const char *lines[] = {"cat bench_opt.tmp | cat | wc -l >/dev/null", "cat bench_opt.tmp >bench_opt.out"};
+    const int num_lines = sizeof(lines) / sizeof(lines[0]);
+
+    FILE *fp = fopen("bench_opt.tmp", "w");
+    assert(fp != NULL);
+    for (int i = 0; i < 10000; i++)
+        fprintf(fp, "line %d of the file being copied\n", i);
+    fclose(fp);
+
+    printf("optimize: %d reps\n", reps);
+
+    unsigned old_rules = PT_set_optimizations(PT_OPT_ALL);
+    for (int l = 0; l < num_lines; l++)
+    {
+        double ms[2];
+        for (int optimized = 0; optimized < 2; optimized++)
+        {
+            char line[128];
+            char errmsg[128];
+            snprintf(line, sizeof(line), "%s", lines[l]);
+            PipeTree tree = ParseLine(line, NULL, errmsg, sizeof(errmsg));
+            assert(tree != NULL);
+            if (optimized)
+                PT_optimize(tree);
+
+            double t0 = now();
+            for (int r = 0; r < reps; r++)
+                assert(PT_evaluate(tree) == 0);
+            ms[optimized] = (now() - t0) * 1e3 / reps;
+
+            PT_free(tree);
+        }
+
+        printf("  %s\n    as parsed %8.3f ms/line, optimized %8.3f ms/line\n", lines[l], ms[0], ms[1]);
+    }
+    PT_set_optimizations(old_rules);
+
+    unlink("bench_opt.tmp");
+    unlink("bench_opt.out");
+}
+
+/*
+ * Latency of starting commands by fork and by posix_spawn as the
+ * shell's resident memory grows: fork copies page tables in
+ * proportion to it, posix_spawn does not
+ */
+static void bench_backends()
+{
+    const int reps = 100;
+    const size_t sizes_mb[] = {0, 256, 1024};
+    const int num_sizes = sizeof(sizes_mb) / sizeof(sizes_mb[0]);
+    const char *names[] = {"fork", "spawn"};
+    const int backends[] = {PT_SPAWN_FORK, PT_SPAWN_POSIX};
+    char errmsg[128];
+    char command[] = "/bin/true";
+    char pipeline[] = "/bin/true | /bin/true | /bin/true | /bin/true";
+
+    printf("backends: /bin/true and a 4-stage pipeline of it, %d reps\n", reps);
+    int old_backend = PT_set_spawn(PT_SPAWN_POSIX);
+
+    PipeTree trees[2];
+    trees[0] = ParseLine(command, NULL, errmsg, sizeof(errmsg));
+    trees[1] = ParseLine(pipeline, NULL, errmsg, sizeof(errmsg));
+    assert(trees[0] != NULL && trees[1] != NULL);
+
+    for (int s = 0; s < num_sizes; s++)
+    {
+        // memory the shell has touched, and fork must map in the child
+        size_t ballast_sz = sizes_mb[s] << 20;
+        char *ballast = NULL;
+        if (ballast_sz > 0)
+        {
+            ballast = mmap(NULL, ballast_sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            assert(ballast != MAP_FAILED);
+            memset(ballast, 1, ballast_sz);
+        }
+
+        printf("  RSS +%4zu MB\n", sizes_mb[s]);
+        for (int b = 0; b < 2; b++)
+        {
+            PT_set_spawn(backends[b]);
+            double ms[2];
+            for (int t = 0; t < 2; t++)
+            {
+                double t0 = now();
+                for (int r = 0; r < reps; r++)
+                    assert(PT_evaluate(trees[t]) == 0);
+                ms[t] = (now() - t0) * 1e3 / reps;
+            }
+            printf("    %-6s %8.3f ms/command %8.3f ms/pipeline\n", names[b], ms[0], ms[1]);
+        }
+
+        if (ballast != NULL)
+            munmap(ballast, ballast_sz);
+    }
+
+    PT_set_spawn(old_backend);
+    PT_free(trees[0]);
+    PT_free(trees[1]);
+}
+
+typedef struct
+{
+    const char *name;
+    void (*run)();
+} Benchmark;
+
+static const Benchmark benchmarks[] = {
+    {"scan", bench_scan},
+    {"longword", bench_longword},
+    {"alloc", bench_alloc},
+    {"fused", bench_fused},
+    {"tlist", bench_tlist},
+    {"args", bench_args},
+    {"glob", bench_glob},
+    {"batch", bench_batch},
+    {"tree", bench_tree},
+    {"brace", bench_brace},
+    {"intern", bench_intern},
+    {"spawn", bench_spawn},
+    {"stages", bench_stages},
+    {"parsecache", bench_parsecache},
+    {"script", bench_script},
+    {"tostring", bench_tostring},
+    {"lists", bench_lists},
+    {"optimize", bench_optimize},
+    {"backends", bench_backends},
+};
+
+int main(int argc, char *argv[])
+{
+    const int num_benchmarks = sizeof(benchmarks) / sizeof(Benchmark);
+
+    for (int i = 0; i < num_benchmarks; i++)
+    {
+        bool selected = (argc == 1);
+        for (int a = 1; a < argc; a++)
+            selected = selected || strcmp(argv[a], benchmarks[i].name) == 0;
+
+        if (selected)
+            benchmarks[i].run();
+    }
+
+    return 0;
+}
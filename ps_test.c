@@ -5,11 +5,26 @@
 #include <ctype.h>  // isblank
 #include <math.h>   // fabs
 #include <stdbool.h>
+#include <stddef.h> // max_align_t
+#include <glob.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <signal.h>
 
 #include "token.h"
 #include "tokenize.h"
 #include "parse.h"
 #include "pipeline.h"
+#include "scan.h"
+#include "clist.h"
+#include "globcache.h"
+#include "brace.h"
+#include "intern.h"
+#include "parsecache.h"
+#include "scriptcache.h"
+#include "strbuild.h"
 
 // Checks that value is true; if not, prints a failure message and
 // returns 0 from this function
@@ -100,8 +115,14 @@ int test_tokenization()
             {"<", {{TOK_LESSTHAN}, {TOK_END}}},
             {">", {{TOK_GREATERTHAN}, {TOK_END}}},
             {"|", {{TOK_PIPE}, {TOK_END}}},
-            {">><<", {{TOK_GREATERTHAN}, {TOK_GREATERTHAN}, {TOK_LESSTHAN}, {TOK_LESSTHAN}, {TOK_END}}},
-            {">>|<<", {{TOK_GREATERTHAN}, {TOK_GREATERTHAN}, {TOK_PIPE}, {TOK_LESSTHAN}, {TOK_LESSTHAN}, {TOK_END}}},
+            {">><<", {{TOK_APPEND}, {TOK_LESSTHAN}, {TOK_LESSTHAN}, {TOK_END}}},
+            {">>|<<", {{TOK_APPEND}, {TOK_PIPE}, {TOK_LESSTHAN}, {TOK_LESSTHAN}, {TOK_END}}},
+            {">>>", {{TOK_APPEND}, {TOK_GREATERTHAN}, {TOK_END}}},
+            // sequences, lists and descriptor redirections
+            {"a;b&c&&d||e", {{TOK_WORD, .word = "a"}, {TOK_SEMI}, {TOK_WORD, .word = "b"}, {TOK_AMP}, {TOK_WORD, .word = "c"}, {TOK_AND}, {TOK_WORD, .word = "d"}, {TOK_OR}, {TOK_WORD, .word = "e"}, {TOK_END}}},
+            {"cc 2>err 2>>log 2>&1 |& cat", {{TOK_WORD, .word = "cc"}, {TOK_ERR_GREATERTHAN}, {TOK_WORD, .word = "err"}, {TOK_ERR_APPEND}, {TOK_WORD, .word = "log"}, {TOK_ERR_TO_OUT}, {TOK_PIPE_ERR}, {TOK_WORD, .word = "cat"}, {TOK_END}}},
+            {"echo 2 > a2>b", {{TOK_WORD, .word = "echo"}, {TOK_WORD, .word = "2"}, {TOK_GREATERTHAN}, {TOK_WORD, .word = "a2"}, {TOK_GREATERTHAN}, {TOK_WORD, .word = "b"}, {TOK_END}}},
+            {"echo \\; \\&\"a;b&c\"", {{TOK_WORD, .word = "echo"}, {TOK_WORD, .word = ";"}, {TOK_WORD, .word = "&"}, {TOK_QUOTED_WORD, .word = "a;b&c"}, {TOK_END}}},
             // all tokens
             {"echo \"Hello\\tWorld\\n\" > output.txt | cat < output.txt | grep \"Hello\\tWorld\\n\"", {{TOK_WORD, .word = "echo"}, {TOK_QUOTED_WORD, .word = "Hello\tWorld\n"}, {TOK_GREATERTHAN}, {TOK_WORD, .word = "output.txt"}, {TOK_PIPE}, {TOK_WORD, .word = "cat"}, {TOK_LESSTHAN}, {TOK_WORD, .word = "output.txt"}, {TOK_PIPE}, {TOK_WORD, .word = "grep"}, {TOK_QUOTED_WORD, .word = "Hello\tWorld\n"}, {TOK_END}}}};
     const int num_tests = sizeof(tests) / sizeof(test_matrix_t);
@@ -126,6 +147,24 @@ int test_tokenization()
         list = NULL;
     }
 
+    // A multi-megabyte word, with escapes so that it is copied
+    {
+        const size_t big = 4 * 1024 * 1024;
+        char *input = malloc(big + 8);
+        assert(input);
+        memset(input, 'w', big);
+        memcpy(input + big / 2, "\\t", 2);
+        input[big] = '\0';
+
+        list = TOK_tokenize_input(input, errmsg, sizeof(errmsg));
+        test_assert(list != NULL && TL_length(list) == 1);
+        test_assert(TOK_next(list).len == big - 1 && TOK_next(list).word[big / 2] == '\t');
+        test_assert(strlen(TOK_next(list).word) == big - 1);
+        TOK_free(list);
+        list = NULL;
+        free(input);
+    }
+
     // Test erroneous inputs
     
     // Illegal escape sequence in regular word
@@ -223,12 +262,13 @@ int test_parsing()
 
         for (int j = 0; test_cases[i].tokens[j].type != TOK_END; j++)
         {
-            Token token;
+            Token token = {0};
             token.type = test_cases[i].tokens[j].type;
             if (token.type == TOK_WORD || token.type == TOK_QUOTED_WORD)
             {
                 token.word = strdup(test_cases[i].tokens[j].word);
                 assert(token.word);
+                token.len = strlen(token.word);
             }
             TL_append(tokens, token);
         }
@@ -316,9 +356,16 @@ int test_parsing()
     TOK_free(tokens);
     PT_free(tree);
 
-    // No command specified  echo || real_file.txt
+    // || is an operator of its own: echo || real_file.txt is a list
     tokens = TOK_tokenize_input(" echo || real_file.txt", errmsg, sizeof(errmsg));
     tree = Parse(tokens, errmsg, sizeof(errmsg));
+    test_assert(tree != NULL && PT_count(tree) == 3);
+    TOK_free(tokens);
+    PT_free(tree);
+
+    // No command specified  echo || | real_file.txt
+    tokens = TOK_tokenize_input(" echo || | real_file.txt", errmsg, sizeof(errmsg));
+    tree = Parse(tokens, errmsg, sizeof(errmsg));
     test_assert(tree == NULL);
     test_assert(strcmp(errmsg, "No command specified") == 0);
     TOK_free(tokens);
@@ -330,15 +377,1736 @@ test_error:
     return 0;
 }
 
-int main()
+/*
+ * Tests TOK_tokenize_spans, and parsing of borrowed words
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_spans()
 {
-    int passed = 0;
-    int num_tests = 0;
+    char errmsg[128] = {'\0'};
+    char line[] = "grep -v \"a b\" x\\ y <in.txt >out.txt";
+    TList tokens = TOK_tokenize_spans(line, NULL, errmsg, sizeof(errmsg));
+    PipeTree tree = NULL;
 
-    num_tests++;
-    passed += test_tokenization();
-    num_tests++;
-    passed += test_parsing();
+    test_assert(tokens != NULL);
+    test_assert(TL_length(tokens) == 8);
+
+    // escape-free words are borrowed spans into the line
+    Token tok = TL_nth(tokens, 0);
+    test_assert(tok.borrowed && tok.word == line && tok.offset == 0 && tok.len == 4);
+    tok = TL_nth(tokens, 2);
+    test_assert(tok.type == TOK_QUOTED_WORD && tok.borrowed && tok.offset == 9 && tok.len == 3);
+
+    // words with escapes are copied
+    tok = TL_nth(tokens, 3);
+    test_assert(!tok.borrowed && strcmp(tok.word, "x y") == 0 && tok.len == 3);
+
+    // parsing terminates the borrowed words in place
+    tree = Parse(tokens, errmsg, sizeof(errmsg));
+    test_assert(tree != NULL);
+    test_assert(test_pipeline(tree, "grep", (const char *[]){"-v", "a b", "x y", NULL}, 3, "in.txt", "out.txt"));
+
+    TOK_free(tokens);
+    PT_free(tree);
+    return 1;
+
+test_error:
+    TOK_free(tokens);
+    PT_free(tree);
+    return 0;
+}
+
+/*
+ * Tests the arena allocator, and tokenizing and parsing into an arena
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_arena()
+{
+    char errmsg[128] = {'\0'};
+    Arena arena = AR_new();
+
+    // allocations are aligned, and the last one grows in place
+    char *a = AR_alloc(arena, 3);
+    double *d = AR_alloc(arena, sizeof(double));
+    test_assert(((size_t)d % _Alignof(max_align_t)) == 0);
+    char *s = AR_strdup(arena, "abc");
+    char *grown = AR_realloc(arena, s, 4, 64);
+    test_assert(grown == s && strcmp(grown, "abc") == 0);
+    test_assert(a != (char *)d);
+
+    // a large allocation survives smaller ones around it
+    char *big = AR_alloc(arena, 100000);
+    memset(big, 'b', 100000);
+    AR_strdup(arena, "after");
+    test_assert(big[0] == 'b' && big[99999] == 'b');
+
+    // build whole commands in the arena, more than once
+    for (int round = 0; round < 3; round++)
+    {
+        char line[] = "cat \\<in\\> \"a\\\\b\" <in.txt";
+        TList tokens = TOK_tokenize_spans(line, arena, errmsg, sizeof(errmsg));
+        test_assert(tokens != NULL && TL_arena(tokens) == arena);
+
+        PipeTree tree = Parse(tokens, errmsg, sizeof(errmsg));
+        test_assert(tree != NULL);
+        test_assert(test_pipeline(tree, "cat", (const char *[]){"<in>", "a\\b", NULL}, 2, "in.txt", NULL));
+
+        char pipeline[] = "cat x | grep -v y | wc >out.txt";
+        tokens = TOK_tokenize_spans(pipeline, arena, errmsg, sizeof(errmsg));
+        tree = Parse(tokens, errmsg, sizeof(errmsg));
+        test_assert(tree != NULL && PT_count(tree) == 5 && PT_depth(tree) == 3);
+
+        // both are no-ops; the arena owns everything
+        TOK_free(tokens);
+        PT_free(tree);
+        AR_reset(arena);
+    }
+
+    AR_free(arena);
+    return 1;
+
+test_error:
+    AR_free(arena);
+    return 0;
+}
+
+/*
+ * Tests ParseLine, which parses while it tokenizes, against Parse on
+ * a complete token list
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_parse_line()
+{
+    char errmsg[128] = {'\0'};
+    char list_errmsg[128] = {'\0'};
+    PipeTree tree = NULL;
+
+    char line[] = "grep -v \"a b\" x\\ y <in.txt >out.txt";
+    tree = ParseLine(line, NULL, errmsg, sizeof(errmsg));
+    test_assert(tree != NULL);
+    test_assert(test_pipeline(tree, "grep", (const char *[]){"-v", "a b", "x y", NULL}, 3, "in.txt", "out.txt"));
+    PT_free(tree);
+
+    char piped[] = "cat x|grep y | wc -l>out.txt";
+    tree = ParseLine(piped, NULL, errmsg, sizeof(errmsg));
+    test_assert(tree != NULL && PT_count(tree) == 5 && PT_depth(tree) == 3);
+    PT_free(tree);
+
+    // a blank line is not an error
+    char blank[] = "  \t ";
+    tree = ParseLine(blank, NULL, errmsg, sizeof(errmsg));
+    test_assert(tree == NULL && errmsg[0] == '\0');
+
+    // errors match the two-pass path, and leave the line unchanged
+    const char *bad[] = {"ls |", "ls > a > b", "echo a \\q b", "echo a b \"c d", "< in.txt", "ls\t|cat\"x\"\t| |", NULL};
+    for (int i = 0; bad[i] != NULL; i++)
+    {
+        char copy[64];
+        strcpy(copy, bad[i]);
+
+        tree = ParseLine(copy, NULL, errmsg, sizeof(errmsg));
+        test_assert(tree == NULL);
+        test_assert(strcmp(copy, bad[i]) == 0);
+
+        TList tokens = TOK_tokenize_input(bad[i], list_errmsg, sizeof(list_errmsg));
+        if (tokens != NULL)
+        {
+            test_assert(Parse(tokens, list_errmsg, sizeof(list_errmsg)) == NULL);
+            TOK_free(tokens);
+        }
+        test_assert(strcmp(errmsg, list_errmsg) == 0);
+    }
+
+    // a syntax error is now found before a later tokenizer error
+    char open_quote[] = "ls | | \"ab";
+    tree = ParseLine(open_quote, NULL, errmsg, sizeof(errmsg));
+    test_assert(tree == NULL && strcmp(errmsg, "No command specified") == 0);
+    test_assert(strcmp(open_quote, "ls | | \"ab") == 0);
+
+    // the same, in an arena
+    Arena arena = AR_new();
+    char again[] = "cat x|grep y | wc -l>out.txt";
+    tree = ParseLine(again, arena, errmsg, sizeof(errmsg));
+    AR_free(arena);
+    test_assert(tree != NULL);
+
+    return 1;
+
+test_error:
+    PT_free(tree);
+    return 0;
+}
+
+/*
+ * Append a path to a space-separated list
+ */
+static void collect_match(const char *path, char *buf)
+{
+    strcat(buf, path);
+    strcat(buf, " ");
+}
+
+/*
+ * Expand a pattern with GC_expand into a space-separated list
+ *
+ * Returns: The number of matches
+ */
+static size_t expand_matches(const char *pattern, Arena arena, char *buf)
+{
+    char *paths;
+    size_t count = GC_expand(pattern, arena, &paths);
+
+    buf[0] = '\0';
+    const char *path = paths;
+    for (size_t i = 0; i < count; i++)
+    {
+        collect_match(path, buf);
+        path += strlen(path) + 1;
+    }
+    if (arena == NULL)
+        free(paths);
+    return count;
+}
+
+/*
+ * Expand a pattern with glob() into a space-separated list, for
+ * comparison with GC_expand
+ */
+static void glob_matches(const char *pattern, char *buf)
+{
+    glob_t glob_result = {0};
+
+    buf[0] = '\0';
+    if (glob(pattern, GLOB_TILDE, NULL, &glob_result) == 0)
+    {
+        for (size_t i = 0; i < glob_result.gl_pathc; i++)
+            collect_match(glob_result.gl_pathv[i], buf);
+    }
+    globfree(&glob_result);
+}
+
+/*
+ * Tests that the glob cache expands patterns exactly as glob() does,
+ * and notices changes to a directory
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_globcache()
+{
+    char dir[] = "/tmp/ps_test.XXXXXX";
+    // a name ending in '/' is a directory
+    const char *files[] = {"a1.c", "a2.c", "b.c", "b.h", ".hidden.c", "sub/", "sub/x.c", "sub/y.h",
+                           "sa/", "sa/x.c", "sb/", "sc/", "sc/z.c", "sub/deep/", "sub/deep/w.c", NULL};
+    int num_files = 0;
+    char path[256];
+    char expected[4096];
+    char got[4096];
+    char *old_home = getenv("HOME") ? strdup(getenv("HOME")) : NULL;
+    char *old_cwd = getcwd(NULL, 0);
+    Arena arena = AR_new();
+    int ok = 0;
+
+    test_assert(mkdtemp(dir) != NULL);
+    for (; files[num_files] != NULL; num_files++)
+    {
+        snprintf(path, sizeof(path), "%s/%s", dir, files[num_files]);
+        if (path[strlen(path) - 1] == '/')
+            mkdir(path, 0700);
+        else
+            fclose(fopen(path, "w"));
+    }
+    setenv("HOME", dir, 1);
+
+    const char *patterns[] = {"*", ".*", "*.c", "a?.c", "[ab]*", "[!a]*", "*.none", "s*/", "*/..", "~/*.h", "~/s*",
+                              "*/*.c", "s*/x.c", "s?/*", "*//*.h", "[!s]*/", "sub/*.h", "none/*", "*/none", NULL};
+    for (int round = 0; round < 2; round++)
+    {
+        for (int i = 0; patterns[i] != NULL; i++)
+        {
+            // relative to the directory, and as an absolute path
+            for (int absolute = 0; absolute <= 1; absolute++)
+            {
+                if (absolute && patterns[i][0] == '~')
+                    continue;
+                snprintf(path, sizeof(path), "%s%s%s", absolute ? dir : "", absolute ? "/" : "", patterns[i]);
+                if (!absolute)
+                    test_assert(chdir(dir) == 0);
+
+                glob_matches(path, expected);
+                got[0] = '\0';
+                size_t count = expand_matches(path, NULL, got);
+                test_assert(strcmp(got, expected) == 0);
+                test_assert((count == 0) == (expected[0] == '\0'));
+            }
+        }
+    }
+
+    // a new file is seen by a cached listing and a cached miss
+    test_assert(expand_matches("*.none", NULL, got) == 0);
+    fclose(fopen("x.none", "w"));
+    test_assert(expand_matches("*.none", NULL, got) == 1 && strcmp(got, "x.none ") == 0);
+    unlink("x.none");
+    test_assert(expand_matches("*.none", NULL, got) == 0);
+
+    // a tiny limit keeps nothing cached, but expansion still works
+    size_t old_limit = GC_set_limit(16);
+    test_assert(expand_matches("*.h", NULL, got) == 1 && strcmp(got, "b.h ") == 0);
+    GC_set_limit(0);
+    test_assert(expand_matches("*.h", NULL, got) == 1 && strcmp(got, "b.h ") == 0);
+    GC_set_limit(old_limit);
+
+    // the same matches from an arena, and unsorted
+    const char *all = "sa/x.c sc/z.c sub/deep sub/x.c sub/y.h ";
+    test_assert(expand_matches("s*/*", arena, got) == 5 && strcmp(got, all) == 0);
+    GC_set_unsorted(true);
+    test_assert(expand_matches("s*/*", NULL, got) == 5);
+    GC_set_unsorted(false);
+    for (char *match = strtok(got, " "); match != NULL; match = strtok(NULL, " "))
+        test_assert(strstr(all, match) != NULL);
+
+    // ** matches any number of directories, but not hidden ones
+    test_assert(expand_matches("**/*.c", NULL, got) == 7);
+    test_assert(strcmp(got, "a1.c a2.c b.c sa/x.c sc/z.c sub/deep/w.c sub/x.c ") == 0);
+    test_assert(expand_matches("sub/**", NULL, got) == 5);
+    test_assert(strcmp(got, "sub/ sub/deep sub/deep/w.c sub/x.c sub/y.h ") == 0);
+    test_assert(expand_matches("**/", NULL, got) == 5 && strcmp(got, "sa/ sb/ sc/ sub/ sub/deep/ ") == 0);
+    test_assert(expand_matches("**/**/w.c", NULL, got) == 1 && strcmp(got, "sub/deep/w.c ") == 0);
+    ok = 1;
+
+test_error:
+    while (num_files > 0)
+    {
+        snprintf(path, sizeof(path), "%s/%s", dir, files[--num_files]);
+        if (path[strlen(path) - 1] == '/')
+            rmdir(path);
+        else
+            unlink(path);
+    }
+    rmdir(dir);
+    if (old_cwd != NULL)
+        chdir(old_cwd);
+    free(old_cwd);
+    GC_clear();
+    AR_free(arena);
+    if (old_home != NULL)
+        setenv("HOME", old_home, 1);
+    free(old_home);
+    return ok;
+}
+
+/*
+ * Runs a command line with its output in a file, and reads the
+ * output back
+ *
+ * Returns: The number of lines of output, or -1 if the command fails
+ */
+static int run_to_file(const char *command, char *output, size_t output_sz)
+{
+    char line[256];
+    char errmsg[128];
+    snprintf(line, sizeof(line), "%s > out.txt", command);
+
+    PipeTree tree = ParseLine(line, NULL, errmsg, sizeof(errmsg));
+    if (tree == NULL)
+        return -1;
+    int rc = PT_evaluate(tree);
+    PT_free(tree);
+    if (rc != 0)
+        return -1;
+
+    FILE *fp = fopen("out.txt", "r");
+    size_t n = fread(output, 1, output_sz - 1, fp);
+    fclose(fp);
+    output[n] = '\0';
+
+    int lines = 0;
+    for (char *p = output; *p != '\0'; p++)
+    {
+        if (*p == '\n')
+        {
+            *p = ' ';
+            lines++;
+        }
+    }
+    return lines;
+}
+
+/*
+ * Tests that glob patterns are expanded when a command runs, and that
+ * a command too long for the argv limit runs in batches
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_glob_batches()
+{
+    char dir[] = "/tmp/ps_test.XXXXXX";
+    char path[256];
+    char expected[4096] = "";
+    char got[4096];
+    char errmsg[128];
+    char *old_cwd = getcwd(NULL, 0);
+    const int num_files = 40;
+    TList tokens = NULL;
+    int ok = 0;
+
+    test_assert(mkdtemp(dir) != NULL && chdir(dir) == 0);
+    for (int i = 0; i < num_files; i++)
+    {
+        snprintf(path, sizeof(path), "file%02d", i);
+        fclose(fopen(path, "w"));
+        strcat(expected, path);
+        strcat(expected, " ");
+    }
+
+    // only unquoted words with wildcards are patterns
+    tokens = TOK_tokenize_input("ls *.c \"*.h\" x[1] plain", errmsg, sizeof(errmsg));
+    test_assert(tokens != NULL);
+    test_assert(TL_nth(tokens, 1).glob && !TL_nth(tokens, 2).glob);
+    test_assert(TL_nth(tokens, 3).glob && !TL_nth(tokens, 4).glob);
+
+    // the same output in one go, in batches, and in parallel batches
+    test_assert(run_to_file("echo file*", got, sizeof(got)) == 1);
+    test_assert(strncmp(got, expected, strlen(expected) - 1) == 0);
+
+    size_t old_limit = PT_set_arg_limit(128);
+    int lines = run_to_file("echo file*", got, sizeof(got));
+    test_assert(lines > 1 && strcmp(got, expected) == 0);
+
+    int old_jobs = PT_set_batch_jobs(4);
+    test_assert(run_to_file("echo file*", got, sizeof(got)) == lines);
+    test_assert(strlen(got) == strlen(expected));
+    PT_set_batch_jobs(old_jobs);
+
+    // a word after the pattern cannot be split across batches
+    test_assert(run_to_file("echo file* end", got, sizeof(got)) == -1);
+
+    // a pattern that matches nothing is passed on as it is
+    test_assert(run_to_file("echo none*", got, sizeof(got)) == 1 && strcmp(got, "none* ") == 0);
+    PT_set_arg_limit(old_limit);
+    ok = 1;
+
+test_error:
+    for (int i = 0; i < num_files; i++)
+    {
+        snprintf(path, sizeof(path), "file%02d", i);
+        unlink(path);
+    }
+    unlink("out.txt");
+    if (old_cwd != NULL)
+        chdir(old_cwd);
+    rmdir(dir);
+    free(old_cwd);
+    TOK_free(tokens);
+    GC_clear();
+    return ok;
+}
+
+/*
+ * Collects the expansions of a word with braces, each followed by a
+ * space
+ *
+ * Returns: The number of expansions
+ */
+static size_t brace_expansions(const char *word, char *buf)
+{
+    BraceGen gen = BR_open(word);
+    const char *expansion;
+    size_t count = 0;
+
+    buf[0] = '\0';
+    for (; (expansion = BR_next(gen)) != NULL; count++)
+    {
+        strcat(buf, expansion);
+        strcat(buf, " ");
+    }
+    BR_close(gen);
+    return count;
+}
+
+/*
+ * Tests that braces are expanded as bash does, lazily, and when a
+ * command runs
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_braces()
+{
+    const struct
+    {
+        const char *word;
+        const char *expansions;
+    } tests[] = {
+        {"plain", "plain "},
+        {"x{a,b}{1,2}y", "xa1y xa2y xb1y xb2y "},
+        {"a{b,c{d,e}f}g", "abg acdfg acefg "},
+        {"{,x}y", "y xy "},
+        {"{1..3}{a,b}", "1a 1b 2a 2b 3a 3b "},
+        {"{5..1}", "5 4 3 2 1 "},
+        {"{-2..2}", "-2 -1 0 1 2 "},
+        {"{01..10..3}", "01 04 07 10 "},
+        {"{-05..5..5}", "-05 000 005 "},
+        {"{a..e..2}", "a c e "},
+        // braces that do not expand stay as they are
+        {"{x}", "{x} "},
+        {"{}", "{} "},
+        {"{a,b", "{a,b "},
+        {"a}b{c,d}", "a}bc a}bd "},
+        {"{a,{b}}", "a {b} "},
+        {"{a{b,c}}", "{ab} {ac} "},
+        {"{1..2..}", "{1..2..} "},
+    };
+    char got[4096];
+    char errmsg[128];
+    char *old_cwd = getcwd(NULL, 0);
+    char dir[] = "/tmp/ps_test.XXXXXX";
+    BraceGen gen = NULL;
+    TList tokens = NULL;
+    PipeTree tree = NULL;
+    int ok = 0;
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+    {
+        brace_expansions(tests[i].word, got);
+        if (strcmp(got, tests[i].expansions) != 0)
+            printf("%s: expected \"%s\", got \"%s\"\n", tests[i].word, tests[i].expansions, got);
+        test_assert(strcmp(got, tests[i].expansions) == 0);
+    }
+
+    // a million expansions are counted and generated without a list
+    gen = BR_open("file{1..1000000}.dat");
+    test_assert(BR_count(gen) == 1000000);
+    size_t count = 0;
+    while (BR_next(gen) != NULL)
+        count++;
+    test_assert(count == 1000000);
+    BR_close(gen);
+    gen = BR_open("file{1..1000000}.dat");
+    for (int i = 0; i < 999999; i++)
+        BR_next(gen);
+    test_assert(strcmp(BR_next(gen), "file1000000.dat") == 0 && BR_next(gen) == NULL);
+
+    // only unquoted words with braces are marked
+    tokens = TOK_tokenize_input("echo {a,b} \"{a,b}\" {x", errmsg, sizeof(errmsg));
+    test_assert(tokens != NULL);
+    test_assert(TL_nth(tokens, 1).brace && !TL_nth(tokens, 2).brace && !TL_nth(tokens, 3).brace);
+    TOK_free(tokens);
+
+    // an escaped brace or comma is literal, and keeps the word whole
+    tokens = TOK_tokenize_input("echo a\\{b,c} {a\\,b} x\\}", errmsg, sizeof(errmsg));
+    test_assert(tokens != NULL && strcmp(TL_nth(tokens, 1).word, "a{b,c}") == 0);
+    test_assert(!TL_nth(tokens, 1).brace && !TL_nth(tokens, 2).brace && !TL_nth(tokens, 3).brace);
+    test_assert(strcmp(TL_nth(tokens, 2).word, "{a,b}") == 0 && strcmp(TL_nth(tokens, 3).word, "x}") == 0);
+
+    // braces expand before globs when the command runs
+    test_assert(mkdtemp(dir) != NULL && chdir(dir) == 0);
+    fclose(fopen("a1.c", "w"));
+    fclose(fopen("b1.c", "w"));
+    fclose(fopen("c1.c", "w"));
+    test_assert(run_to_file("echo x{1..3}y", got, sizeof(got)) == 1 && strcmp(got, "x1y x2y x3y ") == 0);
+    test_assert(run_to_file("echo {c,a}*.c {,}", got, sizeof(got)) == 1 && strcmp(got, "c1.c a1.c ") == 0);
+    test_assert(run_to_file("echo a\\{b,c} {x,y}", got, sizeof(got)) == 1 && strcmp(got, "a{b,c} x y ") == 0);
+
+    // a redirection must expand to one file
+    char line[] = "echo hi > {a,b}.txt";
+    tree = ParseLine(line, NULL, errmsg, sizeof(errmsg));
+    test_assert(tree != NULL && PT_evaluate(tree) == -1);
+    ok = 1;
+
+test_error:
+    unlink("a1.c");
+    unlink("b1.c");
+    unlink("c1.c");
+    unlink("out.txt");
+    if (old_cwd != NULL)
+        chdir(old_cwd);
+    rmdir(dir);
+    free(old_cwd);
+    BR_close(gen);
+    TOK_free(tokens);
+    PT_free(tree);
+    GC_clear();
+    return ok;
+}
+
+/*
+ * Tests the token list as a queue and as a list: appends and pops
+ * interleaved, access from either end, insertion, removal and joins
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_tlist()
+{
+    TList list = TL_new();
+    TList other = TL_new();
+    TList copy = NULL;
+    Token token = {.type = TOK_WORD};
+
+    // a queue that never holds more than a few tokens at once
+    for (int i = 0; i < 1000; i++)
+    {
+        token.offset = i;
+        TL_append(list, token);
+        if (i % 4 == 3)
+        {
+            for (int k = 0; k < 3; k++)
+                TL_pop(list);
+        }
+    }
+    test_assert(TL_length(list) == 250);
+    test_assert(TL_nth(list, 0).offset == 750);
+    test_assert(TL_peek(list) != NULL && TL_peek(list)->offset == TL_nth(list, 0).offset);
+    test_assert(TL_nth(list, -1).offset == 999 && TL_nth(list, 250).type == TOK_END);
+
+    while (TL_length(list) > 0)
+        TL_pop(list);
+    test_assert(TL_peek(list) == NULL && TL_pop(list).type == TOK_END);
+
+    // 0 1 2 3 4, built from both ends and the middle
+    for (int i = 1; i <= 3; i += 2)
+    {
+        token.offset = i;
+        TL_append(list, token);
+    }
+    token.offset = 0;
+    TL_push(list, token);
+    token.offset = 2;
+    test_assert(TL_insert(list, token, 2));
+    token.offset = 4;
+    test_assert(TL_insert(list, token, -1) && !TL_insert(list, token, 6));
+    for (int i = 0; i < 5; i++)
+        test_assert(TL_nth(list, i).offset == (size_t)i && TL_nth(list, i - 5).offset == (size_t)i);
+
+    test_assert(TL_remove(list, 2).offset == 2 && TL_remove(list, -1).offset == 4);
+    test_assert(TL_length(list) == 3 && TL_nth(list, 2).offset == 3);
+
+    copy = TL_copy(list);
+    TL_reverse(copy);
+    test_assert(TL_nth(copy, 0).offset == 3 && TL_nth(copy, -1).offset == 0);
+
+    // joins onto an empty list and onto a full one
+    TL_join(other, copy);
+    test_assert(TL_length(other) == 3 && TL_length(copy) == 0);
+    TL_join(list, other);
+    test_assert(TL_length(list) == 6 && TL_length(other) == 0 && TL_nth(list, 3).offset == 3);
+
+    TL_free(list);
+    TL_free(other);
+    TL_free(copy);
+    return 1;
+
+test_error:
+    TL_free(list);
+    TL_free(other);
+    TL_free(copy);
+    return 0;
+}
+
+/*
+ * Tests the string list, and that its array view stays a
+ * NULL-terminated argv as it changes
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_clist()
+{
+    const char *words[] = {"a", "b", "c", "d", "e", "f", "g", "h", "i", "j"};
+    CList list = CL_new();
+    CList other = CL_new();
+    CList copy = NULL;
+
+    test_assert(CL_array(list)[0] == NULL);
+    for (int i = 0; i < 10; i++)
+        CL_append(list, words[i]);
+
+    const char **argv = CL_array(list);
+    for (int i = 0; i < 10; i++)
+        test_assert(argv[i] == words[i] && CL_nth(list, i) == words[i] && CL_nth(list, i - 10) == words[i]);
+    test_assert(argv[10] == NULL && CL_nth(list, 10) == NULL);
+
+    // the view follows pops, removals and insertions
+    test_assert(CL_pop(list) == words[0] && CL_array(list)[0] == words[1]);
+    test_assert(CL_remove(list, -1) == words[9] && CL_array(list)[8] == NULL);
+    test_assert(CL_insert(list, words[0], 0) && CL_insert(list, words[9], -1));
+    test_assert(CL_length(list) == 10 && CL_array(list)[0] == words[0] && CL_array(list)[9] == words[9]);
+    test_assert(CL_array(list)[10] == NULL);
+
+    // sorted insertion keeps the list sorted
+    CL_append(other, "b");
+    CL_append(other, "d");
+    test_assert(CL_insert_sorted(other, "c") == 1 && CL_insert_sorted(other, "a") == 0);
+    test_assert(CL_insert_sorted(other, "e") == 4 && CL_array(other)[5] == NULL);
+
+    copy = CL_copy(other);
+    CL_reverse(copy);
+    test_assert(strcmp(CL_nth(copy, 0), "e") == 0 && strcmp(CL_nth(copy, -1), "a") == 0);
+
+    CL_join(list, copy);
+    test_assert(CL_length(list) == 15 && CL_length(copy) == 0 && CL_array(copy)[0] == NULL);
+    test_assert(strcmp(CL_array(list)[14], "a") == 0 && CL_array(list)[15] == NULL);
+
+    CL_free(list);
+    CL_free(other);
+    CL_free(copy);
+    return 1;
+
+test_error:
+    CL_free(list);
+    CL_free(other);
+    CL_free(copy);
+    return 0;
+}
+
+/*
+ * Read what a command wrote to out.txt, with newlines turned into
+ * spaces
+ */
+static void read_out(char *output, size_t output_sz)
+{
+    FILE *fp = fopen("out.txt", "r");
+    size_t n = (fp != NULL) ? fread(output, 1, output_sz - 1, fp) : 0;
+    if (fp != NULL)
+        fclose(fp);
+    output[n] = '\0';
+
+    for (char *p = output; *p != '\0'; p++)
+        if (*p == '\n')
+            *p = ' ';
+}
+
+/*
+ * Tests flat pipelines: built by Parse and PT_pipe, printed, and run
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_pipelines()
+{
+    char errmsg[128];
+    char buf[256];
+    char got[256];
+    PipeTree tree = NULL;
+    PipeTree left = NULL;
+    PipeTree right = NULL;
+    char *huge = NULL;
+    char *printed = NULL;
+
+    char line[] = "cat <in.txt | grep -v x | sort | uniq -c >out.txt";
+    tree = ParseLine(line, NULL, errmsg, sizeof(errmsg));
+    test_assert(tree != NULL && PT_count(tree) == 7 && PT_depth(tree) == 4);
+    PT_tree2string(tree, buf, sizeof(buf));
+    test_assert(strcmp(buf, " cat <in.txt | grep -v x | sort | uniq -c >out.txt") == 0);
+    PT_free(tree);
+
+    // joining pipelines keeps them flat, in order
+    left = PT_pipe(PT_word("a", NULL), PT_word("b", NULL));
+    right = PT_pipe(PT_word("c", NULL), PT_word("d", NULL));
+    tree = PT_pipe(left, right);
+    left = right = NULL;
+    test_assert(PT_count(tree) == 7 && PT_depth(tree) == 4);
+    PT_tree2string(tree, buf, sizeof(buf));
+    test_assert(strcmp(buf, " a | b | c | d") == 0);
+    PT_free(tree);
+    tree = NULL;
+
+    // the same in an arena
+    Arena arena = AR_new();
+    char again[] = "a|b|c|d|e|f|g|h|i";
+    tree = ParseLine(again, arena, errmsg, sizeof(errmsg));
+    test_assert(tree != NULL && PT_count(tree) == 17 && PT_depth(tree) == 9);
+    PT_tree2string(tree, buf, sizeof(buf));
+    AR_free(arena);
+    tree = NULL;
+    test_assert(strcmp(buf, " a | b | c | d | e | f | g | h | i") == 0);
+
+    // an argv longer than a node holds spills, keeping its patterns,
+    // including when the node becomes a stage of a pipeline
+    const char *many[] = {"1", "2", "3", "4", "5", "6", "7", "8", "9", "10", NULL};
+
+    // up to six arguments are held in the node itself
+    tree = PT_word("echo", NULL);
+    for (int i = 0; i < 6; i++)
+        PT_set_args(tree, many[i]);
+    const char *node = (const char *)tree;
+    const char *inline_argv = (const char *)PT_argv(tree);
+    test_assert(inline_argv > node && inline_argv < node + 128);
+    PT_set_args(tree, many[6]);
+    inline_argv = (const char *)PT_argv(tree);
+    test_assert(inline_argv < node || inline_argv >= node + 128);
+    test_assert(strcmp(PT_argv(tree)[7], "7") == 0 && PT_argv(tree)[8] == NULL);
+    PT_free(tree);
+
+    tree = PT_word("echo", NULL);
+    for (int i = 0; i < 3; i++)
+        PT_set_args(tree, many[i]);
+    test_assert(PT_set_pattern(tree, 2) == 0);
+    test_assert(PT_set_pattern(tree, 4) == -1);
+    for (int i = 3; many[i] != NULL; i++)
+        PT_set_args(tree, many[i]);
+    test_assert(PT_set_pattern(tree, 10) == 0);
+    tree = PT_pipe(PT_word("true", NULL), tree);
+    PT_tree2string(tree, buf, sizeof(buf));
+    test_assert(strcmp(buf, " true | echo 1 2 3 4 5 6 7 8 9 10") == 0);
+    test_assert(PT_set_args(tree, "x") == -1);
+    PT_free(tree);
+    tree = NULL;
+
+    // a pipeline far longer than any recursion could handle
+    const int num_stages = 20000;
+    huge = malloc(num_stages * 8);
+    size_t len = 0;
+    for (int i = 0; i < num_stages; i++)
+        len += sprintf(huge + len, "%sc%d", (i == 0) ? "" : " | ", i % 10);
+    tree = ParseLine(huge, NULL, errmsg, sizeof(errmsg));
+    test_assert(tree != NULL && PT_count(tree) == 2 * num_stages - 1 && PT_depth(tree) == num_stages);
+    printed = malloc(2 * len);
+    test_assert(PT_tree2string(tree, printed, 2 * len) == len + 1 && strncmp(printed, " c0 | c1 | c2", 13) == 0);
+    PT_free(tree);
+    tree = NULL;
+
+    // every stage runs, each reading what the one before it wrote
+    test_assert(run_to_file("echo hello | tr a-z A-Z | rev | tr -d L", got, sizeof(got)) == 1);
+    test_assert(strcmp(got, "OEH ") == 0);
+    test_assert(run_to_file("echo x | cat | cat | cat | cat | cat | cat | cat", got, sizeof(got)) == 1);
+    test_assert(strcmp(got, "x ") == 0);
+    unlink("out.txt");
+
+    // each stage's status is kept, whatever order the stages exit in
+    char statuses[] = "true | sh -c \"exit 3\" | sleep 0.1 | true";
+    tree = ParseLine(statuses, NULL, errmsg, sizeof(errmsg));
+    test_assert(tree != NULL && PT_evaluate(tree) == -1);
+    test_assert(PT_status(0) == 0 && PT_status(1) == 3);
+    test_assert(PT_status(2) == 0 && PT_status(3) == 0 && PT_status(4) == -1);
+    PT_free(tree);
+
+    // a stage killed when the next one exits early
+    char early[] = "yes | head -n 1";
+    tree = ParseLine(early, NULL, errmsg, sizeof(errmsg));
+    test_assert(tree != NULL && PT_evaluate(tree) == -1);
+    test_assert(PT_status(0) == 128 + SIGPIPE && PT_status(1) == 0 && PT_status(2) == -1);
+    PT_free(tree);
+    tree = NULL;
+
+    // argv is built as the command is parsed, and exec'd as it is
+    char exec_ready[] = "printenv PS_TEST_VAR >out.txt";
+    tree = ParseLine(exec_ready, NULL, errmsg, sizeof(errmsg));
+    char *const *argv = PT_argv(tree);
+    test_assert(argv != NULL && strcmp(argv[0], "printenv") == 0);
+    test_assert(strcmp(argv[1], "PS_TEST_VAR") == 0 && argv[2] == NULL);
+
+    // commands run with the environment set for them
+    char *const env[] = {"PS_TEST_VAR=hello", NULL};
+    test_assert(PT_set_environment(env) == NULL);
+    test_assert(PT_evaluate(tree) == 0);
+    test_assert(PT_set_environment(NULL) == env);
+    read_out(got, sizeof(got));
+    test_assert(strcmp(got, "hello ") == 0);
+    test_assert(PT_argv(tree) == argv && strcmp(argv[1], "PS_TEST_VAR") == 0);
+    test_assert(PT_evaluate(tree) != 0);
+    PT_free(tree);
+    tree = NULL;
+    unlink("out.txt");
+
+    char two[] = "a | b";
+    tree = ParseLine(two, NULL, errmsg, sizeof(errmsg));
+    test_assert(tree != NULL && PT_argv(tree) == NULL);
+    PT_free(tree);
+    tree = NULL;
+
+    // commands started by posix_spawn and by fork behave the same
+    const int backends[] = {PT_SPAWN_FORK, PT_SPAWN_POSIX};
+    for (int b = 0; b < 2; b++)
+    {
+        PT_set_spawn(backends[b]);
+        test_assert(run_to_file("echo hello | tr a-z A-Z | rev | tr -d L", got, sizeof(got)) == 1);
+        test_assert(strcmp(got, "OEH ") == 0);
+
+        char missing[] = "true | no_such_command_ps | true";
+        tree = ParseLine(missing, NULL, errmsg, sizeof(errmsg));
+        test_assert(tree != NULL && PT_evaluate(tree) == -1);
+        test_assert(PT_status(0) == 0 && PT_status(1) == EXIT_FAILURE && PT_status(2) == 0);
+        PT_free(tree);
+        tree = NULL;
+
+        char redirected[] = "ls /no_such_dir_ps >out.txt 2>&1";
+        tree = ParseLine(redirected, NULL, errmsg, sizeof(errmsg));
+        test_assert(tree != NULL && PT_evaluate(tree) != 0);
+        read_out(got, sizeof(got));
+        test_assert(strstr(got, "no_such_dir_ps") != NULL);
+        PT_free(tree);
+        tree = NULL;
+    }
+    test_assert(PT_set_spawn(PT_SPAWN_POSIX) == PT_SPAWN_POSIX);
+    unlink("out.txt");
+    free(huge);
+    free(printed);
+
+    return 1;
+
+test_error:
+    PT_free(tree);
+    PT_free(left);
+    PT_free(right);
+    free(huge);
+    free(printed);
+    PT_set_environment(NULL);
+    PT_set_spawn(PT_SPAWN_POSIX);
+    unlink("out.txt");
+    return 0;
+}
+
+/*
+ * Parse a line and evaluate it
+ *
+ * Returns: The status of the line, or -2 if it does not parse
+ */
+static int run_line(const char *command)
+{
+    char line[256];
+    char errmsg[128];
+    snprintf(line, sizeof(line), "%s", command);
+
+    PipeTree tree = ParseLine(line, NULL, errmsg, sizeof(errmsg));
+    if (tree == NULL)
+        return -2;
+    int rc = PT_evaluate(tree);
+    PT_free(tree);
+    return rc;
+}
+
+/*
+ * Tests lists, appending and the redirection of standard error:
+ * parsing them with redirections in any order, printing them, and
+ * running them without a second shell
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_sequences()
+{
+    char errmsg[128];
+    char buf[256];
+    char got[256];
+    PipeTree tree = NULL;
+
+    // redirections may come anywhere after the command word
+    char any_order[] = "sort <in.txt -r >>out.txt 2>&1 -u";
+    tree = ParseLine(any_order, NULL, errmsg, sizeof(errmsg));
+    test_assert(tree != NULL && PT_count(tree) == 1);
+    PT_tree2string(tree, buf, sizeof(buf));
+    test_assert(strcmp(buf, " sort -r -u <in.txt >>out.txt 2>&1") == 0);
+    PT_free(tree);
+
+    char errors[] = "make 2>>log.txt -k 2>/dev/null";
+    tree = ParseLine(errors, NULL, errmsg, sizeof(errmsg));
+    test_assert(tree == NULL && strcmp(errmsg, "Multiple redirection") == 0);
+
+    // a list is flat, each pipeline followed by its operator
+    char list[] = "a && b | c || d ; e &";
+    tree = ParseLine(list, NULL, errmsg, sizeof(errmsg));
+    test_assert(tree != NULL && PT_count(tree) == 9 && PT_depth(tree) == 4);
+    PT_tree2string(tree, buf, sizeof(buf));
+    test_assert(strcmp(buf, " a && b | c || d ; e &") == 0);
+    PT_free(tree);
+
+    char piped_errors[] = "cc x.c |& less";
+    tree = ParseLine(piped_errors, NULL, errmsg, sizeof(errmsg));
+    test_assert(tree != NULL && PT_count(tree) == 3);
+    PT_tree2string(tree, buf, sizeof(buf));
+    test_assert(strcmp(buf, " cc x.c 2>&1 | less") == 0);
+    PT_free(tree);
+    tree = NULL;
+
+    // a trailing ; is dropped; other operators need a command after them
+    char trailing[] = "ls ;";
+    tree = ParseLine(trailing, NULL, errmsg, sizeof(errmsg));
+    test_assert(tree != NULL && PT_count(tree) == 1);
+    PT_free(tree);
+    tree = NULL;
+
+    const char *bad[] = {"ls &&", "ls ; ; ls", "; ls", "ls |& 2>x", "ls 2>&1 |& cat", "ls >a >>b", NULL};
+    const char *bad_errmsg[] = {"No command specified", "No command specified", "No command specified",
+                                "No command specified", "Multiple redirection", "Multiple redirection"};
+    for (int i = 0; bad[i] != NULL; i++)
+    {
+        char line[64];
+        strcpy(line, bad[i]);
+        test_assert(ParseLine(line, NULL, errmsg, sizeof(errmsg)) == NULL);
+        test_assert(strcmp(errmsg, bad_errmsg[i]) == 0);
+        test_assert(strcmp(line, bad[i]) == 0);
+    }
+
+    char incomplete[] = "ls 2>&2";
+    test_assert(ParseLine(incomplete, NULL, errmsg, sizeof(errmsg)) == NULL);
+    test_assert(strcmp(errmsg, "Incomplete operator '2>&'") == 0);
+
+    // ; runs both sides, and >> appends
+    unlink("out.txt");
+    test_assert(run_line("echo one >out.txt ; echo two >>out.txt;pwd>>out.txt") == 0);
+    read_out(got, sizeof(got));
+    test_assert(strncmp(got, "one two /", 9) == 0);
+
+    // && and || run what follows them on success, or failure
+    test_assert(run_line("false && echo no >out.txt || echo yes >out.txt") == 0);
+    read_out(got, sizeof(got));
+    test_assert(strcmp(got, "yes ") == 0);
+    test_assert(run_line("true || echo no >out.txt && echo and >out.txt") == 0);
+    read_out(got, sizeof(got));
+    test_assert(strcmp(got, "and ") == 0);
+
+    // standard error to a file, to standard output, and down a pipe
+    test_assert(run_line("ls /no_such_dir_ps 2>out.txt") != 0);
+    read_out(got, sizeof(got));
+    test_assert(strstr(got, "no_such_dir_ps") != NULL);
+    test_assert(run_line("ls /no_such_dir_ps >out.txt 2>&1") != 0);
+    read_out(got, sizeof(got));
+    test_assert(strstr(got, "no_such_dir_ps") != NULL);
+    unlink("out.txt");
+    test_assert(run_line("ls /no_such_dir_ps |& tr a-z A-Z >out.txt") != 0);
+    read_out(got, sizeof(got));
+    test_assert(strstr(got, "NO_SUCH_DIR_PS") != NULL);
+
+    // & does not wait
+    unlink("out.txt");
+    test_assert(run_line("sleep 0.2 && echo late >out.txt &") == 0);
+    read_out(got, sizeof(got));
+    test_assert(strcmp(got, "") == 0);
+    for (int i = 0; i < 100 && strcmp(got, "late ") != 0; i++)
+    {
+        usleep(20000);
+        read_out(got, sizeof(got));
+    }
+    test_assert(strcmp(got, "late ") == 0);
+    test_assert(run_line("true") == 0);
+
+    // a pipeline, or batches, reap only their own children: one in the
+    // background that exits as they run is left for a later line
+    while (waitpid(-1, NULL, 0) > 0)
+        ;
+    test_assert(run_line("true") == 0);
+    test_assert(run_line("true &") == 0);
+    test_assert(run_line("sleep 0.2 | true") == 0);
+    test_assert(waitpid(-1, NULL, WNOHANG) > 0);
+    test_assert(run_line("true &") == 0);
+    PT_set_arg_limit(200);
+    test_assert(run_line("sh -c \"sleep 0.2\" *.c") == 0);
+    PT_set_arg_limit(0);
+    test_assert(waitpid(-1, NULL, WNOHANG) > 0);
+    test_assert(run_line("true") == 0);
+    test_assert(waitpid(-1, NULL, WNOHANG) == -1 && errno == ECHILD);
+
+    unlink("out.txt");
+    return 1;
+
+test_error:
+    PT_free(tree);
+    unlink("out.txt");
+    return 0;
+}
+
+/*
+ * Parse a line, optimize it, and print it
+ *
+ * Returns: The tree, or NULL if the line does not parse. Its words
+ *   point into a buffer the next call reuses.
+ */
+static PipeTree optimize_line(const char *command, char *buf, size_t buf_sz)
+{
+    static char line[256];
+    char errmsg[128];
+    snprintf(line, sizeof(line), "%s", command);
+
+    PipeTree tree = ParseLine(line, NULL, errmsg, sizeof(errmsg));
+    if (tree == NULL)
+        return NULL;
+    PT_optimize(tree);
+    PT_tree2string(tree, buf, buf_sz);
+    return tree;
+}
+
+/*
+ * Tests the rewrites made before a tree is evaluated: each rule, that
+ * it can be switched off, that it is counted, and that the rewritten
+ * tree does what the one parsed would have
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_optimize()
+{
+    char buf[256];
+    char got[256];
+    char cwd[256];
+    PipeTree tree = NULL;
+    unsigned old_rules = PT_set_optimizations(PT_OPT_ALL);
+
+    FILE *fp = fopen("opt_test.tmp", "w");
+    test_assert(fp != NULL);
+    fputs("one\ntwo\nthree\n", fp);
+    fclose(fp);
+
+    // a cat at the start becomes the input of the next stage, and one
+    // in the middle goes; one at the end is kept
+    size_t dropped = PT_optimized(PT_OPT_CAT_INPUT);
+    tree = optimize_line("cat opt_test.tmp | grep o | cat | cat >out.txt", buf, sizeof(buf));
+    test_assert(tree != NULL && strcmp(buf, " grep o <opt_test.tmp | cat >out.txt") == 0);
+    test_assert(PT_optimized(PT_OPT_CAT_INPUT) == dropped + 2);
+    test_assert(PT_evaluate(tree) == 0 && PT_status(0) == 0 && PT_status(2) == -1);
+    read_out(got, sizeof(got));
+    test_assert(strcmp(got, "one two ") == 0);
+
+    // again, nothing is left to do
+    PT_optimize(tree);
+    test_assert(PT_optimized(PT_OPT_CAT_INPUT) == dropped + 2);
+    PT_free(tree);
+
+    // a pipeline left one stage runs as that command
+    tree = optimize_line("cat <opt_test.tmp | wc -l >out.txt", buf, sizeof(buf));
+    test_assert(tree != NULL && strcmp(buf, " wc -l <opt_test.tmp >out.txt") == 0);
+    test_assert(PT_count(tree) == 1 && PT_evaluate(tree) == 0);
+    read_out(got, sizeof(got));
+    test_assert(strcmp(got, "3 ") == 0);
+    PT_free(tree);
+
+    // a cat with options, at the end, or reading the terminal is kept
+    tree = optimize_line("cat -n opt_test.tmp | ls | cat", buf, sizeof(buf));
+    test_assert(tree != NULL && strcmp(buf, " cat -n opt_test.tmp | ls | cat") == 0);
+    PT_free(tree);
+    tree = optimize_line("cat | wc", buf, sizeof(buf));
+    test_assert(tree != NULL && strcmp(buf, " cat | wc") == 0);
+    PT_free(tree);
+
+    // cat file >out is a copy, made without a process
+    size_t copies = PT_optimized(PT_OPT_COPY_FILE);
+    tree = optimize_line("cat opt_test.tmp >out.txt", buf, sizeof(buf));
+    test_assert(tree != NULL && strcmp(buf, " cat opt_test.tmp >out.txt") == 0);
+    test_assert(PT_optimized(PT_OPT_COPY_FILE) == copies + 1);
+    test_assert(PT_evaluate(tree) == 0);
+    read_out(got, sizeof(got));
+    test_assert(strcmp(got, "one two three ") == 0);
+    PT_free(tree);
+    tree = optimize_line("cat opt_test.tmp >>out.txt", buf, sizeof(buf));
+    test_assert(tree != NULL && PT_evaluate(tree) == 0);
+    read_out(got, sizeof(got));
+    test_assert(strcmp(got, "one two three one two three ") == 0);
+    PT_free(tree);
+    tree = optimize_line("cat no_such_opt_test.tmp >out.txt", buf, sizeof(buf));
+    test_assert(tree != NULL && PT_evaluate(tree) == 1);
+    PT_free(tree);
+
+    // as with cat, a file is not appended to itself, which would never
+    // end; truncated first, it is left empty
+    tree = optimize_line("cat opt_test.tmp >out.txt", buf, sizeof(buf));
+    test_assert(tree != NULL && PT_evaluate(tree) == 0);
+    PT_free(tree);
+    tree = optimize_line("cat out.txt >>out.txt", buf, sizeof(buf));
+    test_assert(tree != NULL && PT_evaluate(tree) == 1);
+    read_out(got, sizeof(got));
+    test_assert(strcmp(got, "one two three ") == 0);
+    PT_free(tree);
+    tree = optimize_line("cat out.txt >out.txt", buf, sizeof(buf));
+    test_assert(tree != NULL && PT_evaluate(tree) == 0);
+    read_out(got, sizeof(got));
+    test_assert(strcmp(got, "") == 0);
+    PT_free(tree);
+
+    // a builtin stage runs in the shell, writing into the pipe
+    size_t inlined = PT_optimized(PT_OPT_INLINE_BUILTIN);
+    tree = optimize_line("pwd | tr / : >out.txt", buf, sizeof(buf));
+    test_assert(tree != NULL && PT_optimized(PT_OPT_INLINE_BUILTIN) == inlined + 1);
+    test_assert(PT_evaluate(tree) == 0 && PT_status(0) == 0 && PT_status(1) == 0);
+    test_assert(getcwd(cwd, sizeof(cwd) - 1) != NULL);
+    strcat(cwd, " ");
+    for (char *p = cwd; *p != '\0'; p++)
+        if (*p == '/')
+            *p = ':';
+    read_out(got, sizeof(got));
+    test_assert(strcmp(got, cwd) == 0);
+    PT_free(tree);
+
+    // each rule can be switched off; lists are optimized item by item
+    test_assert(PT_set_optimizations(PT_OPT_COPY_FILE) == PT_OPT_ALL);
+    tree = optimize_line("cat opt_test.tmp | wc -l >out.txt; cat opt_test.tmp >out.txt", buf, sizeof(buf));
+    test_assert(tree != NULL && strcmp(buf, " cat opt_test.tmp | wc -l >out.txt ; cat opt_test.tmp >out.txt") == 0);
+    test_assert(PT_optimized(PT_OPT_COPY_FILE) == copies + 7);
+    PT_free(tree);
+    tree = NULL;
+
+    PT_set_optimizations(old_rules);
+    unlink("opt_test.tmp");
+    unlink("out.txt");
+    return 1;
+
+test_error:
+    PT_free(tree);
+    PT_set_optimizations(old_rules);
+    unlink("opt_test.tmp");
+    unlink("out.txt");
+    return 0;
+}
+
+/*
+ * Tests the cache of parsed lines: hits, eviction in least recently
+ * used order, and that a cached tree runs again unchanged, with its
+ * globs expanded afresh
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_parse_cache()
+{
+    char errmsg[128];
+    char before[256];
+    char after[256];
+    size_t old_capacity = PC_set_capacity(2);
+    PC_clear();
+
+    const char *line = "grep -v \"a b\" x\\ y <in.txt";
+    PipeTree tree = PC_parse(line, errmsg, sizeof(errmsg));
+    test_assert(tree != NULL && PC_misses() == 1 && PC_hits() == 0);
+    test_assert(test_pipeline(tree, "grep", (const char *[]){"-v", "a b", "x y", NULL}, 3, "in.txt", NULL));
+    test_assert(strcmp(line, "grep -v \"a b\" x\\ y <in.txt") == 0);
+
+    // the same text, from another buffer, is a hit
+    char same[64];
+    strcpy(same, line);
+    test_assert(PC_parse(same, errmsg, sizeof(errmsg)) == tree && PC_hits() == 1 && PC_count() == 1);
+
+    // the least recently used line is evicted: b, not a
+    PipeTree a = PC_parse("ls a", errmsg, sizeof(errmsg));
+    PC_parse("ls b", errmsg, sizeof(errmsg));
+    test_assert(PC_parse("ls a", errmsg, sizeof(errmsg)) == a && PC_count() == 2);
+    PC_parse("ls c", errmsg, sizeof(errmsg));
+    test_assert(PC_parse("ls a", errmsg, sizeof(errmsg)) == a);
+    size_t misses = PC_misses();
+    PC_parse("ls b", errmsg, sizeof(errmsg));
+    test_assert(PC_misses() == misses + 1 && PC_count() == 2);
+
+    // blank lines and errors are not cached
+    test_assert(PC_parse("   ", errmsg, sizeof(errmsg)) == NULL && errmsg[0] == '\0');
+    test_assert(PC_parse("ls |", errmsg, sizeof(errmsg)) == NULL && strcmp(errmsg, "No command specified") == 0);
+    test_assert(PC_parse("ls |", errmsg, sizeof(errmsg)) == NULL && PC_count() == 2);
+
+    // a cached tree is not changed by running it, and its glob is
+    // matched against the directory as it is at each run
+    PC_set_capacity(PC_DEFAULT_CAPACITY);
+    unlink("pc_test_1.tmp");
+    unlink("pc_test_2.tmp");
+    test_assert(fclose(fopen("pc_test_1.tmp", "w")) == 0);
+    tree = PC_parse("echo pc_test_*.tmp >out.txt", errmsg, sizeof(errmsg));
+    PT_tree2string(tree, before, sizeof(before));
+    test_assert(PT_evaluate(tree) == 0);
+    read_out(after, sizeof(after));
+    test_assert(strcmp(after, "pc_test_1.tmp ") == 0);
+
+    test_assert(fclose(fopen("pc_test_2.tmp", "w")) == 0);
+    test_assert(PC_parse("echo pc_test_*.tmp >out.txt", errmsg, sizeof(errmsg)) == tree);
+    test_assert(PT_evaluate(tree) == 0);
+    read_out(after, sizeof(after));
+    test_assert(strcmp(after, "pc_test_1.tmp pc_test_2.tmp ") == 0);
+    PT_tree2string(tree, after, sizeof(after));
+    test_assert(strcmp(before, after) == 0);
+
+    // a tree is optimized once, as it is cached, and never after
+    size_t dropped = PT_optimized(PT_OPT_CAT_INPUT);
+    tree = PC_parse("cat pc_test_1.tmp | wc -l", errmsg, sizeof(errmsg));
+    PT_tree2string(tree, after, sizeof(after));
+    test_assert(strcmp(after, " wc -l <pc_test_1.tmp") == 0);
+    test_assert(PC_parse("cat pc_test_1.tmp | wc -l", errmsg, sizeof(errmsg)) == tree);
+    test_assert(PT_optimized(PT_OPT_CAT_INPUT) == dropped + 1);
+
+    // without a cache, every line is parsed
+    PC_set_capacity(0);
+    test_assert(PC_count() == 0);
+    misses = PC_misses();
+    PC_parse("ls a", errmsg, sizeof(errmsg));
+    tree = PC_parse("ls a", errmsg, sizeof(errmsg));
+    test_assert(tree != NULL && PC_misses() == misses + 2 && PC_count() == 0);
+    test_assert(test_pipeline(tree, "ls", (const char *[]){"a", NULL}, 1, NULL, NULL));
+
+    PC_clear();
+    PC_set_capacity(old_capacity);
+    unlink("pc_test_1.tmp");
+    unlink("pc_test_2.tmp");
+    unlink("out.txt");
+    return 1;
+
+test_error:
+    PC_clear();
+    PC_set_capacity(old_capacity);
+    unlink("pc_test_1.tmp");
+    unlink("pc_test_2.tmp");
+    unlink("out.txt");
+    return 0;
+}
+
+int test_strbuild()
+{
+    char buf[8];
+    char errmsg[128];
+    StrBuilder sb;
+    PipeTree tree = NULL;
+    char *str = NULL;
+
+    // a fixed buffer keeps what fits, and reports the rest
+    SB_init(&sb, buf, sizeof(buf));
+    SB_append(&sb, "echo");
+    SB_append_char(&sb, ' ');
+    test_assert(!SB_truncated(&sb) && SB_length(&sb) == 5);
+    SB_append_n(&sb, "hello", 5);
+    test_assert(SB_truncated(&sb) && SB_length(&sb) == 7 && SB_needed(&sb) == 10);
+    test_assert(strcmp(buf, "echo he") == 0);
+
+    // an empty buffer is allowed
+    SB_init(&sb, NULL, 0);
+    SB_append(&sb, "x");
+    test_assert(SB_length(&sb) == 0 && SB_needed(&sb) == 1 && strcmp(SB_str(&sb), "") == 0);
+
+    // a dynamic builder grows to hold everything
+    SB_init_dynamic(&sb);
+    test_assert(strcmp(SB_str(&sb), "") == 0);
+    for (int i = 0; i < 1000; i++)
+        SB_append(&sb, "0123456789");
+    test_assert(!SB_truncated(&sb) && SB_length(&sb) == 10000 && strlen(SB_str(&sb)) == 10000);
+    str = SB_take(&sb);
+    test_assert(strncmp(str + 9990, "0123456789", 10) == 0 && SB_length(&sb) == 0);
+    free(str);
+    str = NULL;
+
+    // a tree, whole into a builder, or truncated into a small buffer
+    char line[] = "cat <in.txt | grep -v x | sort >out.txt";
+    tree = ParseLine(line, NULL, errmsg, sizeof(errmsg));
+    test_assert(tree != NULL);
+    SB_init_dynamic(&sb);
+    SB_append(&sb, "log:");
+    PT_append_string(tree, &sb);
+    test_assert(strcmp(SB_str(&sb), "log: cat <in.txt | grep -v x | sort >out.txt") == 0);
+    SB_free(&sb);
+    test_assert(PT_tree2string(tree, buf, sizeof(buf)) == 7 && strcmp(buf, " cat <i") == 0);
+    PT_free(tree);
+
+    return 1;
+
+test_error:
+    SB_free(&sb);
+    free(str);
+    PT_free(tree);
+    return 0;
+}
+
+int test_serialize()
+{
+    char errmsg[128];
+    char before[256];
+    char after[256];
+    unsigned char buf[1024];
+    unsigned char again[1024];
+    PipeTree tree = NULL;
+    PipeTree copy = NULL;
+    Arena arena = NULL;
+
+    const char *lines[] = {
+        "ls",
+        "cat <in.txt | grep -v \"a b\" | sort >out.txt",
+        "echo *.c {a,b} 1 2 3 4 5 6 7 8 9 <x*.txt",
+        "cd /tmp",
+        "make -k 2>err.txt >>log.txt && echo ok |& cat || echo fail 2>>log.txt ; sleep 1 &",
+        NULL};
+
+    for (int i = 0; lines[i] != NULL; i++)
+    {
+        char line[128];
+        strcpy(line, lines[i]);
+        tree = ParseLine(line, NULL, errmsg, sizeof(errmsg));
+        test_assert(tree != NULL);
+        PT_tree2string(tree, before, sizeof(before));
+
+        // the size is found first, as with snprintf
+        size_t n = PT_serialize(tree, NULL, 0);
+        test_assert(n > 0 && n <= sizeof(buf));
+        test_assert(PT_serialize(tree, buf, sizeof(buf)) == n);
+        PT_free(tree);
+        tree = NULL;
+
+        // the copy borrows from buf, and is the same tree
+        copy = PT_deserialize(buf, n, NULL);
+        test_assert(copy != NULL);
+        PT_tree2string(copy, after, sizeof(after));
+        test_assert(strcmp(before, after) == 0);
+        test_assert(PT_serialize(copy, again, sizeof(again)) == n && memcmp(buf, again, n) == 0);
+        PT_free(copy);
+        copy = NULL;
+
+        // a truncated or damaged tree is refused
+        test_assert(PT_deserialize(buf, n - 1, NULL) == NULL);
+        buf[4] = PT_SERIAL_VERSION + 1;
+        test_assert(PT_deserialize(buf, n, NULL) == NULL);
+    }
+
+    // patterns survive, and are expanded when the copy runs
+    unlink("ser_test_1.tmp");
+    test_assert(fclose(fopen("ser_test_1.tmp", "w")) == 0);
+    char glob_line[] = "echo ser_test_*.tmp >out.txt";
+    tree = ParseLine(glob_line, NULL, errmsg, sizeof(errmsg));
+    test_assert(tree != NULL);
+    size_t n = PT_serialize(tree, buf, sizeof(buf));
+    PT_free(tree);
+    tree = NULL;
+    arena = AR_new();
+    copy = PT_deserialize(buf, n, arena);
+    test_assert(copy != NULL && PT_evaluate(copy) == 0);
+    read_out(after, sizeof(after));
+    test_assert(strcmp(after, "ser_test_1.tmp ") == 0);
+    AR_free(arena);
+    arena = NULL;
+    copy = NULL;
+
+    unlink("ser_test_1.tmp");
+    unlink("out.txt");
+    return 1;
+
+test_error:
+    PT_free(tree);
+    PT_free(copy);
+    AR_free(arena);
+    unlink("ser_test_1.tmp");
+    unlink("out.txt");
+    return 0;
+}
+
+int test_script_cache()
+{
+    char errmsg[128];
+    char buf[256];
+    const char *path = "sc_test.sh";
+    const char *cache_path = "sc_test.sh" SC_SUFFIX;
+    Script script = NULL;
+    PipeTree tree = NULL;
+    FILE *f = NULL;
+    struct stat st;
+
+    unlink(cache_path);
+    f = fopen(path, "w");
+    test_assert(f != NULL);
+    fputs("ls -l\n\ncat <in.txt | sort >out.txt\necho \"a\nb\"", f);
+    fclose(f);
+    f = NULL;
+
+    // the first open compiles the script, and writes the cache file
+    script = SC_open(path, errmsg, sizeof(errmsg));
+    test_assert(script != NULL && !SC_from_cache(script) && SC_num_commands(script) == 3);
+    test_assert(stat(cache_path, &st) == 0);
+    SC_close(script);
+
+    // the next is served from it
+    script = SC_open(path, errmsg, sizeof(errmsg));
+    test_assert(script != NULL && SC_from_cache(script) && SC_num_commands(script) == 3);
+    tree = SC_command(script, 1, NULL);
+    test_assert(tree != NULL);
+    PT_tree2string(tree, buf, sizeof(buf));
+    test_assert(strcmp(buf, " cat <in.txt | sort >out.txt") == 0);
+    PT_free(tree);
+    tree = SC_command(script, 2, NULL);
+    test_assert(test_pipeline(tree, "echo", (const char *[]){"a\nb", NULL}, 1, NULL, NULL));
+    PT_free(tree);
+    tree = NULL;
+    test_assert(SC_command(script, 3, NULL) == NULL);
+    SC_close(script);
+
+    // an edited script is compiled again
+    f = fopen(path, "w");
+    test_assert(f != NULL);
+    fputs("pwd\n", f);
+    fclose(f);
+    f = NULL;
+    script = SC_open(path, errmsg, sizeof(errmsg));
+    test_assert(script != NULL && !SC_from_cache(script) && SC_num_commands(script) == 1);
+    SC_close(script);
+
+    // a damaged cache file is ignored, and replaced
+    f = fopen(cache_path, "r+");
+    test_assert(f != NULL);
+    fseek(f, -2, SEEK_END);
+    fputc(0xff, f);
+    fputc(0xff, f);
+    fclose(f);
+    f = NULL;
+    script = SC_open(path, errmsg, sizeof(errmsg));
+    test_assert(script != NULL && !SC_from_cache(script) && SC_num_commands(script) == 1);
+    SC_close(script);
+
+    // a script that does not parse has no compiled form
+    f = fopen(path, "w");
+    test_assert(f != NULL);
+    fputs("ls\nls |\n", f);
+    fclose(f);
+    f = NULL;
+    script = SC_open(path, errmsg, sizeof(errmsg));
+    test_assert(script == NULL && strcmp(errmsg, "No command specified") == 0);
+
+    unlink(path);
+    unlink(cache_path);
+    return 1;
+
+test_error:
+    if (f != NULL)
+        fclose(f);
+    PT_free(tree);
+    SC_close(script);
+    unlink(path);
+    unlink(cache_path);
+    return 0;
+}
+
+/*
+ * Tests the string interning table, and that trees built on the heap
+ * share their strings through it
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_intern()
+{
+    const char *args[] = {"-l", "-a", NULL};
+    PipeTree tree1 = NULL;
+    PipeTree tree2 = NULL;
+    size_t old_limit = IN_set_limit(IN_DEFAULT_LIMIT);
+    char buf[256];
+
+    // equal strings share one copy, even from spans
+    const char *ls = IN_intern("ls", 2);
+    test_assert(ls != NULL && strcmp(ls, "ls") == 0);
+    test_assert(IN_intern("ls -l", 2) == ls && IN_lookup("ls", 2) == ls);
+    test_assert(IN_intern("lsof", 4) != ls && IN_intern("l", 1) != ls);
+    test_assert(IN_lookup("never interned", 14) == NULL);
+
+    // the table grows past its first size and keeps every string
+    char word[32];
+    size_t count = IN_count();
+    for (int i = 0; i < 1000; i++)
+    {
+        snprintf(word, sizeof(word), "intern-%d", i);
+        test_assert(IN_intern(word, strlen(word)) != NULL);
+    }
+    test_assert(IN_count() == count + 1000);
+    test_assert(IN_lookup("intern-512", 10) != NULL && IN_lookup("ls", 2) == ls);
+
+    // a full table takes no new strings, but still finds old ones
+    IN_set_limit(IN_bytes());
+    test_assert(IN_intern("brand new", 9) == NULL && IN_lookup("brand new", 9) == NULL);
+    test_assert(IN_intern("ls", 2) == ls && IN_count() == count + 1000);
+    IN_set_limit(IN_DEFAULT_LIMIT);
+
+    // building the same tree twice adds nothing the second time
+    tree1 = PT_word("cat", args);
+    setInputFiles(tree1, "in.txt");
+    count = IN_count();
+    tree2 = PT_word("cat", args);
+    setInputFiles(tree2, "in.txt");
+    test_assert(IN_count() == count);
+    PT_tree2string(tree2, buf, sizeof(buf));
+    test_assert(strcmp(buf, " cat -l -a <in.txt") == 0);
+    PT_free(tree1);
+    PT_free(tree2);
+    tree1 = tree2 = NULL;
+
+    // with the table full, trees fall back to copies of their own
+    IN_set_limit(0);
+    tree1 = PT_word("uninterned", args);
+    setInputFiles(tree1, "uninterned.txt");
+    PT_tree2string(tree1, buf, sizeof(buf));
+    test_assert(strcmp(buf, " uninterned -l -a <uninterned.txt") == 0);
+    test_assert(IN_lookup("uninterned", 10) == NULL);
+    PT_free(tree1);
+    tree1 = NULL;
+
+    // builtins are still recognized
+    char got[256];
+    test_assert(run_to_file("pwd", got, sizeof(got)) == 1);
+    test_assert(getcwd(buf, sizeof(buf)) != NULL && strncmp(got, buf, strlen(buf)) == 0);
+    unlink("out.txt");
+
+    IN_set_limit(old_limit);
+    return 1;
+
+test_error:
+    PT_free(tree1);
+    PT_free(tree2);
+    unlink("out.txt");
+    IN_set_limit(old_limit);
+    return 0;
+}
+
+/*
+ * Tests that every scanner implementation finds the same stops
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_scan()
+{
+    const char stops[] = "<>|&;\"\\ \t\n\v\f\r";
+    char buf[80];
+
+    for (ScanImpl impl = SCAN_SCALAR; impl <= SCAN_AVX2; impl++)
+    {
+        SCAN_set_impl(impl);
+
+        // a stop character at every position, in and across blocks
+        for (size_t pos = 0; pos < sizeof(buf) - 1; pos++)
+        {
+            for (size_t c = 0; c < sizeof(stops) - 1; c++)
+            {
+                memset(buf, 'x', sizeof(buf) - 1);
+                buf[sizeof(buf) - 1] = '\0';
+                buf[pos] = stops[c];
+
+                test_assert(SCAN_word(buf, sizeof(buf) - 1) == pos);
+
+                bool quoted_stop = (stops[c] == '"' || stops[c] == '\\');
+                test_assert(SCAN_quoted(buf, sizeof(buf) - 1) == (quoted_stop ? pos : sizeof(buf) - 1));
+            }
+        }
+
+        // no stop at all, and the terminating NUL
+        memset(buf, 'x', sizeof(buf) - 1);
+        test_assert(SCAN_word(buf, 50) == 50);
+        test_assert(SCAN_word(buf, sizeof(buf)) == sizeof(buf) - 1);
+        test_assert(SCAN_quoted(buf, sizeof(buf)) == sizeof(buf) - 1);
+    }
+
+    SCAN_set_impl(SCAN_AUTO);
+    return 1;
+
+test_error:
+    SCAN_set_impl(SCAN_AUTO);
+    return 0;
+}
+
+/*
+ * Tests the streaming tokenizer: input split at every position must
+ * give the same tokens as TOK_tokenize_input
+ *
+ * Returns: 1 if all tests pass, 0 otherwise
+ */
+int test_stream()
+{
+    const char *inputs[] = {
+        "echo a\\ b \"c\\td\" e\"f g\"|grep x>out<in",
+        "cat \"long quoted word with spaces\"   trailing\\|pipe",
+        "sed \"math\\\" file\"",
+        "make 2>err>>log 2>&1&&a 2||b|&c;d&",
+    };
+    char errmsg[128] = {'\0'};
+    TList expected = NULL;
+    TList got = NULL;
+    TokStream ts = TOK_stream_new(false);
+
+    for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++)
+    {
+        size_t len = strlen(inputs[i]);
+        for (size_t split = 0; split <= len; split++)
+        {
+            expected = TOK_tokenize_input(inputs[i], errmsg, sizeof(errmsg));
+            got = TOK_stream_feed(ts, inputs[i], split, errmsg, sizeof(errmsg));
+            test_assert(expected != NULL && got != NULL);
+
+            TList rest = TOK_stream_feed(ts, inputs[i] + split, len - split, errmsg, sizeof(errmsg));
+            test_assert(rest != NULL);
+            TL_join(got, rest);
+            TL_free(rest);
+
+            rest = TOK_stream_finish(ts, errmsg, sizeof(errmsg));
+            test_assert(rest != NULL);
+            TL_join(got, rest);
+            TL_free(rest);
+
+            test_assert(TL_length(got) == TL_length(expected));
+            while (TOK_next_type(expected) != TOK_END)
+            {
+                Token e = TOK_next(expected);
+                Token g = TOK_next(got);
+                test_assert(e.type == g.type && e.offset == g.offset);
+                if (e.type == TOK_WORD || e.type == TOK_QUOTED_WORD)
+                    test_assert(strcmp(e.word, g.word) == 0);
+                TOK_consume(expected);
+                TOK_consume(got);
+            }
+
+            TOK_free(expected);
+            TOK_free(got);
+            expected = got = NULL;
+        }
+    }
+
+    // an open quote is carried over to the next chunk
+    got = TOK_stream_feed(ts, "echo \"a", 7, errmsg, sizeof(errmsg));
+    test_assert(got != NULL && TL_length(got) == 1 && TOK_stream_in_quote(ts));
+    TOK_free(got);
+    got = TOK_stream_finish(ts, errmsg, sizeof(errmsg));
+    test_assert(got == NULL && strcmp(errmsg, "Unterminated quote") == 0);
+
+    // in line mode, each unquoted newline ends a command
+    TOK_stream_free(ts);
+    ts = TOK_stream_new(true);
+    const char *script = "ls -l\necho \"x\ny\"\n";
+    got = TOK_stream_feed(ts, script, strlen(script), errmsg, sizeof(errmsg));
+    test_assert(got != NULL && TL_length(got) == 6);
+    test_assert(TL_nth(got, 2).type == TOK_END && TL_nth(got, 5).type == TOK_END);
+    test_assert(strcmp(TL_nth(got, 4).word, "x\ny") == 0);
+
+    TOK_free(got);
+    TOK_stream_free(ts);
+    return 1;
+
+test_error:
+    TOK_free(expected);
+    TOK_free(got);
+    TOK_stream_free(ts);
+    return 0;
+}
+
+int main()
+{
+    int passed = 0;
+    int num_tests = 0;
+
+    num_tests++;
+    passed += test_tokenization();
+    num_tests++;
+    passed += test_parsing();
+    num_tests++;
+    passed += test_spans();
+    num_tests++;
+    passed += test_arena();
+    num_tests++;
+    passed += test_parse_line();
+    num_tests++;
+    passed += test_globcache();
+    num_tests++;
+    passed += test_glob_batches();
+    num_tests++;
+    passed += test_braces();
+    num_tests++;
+    passed += test_tlist();
+    num_tests++;
+    passed += test_clist();
+    num_tests++;
+    passed += test_intern();
+    num_tests++;
+    passed += test_pipelines();
+    num_tests++;
+    passed += test_sequences();
+    num_tests++;
+    passed += test_optimize();
+    num_tests++;
+    passed += test_strbuild();
+    num_tests++;
+    passed += test_parse_cache();
+    num_tests++;
+    passed += test_serialize();
+    num_tests++;
+    passed += test_script_cache();
+    num_tests++;
+    passed += test_scan();
+    num_tests++;
+    passed += test_stream();
 
     printf("Passed all test cases for \e[01;35mTokenizing\e[01;39m and \e[01;33mParsing\e[01;39m %d/%d\n", passed, num_tests);
 
@@ -0,0 +1,250 @@
+/*
+ * scan.c
+ *
+ * Character-class scanners for the tokenizer hot loop, with SSE2 and
+ * AVX2 implementations selected at runtime
+ *
+ * Author: Nwankwo Chukwunonso Michael
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD
+#endif
+
+#include "scan.h"
+
+// Bytes that end an unquoted run of word characters
+static const unsigned char word_stop[256] = {
+    ['\0'] = 1, ['<'] = 1, ['>'] = 1, ['|'] = 1, ['&'] = 1, [';'] = 1,
+    ['"'] = 1, ['\\'] = 1, [' '] = 1, ['\t'] = 1, ['\n'] = 1, ['\v'] = 1, ['\f'] = 1, ['\r'] = 1};
+
+// Bytes that end a run of characters inside a quoted word
+static const unsigned char quoted_stop[256] = {
+    ['\0'] = 1, ['"'] = 1, ['\\'] = 1};
+
+/*
+ * Scalar scanners, used for the tail of every scan and on CPUs
+ * without SIMD support
+ */
+static size_t scan_word_scalar(const char *s, size_t len)
+{
+  size_t i = 0;
+  while (i < len && !word_stop[(unsigned char)s[i]])
+    i++;
+  return i;
+}
+
+static size_t scan_quoted_scalar(const char *s, size_t len)
+{
+  size_t i = 0;
+  while (i < len && !quoted_stop[(unsigned char)s[i]])
+    i++;
+  return i;
+}
+
+#ifdef HAVE_X86_SIMD
+
+/*
+ * Mark the bytes in v that end an unquoted word. The control
+ * characters \t \n \v \f \r are 9..13, tested as (v - 9) <= 4
+ * unsigned.
+ */
+static inline __m128i word_stop_sse2(__m128i v)
+{
+  __m128i m = _mm_cmpeq_epi8(v, _mm_setzero_si128());
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('<')));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('>')));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('|')));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('&')));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(';')));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+
+  __m128i t = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(4)), t));
+  return m;
+}
+
+/*
+ * Quote mask for a block: marks the bytes that end a quoted run, so
+ * whole blocks of a quoted region are skipped with a single test
+ */
+static inline __m128i quoted_stop_sse2(__m128i v)
+{
+  __m128i m = _mm_cmpeq_epi8(v, _mm_setzero_si128());
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+  m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+  return m;
+}
+
+static size_t scan_word_sse2(const char *s, size_t len)
+{
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+    int bits = _mm_movemask_epi8(word_stop_sse2(v));
+    if (bits != 0)
+      return i + __builtin_ctz(bits);
+  }
+  return i + scan_word_scalar(s + i, len - i);
+}
+
+static size_t scan_quoted_sse2(const char *s, size_t len)
+{
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+    int bits = _mm_movemask_epi8(quoted_stop_sse2(v));
+    if (bits != 0)
+      return i + __builtin_ctz(bits);
+  }
+  return i + scan_quoted_scalar(s + i, len - i);
+}
+
+__attribute__((target("avx2"))) static inline __m256i word_stop_avx2(__m256i v)
+{
+  __m256i m = _mm256_cmpeq_epi8(v, _mm256_setzero_si256());
+  m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('<')));
+  m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('>')));
+  m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('|')));
+  m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('&')));
+  m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(';')));
+  m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')));
+  m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+  m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+
+  __m256i t = _mm256_sub_epi8(v, _mm256_set1_epi8('\t'));
+  m = _mm256_or_si256(m, _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(4)), t));
+  return m;
+}
+
+__attribute__((target("avx2"))) static inline __m256i quoted_stop_avx2(__m256i v)
+{
+  __m256i m = _mm256_cmpeq_epi8(v, _mm256_setzero_si256());
+  m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')));
+  m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+  return m;
+}
+
+__attribute__((target("avx2"))) static size_t scan_word_avx2(const char *s, size_t len)
+{
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32)
+  {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+    unsigned bits = (unsigned)_mm256_movemask_epi8(word_stop_avx2(v));
+    if (bits != 0)
+      return i + __builtin_ctz(bits);
+  }
+  return i + scan_word_sse2(s + i, len - i);
+}
+
+__attribute__((target("avx2"))) static size_t scan_quoted_avx2(const char *s, size_t len)
+{
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32)
+  {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+    unsigned bits = (unsigned)_mm256_movemask_epi8(quoted_stop_avx2(v));
+    if (bits != 0)
+      return i + __builtin_ctz(bits);
+  }
+  return i + scan_quoted_sse2(s + i, len - i);
+}
+
+#endif /* HAVE_X86_SIMD */
+
+// The selected implementation; resolved on first use
+static ScanImpl current = SCAN_AUTO;
+static size_t (*word_fn)(const char *, size_t) = NULL;
+static size_t (*quoted_fn)(const char *, size_t) = NULL;
+
+// Documented in .h file
+ScanImpl SCAN_set_impl(ScanImpl impl)
+{
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init();
+  bool avx2 = __builtin_cpu_supports("avx2");
+
+  if (impl == SCAN_AVX2 && !avx2)
+    impl = SCAN_SSE2;
+  if (impl == SCAN_AUTO)
+  {
+#ifdef __OPTIMIZE__
+    impl = avx2 ? SCAN_AVX2 : SCAN_SSE2;
+#else
+    // unoptimized, each intrinsic is a call and a spill, and the SIMD
+    // loops run at half the speed of the scalar one
+    impl = SCAN_SCALAR;
+#endif
+  }
+#else
+  impl = SCAN_SCALAR;
+#endif
+
+  switch (impl)
+  {
+#ifdef HAVE_X86_SIMD
+  case SCAN_AVX2:
+    word_fn = scan_word_avx2;
+    quoted_fn = scan_quoted_avx2;
+    break;
+  case SCAN_SSE2:
+    word_fn = scan_word_sse2;
+    quoted_fn = scan_quoted_sse2;
+    break;
+#endif
+  default:
+    impl = SCAN_SCALAR;
+    word_fn = scan_word_scalar;
+    quoted_fn = scan_quoted_scalar;
+    break;
+  }
+
+  current = impl;
+  return current;
+}
+
+// Documented in .h file
+const char *SCAN_impl_name(ScanImpl impl)
+{
+  switch (impl)
+  {
+  case SCAN_AUTO:
+    return "auto";
+  case SCAN_SCALAR:
+    return "scalar";
+  case SCAN_SSE2:
+    return "sse2";
+  case SCAN_AVX2:
+    return "avx2";
+  }
+
+  __builtin_unreachable();
+}
+
+// Documented in .h file
+size_t SCAN_word(const char *s, size_t len)
+{
+  if (word_fn == NULL)
+    SCAN_set_impl(current);
+
+  return word_fn(s, len);
+}
+
+// Documented in .h file
+size_t SCAN_quoted(const char *s, size_t len)
+{
+  if (quoted_fn == NULL)
+    SCAN_set_impl(current);
+
+  return quoted_fn(s, len);
+}
@@ -0,0 +1,77 @@
+/*
+ * scan.h
+ *
+ * Character-class scanners for the tokenizer hot loop. Each scanner
+ * finds the next byte that ends a run of ordinary word characters,
+ * using SSE2 or AVX2 where the CPU supports it and a scalar loop
+ * otherwise.
+ *
+ * Author: Nwankwo Chukwunonso Michael
+ */
+
+#ifndef _SCAN_H_
+#define _SCAN_H_
+
+#include <stddef.h>
+
+// The available scanner implementations
+typedef enum
+{
+  SCAN_AUTO,   // pick the best implementation the CPU supports
+  SCAN_SCALAR,
+  SCAN_SSE2,
+  SCAN_AVX2
+} ScanImpl;
+
+/*
+ * Find the end of an unquoted run of word characters.
+ *
+ * Parameters:
+ *   s       The characters to scan
+ *   len     Number of characters available at s
+ *
+ * Returns: The index of the first byte in s that is one of
+ *   < > | & ; " \ NUL or a space character (as isspace in the C locale),
+ *   or len if there is none.
+ */
+size_t SCAN_word(const char *s, size_t len);
+
+/*
+ * Find the end of a run of characters inside a quoted word. The SIMD
+ * implementations build a mask of the quote and escape bytes for
+ * each block, so a quoted region is skipped a block at a time.
+ *
+ * Parameters:
+ *   s       The characters to scan
+ *   len     Number of characters available at s
+ *
+ * Returns: The index of the first '"', '\' or NUL in s, or len if
+ *   there is none.
+ */
+size_t SCAN_quoted(const char *s, size_t len);
+
+/*
+ * Select the scanner implementation. SCAN_AUTO, the default, uses
+ * CPUID to pick AVX2, then SSE2, then the scalar loop; in a build
+ * without optimization (no -O) it picks the scalar loop, which is
+ * then the fastest. Asking for an implementation the CPU does not
+ * support falls back the same way.
+ *
+ * Parameters:
+ *   impl    The implementation to use
+ *
+ * Returns: The implementation actually selected
+ */
+ScanImpl SCAN_set_impl(ScanImpl impl);
+
+/*
+ * For diagnostics; the name of a scanner implementation
+ *
+ * Parameters:
+ *   impl    The implementation
+ *
+ * Returns: A printable name
+ */
+const char *SCAN_impl_name(ScanImpl impl);
+
+#endif /* _SCAN_H_ */
@@ -0,0 +1,437 @@
+/*
+ * scriptcache.c
+ *
+ * Compiled scripts, cached next to their source
+ *
+ * Author: Nwankwo Chukwunonso Michael
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "scriptcache.h"
+#include "tokenize.h"
+#include "parse.h"
+
+// Version of the cache file layout, apart from that of the trees in it
+#define SC_VERSION 1
+
+// The start of a cache file. It is followed by each command, as a
+// 32-bit length and the bytes of PT_serialize. The file is only read
+// on the machine that wrote it, so integers are in host order; a file
+// from another byte order fails the magic check, and is rewritten.
+typedef struct
+{
+  char magic[4]; // "PSSC"
+  uint32_t version;
+  uint32_t tree_version;
+  uint32_t reserved;
+  // the script the file was compiled from
+  uint64_t source_size;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  uint64_t hash;
+  // the fields from here on describe the commands, not the script
+  uint64_t num_commands;
+  uint64_t commands_hash; // of the rest of the file, to catch damage
+} CacheHeader;
+
+// definition of struct _script
+struct _script
+{
+  const unsigned char *image; // the header, then the commands
+  size_t image_len;
+  bool mapped;      // image is a mapping of the cache file, not malloc'd
+  bool from_cache;
+  size_t *offsets;  // where each command's tree starts in image
+  size_t num_commands;
+};
+
+// An image being compiled, grown as commands are added
+typedef struct
+{
+  unsigned char *buf;
+  size_t len;
+  size_t cap;
+} Image;
+
+/*
+ * FNV-1a hash of the first len bytes of str
+ */
+static uint64_t hashSource(const unsigned char *str, size_t len)
+{
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < len; i++)
+  {
+    hash ^= str[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+/*
+ * Make room for n more bytes in an image
+ */
+static void reserve(Image *img, size_t n)
+{
+  if (img->len + n <= img->cap)
+    return;
+
+  size_t cap = (img->cap == 0) ? 4096 : 2 * img->cap;
+  while (cap < img->len + n)
+    cap *= 2;
+
+  img->buf = (unsigned char *)realloc(img->buf, cap);
+  assert(img->buf);
+  img->cap = cap;
+}
+
+/*
+ * Fill in the fields of a header that identify the script a stat
+ * describes; those describing its commands are left 0
+ */
+static void initHeader(CacheHeader *header, const struct stat *st, uint64_t hash)
+{
+  memset(header, 0, sizeof(CacheHeader));
+  memcpy(header->magic, "PSSC", 4);
+  header->version = SC_VERSION;
+  header->tree_version = PT_SERIAL_VERSION;
+  header->source_size = st->st_size;
+  header->mtime_sec = st->st_mtim.tv_sec;
+  header->mtime_nsec = st->st_mtim.tv_nsec;
+  header->hash = hash;
+}
+
+/*
+ * Make a script of an image, finding where each of its commands
+ * starts
+ *
+ * Parameters:
+ *   image      The image; the script takes it over
+ *   len        Its length
+ *   mapped     True if image is a mapping, false if it was malloc'd
+ *
+ * Returns: The script, or NULL if the image is truncated or malformed,
+ *   in which case the image is released
+ */
+static Script newScript(const unsigned char *image, size_t len, bool mapped)
+{
+  Script script = (Script)malloc(sizeof(struct _script));
+  assert(script);
+  script->image = image;
+  script->image_len = len;
+  script->mapped = mapped;
+  script->from_cache = false;
+  script->offsets = NULL;
+  script->num_commands = 0;
+
+  CacheHeader header;
+  if (len < sizeof(CacheHeader))
+    goto malformed;
+  memcpy(&header, image, sizeof(CacheHeader));
+
+  // every command takes its length at least
+  if (header.num_commands > (len - sizeof(CacheHeader)) / 4)
+    goto malformed;
+
+  script->offsets = (size_t *)malloc((header.num_commands + 1) * sizeof(size_t));
+  assert(script->offsets);
+
+  size_t pos = sizeof(CacheHeader);
+  for (size_t i = 0; i < header.num_commands; i++)
+  {
+    uint32_t size;
+    if (len - pos < 4)
+      goto malformed;
+    memcpy(&size, image + pos, 4);
+    pos += 4;
+
+    if (len - pos < size)
+      goto malformed;
+    script->offsets[i] = pos;
+    pos += size;
+  }
+  if (pos != len)
+    goto malformed;
+
+  script->num_commands = header.num_commands;
+  return script;
+
+malformed:
+  SC_close(script);
+  return NULL;
+}
+
+/*
+ * Load a script from its cache file, if the file was compiled from the
+ * script as it is now
+ *
+ * Parameters:
+ *   cache_path  The path of the cache file
+ *   expected    The header the file must start with
+ *
+ * Returns: The script, or NULL if there is no such cache file or it
+ *   is not current
+ */
+static Script loadCache(const char *cache_path, const CacheHeader *expected)
+{
+  int fd = open(cache_path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (size_t)st.st_size < sizeof(CacheHeader))
+  {
+    close(fd);
+    return NULL;
+  }
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return NULL;
+
+  // the fields before num_commands identify the script
+  if (memcmp(map, expected, offsetof(CacheHeader, num_commands)) != 0)
+  {
+    munmap(map, st.st_size);
+    return NULL;
+  }
+
+  const CacheHeader *header = (const CacheHeader *)map;
+  if (header->commands_hash != hashSource((const unsigned char *)map + sizeof(CacheHeader), st.st_size - sizeof(CacheHeader)))
+  {
+    munmap(map, st.st_size);
+    return NULL;
+  }
+
+  Script script = newScript((const unsigned char *)map, st.st_size, true);
+  if (script != NULL)
+    script->from_cache = true;
+  return script;
+}
+
+/*
+ * Write an image to a cache file, through a temporary file renamed
+ * over it, so that a shell running the script at the same time sees
+ * either the old file or the new one. Failure is not reported: the
+ * script is compiled again next time.
+ */
+static void writeCache(const char *cache_path, const Image *img)
+{
+  size_t len = strlen(cache_path);
+  char *tmp_path = (char *)malloc(len + 8);
+  assert(tmp_path);
+  memcpy(tmp_path, cache_path, len);
+  memcpy(tmp_path + len, ".XXXXXX", 8);
+
+  int fd = mkstemp(tmp_path);
+  if (fd < 0)
+  {
+    free(tmp_path);
+    return;
+  }
+
+  size_t pos = 0;
+  while (pos < img->len)
+  {
+    ssize_t n = write(fd, img->buf + pos, img->len - pos);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    pos += n;
+  }
+
+  if (close(fd) != 0 || pos < img->len || rename(tmp_path, cache_path) != 0)
+    unlink(tmp_path);
+  free(tmp_path);
+}
+
+/*
+ * Tokenize and parse a script into an image of its commands
+ *
+ * Parameters:
+ *   source     The text of the script
+ *   size       Its length
+ *   img        The image, holding room for the header; the commands
+ *              are appended
+ *   errmsg     Return space for an error message
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The number of commands, or -1 on error
+ */
+static long compile(const char *source, size_t size, Image *img, char *errmsg, size_t errmsg_sz)
+{
+  TokStream ts = TOK_stream_new(true);
+  TList tokens = TOK_stream_feed(ts, source, size, errmsg, errmsg_sz);
+  if (tokens != NULL)
+  {
+    TList last = TOK_stream_finish(ts, errmsg, errmsg_sz);
+    if (last == NULL)
+    {
+      TOK_free(tokens);
+      tokens = NULL;
+    }
+    else
+    {
+      TL_join(tokens, last);
+      TL_free(last);
+    }
+  }
+  TOK_stream_free(ts);
+  if (tokens == NULL)
+    return -1;
+
+  // the last line need not end with a newline
+  Token end = {.type = TOK_END};
+  TL_append(tokens, end);
+
+  long num_commands = 0;
+  while (TL_length(tokens) > 0)
+  {
+    // a blank line
+    if (TOK_next_type(tokens) == TOK_END)
+    {
+      TOK_consume(tokens);
+      continue;
+    }
+
+    PipeTree tree = Parse(tokens, errmsg, errmsg_sz);
+    if (tree == NULL)
+    {
+      num_commands = -1;
+      break;
+    }
+
+    uint32_t n = PT_serialize(tree, NULL, 0);
+    reserve(img, 4 + n);
+    memcpy(img->buf + img->len, &n, 4);
+    PT_serialize(tree, img->buf + img->len + 4, n);
+    img->len += 4 + n;
+    num_commands++;
+    PT_free(tree);
+  }
+
+  TOK_free(tokens);
+  return num_commands;
+}
+
+// Documented in .h file
+Script SC_open(const char *path, char *errmsg, size_t errmsg_sz)
+{
+  errmsg[0] = '\0';
+
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0)
+  {
+    snprintf(errmsg, errmsg_sz, "%s: %s", path, strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    return NULL;
+  }
+
+  // a FIFO, say, can only be read once, as it is run
+  if (!S_ISREG(st.st_mode))
+  {
+    snprintf(errmsg, errmsg_sz, "%s: Not a regular file", path);
+    close(fd);
+    return NULL;
+  }
+
+  const char *source = "";
+  if (st.st_size > 0)
+  {
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+    {
+      snprintf(errmsg, errmsg_sz, "%s: %s", path, strerror(errno));
+      close(fd);
+      return NULL;
+    }
+    source = (const char *)map;
+  }
+  close(fd);
+
+  CacheHeader header;
+  initHeader(&header, &st, hashSource((const unsigned char *)source, st.st_size));
+
+  size_t len = strlen(path);
+  char *cache_path = (char *)malloc(len + sizeof(SC_SUFFIX));
+  assert(cache_path);
+  memcpy(cache_path, path, len);
+  memcpy(cache_path + len, SC_SUFFIX, sizeof(SC_SUFFIX));
+
+  Script script = loadCache(cache_path, &header);
+  if (script == NULL)
+  {
+    Image img = {NULL, 0, 0};
+    reserve(&img, sizeof(CacheHeader));
+    img.len = sizeof(CacheHeader);
+
+    long num_commands = compile(source, st.st_size, &img, errmsg, errmsg_sz);
+    if (num_commands >= 0)
+    {
+      header.num_commands = num_commands;
+      header.commands_hash = hashSource(img.buf + sizeof(CacheHeader), img.len - sizeof(CacheHeader));
+      memcpy(img.buf, &header, sizeof(CacheHeader));
+      writeCache(cache_path, &img);
+      script = newScript(img.buf, img.len, false);
+      assert(script);
+    }
+    else
+    {
+      free(img.buf);
+    }
+  }
+
+  if (st.st_size > 0)
+    munmap((void *)source, st.st_size);
+  free(cache_path);
+  return script;
+}
+
+// Documented in .h file
+size_t SC_num_commands(Script script)
+{
+  return script->num_commands;
+}
+
+// Documented in .h file
+PipeTree SC_command(Script script, size_t index, Arena arena)
+{
+  if (index >= script->num_commands)
+    return NULL;
+
+  size_t offset = script->offsets[index];
+  return PT_deserialize(script->image + offset, script->image_len - offset, arena);
+}
+
+// Documented in .h file
+bool SC_from_cache(Script script)
+{
+  return script->from_cache;
+}
+
+// Documented in .h file
+void SC_close(Script script)
+{
+  if (script == NULL)
+    return;
+
+  if (script->mapped)
+    munmap((void *)script->image, script->image_len);
+  else
+    free((void *)script->image);
+  free(script->offsets);
+  free(script);
+}
@@ -0,0 +1,77 @@
+/*
+ * scriptcache.h
+ *
+ * Compiled scripts. A script is tokenized and parsed once, and its
+ * commands written in the form of PT_serialize to a cache file next to
+ * it. Later runs map that file and rebuild each command from it,
+ * skipping the tokenizer and the parser, for as long as the script
+ * keeps the size, modification time and contents it was compiled
+ * from.
+ *
+ * Author: Nwankwo Chukwunonso Michael
+ */
+
+#ifndef _SCRIPTCACHE_H_
+#define _SCRIPTCACHE_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "pipeline.h"
+
+// The compiled form of a script is kept in the file named by the
+// script's path followed by this suffix
+#define SC_SUFFIX ".psc"
+
+typedef struct _script *Script;
+
+/*
+ * Open a script in compiled form: from its cache file if that is
+ * current, or else by compiling it, in which case the cache file is
+ * written for next time. A cache file that cannot be written is not
+ * an error.
+ *
+ * Parameters:
+ *   path       The path of the script
+ *   errmsg     Return space for an error message, filled in in case
+ *              of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The script, or NULL if it is not a regular file, cannot be
+ *   read, or does not tokenize or parse in full; the caller may then
+ *   run it line by line instead, reporting each error where it is. It
+ *   is up to the caller to call SC_close on the script.
+ */
+Script SC_open(const char *path, char *errmsg, size_t errmsg_sz);
+
+/*
+ * Returns the number of commands in a script, not counting blank lines
+ */
+size_t SC_num_commands(Script script);
+
+/*
+ * Rebuild a command of a script
+ *
+ * Parameters:
+ *   script    The script
+ *   index     Index of the command, from 0
+ *   arena     Where to allocate the tree, or NULL for the heap
+ *
+ * Returns: The tree of the command, or NULL if index is out of range.
+ *   Its words point into the script, so it must be freed, with
+ *   PT_free, before the script is closed.
+ */
+PipeTree SC_command(Script script, size_t index, Arena arena);
+
+/*
+ * Returns true if a script was loaded from its cache file, rather than
+ * compiled
+ */
+bool SC_from_cache(Script script);
+
+/*
+ * Close a script, releasing its compiled form
+ */
+void SC_close(Script script);
+
+#endif /* _SCRIPTCACHE_H_ */
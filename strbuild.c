@@ -0,0 +1,124 @@
+/*
+ * strbuild.c
+ *
+ * A string builder that keeps track of its length
+ *
+ * Author: Nwankwo Chukwunonso Michael
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "strbuild.h"
+
+// Size of the first buffer of a dynamic builder
+#define SB_INITIAL_CAP 64
+
+// An empty string, for a builder that has no buffer
+static char empty[1] = {'\0'};
+
+// Documented in .h file
+void SB_init(StrBuilder *sb, char *buf, size_t buf_sz)
+{
+  sb->buf = (buf_sz > 0) ? buf : empty;
+  sb->len = 0;
+  sb->cap = (buf_sz > 0) ? buf_sz : 1;
+  sb->needed = 0;
+  sb->dynamic = false;
+  sb->buf[0] = '\0';
+}
+
+// Documented in .h file
+void SB_init_dynamic(StrBuilder *sb)
+{
+  sb->buf = empty;
+  sb->len = 0;
+  sb->cap = 1;
+  sb->needed = 0;
+  sb->dynamic = true;
+}
+
+/*
+ * Grow the buffer of a dynamic builder to hold at least want
+ * characters and the NUL, doubling it so that appends cost amortized
+ * constant time per character
+ */
+static void grow(StrBuilder *sb, size_t want)
+{
+  size_t cap = (sb->buf == empty) ? SB_INITIAL_CAP : 2 * sb->cap;
+  while (cap < want + 1)
+    cap *= 2;
+
+  char *buf = (char *)realloc((sb->buf == empty) ? NULL : sb->buf, cap);
+  assert(buf);
+  if (sb->buf == empty)
+    buf[0] = '\0';
+  sb->buf = buf;
+  sb->cap = cap;
+}
+
+// Documented in .h file
+void SB_append_full(StrBuilder *sb, const char *str, size_t n)
+{
+  sb->needed += n;
+
+  if (sb->dynamic)
+    grow(sb, sb->len + n);
+  else
+    n = sb->cap - 1 - sb->len;
+
+  memcpy(sb->buf + sb->len, str, n);
+  sb->len += n;
+  sb->buf[sb->len] = '\0';
+}
+
+// Documented in .h file
+const char *SB_str(const StrBuilder *sb)
+{
+  return sb->buf;
+}
+
+// Documented in .h file
+size_t SB_length(const StrBuilder *sb)
+{
+  return sb->len;
+}
+
+// Documented in .h file
+bool SB_truncated(const StrBuilder *sb)
+{
+  return sb->needed > sb->len;
+}
+
+// Documented in .h file
+size_t SB_needed(const StrBuilder *sb)
+{
+  return sb->needed;
+}
+
+// Documented in .h file
+char *SB_take(StrBuilder *sb)
+{
+  assert(sb->dynamic);
+  char *str = sb->buf;
+  if (str == empty)
+  {
+    str = strdup("");
+    assert(str);
+  }
+
+  SB_init_dynamic(sb);
+  return str;
+}
+
+// Documented in .h file
+void SB_free(StrBuilder *sb)
+{
+  if (!sb->dynamic)
+    return;
+
+  if (sb->buf != empty)
+    free(sb->buf);
+  SB_init_dynamic(sb);
+}
@@ -0,0 +1,130 @@
+/*
+ * strbuild.h
+ *
+ * A string builder that keeps track of its length, so each append
+ * costs only the characters appended, however long the string gets.
+ * It writes either into a buffer of fixed size, truncating and
+ * recording that it did, or into one it grows on the heap.
+ *
+ * Author: Nwankwo Chukwunonso Michael
+ */
+
+#ifndef _STRBUILD_H_
+#define _STRBUILD_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+
+// A string being built. Its fields are only read and written by the
+// SB_ functions; it is declared here so a builder can be a local.
+typedef struct
+{
+  char *buf;     // the string so far, always NUL-terminated
+  size_t len;    // number of characters in buf
+  size_t cap;    // size of buf, counting the NUL
+  size_t needed; // length of the whole string, had it all fit
+  bool dynamic;  // buf is grown on the heap, rather than fixed
+} StrBuilder;
+
+/*
+ * Start building a string in a caller's buffer. Whatever does not fit
+ * is dropped, and SB_truncated reports it.
+ *
+ * Parameters:
+ *   sb       The builder
+ *   buf      The buffer; it is NUL-terminated if buf_sz > 0
+ *   buf_sz   Size of buf, counting the NUL
+ *
+ * Returns: None
+ */
+void SB_init(StrBuilder *sb, char *buf, size_t buf_sz);
+
+/*
+ * Start building a string on the heap, growing it as needed. It is up
+ * to the caller to call SB_take or SB_free.
+ *
+ * Parameters:
+ *   sb       The builder
+ *
+ * Returns: None
+ */
+void SB_init_dynamic(StrBuilder *sb);
+
+/*
+ * Append the first n characters of str to a builder whose buffer is
+ * full: grow it, or keep what fits. Called by SB_append_n.
+ */
+void SB_append_full(StrBuilder *sb, const char *str, size_t n);
+
+/*
+ * Append the first n characters of str. It is inline, as most of what
+ * is appended is a word of a few characters.
+ */
+static inline void SB_append_n(StrBuilder *sb, const char *str, size_t n)
+{
+  if (sb->len + n >= sb->cap)
+  {
+    SB_append_full(sb, str, n);
+    return;
+  }
+
+  memcpy(sb->buf + sb->len, str, n);
+  sb->len += n;
+  sb->needed += n;
+  sb->buf[sb->len] = '\0';
+}
+
+/*
+ * Append a NUL-terminated string
+ */
+static inline void SB_append(StrBuilder *sb, const char *str)
+{
+  SB_append_n(sb, str, strlen(str));
+}
+
+/*
+ * Append one character
+ */
+static inline void SB_append_char(StrBuilder *sb, char c)
+{
+  SB_append_n(sb, &c, 1);
+}
+
+/*
+ * Returns the string built so far; it belongs to the builder
+ */
+const char *SB_str(const StrBuilder *sb);
+
+/*
+ * Returns the number of characters in the string built so far
+ */
+size_t SB_length(const StrBuilder *sb);
+
+/*
+ * Returns true if characters were dropped because the buffer given to
+ * SB_init was full. SB_needed then tells how large it had to be.
+ */
+bool SB_truncated(const StrBuilder *sb);
+
+/*
+ * Returns the length of the whole string appended, whether or not it
+ * all fit; a buffer one larger than this holds it
+ */
+size_t SB_needed(const StrBuilder *sb);
+
+/*
+ * Take the string of a builder started with SB_init_dynamic, leaving
+ * the builder empty
+ *
+ * Returns: The string; it is up to the caller to free it
+ */
+char *SB_take(StrBuilder *sb);
+
+/*
+ * Release the string of a builder started with SB_init_dynamic. Does
+ * nothing for one started with SB_init.
+ */
+void SB_free(StrBuilder *sb);
+
+#endif /* _STRBUILD_H_ */
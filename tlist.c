@@ -1,88 +1,147 @@
 /*
  *
  * tlist.c
- * 
- * Linked list implementation
- * 
+ *
+ * List of tokens, kept in a growable array
+ *
  * Author: Nwankwo Chukwunonso Michael
- * 
+ *
  */
 
 #include <stdio.h>  //included the stdio header file
 #include <stdlib.h> //included the stdlib header file
 #include <assert.h> //include the assert header file
 #include <string.h> //included the string header file
- 
-#include "tlist.h" //included the user-defined header file clist.h 
+
+#include "tlist.h" //included the user-defined header file tlist.h
 
 #define DEBUG //defined DEBUG for conditional execution
 
+// Number of elements a list has room for when the first one is added
+#define TL_INITIAL_CAP 16
+
 
 /*
  *
- * Defined a struct represent the structure of a node in 
- * the LinkedList
- * 
- * Each node has:
- *  1- a CListElementType, which the element
- *  2- a _cl_node pointer which is the pointer the next node 
- * 
+ * Defined a struct represent the metadata of the list
+ *
+ * The elements are stored back to back in one array. Popping from
+ * the head only moves the head cursor forward, so the list is a
+ * queue as cheap as it is a stack: the element at position i is
+ * elements[head + i].
+ *
  */
-struct _tl_node {
-  TListElementType element;
-  struct _tl_node *next;
+struct _tlist {
+  TListElementType *elements;
+  int head;    // index in elements of the first element
+  int length;  // number of elements
+  int cap;     // number of elements the array has room for
+  Arena arena; // where the array is allocated, or NULL for the heap
 };
 
+
+
 /*
+ * Resize the array of a list to hold cap elements, moving the
+ * elements to its start
+ *
+ * Parameters:
+ *   list   The list
+ *   cap    The new capacity; at least the length of the list
  *
- * Defined a struct represent the metadata of the linkedlist
- * 
- * The metadata for the linkedlist has:
- * 1- a _cl_node pointer to the head of the linkedlist
- * 2- an int variable containing the length of the list
- * 
+ * Returns: None
  */
+static void _TL_resize(TList list, int cap)
+{
+  TListElementType *elements = (list->arena != NULL)
+    ? (TListElementType *) AR_alloc(list->arena, cap * sizeof(TListElementType))
+    : (TListElementType *) malloc(cap * sizeof(TListElementType));
+  assert(elements); //assert that the memory was allocated
 
-struct _tlist {
-  struct _tl_node *head;
-  int length;
-};
+  if (list->length > 0)
+    memcpy(elements, list->elements + list->head, list->length * sizeof(TListElementType));
+
+  if (list->arena == NULL)
+    free(list->elements);
+
+  list->elements = elements;
+  list->head = 0;
+  list->cap = cap;
+}
 
 
 
 /*
- * Create (malloc) a new _cl_node and populate it with the supplied
- * values
+ * Make room for n more elements after the tail of a list. Space
+ * freed at the front by pops is reused before the array grows, so a
+ * list used as a queue stays the size of its longest run.
  *
  * Parameters:
- *   element, next  the values for the node to be created
- * 
- * Returns: The newly-malloc'd node, or NULL in case of error
+ *   list   The list
+ *   n      Number of elements to make room for
+ *
+ * Returns: None
  */
-static struct _tl_node* _TL_new_node(TListElementType element, struct _tl_node *next)
+static void _TL_reserve(TList list, int n)
 {
-  //allocate memory with the right size to store the new node
-  struct _tl_node* new = (struct _tl_node*) malloc(sizeof(struct _tl_node));
+  if (list->head + list->length + n <= list->cap)
+    return;
 
-  assert(new); //assert that the memory was allocated
+  // at least half the array is free: slide the elements down
+  if (list->length + n <= list->cap / 2)
+  {
+    memmove(list->elements, list->elements + list->head, list->length * sizeof(TListElementType));
+    list->head = 0;
+    return;
+  }
+
+  int cap = (list->cap == 0) ? TL_INITIAL_CAP : 2 * list->cap;
+  while (cap < list->length + n)
+    cap *= 2;
+  _TL_resize(list, cap);
+}
 
-  new->element = element; //initialize the element for the node 
-  new->next = next; //initialize the next pointer for the node
 
-  return new; //return the newly created node
+
+/*
+ * Convert a position that may count from the end of a list, as
+ * taken by TL_nth and TL_remove, to an index from its head
+ *
+ * Returns: The index, or -1 if pos is outside [-length, length-1]
+ */
+static int _TL_index(TList list, int pos)
+{
+  if (pos < -list->length || pos >= list->length)
+    return -1;
+
+  return (pos < 0) ? list->length + pos : pos;
 }
 
 
 
 // Documented in .h file
 TList TL_new()
+{
+  return TL_new_in(NULL);
+}
+
+
+
+// Documented in .h file
+TList TL_new_in(Arena arena)
 {
   //allocate memory with the right size to store the metadata for the list
-  TList list = (TList) malloc(sizeof(struct _tlist));
+  TList list = (arena != NULL)
+    ? (TList) AR_alloc(arena, sizeof(struct _tlist))
+    : (TList) malloc(sizeof(struct _tlist));
   assert(list); //assert that the memory was allocated
 
-  list->head = NULL; //initialize the head for the metadata to NULL
-  list->length = 0; //initialize the length for the metadata to 0
+  //the array is allocated when the first element is added
+  list->elements = NULL;
+  list->head = 0;
+  list->length = 0;
+  list->cap = 0;
+  list->arena = arena; //the array comes from the same place as the list
 
   return list; //return the newly created list
 }
@@ -90,28 +149,23 @@ TList TL_new()
 
 
 // Documented in .h file
-void TL_free(TList list)
+Arena TL_arena(TList list)
 {
-  //if list is NULL return
-  if(list == NULL){
-    return;
-  }
+  return (list != NULL) ? list->arena : NULL;
+}
 
-  //Get a reference to the first node
-  struct _tl_node *free_node = list -> head;
 
-  //loop through till free_node is NULL
-  while(free_node != NULL){
-    list -> head = free_node -> next; //point the head to the next node
 
-    free(free_node); //free the current node
-    free_node = list -> head; //update the free_node with the value of the head pointer.
+// Documented in .h file
+void TL_free(TList list)
+{
+  //if list is NULL, or in an arena, there is nothing to free
+  if(list == NULL || list->arena != NULL){
+    return;
   }
-  free(list); //free the list the contains the metadata for the list
-  list = NULL; //set list pointer to NULL
-
-  return; 
 
+  free(list->elements); //free the array of elements
+  free(list); //free the list the contains the metadata for the list
 }
 
 
@@ -119,24 +173,13 @@ void TL_free(TList list)
 // Documented in .h file
 int TL_length(TList list)
 {
-  // assert(list); //assert that the list is valid
   if(list == NULL){
     return 0;
   }
 #ifdef DEBUG
-  // In production code, we simply return the stored value for
-  // length. However, as a defensive programming method to prevent
-  // bugs in our code, in DEBUG mode we walk the list and ensure the
-  // number of elements on the list is equal to the stored length.
-
-  int len = 0; //declare an int variable and initialize it to 0
-  
-  //loop through each element in the linkedlist 
-  for (struct _tl_node *node = list->head; node != NULL; node = node->next)
-    len++; //increment len in each iteration
-
-  //assert that the node counted equals the length in the metadata for the list
-  assert(len == list->length);  
+  // As a defensive programming method, in DEBUG mode we check that
+  // the elements lie within the array
+  assert(list->head >= 0 && list->length >= 0 && list->head + list->length <= list->cap);
 #endif // DEBUG
 
   return list->length; //return the value in length
@@ -144,18 +187,34 @@ int TL_length(TList list)
 
 
 
+// Documented in .h file
+TListElementType *TL_peek(TList list)
+{
+  if(list == NULL || list->length == 0){
+    return NULL;
+  }
+
+  return &list->elements[list->head];
+}
+
+
+
 // Documented in .h file
 void TL_push(TList list, TListElementType element)
 {
-  // assert(list); //assert that the list is valid
-    if(list == NULL){
+  if(list == NULL){
     return;
   }
 
-  //Create a new node that has the its next pointer as the current head
-  //and update the head to point to the newly created node
-  list->head = _TL_new_node(element, list->head); 
-  list->length++; //increment the length by 1
+  //reuse the space left by a pop if there is some
+  if (list->head > 0)
+  {
+    list->elements[--list->head] = element;
+    list->length++;
+    return;
+  }
+
+  TL_insert(list, element, 0);
 }
 
 
@@ -163,27 +222,21 @@ void TL_push(TList list, TListElementType element)
 // Documented in .h file
 TListElementType TL_pop(TList list)
 {
-  // assert(list); //assert that the list is valid
-  if(list == NULL){
+  //if the list is empty return INVALID
+  if(list == NULL || list->length == 0){
     return INVALID;
   }
-  struct _tl_node *popped_node = list->head; //get a reference to the head of the linkedlist
-
-  //if the head is NULL return INVALID_RETURN
-  if (popped_node == NULL)
-    return INVALID;
 
-  TListElementType ret = popped_node->element; //get a reference to the element in the head 
+  TListElementType ret = list->elements[list->head]; //get the element at the head
 
-  // unlink previous head node, then free it
-  list->head = popped_node->next;
-  free(popped_node);
-  // we cannot refer to popped node any longer
-
-  popped_node = NULL; //set popped_node to NULL
+  list->head++; //the next element is now the head
   list->length--; //decrement the length of the list
 
-  return ret; //return the string that is popped
+  //an empty list starts again at the front of its array
+  if (list->length == 0)
+    list->head = 0;
+
+  return ret; //return the popped element
 }
 
 
@@ -191,67 +244,29 @@ TListElementType TL_pop(TList list)
 // Documented in .h file
 void TL_append(TList list, TListElementType element)
 {
-  // assert(list); //assert that the list is valid
-
   if(list == NULL){
     return;
   }
-  struct _tl_node *tail_node= list->head; // get a reference to the head node
-
-  
-  if(tail_node == NULL){
-  // if the head node is NULL, create the new node with a next pointer of NULL
-    list->head = _TL_new_node(element, NULL); // update the list's head to the newly created node.
-    list -> length++; //increment the length by 1
-    return;
-  }
-
-
-  for ( ; tail_node->next != NULL; tail_node = tail_node->next)
-    ;//loop till we hit the tail node
-
-  //Set the next pointer of the tail node to the newly created node.
-  tail_node -> next = _TL_new_node(element, NULL);
-
-  list-> length++; //increment the length by 1
-  return;
 
+  _TL_reserve(list, 1); //make sure there is room after the tail
+  list->elements[list->head + list->length] = element;
+  list->length++; //increment the length by 1
 }
 
 
 
-
 // Documented in .h file
 TListElementType TL_nth(TList list, int pos)
 {
-  // assert(list); // assert that the list is valid
   if(list == NULL){
     return INVALID;
   }
 
-  // Validate that pos is within the range of the list
-  if(!(pos >= -(list->length) && pos <= (list->length-1))){
+  int index = _TL_index(list, pos);
+  if (index < 0)
     return INVALID;
-  }
-
-
-  // if pos is negative, get the positive equivalent
-  if(pos < 0){
-    pos = list -> length + pos;
-  }
-
-  int num = 0; // declare and initialize an int variable to 0
 
-  //loop till the node at the index 'pos' and return the element at the node
-  for (struct _tl_node *node = list->head; node != NULL; node = node->next){
-    if(num == pos){
-        return node -> element;
-    }
-    num++;
-  }
-
-  // if the node is not found return, INVALID_RETURN 
-  return INVALID;
+  return list->elements[list->head + index];
 }
 
 
@@ -259,14 +274,10 @@ TListElementType TL_nth(TList list, int pos)
 // Documented in .h file
 bool TL_insert(TList list, TListElementType element, int pos)
 {
-  // assert(list); // assert that the list is valid
   if(list == NULL){
     return false;
   }
 
-  int num = 0; // declare and initialize an int variable to 0
-
-  
   // Validate that pos is within the range of the list
   if(!(pos >= (-list->length -1) && pos <= list->length)){
     return false;
@@ -277,78 +288,42 @@ bool TL_insert(TList list, TListElementType element, int pos)
     pos = list -> length + pos + 1;
   }
 
-  //if pos is 0. it's a push
-  if(pos == 0){
-    TL_push(list, element);
-    return true;
-  }
+  //shift the elements from pos on up by one
+  _TL_reserve(list, 1);
+  TListElementType *at = list->elements + list->head + pos;
+  memmove(at + 1, at, (list->length - pos) * sizeof(TListElementType));
+  *at = element;
+  list->length++; //increment the length of the list by 1
 
-  
-  
-   
-  for (struct _tl_node *node = list->head; node != NULL; node = node->next){
-    if(num == (pos-1)){
-    //loop till the 'pos - 1'th node
-    //create a new node with a next pointer of the 'pos'th node
-    //point the pos - 1 th node next pointer to the newly created node
-        node->next = _TL_new_node(element, node->next);
-        list->length++; //increment the length of the list by 1
-        return true;
-    }
-    num++;
-  }
-
-  return false;
+  return true;
 }
 
 
-    
+
 // Documented in .h file
 TListElementType TL_remove(TList list, int pos)
 {
-  // assert(list); // assert that the list is valid
   if(list == NULL){
     return INVALID;
   }
 
-  //if not within the valid range for insertion, return INVALID_RETURN
-  if(!(pos >= -(list->length) && pos <= (list->length-1))){
+  //if not within the valid range for removal, return INVALID
+  int index = _TL_index(list, pos);
+  if (index < 0)
     return INVALID;
-  }
-
-  // if pos is negative, get the positive equivalent
-  if(pos < 0){
-    pos = list -> length + pos;
-  }
 
   //if pos is 0, it's a pop
-  if(pos == 0){
-    return TL_pop(list); 
+  if(index == 0){
+    return TL_pop(list);
   }
 
-  int num=0;  // declare and initialize an int variable to 0
-  for(struct _tl_node *node = list-> head; node != NULL; node = node->next){
-    if(num == (pos - 1)){
-    //loop till the 'pos - 1'th node
-      struct _tl_node *remove_node = node -> next; //get a reference to the node to be removed
-
-      TListElementType ret = remove_node -> element; //get the string value of the node to be removed
-
-      //Update the 'pos - 1'th node's next pointer to the 'pos + 1'th node
-      node -> next = remove_node -> next; 
-
-      free(remove_node); //destroy the memory of the node to be destroyed
-      remove_node = NULL; //set the pointer to NULL
-
-      list -> length--; //decrement the length of the list
-
-      return ret; //return the string value of the removed node
+  //shift the elements after the removed one down by one
+  TListElementType *at = list->elements + list->head + index;
+  TListElementType ret = *at;
+  memmove(at, at + 1, (list->length - index - 1) * sizeof(TListElementType));
+  list->length--; //decrement the length of the list
 
-    }
-    num++;
-  }
- 
-  return INVALID;
+  return ret; //return the removed element
 }
 
 
@@ -356,127 +331,83 @@ TListElementType TL_remove(TList list, int pos)
 // Documented in .h file
 TList TL_copy(TList list)
 {
-  // assert(list); // assert that the list is valid
   if(list == NULL){
     return NULL;
   }
 
-  TList copy_list = TL_new(); // create a new list
-
-  if(list->head == NULL){
-  //if the list is empty, return the newly created list
-    return copy_list;
-  }
-
-  //create a copy of the head node
-  copy_list -> head = _TL_new_node(list->head->element, NULL);
-  struct _tl_node  *copy_node = copy_list->head; //get a reference to the copy of the head node
-  
-  if(copy_node != NULL){
-    copy_list -> length = 1; //update the length to 1, if the copy_node was created successfully.
-  }
-
-
-  //set 'node' pointer one position ahead of the 'copy_node' pointer
-  //loop through till 'node' pointer is NULL
-  //on each iteration, make a copy of node and update the copy list
-  for(struct _tl_node *node=list->head->next ; node != NULL; node=node->next){
-
-    copy_node -> next = _TL_new_node(node->element, NULL);
-    copy_node = copy_node -> next;
-    copy_list -> length++;
+  TList copy_list = TL_new_in(list->arena); // create a new list, in the same arena
 
+  if (list->length > 0)
+  {
+    _TL_resize(copy_list, list->length);
+    memcpy(copy_list->elements, list->elements + list->head, list->length * sizeof(TListElementType));
+    copy_list->length = list->length;
   }
 
-  copy_node = NULL; //set the copy_pointer to NULL
-
   return copy_list; //return the copied the list
 }
 
 
 // Documented in .h file
 void TL_join(TList list1, TList list2){
-  
-  // assert(list1); // assert that the list1 is valid
-  // assert(list2); // assert that the list2 is valid
 
-  if(list1 == NULL || list2 == NULL){
+  if(list1 == NULL || list2 == NULL || list2->length == 0){
     return;
   }
 
-  if(list2->head == NULL){
-  //if the list2 is empty, return
-    return;
-  }else if(list1->head == NULL){
-  //if list1 is empty, but list2 is not empty
-    list1->head = list2->head; //attached the head of list2 to the head of list1
-    list1->length = list2->length; //update the length
-    list2->head = NULL; //set the head of list2 to NULL
-    list2->length = 0; //set the length of list2 to 0
-    return; //return
-  }else{
-  //if list1 is not empty, and list2 is not empty
-
-    //get the tail node
-    struct _tl_node *tail_node = list1->head;
-    
-    while(tail_node->next != NULL){
-      tail_node = tail_node->next;
-    }
-
-    tail_node->next = list2->head; //attached the head of list2 to tail of list1
-    list1->length = list1->length+ list2->length;  //update the length
-    list2->head = NULL;  //set the head of list2 to NULL
-    list2->length = 0; //set the length of list2 to 0
-
-    return; //return
-  }
+  if (list1->length == 0 && list1->arena == list2->arena)
+  {
+    //list1 is empty: take over list2's array rather than copy it
+    TListElementType *elements = list1->elements;
+    int cap = list1->cap;
 
+    list1->elements = list2->elements;
+    list1->head = list2->head;
+    list1->length = list2->length;
+    list1->cap = list2->cap;
 
+    list2->elements = elements;
+    list2->cap = cap;
+  }
+  else
+  {
+    _TL_reserve(list1, list2->length);
+    memcpy(list1->elements + list1->head + list1->length, list2->elements + list2->head,
+           list2->length * sizeof(TListElementType));
+    list1->length += list2->length;
+  }
 
+  list2->head = 0;  //list2 is left empty
+  list2->length = 0;
 }
 
 
 // Documented in .h file
 void TL_reverse(TList list)
 {
-  // assert(list); // assert that the list is valid
   if(list == NULL){
     return;
   }
 
-  struct _tl_node *prev = NULL; //initialize a _cl_node pointer to NULL
-  struct _tl_node *curr = list->head; //initialize a _cl_node pointer to head node of the list
-  struct _tl_node *next = NULL;  //initialize a _cl_node pointer to NULL
-
-
-  //loop through till curr is NULL
-  while(curr != NULL){
-    next = curr -> next; //get a reference to the next
-    curr-> next = prev; //update the curr's next pointer to prev
-
-    prev = curr; //update prev with curr
-    curr = next; //update curr with next
+  //swap the elements from both ends towards the middle
+  TListElementType *elements = list->elements + list->head;
+  for (int i = 0, j = list->length - 1; i < j; i++, j--)
+  {
+    TListElementType tmp = elements[i];
+    elements[i] = elements[j];
+    elements[j] = tmp;
   }
-
-  list -> head = prev; //set the head of the list to prev
-
 }
 
 
 // Documented in .h file
 void TL_foreach(TList list, TL_foreach_callback callback, void *cb_data)
 {
-  // assert(list); // assert that the list is valid
   if(list == NULL){
     return;
   }
 
-    int pos = 0; // declare and initialize an int variable to 0
-
-    //loop through each node in the list
-    for(struct _tl_node *node = list -> head; node != NULL; node = node -> next){
-        callback(pos, node->element, cb_data); //on each iteration, invoke the callback function
-        pos++; //increment pos by 1
-    }
+  //invoke the callback function on each element, in order
+  for (int pos = 0; pos < list->length; pos++)
+    callback(pos, list->elements[list->head + pos], cb_data);
 }
@@ -1,7 +1,9 @@
 /*
- * clist.h
+ * tlist.h
  * 
- * Linked list implementation for ISSE Assignment 5
+ * List of tokens for ISSE Assignment 5. The elements are kept in one
+ * growable array with a cursor at the head, so appending, popping
+ * and looking at any position are all O(1).
  * 
  * Author: Howdy Pierce and Nwankwo Chukwunonso Michael
  *
@@ -12,6 +14,7 @@
 
 
 #include <stdbool.h>
+#include "arena.h"
 #include "token.h"
 
 // struct _clist is defined in .c file
@@ -37,6 +40,25 @@ typedef Token TListElementType;
 TList TL_new();
 
 
+/*
+ * Create a new TList whose nodes are allocated from an arena. Freeing
+ * the list, or removing elements from it, then releases nothing: the
+ * memory is reclaimed when the arena is reset or freed.
+ *
+ * Parameters:
+ *   arena    The arena, or NULL to use the heap (same as TL_new)
+ *
+ * Returns: The new list
+ */
+TList TL_new_in(Arena arena);
+
+
+/*
+ * Returns the arena a list was created in, or NULL for a heap list
+ */
+Arena TL_arena(TList list);
+
+
 /*
  * Destroy a list, calling free() on all malloc'd memory.
  *
@@ -60,6 +82,18 @@ void TL_free(TList list);
 int TL_length(TList list);
 
 
+/*
+ * Return the head element in place, without copying or removing it.
+ *
+ * Parameters:
+ *   list     The list
+ * 
+ * Returns: A pointer to the head element, valid until the list is
+ *   next changed, or NULL if the list is empty
+ */
+TListElementType *TL_peek(TList list);
+
+
 /*
  * Insert the specified element onto the head of the list.
  *
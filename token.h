@@ -9,19 +9,52 @@
 #ifndef _TOKEN_H_
 #define _TOKEN_H_
 
+#include <stdbool.h>
+#include <stddef.h>
+
 typedef enum {
   TOK_WORD,
   TOK_QUOTED_WORD, 
   TOK_LESSTHAN, 
   TOK_GREATERTHAN, 
   TOK_PIPE,
-  TOK_END
+  TOK_END,
+  TOK_APPEND,          // >>
+  TOK_ERR_GREATERTHAN, // 2>
+  TOK_ERR_APPEND,      // 2>>
+  TOK_ERR_TO_OUT,      // 2>&1
+  TOK_PIPE_ERR,        // |&
+  TOK_SEMI,            // ;
+  TOK_AMP,             // &
+  TOK_AND,             // &&
+  TOK_OR               // ||
 } TokenType;
 
 
+/*
+ * A token. For TOK_WORD and TOK_QUOTED_WORD, word holds the text of
+ * the word, and offset/len give the span of that text in the input
+ * line.
+ *
+ * Tokens produced by TOK_tokenize_spans may be borrowed: word then
+ * points directly into the input line (word == line + offset), is
+ * not NUL-terminated, and must not be freed. Only words that contain
+ * escapes are copied into owned storage.
+ *
+ * A TOK_WORD with wildcards (* ? or [...]) is a glob pattern. It is
+ * not expanded by the tokenizer, only marked, so that its matches
+ * are produced when the command runs. So is a TOK_WORD with braces,
+ * such as file{1..100}.dat, whose expansions are generated one at a
+ * time by a BraceGen (see brace.h) when the command runs.
+ */
 typedef struct {
   TokenType type;
   char *word;
+  size_t offset;
+  size_t len;
+  bool borrowed;
+  bool glob;
+  bool brace;
 } Token;
 
 
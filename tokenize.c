@@ -11,12 +11,12 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
-#include <glob.h>
 
 #include "tlist.h"
 #include "tokenize.h"
 #include "token.h"
+#include "scan.h"
+#include "brace.h"
 
 // Documented in .h file
 const char *TT_to_str(TokenType tt)
@@ -35,349 +35,869 @@ const char *TT_to_str(TokenType tt)
     return "PIPE";
   case TOK_END:
     return "(end)";
+  case TOK_APPEND:
+    return "APPEND";
+  case TOK_ERR_GREATERTHAN:
+    return "ERR_GREATERTHAN";
+  case TOK_ERR_APPEND:
+    return "ERR_APPEND";
+  case TOK_ERR_TO_OUT:
+    return "ERR_TO_OUT";
+  case TOK_PIPE_ERR:
+    return "PIPE_ERR";
+  case TOK_SEMI:
+    return "SEMI";
+  case TOK_AMP:
+    return "AMP";
+  case TOK_AND:
+    return "AND";
+  case TOK_OR:
+    return "OR";
   }
 
   __builtin_unreachable();
 }
 
-/**
- * Checks if a word needs glob expansion.
- *
- * This examines the given word and returns true if it contains
- * glob patterns like *, ?, [] that need expansion.
+/*
+ * Checks if the first len characters of a word need glob expansion,
+ * i.e. contain '*', '?', or a '[' and a ']'
+ */
+static bool needsGlobbing(const char *word, size_t len)
+{
+  return memchr(word, '*', len) || memchr(word, '?', len) || (memchr(word, '[', len) && memchr(word, ']', len));
+}
+
+/*
+ * Append a word token to the list of tokens
  *
- * Parameter
- *   word - The word to check
+ * Parameters:
+ *   tokens    The list of tokens
+ *   type      TOK_WORD or TOK_QUOTED_WORD
+ *   word      The word; either owned, or a span into the input line
+ *   offset    Offset of the word in the input line
+ *   len       Length of the word
+ *   borrowed  True if word points into the input line
+ *   literal   True if the word has an escaped brace or comma, so that
+ *             its braces are not expanded
  *
- * Returns
- *   true if globbing needed, false otherwise
+ * Returns: None
+ */
+static void appendWord(TList tokens, TokenType type, char *word, size_t offset, size_t len, bool borrowed,
+                       bool literal)
+{
+  Token token;
+
+  token.type = type;
+  token.word = word;
+  token.offset = offset;
+  token.len = len;
+  token.borrowed = borrowed;
+  token.glob = (type == TOK_WORD && needsGlobbing(word, len));
+  token.brace = (type == TOK_WORD && !literal && BR_has_braces(word, len));
+
+  TL_append(tokens, token);
+}
+
+/*
+ * Copy the first len characters of a word into a new NUL-terminated
+ * string, allocated from arena if it is not NULL
+ */
+static char *copyWord(Arena arena, const char *word, size_t len)
+{
+  if (arena != NULL)
+    return AR_strndup(arena, word, len);
+
+  char *copy = (char *)malloc(len + 1);
+  assert(copy);
+
+  memcpy(copy, word, len);
+  copy[len] = '\0';
+  return copy;
+}
+
+/*
+ * The tokenizer is a DFA driven by two compile-time tables: a
+ * character class for every byte, and a transition (next state plus
+ * actions) for every state and class. Classes are assigned
+ * explicitly, so the result does not depend on the locale.
+ */
+typedef enum
+{
+  CC_OTHER,  // an ordinary word character
+  CC_SPACE,  // ' ' \t \n \v \f \r
+  CC_LESS,   // <
+  CC_GREAT,  // >
+  CC_PIPE,   // |
+  CC_AMP,    // &
+  CC_SEMI,   // ;
+  CC_QUOTE,  // "
+  CC_ESCAPE, // backslash
+  CC_END,    // end of input; never produced by the class table
+  NUM_CLASSES
+} CharClass;
+
+typedef enum
+{
+  S_START,      // between tokens
+  S_WORD,       // inside an unquoted word
+  S_WORD_ESC,   // after a backslash in an unquoted word
+  S_QUOTED,     // inside a quoted word
+  S_QUOTED_ESC, // after a backslash in a quoted word
+  S_OPERATOR,   // inside an operator, which may be extended
+  NUM_STATES
+} LexState;
+
+// Actions taken on a transition, in the order listed
+enum
+{
+  ACT_END_WORD = 1 << 0,     // emit the word being built
+  ACT_OPERATOR = 1 << 1,     // start an operator at this character
+  ACT_BEGIN_WORD = 1 << 2,   // start an unquoted word at this character
+  ACT_BEGIN_QUOTED = 1 << 3, // start a quoted word after this character
+  ACT_MATERIALIZE = 1 << 4,  // move the word into the output buffer
+  ACT_APPEND = 1 << 5,       // add this character to the word
+  ACT_ESCAPE = 1 << 6,       // add the escape for this character
+  ACT_UNTERMINATED = 1 << 7  // error: input ended inside quotes
+};
+
+typedef struct
+{
+  unsigned char next;
+  unsigned char actions;
+} Transition;
+
+static const unsigned char char_class[256] = {
+    [' '] = CC_SPACE, ['\t'] = CC_SPACE, ['\n'] = CC_SPACE,
+    ['\v'] = CC_SPACE, ['\f'] = CC_SPACE, ['\r'] = CC_SPACE,
+    ['<'] = CC_LESS, ['>'] = CC_GREAT, ['|'] = CC_PIPE,
+    ['&'] = CC_AMP, [';'] = CC_SEMI, ['"'] = CC_QUOTE, ['\\'] = CC_ESCAPE};
+
+// The character each escape sequence stands for; 0 if illegal
+static const char escape_char[256] = {
+    ['n'] = '\n', ['r'] = '\r', ['t'] = '\t', ['"'] = '"', ['\\'] = '\\',
+    [' '] = ' ', ['|'] = '|', ['>'] = '>', ['<'] = '<', ['&'] = '&',
+    [';'] = ';',
+    ['{'] = '{', ['}'] = '}', [','] = ','};
+
+/*
+ * The operators, each with the token it produces. An operator is
+ * lexed by maximal munch: it is extended while the characters so far,
+ * plus the next one, still begin some operator in this table.
+ */
+static const struct
+{
+  const char *text;
+  TokenType type;
+} operators[] = {
+    {"<", TOK_LESSTHAN},
+    {">", TOK_GREATERTHAN},
+    {">>", TOK_APPEND},
+    {"2>", TOK_ERR_GREATERTHAN},
+    {"2>>", TOK_ERR_APPEND},
+    {"2>&1", TOK_ERR_TO_OUT},
+    {"|", TOK_PIPE},
+    {"|&", TOK_PIPE_ERR},
+    {"||", TOK_OR},
+    {"&", TOK_AMP},
+    {"&&", TOK_AND},
+    {";", TOK_SEMI}};
+
+#define NUM_OPERATORS (sizeof(operators) / sizeof(operators[0]))
+#define MAX_OPERATOR_LEN 4
+
+// Every class of an escape state leads back to the word state
+#define ESCAPE_ROW(back)                            \
+  {                                                 \
+    [CC_OTHER] = {back, ACT_ESCAPE},                \
+    [CC_SPACE] = {back, ACT_ESCAPE},                \
+    [CC_LESS] = {back, ACT_ESCAPE},                 \
+    [CC_GREAT] = {back, ACT_ESCAPE},                \
+    [CC_PIPE] = {back, ACT_ESCAPE},                 \
+    [CC_AMP] = {back, ACT_ESCAPE},                  \
+    [CC_SEMI] = {back, ACT_ESCAPE},                 \
+    [CC_QUOTE] = {back, ACT_ESCAPE},                \
+    [CC_ESCAPE] = {back, ACT_ESCAPE},               \
+    [CC_END] = {back, ACT_ESCAPE},                  \
+  }
+
+static const Transition transitions[NUM_STATES][NUM_CLASSES] = {
+    [S_START] = {
+        [CC_OTHER] = {S_WORD, ACT_BEGIN_WORD},
+        [CC_SPACE] = {S_START, 0},
+        [CC_LESS] = {S_OPERATOR, ACT_OPERATOR},
+        [CC_GREAT] = {S_OPERATOR, ACT_OPERATOR},
+        [CC_PIPE] = {S_OPERATOR, ACT_OPERATOR},
+        [CC_AMP] = {S_OPERATOR, ACT_OPERATOR},
+        [CC_SEMI] = {S_OPERATOR, ACT_OPERATOR},
+        [CC_QUOTE] = {S_QUOTED, ACT_BEGIN_QUOTED},
+        [CC_ESCAPE] = {S_WORD_ESC, ACT_BEGIN_WORD | ACT_MATERIALIZE},
+        [CC_END] = {S_START, 0},
+    },
+    [S_WORD] = {
+        [CC_OTHER] = {S_WORD, ACT_APPEND},
+        [CC_SPACE] = {S_START, ACT_END_WORD},
+        [CC_LESS] = {S_OPERATOR, ACT_END_WORD | ACT_OPERATOR},
+        [CC_GREAT] = {S_OPERATOR, ACT_END_WORD | ACT_OPERATOR},
+        [CC_PIPE] = {S_OPERATOR, ACT_END_WORD | ACT_OPERATOR},
+        [CC_AMP] = {S_OPERATOR, ACT_END_WORD | ACT_OPERATOR},
+        [CC_SEMI] = {S_OPERATOR, ACT_END_WORD | ACT_OPERATOR},
+        [CC_QUOTE] = {S_QUOTED, ACT_END_WORD | ACT_BEGIN_QUOTED},
+        [CC_ESCAPE] = {S_WORD_ESC, ACT_MATERIALIZE},
+        [CC_END] = {S_START, ACT_END_WORD},
+    },
+    [S_WORD_ESC] = ESCAPE_ROW(S_WORD),
+    [S_QUOTED] = {
+        [CC_OTHER] = {S_QUOTED, ACT_APPEND},
+        [CC_SPACE] = {S_QUOTED, ACT_APPEND},
+        [CC_LESS] = {S_QUOTED, ACT_APPEND},
+        [CC_GREAT] = {S_QUOTED, ACT_APPEND},
+        [CC_PIPE] = {S_QUOTED, ACT_APPEND},
+        [CC_AMP] = {S_QUOTED, ACT_APPEND},
+        [CC_SEMI] = {S_QUOTED, ACT_APPEND},
+        [CC_QUOTE] = {S_START, ACT_END_WORD},
+        [CC_ESCAPE] = {S_QUOTED_ESC, ACT_MATERIALIZE},
+        [CC_END] = {S_QUOTED, ACT_UNTERMINATED},
+    },
+    [S_QUOTED_ESC] = ESCAPE_ROW(S_QUOTED),
+    // S_OPERATOR has no row: lex either extends the operator with the
+    // character, or emits it and handles the character from S_START
+};
+
+/*
+ * The state of a tokenization in progress.
  *
+ * While a word contains no escapes it is tracked as a span of the
+ * input (span != NULL) and nothing is copied. The first escape
+ * materializes the word into buf, an amortized buffer to which every
+ * later character is written exactly once.
  */
+typedef struct
+{
+  LexState state;
+  bool spans;         // emit escape-free words as borrowed spans
+  bool lines;         // an unquoted newline ends a command (TOK_END)
+  bool pull;          // return as soon as a token is complete
+  const char *stop;   // where the last call to lex stopped
+  Arena arena;        // where words are allocated, or NULL for the heap
+  TokenType type;     // TOK_WORD or TOK_QUOTED_WORD, for the current word
+  size_t word_offset; // offset of the current word in the input
+  const char *span;   // start of the unbuffered word, or NULL
+  bool literal;       // the word has an escaped { } or , (no expansion)
+  char *buf;          // the materialized word
+  size_t len;
+  size_t cap;
+  char op[MAX_OPERATOR_LEN]; // the operator being lexed, in S_OPERATOR
+  size_t op_len;
+  size_t op_offset;   // offset of the operator in the input
+} Lexer;
 
-bool needsGlobbing(const char *word)
+/*
+ * Append characters to the lexer's output buffer, growing it by
+ * doubling
+ */
+static void bufAppend(Lexer *lx, const char *chars, size_t n)
 {
-  // Check if the word contains '*', '?', or '[]'
-  return strchr(word, '*') || strchr(word, '?') || (strchr(word, '[') && strchr(word, ']'));
+  if (lx->len + n + 1 > lx->cap)
+  {
+    size_t cap = (lx->cap == 0) ? 16 : lx->cap;
+    while (lx->len + n + 1 > cap)
+      cap *= 2;
+
+    if (lx->arena != NULL)
+      lx->buf = (char *)AR_realloc(lx->arena, lx->buf, lx->cap, cap);
+    else
+      lx->buf = (char *)realloc(lx->buf, cap);
+    assert(lx->buf);
+    lx->cap = cap;
+  }
+
+  memcpy(lx->buf + lx->len, chars, n);
+  lx->len += n;
 }
 
-// Documented in .h file
-TList TOK_tokenize_input(const char *input, char *errmsg, size_t errmsg_sz)
+/*
+ * Emit the word the lexer has built, which ends at p
+ */
+static void emitWord(Lexer *lx, TList tokens, const char *p)
 {
-  // initialize a TList of tokens
-  TList tokens = TL_new();
+  if (lx->span != NULL)
+  {
+    size_t len = p - lx->span;
+
+    if (len == 0)
+      ; // an empty quoted word produces no token
+    else if (lx->spans)
+      appendWord(tokens, lx->type, (char *)lx->span, lx->word_offset, len, true, false);
+    else
+      appendWord(tokens, lx->type, copyWord(lx->arena, lx->span, len), lx->word_offset, len, false, false);
+  }
+  else
+  {
+    // hand the buffer over to the token, and start a fresh one
+    bufAppend(lx, "", 0);
+    lx->buf[lx->len] = '\0';
+
+    if (lx->type == TOK_QUOTED_WORD && lx->len == 0 && lx->arena == NULL)
+      free(lx->buf);
+    else if (lx->type == TOK_QUOTED_WORD && lx->len == 0)
+      ; // arena memory is reclaimed with the arena
+    else
+      appendWord(tokens, lx->type, lx->buf, lx->word_offset, lx->len, false, lx->literal);
 
-  size_t pos = 0;
+    lx->buf = NULL;
+    lx->len = lx->cap = 0;
+  }
 
-  Token token;
+  lx->span = NULL;
+  lx->literal = false;
+}
 
-  while (*input != '\0')
+/*
+ * Checks if the operator the lexer has so far, followed by c, begins
+ * some operator
+ */
+static bool extendsOperator(const Lexer *lx, char c)
+{
+  for (size_t i = 0; i < NUM_OPERATORS; i++)
   {
+    const char *text = operators[i].text;
+    if (strlen(text) > lx->op_len && strncmp(text, lx->op, lx->op_len) == 0 && text[lx->op_len] == c)
+      return true;
+  }
+  return false;
+}
 
-    // Skip through spaces
-    if (isspace(*input))
+/*
+ * Emit the operator the lexer has built
+ *
+ * Returns: true on success, false if it is only the beginning of an
+ *   operator, such as 2>& (with errmsg filled in)
+ */
+static bool emitOperator(Lexer *lx, TList tokens, char *errmsg, size_t errmsg_sz)
+{
+  for (size_t i = 0; i < NUM_OPERATORS; i++)
+  {
+    if (strlen(operators[i].text) == lx->op_len && strncmp(operators[i].text, lx->op, lx->op_len) == 0)
     {
-      // advance and do nothing
-      pos++;
-      input++;
-      continue;
+      Token token = {0};
+      token.type = operators[i].type;
+      token.offset = lx->op_offset;
+      TL_append(tokens, token);
+      lx->op_len = 0;
+      return true;
     }
-    else if (*input == '<')
+  }
+
+  snprintf(errmsg, errmsg_sz, "Incomplete operator '%.*s'", (int)lx->op_len, lx->op);
+  return false;
+}
+
+/*
+ * Checks if the unquoted word the lexer is building, which ends at p,
+ * is the file descriptor 2, which a following > makes part of a 2>
+ * operator
+ */
+static bool isErrorPrefix(const Lexer *lx, const char *p)
+{
+  if (lx->type != TOK_WORD)
+    return false;
+  if (lx->span != NULL)
+    return p - lx->span == 1 && lx->span[0] == '2';
+  return lx->len == 1 && lx->buf[0] == '2';
+}
+
+/*
+ * Run the lexer over the characters [p, end). Then, if at_end is
+ * true, feed it the end of input. In pull mode it stops early, once
+ * at least one token is complete; lx->stop records where it stopped,
+ * and is end once the whole input has been processed.
+ *
+ * Parameters:
+ *   lx         The lexer
+ *   tokens     The list that completed tokens are appended to
+ *   base       Offset of p in the whole input
+ *   p, end     The characters to process
+ *   at_end     True if no input follows end
+ *   errmsg     Return space for an error message
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: true on success, false on error (with errmsg filled in)
+ */
+static bool lex(Lexer *lx, TList tokens, size_t base, const char *p, const char *end, bool at_end, char *errmsg, size_t errmsg_sz)
+{
+  const char *chunk = p;
+
+  for (;;)
+  {
+    // skip runs of ordinary characters in bulk
+    if (lx->state == S_WORD || lx->state == S_QUOTED)
     {
-      // tokenize the character <
-      token.type = TOK_LESSTHAN;
-      token.word = NULL;
+      size_t n = (lx->state == S_WORD) ? SCAN_word(p, end - p) : SCAN_quoted(p, end - p);
+      if (lx->span == NULL)
+        bufAppend(lx, p, n);
+      p += n;
+    }
 
-      TL_append(tokens, token);
-      pos++;
-      input++;
+    CharClass cc;
+    unsigned char c = 0;
+
+    if (p < end)
+    {
+      c = (unsigned char)*p;
+      cc = (CharClass)char_class[c];
     }
-    else if (*input == '>')
+    else if (at_end)
     {
-      // tokenize the character >
-      token.type = TOK_GREATERTHAN;
-      token.word = NULL;
-
-      TL_append(tokens, token);
-      pos++;
-      input++;
+      cc = CC_END;
     }
-    else if (*input == '|')
+    else
     {
-      // tokenize the character |
-      token.type = TOK_PIPE;
-      token.word = NULL;
-
-      TL_append(tokens, token);
-      pos++;
-      input++;
+      break;
     }
-    else if (*input == '"')
+
+    if (lx->state == S_OPERATOR)
     {
-      // tokenize the quoted word
+      if (cc != CC_END && lx->op_len < MAX_OPERATOR_LEN && extendsOperator(lx, c))
+      {
+        lx->op[lx->op_len++] = c;
+        p++;
+        continue;
+      }
 
-      input++;                   // skip past the double quotes
-      const char *start = input; // keep a reference to the start
+      if (!emitOperator(lx, tokens, errmsg, errmsg_sz))
+        return false;
+      lx->state = S_START;
+    }
 
-      // initialize the start memory capacity for words and length of characters seen
-      size_t capacity = 8;
-      size_t len = 0;
+    Transition t = transitions[lx->state][cc];
 
-      // calloc some memory
-      char *word = (char *)calloc(capacity, sizeof(char));
-      assert(word);
+    // 2> after a lone 2 redirects standard error; the 2 is no word
+    bool error_prefix = (t.actions & ACT_OPERATOR) && cc == CC_GREAT && lx->state == S_WORD && isErrorPrefix(lx, p);
 
-      // Loop through till we find a terminating douuble quotes or null terminator
-      while (*input != '\0' && *input != '\"')
-      {
+    if ((t.actions & ACT_END_WORD) && !error_prefix)
+      emitWord(lx, tokens, p);
 
-        // check for escape sequence conditions
-        if (*input == '\\')
-        {
-          // skip the escape character
-          input++;
-
-          // Variable to hold escape character
-          char escape_char[2] = {'\0'};
-
-          switch (*input)
-          {
-          case 'n':
-            escape_char[0] = '\n';
-            break;
-          case 'r':
-            escape_char[0] = '\r';
-            break;
-          case 't':
-            escape_char[0] = '\t';
-            break;
-          case '\"':
-            escape_char[0] = '\"';
-            break;
-          case '\\':
-            escape_char[0] = '\\';
-            break;
-          case ' ':
-            escape_char[0] = ' ';
-            break;
-          case '|':
-            escape_char[0] = '|';
-            break;
-          case '>':
-            escape_char[0] = '>';
-            break;
-          case '<':
-            escape_char[0] = '<';
-            break;
-          default: // Illegal escape sequence, error handling
-
-            snprintf(errmsg, errmsg_sz, "Illegal escape character '%c'", *input);
-            free(word);
-            TOK_free(tokens);
-            word = NULL;
-            tokens = NULL;
-            return NULL;
-          }
-
-          // append the character found
-          strncat(word, escape_char, 1);
-        }
-        else
-        {
-          // append the character found
-          strncat(word, input, 1);
-        }
-
-        len++;
-        input++;
-        word[len] = '\0';
-
-        // if the capacity is about to be exceeded, double the capacity
-        if (len == capacity - 1)
-        {
-          capacity *= 2;
-          word = (char *)realloc(word, capacity);
-          assert(word);
-        }
+    if (t.actions & ACT_OPERATOR)
+    {
+      if (error_prefix)
+      {
+        lx->op_offset = lx->word_offset;
+        lx->op[0] = '2';
+        lx->op_len = 1;
+        lx->span = NULL;
+        lx->len = 0;
       }
-
-      if (*input == '\0')
+      else
       {
-        // Error, I hit the null terminator without closing
-        // before the terminating " for the quoted word
-        snprintf(errmsg, errmsg_sz, "Unterminated quote");
-        free(word);
-        TOK_free(tokens);
-        word = NULL;
-        tokens = NULL;
-        return NULL;
+        lx->op_offset = base + (p - chunk);
+        lx->op_len = 0;
       }
+      lx->op[lx->op_len++] = c;
+    }
 
-      // check that at least one character was captured
-      // in between the quotes
-      if (input - start > 1)
-      {
-        token.type = TOK_QUOTED_WORD;
-        token.word = word;
+    if (t.actions & (ACT_BEGIN_WORD | ACT_BEGIN_QUOTED))
+    {
+      const char *start = (t.actions & ACT_BEGIN_QUOTED) ? p + 1 : p;
+      lx->type = (t.actions & ACT_BEGIN_QUOTED) ? TOK_QUOTED_WORD : TOK_WORD;
+      lx->word_offset = base + (start - chunk);
+      lx->span = start;
+    }
 
-        TL_append(tokens, token);
-      }
-      else
+    if ((t.actions & ACT_MATERIALIZE) && lx->span != NULL)
+    {
+      bufAppend(lx, lx->span, p - lx->span);
+      lx->span = NULL;
+    }
+
+    if ((t.actions & ACT_APPEND) && lx->span == NULL)
+      bufAppend(lx, (const char *)&c, 1);
+
+    if (t.actions & ACT_ESCAPE)
+    {
+      if (escape_char[c] == 0)
       {
-        free(word);
+        snprintf(errmsg, errmsg_sz, "Illegal escape character '%c'", c);
+        return false;
       }
+      bufAppend(lx, &escape_char[c], 1);
+      lx->literal |= (c == '{' || c == '}' || c == ',');
+    }
 
-      // update the current position
-      pos += (input - start);
-
-      // skip past the last "
-      input++;
+    if (t.actions & ACT_UNTERMINATED)
+    {
+      snprintf(errmsg, errmsg_sz, "Unterminated quote");
+      return false;
     }
-    else
+
+    // in line mode, a newline outside quotes also ends the command
+    if (lx->lines && c == '\n' && cc == CC_SPACE && (lx->state == S_START || lx->state == S_WORD))
     {
-      // Tokenize a regular word
+      Token token = {0};
+      token.type = TOK_END;
+      token.offset = base + (p - chunk);
+      TL_append(tokens, token);
+    }
 
-      const char *start = input; // keep a reference to the start
+    lx->state = (LexState)t.next;
 
-      // initialize the start memory capacity for words and length of characters seen
-      size_t capacity = 8;
-      size_t len = 0;
+    if (cc == CC_END)
+      break;
+    p++;
 
-      // calloc some memory
-      char *word = (char *)calloc(capacity, sizeof(char));
-      assert(word);
+    // in pull mode, hand each token back as soon as it is complete
+    if (lx->pull && p < end && TL_length(tokens) > 0)
+      break;
+  }
 
-      // Loop through till we find a terminating condition for a word
-      while (*input != '<' && *input != '>' && *input != '|' && *input != '"' && !isspace(*input) && *input != '\0')
-      {
+  lx->stop = p;
 
-        // check for escape sequence conditions
-        if (*input == '\\')
-        {
-          // skip the escape character
-          input++;
-
-          // Variable to hold escape character
-          char escape_char[2] = {'\0'};
-
-          switch (*input)
-          {
-          case 'n':
-            escape_char[0] = '\n';
-            break;
-          case 'r':
-            escape_char[0] = '\r';
-            break;
-          case 't':
-            escape_char[0] = '\t';
-            break;
-          case '\"':
-            escape_char[0] = '\"';
-            break;
-          case '\\':
-            escape_char[0] = '\\';
-            break;
-          case ' ':
-            escape_char[0] = ' ';
-            break;
-          case '|':
-            escape_char[0] = '|';
-            break;
-          case '>':
-            escape_char[0] = '>';
-            break;
-          case '<':
-            escape_char[0] = '<';
-            break;
-          default: // Illegal escape sequence, error handling
-
-            snprintf(errmsg, errmsg_sz, "Illegal escape character '%c'", *input);
-            free(word);
-            TOK_free(tokens);
-            word = NULL;
-            tokens = NULL;
-            return NULL;
-          }
-
-          // append character found
-          strncat(word, escape_char, 1);
-        }
-        else
-        {
-          // append the character found
-          strncat(word, input, 1);
-        }
-        input++;
-        len++;
-        word[len] = '\0';
-
-        // if the capacity is about to be exceeded, double the capacity
-        if (len == (capacity - 1))
-        {
-          capacity *= 2;
-          word = (char *)realloc(word, capacity);
-          assert(word);
-        }
-      }
+  // a word still open at the end of this chunk cannot stay a span
+  if (lx->span != NULL && !at_end)
+  {
+    bufAppend(lx, lx->span, p - lx->span);
+    lx->span = NULL;
+  }
 
-      // check if word found needs globbing
-      if (needsGlobbing(word))
-      {
-        glob_t glob_result;
-        memset(&glob_result, 0, sizeof(glob_result)); // zero out memory
-
-        int result = glob(word, GLOB_TILDE, NULL, &glob_result);
-        if (result == 0)
-        {
-          // Loop through all matched file names and append
-          for (size_t i = 0; i < glob_result.gl_pathc; ++i)
-          {
-            token.type = TOK_WORD;
-            token.word = strdup(glob_result.gl_pathv[i]);
-            TL_append(tokens, token);
-          }
-
-          // free the malloc'd memory
-          free(word);
-        }
-        else
-        {
-          // no matched file found, just tokenize
-          token.type = TOK_WORD;
-          token.word = word;
-          TL_append(tokens, token);
-        }
-
-        // free malloc'd memory
-        globfree(&glob_result);
-      }
+  return true;
+}
+
+/*
+ * Tokenize a line. Shared by TOK_tokenize_input and TOK_tokenize_spans.
+ *
+ * Parameters:
+ *   line       The input line
+ *   spans      If true, escape-free words are emitted as borrowed
+ *              spans into line instead of being copied
+ *   arena      Where to allocate tokens and words, or NULL for the heap
+ *   errmsg     Return space for an error message
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: The list of tokens, or NULL on error
+ */
+static TList tokenize(const char *line, bool spans, Arena arena, char *errmsg, size_t errmsg_sz)
+{
+  // initialize a TList of tokens
+  TList tokens = TL_new_in(arena);
+
+  Lexer lx = {.state = S_START, .spans = spans, .arena = arena};
+
+  bool ok = lex(&lx, tokens, 0, line, line + strlen(line), true, errmsg, errmsg_sz);
+
+  if (arena == NULL)
+    free(lx.buf);
+
+  if (!ok)
+  {
+    TOK_free(tokens);
+    return NULL;
+  }
+
+  return tokens;
+}
+
+// Documented in .h file
+TList TOK_tokenize_input(const char *input, char *errmsg, size_t errmsg_sz)
+{
+  return tokenize(input, false, NULL, errmsg, errmsg_sz);
+}
+
+// Documented in .h file
+TList TOK_tokenize_spans(char *input, Arena arena, char *errmsg, size_t errmsg_sz)
+{
+  return tokenize(input, true, arena, errmsg, errmsg_sz);
+}
+
+// definition of struct _tok_stream
+struct _tok_stream
+{
+  Lexer lx;
+  size_t fed;  // number of characters fed so far
+  bool failed; // an error was reported; no further input is accepted
+};
+
+// Documented in .h file
+TokStream TOK_stream_new(bool lines)
+{
+  TokStream ts = (TokStream)calloc(1, sizeof(struct _tok_stream));
+  assert(ts);
+
+  ts->lx.state = S_START;
+  ts->lx.lines = lines;
+  return ts;
+}
+
+/*
+ * Run a chunk through a stream; shared by TOK_stream_feed and
+ * TOK_stream_finish
+ */
+static TList streamLex(TokStream ts, const char *chunk, size_t len, bool at_end, char *errmsg, size_t errmsg_sz)
+{
+  if (ts->failed)
+  {
+    snprintf(errmsg, errmsg_sz, "Tokenizer stream already failed");
+    return NULL;
+  }
+
+  TList tokens = TL_new();
+
+  if (!lex(&ts->lx, tokens, ts->fed, chunk, chunk + len, at_end, errmsg, errmsg_sz))
+  {
+    ts->failed = true;
+    TOK_free(tokens);
+    return NULL;
+  }
+
+  ts->fed += len;
+  return tokens;
+}
+
+// Documented in .h file
+TList TOK_stream_feed(TokStream ts, const char *chunk, size_t len, char *errmsg, size_t errmsg_sz)
+{
+  return streamLex(ts, chunk, len, false, errmsg, errmsg_sz);
+}
+
+// Documented in .h file
+TList TOK_stream_finish(TokStream ts, char *errmsg, size_t errmsg_sz)
+{
+  TList tokens = streamLex(ts, "", 0, true, errmsg, errmsg_sz);
+
+  // ready for a fresh input, whether or not this one failed
+  ts->lx.state = S_START;
+  ts->lx.span = NULL;
+  ts->lx.literal = false;
+  ts->lx.len = 0;
+  ts->lx.op_len = 0;
+  ts->fed = 0;
+  ts->failed = false;
+  return tokens;
+}
+
+// Documented in .h file
+bool TOK_stream_in_quote(TokStream ts)
+{
+  return ts->lx.state == S_QUOTED || ts->lx.state == S_QUOTED_ESC;
+}
+
+// Documented in .h file
+void TOK_stream_free(TokStream ts)
+{
+  if (ts == NULL)
+  {
+    return;
+  }
+
+  free(ts->lx.buf);
+  free(ts);
+}
+
+// definition of struct _tok_source
+struct _tok_source
+{
+  TList queue;      // tokens lexed but not yet taken
+  bool pull;        // the queue is refilled from the lexer
+  Lexer lx;
+  const char *line; // the input line, in pull mode
+  const char *end;
+  bool failed;      // the lexer reported an error
+  char errmsg[128]; // ...and this is it
+
+  // the character after each borrowed word handed out, which the
+  // parser overwrites with a NUL; see TOK_source_restore. Spaces, by
+  // far the commonest, are not recorded.
+  struct _saved_char
+  {
+    char *at;
+    char was;
+  } *saved;
+  size_t num_saved;
+  size_t saved_cap;
+};
+
+/*
+ * Allocate a token source, in arena if it is not NULL
+ */
+static TokSource newSource(Arena arena)
+{
+  TokSource src;
+  if (arena != NULL)
+    src = (TokSource)AR_alloc(arena, sizeof(struct _tok_source));
+  else
+    src = (TokSource)malloc(sizeof(struct _tok_source));
+  assert(src);
+
+  memset(src, 0, sizeof(struct _tok_source));
+  return src;
+}
+
+// Documented in .h file
+TokSource TOK_source_list(TList tokens)
+{
+  TokSource src = newSource(TL_arena(tokens));
+  src->queue = tokens;
+  return src;
+}
+
+// Documented in .h file
+TokSource TOK_source_line(char *line, Arena arena)
+{
+  TokSource src = newSource(arena);
+  src->queue = TL_new_in(arena);
+  src->pull = true;
+  src->lx.state = S_START;
+  src->lx.spans = true;
+  src->lx.pull = true;
+  src->lx.arena = arena;
+  src->line = line;
+  src->end = line + strlen(line);
+  src->lx.stop = line;
+  return src;
+}
+
+/*
+ * Make sure the queue of a pull-mode source holds the next token,
+ * unless the line is exhausted or the lexer has failed
+ */
+static void refill(TokSource src)
+{
+  Lexer *lx = &src->lx;
+
+  while (src->pull && !src->failed && TL_length(src->queue) == 0 && lx->stop != NULL)
+  {
+    const char *p = lx->stop;
+    bool ok = lex(lx, src->queue, p - src->line, p, src->end, true, src->errmsg, sizeof(src->errmsg));
+
+    if (!ok)
+      src->failed = true;
+    else if (lx->stop == src->end)
+      lx->stop = NULL; // the end of the line has been lexed
+  }
+}
+
+// Documented in .h file
+Arena TOK_source_arena(TokSource src)
+{
+  return TL_arena(src->queue);
+}
+
+// Documented in .h file
+TokenType TOK_source_next_type(TokSource src)
+{
+  refill(src);
+  return TOK_next_type(src->queue);
+}
+
+// Documented in .h file
+void TOK_source_consume(TokSource src)
+{
+  refill(src);
+  TOK_consume(src->queue);
+}
+
+// Documented in .h file
+Token TOK_source_take(TokSource src)
+{
+  refill(src);
+  Token token = TOK_take(src->queue);
+
+  if (src->pull && token.borrowed && token.word[token.len] != ' ')
+  {
+    Arena arena = TL_arena(src->queue);
+    if (src->num_saved == src->saved_cap)
+    {
+      size_t cap = src->saved_cap ? src->saved_cap * 2 : 16;
+      size_t old_sz = src->saved_cap * sizeof(struct _saved_char);
+      size_t new_sz = cap * sizeof(struct _saved_char);
+
+      if (arena != NULL)
+        src->saved = AR_realloc(arena, src->saved, old_sz, new_sz);
       else
-      {
-        // word does not need globbing, just append
-        token.type = TOK_WORD;
-        token.word = word;
-        TL_append(tokens, token);
-      }
+        src->saved = realloc(src->saved, new_sz);
+      assert(src->saved);
+      src->saved_cap = cap;
+    }
 
-      // update the current position
-      pos += (input - start);
+    src->saved[src->num_saved].at = token.word + token.len;
+    src->saved[src->num_saved].was = token.word[token.len];
+    src->num_saved++;
+  }
+
+  return token;
+}
+
+// Documented in .h file
+void TOK_source_restore(TokSource src)
+{
+  if (!src->pull)
+  {
+    return;
+  }
+
+  // the line had no NULs before end, so each one was written by the
+  // parser over either a space or a saved character
+  size_t next = 0;
+  char *line = (char *)src->line;
+  for (char *p = line + strlen(line); p < src->end; p += strlen(p))
+  {
+    while (next < src->num_saved && src->saved[next].at < p)
+      next++;
+
+    if (next < src->num_saved && src->saved[next].at == p)
+      *p = src->saved[next++].was;
+    else
+      *p = ' ';
+  }
+
+  src->num_saved = 0;
+}
+
+// Documented in .h file
+bool TOK_source_failed(TokSource src, char *errmsg, size_t errmsg_sz)
+{
+  if (src->failed)
+    snprintf(errmsg, errmsg_sz, "%s", src->errmsg);
+
+  return src->failed;
+}
+
+// Documented in .h file
+void TOK_source_free(TokSource src)
+{
+  if (src == NULL)
+  {
+    return;
+  }
+
+  Arena arena = TL_arena(src->queue);
+
+  if (src->pull)
+  {
+    TOK_free(src->queue);
+    if (arena == NULL)
+    {
+      free(src->lx.buf);
+      free(src->saved);
     }
   }
 
-  return tokens;
+  if (arena == NULL)
+    free(src);
 }
 
 // Documented in .h file
 TokenType TOK_next_type(TList tokens)
 {
-  // return the next token type or token type at the head of the list
-  return TL_nth(tokens, 0).type;
+  // the type of the token at the head of the list, looked at in place
+  Token *token = TL_peek(tokens);
+  return (token != NULL) ? token->type : TOK_END;
 }
 
 // Documented in .h file
 const char *TOK_next_word(TList tokens)
 {
-  // return the next token type or token type at the head of the list
-  return TL_nth(tokens, 0).word;
+  // the word of the token at the head of the list
+  Token *token = TL_peek(tokens);
+  return (token != NULL) ? token->word : NULL;
 }
 
 // Documented in .h file
@@ -392,11 +912,12 @@ Token TOK_next(TList tokens)
 void TOK_consume(TList tokens)
 {
 
-  if(tokens == NULL){
+  Token *token = TL_peek(tokens);
+  if(token == NULL){
     return;
   }
-  if (TL_nth(tokens, 0).type == TOK_WORD || TL_nth(tokens, 0).type == TOK_QUOTED_WORD)
-    free((void *)TL_nth(tokens, 0).word);
+  if ((token->type == TOK_WORD || token->type == TOK_QUOTED_WORD) && !token->borrowed && TL_arena(tokens) == NULL)
+    free((void *)token->word);
 
   // pop the head node
   TL_pop(tokens);
@@ -404,6 +925,13 @@ void TOK_consume(TList tokens)
   return;
 }
 
+// Documented in .h file
+Token TOK_take(TList tokens)
+{
+  // pop the head node, without freeing the word
+  return TL_pop(tokens);
+}
+
 /*
  *
  * Print a token's information to the console.
@@ -423,7 +951,7 @@ void TOK_print_callback(int pos, TListElementType token, void *cb_data)
 {
   if (token.type == TOK_WORD || token.type == TOK_QUOTED_WORD)
   {
-    printf("%s [%d] type ==> %s, word ==> %s\n", (char *)cb_data, pos, TT_to_str(token.type), token.word);
+    printf("%s [%d] type ==> %s, word ==> %.*s\n", (char *)cb_data, pos, TT_to_str(token.type), (int)token.len, token.word);
   }
   else
   {
@@ -458,7 +986,7 @@ void TOK_print(TList tokens)
 
 void TOK_free_callback(int pos, TListElementType token, void *cb_data)
 {
-  if (token.type == TOK_QUOTED_WORD || token.type == TOK_WORD)
+  if ((token.type == TOK_QUOTED_WORD || token.type == TOK_WORD) && !token.borrowed)
   {
     free(token.word);
   }
@@ -486,8 +1014,9 @@ void TOK_free(TList tokens)
     return;
   }
 
-  // free the words
-  TL_foreach(tokens, TOK_free_callback, NULL);
+  // free the words; those in an arena go with the arena
+  if (TL_arena(tokens) == NULL)
+    TL_foreach(tokens, TOK_free_callback, NULL);
 
   // before freeing the list
   TL_free(tokens);
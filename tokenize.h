@@ -42,6 +42,178 @@ const char *TT_to_str(TokenType tt);
 TList TOK_tokenize_input(const char *input, char *errmsg, size_t errmsg_sz);
 
 
+/*
+ * Tokenize a string entered by the user, without copying words that
+ * contain no escapes.
+ *
+ * Like TOK_tokenize_input, except that every TOK_WORD or
+ * TOK_QUOTED_WORD that has no escape sequence is a borrowed span: its
+ * word points into input, it is not NUL-terminated, and its length
+ * is given by len. Words with escapes are still copied into owned
+ * storage.
+ *
+ * The input buffer is not modified by this call, but Parse will
+ * NUL-terminate borrowed words in place when it takes them, so
+ * input must be writable and must outlive both the token list and
+ * any PipeTree built from it.
+ *
+ * If arena is not NULL, the list, its nodes and every copied word
+ * are allocated from it, and Parse builds the PipeTree in the same
+ * arena; TOK_free and PT_free then release nothing, and the whole
+ * command is released by AR_reset or AR_free.
+ *
+ * Parameters:
+ *   input      The input as entered by the user
+ *   arena      Where to allocate the tokens, or NULL for the heap
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: A newly-created TList, or NULL on error. It is up to the
+ *   caller to call TOK_free on the returned list.
+ */
+TList TOK_tokenize_spans(char *input, Arena arena, char *errmsg, size_t errmsg_sz);
+
+
+
+// A resumable tokenizer; struct _tok_stream is defined in the .c file
+typedef struct _tok_stream *TokStream;
+
+/*
+ * Create a tokenizer that accepts its input in chunks, for input
+ * such as a script file or a pipe that arrives a piece at a time.
+ * Partial words, open quotes and pending escapes are carried across
+ * chunk boundaries, so a chunk may end anywhere.
+ *
+ * Parameters:
+ *   lines     If true, every newline outside quotes ends a command:
+ *             a TOK_END token is emitted for it, so Parse can be
+ *             called once per command on the tokens returned
+ *
+ * Returns: The new stream. It is up to the caller to call
+ *   TOK_stream_free on it.
+ */
+TokStream TOK_stream_new(bool lines);
+
+/*
+ * Feed the next chunk of input to a stream.
+ *
+ * Parameters:
+ *   ts         The stream
+ *   chunk      The characters; need not be NUL-terminated
+ *   len        Number of characters in chunk
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: A newly-created TList holding the tokens completed by this
+ *   chunk (possibly none), or NULL on error. Words are always copied,
+ *   since chunk need not outlive the call. It is up to the caller to
+ *   call TOK_free on the returned list.
+ */
+TList TOK_stream_feed(TokStream ts, const char *chunk, size_t len, char *errmsg, size_t errmsg_sz);
+
+/*
+ * Signal the end of input to a stream, completing the last word.
+ * Reports the same errors as TOK_tokenize_input for input that ends
+ * inside quotes or after a backslash. Afterwards the stream is ready
+ * to tokenize a new input.
+ *
+ * Parameters:
+ *   ts         The stream
+ *   errmsg     Return space for an error message, filled in in case of error
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: A newly-created TList of the remaining tokens, or NULL on
+ *   error.
+ */
+TList TOK_stream_finish(TokStream ts, char *errmsg, size_t errmsg_sz);
+
+/*
+ * Returns true if the input fed to a stream so far ends inside a
+ * quoted word, so that more input is needed to complete it.
+ */
+bool TOK_stream_in_quote(TokStream ts);
+
+/*
+ * Destroy a stream and any partial word it holds
+ */
+void TOK_stream_free(TokStream ts);
+
+
+// A source of tokens for the parser; struct _tok_source is defined
+// in the .c file
+typedef struct _tok_source *TokSource;
+
+/*
+ * Create a token source that hands out the tokens of an existing
+ * list. The list still belongs to the caller, and must outlive the
+ * source.
+ *
+ * Parameters:
+ *   tokens    The list of tokens
+ *
+ * Returns: The new source. It is up to the caller to call
+ *   TOK_source_free on it.
+ */
+TokSource TOK_source_list(TList tokens);
+
+/*
+ * Create a token source that tokenizes a line on demand: each token
+ * is lexed only when the parser asks for it, and dropped once it has
+ * been taken, so a full token list is never built. Only the pending
+ * word is held at a time. Words
+ * are produced as by TOK_tokenize_spans, so the line must outlive
+ * any tree built from the source.
+ *
+ * Parameters:
+ *   line      The input line
+ *   arena     Where to allocate tokens and words, or NULL for the heap
+ *
+ * Returns: The new source. It is up to the caller to call
+ *   TOK_source_free on it.
+ */
+TokSource TOK_source_line(char *line, Arena arena);
+
+/*
+ * Returns the arena the tokens of a source are allocated from, or
+ * NULL for the heap
+ */
+Arena TOK_source_arena(TokSource src);
+
+/*
+ * The TOK_next_type, TOK_consume and TOK_take of a token source. A
+ * line source that fails to tokenize behaves as if the line ended
+ * where the error was found; see TOK_source_failed.
+ */
+TokenType TOK_source_next_type(TokSource src);
+void TOK_source_consume(TokSource src);
+Token TOK_source_take(TokSource src);
+
+/*
+ * Check whether a line source stopped because of a tokenizer error.
+ *
+ * Parameters:
+ *   src        The source
+ *   errmsg     Return space for the error message, filled in if so
+ *   errmsg_sz  The size of errmsg
+ *
+ * Returns: true if tokenizing failed
+ */
+bool TOK_source_failed(TokSource src, char *errmsg, size_t errmsg_sz);
+
+/*
+ * Undo the changes made to the line of a line source. The parser
+ * NUL-terminates each borrowed word in place, overwriting the
+ * character after it; this puts those characters back, for a caller
+ * that needs the original line after a failed parse.
+ */
+void TOK_source_restore(TokSource src);
+
+/*
+ * Destroy a token source, and any tokens it has lexed but not handed
+ * out. The list of a TOK_source_list source is left alone.
+ */
+void TOK_source_free(TokSource src);
+
 
 /*
  * Returns the TokenType for the next token. Does not modify the list
@@ -78,6 +250,19 @@ Token TOK_next(TList tokens);
 void TOK_consume(TList tokens);
 
 
+/*
+ * Removes the next token from the list and returns it. Unlike
+ * TOK_consume, the word is not freed: if the token is not borrowed,
+ * ownership of its word passes to the caller.
+ *
+ * Parameters:
+ *   tokens    The list of tokens
+ *
+ * Returns: The removed token, or a TOK_END token if the list is empty
+ */
+Token TOK_take(TList tokens);
+
+
 /*
  * For debugging: Prints the list of tokens, one per line
  *